@@ -0,0 +1,92 @@
+#pragma once
+/*
+ * bench.h
+ *
+ * Timing and reporting shared by the C and C++ benchmarks.
+ *
+ * Results are written as JSON in the layout Google Benchmark uses,
+ * so its compare.py and other tooling can track them across releases:
+ *
+ * {
+ *   "context": {"binding": "c", "sbf_version": "0.3.2", ...},
+ *   "benchmarks": [
+ *     {"name": "write/double/1048576", "binding": "c", "iterations": 20,
+ *      "real_time": 812.5, "time_unit": "us", "bytes_per_second": 1.29e9},
+ *     ...
+ *   ]
+ * }
+ *
+ * Each benchmark repeats until it has run for at least
+ * SBF_BENCH_MIN_TIME seconds (and SBF_BENCH_MIN_ITERATIONS times),
+ * and real_time is the mean wall time of one iteration.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef SBF_BENCH_MIN_TIME
+#define SBF_BENCH_MIN_TIME 0.5
+#endif
+#define SBF_BENCH_MIN_ITERATIONS 3
+
+// dataset sizes in bytes, and numbers of datasets for header latency
+#define SBF_BENCH_N_SIZES 4
+static const uint64_t sbf_bench_sizes[SBF_BENCH_N_SIZES] = {
+    4 * 1024, 256 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024};
+#define SBF_BENCH_N_COUNTS 4
+static const uint64_t sbf_bench_counts[SBF_BENCH_N_COUNTS] = {1, 16, 256, 4096};
+
+typedef struct {
+    FILE *out;
+    const char *binding;
+    int n_results;
+} sbf_Bench;
+
+double sbf_bench_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/*
+ * Has a benchmark that has run 'iterations' times since 'start' run long enough?
+ */
+int sbf_bench_done(double start, int iterations) {
+    return iterations >= SBF_BENCH_MIN_ITERATIONS &&
+           sbf_bench_now() - start >= SBF_BENCH_MIN_TIME;
+}
+
+void sbf_bench_begin(sbf_Bench *bench, FILE *out, const char *binding,
+                     const char *version) {
+    char date[32] = "";
+    time_t t = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+    bench->out = out;
+    bench->binding = binding;
+    bench->n_results = 0;
+    fprintf(out, "{\n  \"context\": {\"binding\": \"%s\", \"sbf_version\": \"%s\", "
+                 "\"date\": \"%s\", \"min_time\": %g},\n  \"benchmarks\": [",
+            binding, version, date, SBF_BENCH_MIN_TIME);
+}
+
+/*
+ * Report a benchmark that took 'seconds' for 'iterations' iterations,
+ * each transferring 'bytes' (0 if throughput is meaningless for it).
+ */
+void sbf_bench_report(sbf_Bench *bench, const char *name, int iterations,
+                      double seconds, double bytes) {
+    fprintf(bench->out, "%s\n    {\"name\": \"%s\", \"binding\": \"%s\", \"iterations\": %d, "
+                        "\"real_time\": %.3f, \"time_unit\": \"us\"",
+            bench->n_results ? "," : "", name, bench->binding, iterations,
+            seconds / iterations * 1e6);
+    if (bytes > 0)
+        fprintf(bench->out, ", \"bytes_per_second\": %.6g", bytes * iterations / seconds);
+    fprintf(bench->out, "}");
+    fflush(bench->out);
+    bench->n_results++;
+}
+
+void sbf_bench_end(sbf_Bench *bench) {
+    fprintf(bench->out, "\n  ]\n}\n");
+    fflush(bench->out);
+}
@@ -0,0 +1,108 @@
+/*
+ * parallel_io.c
+ *
+ * Measure how sbf_write_parallel/sbf_read_parallel throughput
+ * scales with the number of threads. See bench.h for the output.
+ *
+ * Usage: parallel_io [results.json] [scratch filename] [MiB per dataset] [number of datasets]
+ */
+#include "sbf.h"
+#include "bench.h"
+
+static int write_file(const char *filename, void **buffers, int n_datasets,
+                      sbf_size shape[SBF_MAX_DIM], int n_threads) {
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = filename;
+    char name[SBF_NAME_LENGTH];
+    sbf_result res = sbf_open(&file);
+    if (res != SBF_RESULT_SUCCESS)
+        return -1;
+    for (int i = 0; (res == SBF_RESULT_SUCCESS) && (i < n_datasets); i++) {
+        snprintf(name, sizeof(name), "dataset_%d", i);
+        res = sbf_add_dataset(&file, name, SBF_DOUBLE, shape, buffers[i]);
+    }
+    if (res == SBF_RESULT_SUCCESS)
+        res = sbf_write_parallel(&file, n_threads);
+    sbf_close(&file);
+    return (res == SBF_RESULT_SUCCESS) ? 0 : -1;
+}
+
+static int read_file(const char *filename, void **buffers, int n_threads) {
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_READONLY;
+    file.filename = filename;
+    sbf_result res = sbf_open(&file);
+    if (res == SBF_RESULT_SUCCESS)
+        res = sbf_read_headers(&file);
+    if (res == SBF_RESULT_SUCCESS)
+        res = sbf_read_parallel(&file, buffers, n_threads);
+    if (file.fp != NULL)
+        sbf_close(&file);
+    return (res == SBF_RESULT_SUCCESS) ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    FILE *out = (argc > 1 && strcmp(argv[1], "-") != 0) ? fopen(argv[1], "w") : stdout;
+    const char *filename = (argc > 2) ? argv[2] : "/tmp/sbf_bench_parallel_io.sbf";
+    sbf_size mib = (argc > 3) ? strtoull(argv[3], NULL, 10) : 64;
+    int n_datasets = (argc > 4) ? atoi(argv[4]) : 8;
+    const int thread_counts[] = {1, 2, 4, 8, 16};
+    if (out == NULL) {
+        SBF_PERROR("Failed to open '%s': %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (n_datasets < 1 || n_datasets > SBF_MAX_DATASETS) {
+        SBF_PERROR("Number of datasets must be between 1 and %d\n", SBF_MAX_DATASETS);
+        return EXIT_FAILURE;
+    }
+
+    sbf_size n = mib * 1024 * 1024 / sizeof(sbf_double);
+    sbf_size shape[SBF_MAX_DIM] = {n};
+    void **buffers = calloc(n_datasets, sizeof(void *));
+    if (buffers == NULL)
+        return EXIT_FAILURE;
+    for (int i = 0; i < n_datasets; i++) {
+        sbf_double *data = malloc(n * sizeof(sbf_double));
+        if (data == NULL) {
+            SBF_PERROR("Failed to allocate %"PRIu64" MiB\n", mib);
+            return EXIT_FAILURE;
+        }
+        for (sbf_size j = 0; j < n; j++)
+            data[j] = (double)(i + j);
+        buffers[i] = data;
+    }
+    const double total_bytes = (double)n_datasets * n * sizeof(sbf_double);
+
+    sbf_Bench bench;
+    char name[64];
+    sbf_bench_begin(&bench, out, "c", SBF_VERSION);
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        int iterations = 0;
+        double start = sbf_bench_now();
+        for (; !sbf_bench_done(start, iterations); iterations++) {
+            if (write_file(filename, buffers, n_datasets, shape, thread_counts[t]) != 0)
+                return EXIT_FAILURE;
+        }
+        snprintf(name, sizeof(name), "write_parallel/%d", thread_counts[t]);
+        sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, total_bytes);
+
+        iterations = 0;
+        start = sbf_bench_now();
+        for (; !sbf_bench_done(start, iterations); iterations++) {
+            if (read_file(filename, buffers, thread_counts[t]) != 0)
+                return EXIT_FAILURE;
+        }
+        snprintf(name, sizeof(name), "read_parallel/%d", thread_counts[t]);
+        sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, total_bytes);
+    }
+    sbf_bench_end(&bench);
+
+    remove(filename);
+    for (int i = 0; i < n_datasets; i++)
+        free(buffers[i]);
+    free(buffers);
+    if (out != stdout)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/*
+ * throughput.c
+ *
+ * Measure sbf_write/sbf_read_dataset throughput across dataset sizes
+ * and datatypes, and the latency of writing a file, and of opening it
+ * and reading its headers, as the number of datasets grows. See bench.h for the output.
+ *
+ * Usage: throughput [results.json] [scratch filename]
+ */
+#include "sbf.h"
+#include "bench.h"
+
+typedef struct {
+    const char *name;
+    sbf_data_type type;
+    sbf_size size;
+} sbf_BenchType;
+
+static const sbf_BenchType bench_types[] = {
+    {"int", SBF_INT, sizeof(sbf_integer)},
+    {"double", SBF_DOUBLE, sizeof(sbf_double)},
+    {"cdouble", SBF_CDOUBLE, sizeof(sbf_complex_double)},
+};
+
+static int write_file(const char *filename, const sbf_BenchType *type, sbf_size bytes,
+                      sbf_size n_datasets, void *data) {
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = filename;
+    char name[SBF_NAME_LENGTH];
+    sbf_size shape[SBF_MAX_DIM] = {bytes / type->size};
+    sbf_result res = sbf_open(&file);
+    if (res != SBF_RESULT_SUCCESS)
+        return -1;
+    for (sbf_size i = 0; (res == SBF_RESULT_SUCCESS) && (i < n_datasets); i++) {
+        snprintf(name, sizeof(name), "dataset_%"PRIu64, i);
+        res = sbf_add_dataset(&file, name, type->type, shape, data);
+    }
+    if (res == SBF_RESULT_SUCCESS)
+        res = sbf_write(&file);
+    sbf_close(&file);
+    return (res == SBF_RESULT_SUCCESS) ? 0 : -1;
+}
+
+static int read_file(const char *filename, void *data) {
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_READONLY;
+    file.filename = filename;
+    sbf_result res = sbf_open(&file);
+    if (res == SBF_RESULT_SUCCESS)
+        res = sbf_read_headers(&file);
+    if (res == SBF_RESULT_SUCCESS && data != NULL)
+        res = sbf_read_dataset(&file, file.datasets[0], data);
+    if (file.fp != NULL)
+        sbf_close(&file);
+    return (res == SBF_RESULT_SUCCESS) ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    FILE *out = (argc > 1 && strcmp(argv[1], "-") != 0) ? fopen(argv[1], "w") : stdout;
+    const char *filename = (argc > 2) ? argv[2] : "/tmp/sbf_bench_throughput.sbf";
+    if (out == NULL) {
+        SBF_PERROR("Failed to open '%s': %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const sbf_size max_bytes = sbf_bench_sizes[SBF_BENCH_N_SIZES - 1];
+    sbf_byte *data = malloc(max_bytes);
+    if (data == NULL) {
+        SBF_PERROR("Failed to allocate %"PRIu64" bytes\n", max_bytes);
+        return EXIT_FAILURE;
+    }
+    for (sbf_size i = 0; i < max_bytes; i++)
+        data[i] = (sbf_byte)(i * 13);
+
+    sbf_Bench bench;
+    char name[64];
+    sbf_bench_begin(&bench, out, "c", SBF_VERSION);
+    for (size_t t = 0; t < sizeof(bench_types) / sizeof(bench_types[0]); t++) {
+        for (int s = 0; s < SBF_BENCH_N_SIZES; s++) {
+            const sbf_size bytes = sbf_bench_sizes[s];
+            int iterations = 0;
+            double start = sbf_bench_now();
+            for (; !sbf_bench_done(start, iterations); iterations++) {
+                if (write_file(filename, &bench_types[t], bytes, 1, data) != 0)
+                    return EXIT_FAILURE;
+            }
+            snprintf(name, sizeof(name), "write/%s/%"PRIu64, bench_types[t].name, bytes);
+            sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, bytes);
+
+            iterations = 0;
+            start = sbf_bench_now();
+            for (; !sbf_bench_done(start, iterations); iterations++) {
+                if (read_file(filename, data) != 0)
+                    return EXIT_FAILURE;
+            }
+            snprintf(name, sizeof(name), "read/%s/%"PRIu64, bench_types[t].name, bytes);
+            sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, bytes);
+        }
+    }
+
+    for (int c = 0; c < SBF_BENCH_N_COUNTS; c++) {
+        int iterations = 0;
+        double start = sbf_bench_now();
+        for (; !sbf_bench_done(start, iterations); iterations++) {
+            if (write_file(filename, &bench_types[1], sizeof(sbf_double), sbf_bench_counts[c],
+                           data) != 0)
+                return EXIT_FAILURE;
+        }
+        snprintf(name, sizeof(name), "write_datasets/%"PRIu64, sbf_bench_counts[c]);
+        sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, 0);
+
+        iterations = 0;
+        start = sbf_bench_now();
+        for (; !sbf_bench_done(start, iterations); iterations++) {
+            if (read_file(filename, NULL) != 0)
+                return EXIT_FAILURE;
+        }
+        snprintf(name, sizeof(name), "open/%"PRIu64, sbf_bench_counts[c]);
+        sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, 0);
+    }
+    sbf_bench_end(&bench);
+
+    remove(filename);
+    free(data);
+    if (out != stdout)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
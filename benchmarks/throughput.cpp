@@ -0,0 +1,135 @@
+/*
+ * throughput.cpp
+ *
+ * Measure sbf::File write_data/read_data throughput across dataset
+ * sizes and datatypes, and the latency of opening a file and reading
+ * its headers as the number of datasets grows. See bench.h for the output.
+ *
+ * Both I/O backends are measured: results for sbf::direct_io are
+ * reported with the binding "cpp_direct".
+ *
+ * Usage: throughput_cpp [results.json] [scratch filename]
+ */
+#include "sbf.hpp"
+#include "bench.h"
+#include <cstring>
+
+namespace {
+
+// the benchmarks only move bytes, so any element type will do
+template <sbf::DataType T> struct BenchTraits {
+    static const sbf::DataType type = T;
+};
+
+struct BenchType {
+    const char *name;
+    sbf::DataType type;
+    std::size_t size;
+};
+
+const BenchType bench_types[] = {
+    {"int", sbf::SBF_INT, sizeof(sbf::sbf_integer)},
+    {"double", sbf::SBF_DOUBLE, sizeof(sbf::sbf_double)},
+    {"cdouble", sbf::SBF_CDOUBLE, sizeof(sbf::sbf_complex_double)},
+};
+
+template <sbf::DataType T>
+bool write_file(sbf::IOBackend backend, const std::string &filename, std::size_t bytes,
+                std::size_t elem, std::size_t n_datasets, sbf::sbf_byte *data) {
+    sbf::File file(filename, sbf::writing, false, backend);
+    if (file.open() != sbf::success) return false;
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < n_datasets; i++) {
+        names.push_back("dataset_" + std::to_string(i));
+        sbf::Dataset dset(names.back(), sbf::sbf_dimensions{{bytes / elem}}, T);
+        if (file.add_dataset(dset) != sbf::success) return false;
+    }
+    if (file.write_headers() != sbf::success) return false;
+    for (const auto &name : names) {
+        if (file.write_data<sbf::sbf_byte, BenchTraits<T>>(name, data) != sbf::success)
+            return false;
+    }
+    return file.close() == sbf::success;
+}
+
+template <sbf::DataType T>
+bool read_file(sbf::IOBackend backend, const std::string &filename, sbf::sbf_byte *data) {
+    sbf::File file(filename, sbf::reading, true, backend);
+    if (file.status() != sbf::File::Open) return false;
+    if (data == nullptr) return true;
+    return file.read_data<sbf::sbf_byte, BenchTraits<T>>("dataset_0", data) == sbf::success;
+}
+
+template <sbf::DataType T>
+bool bench_type(sbf_Bench &bench, sbf::IOBackend backend, const BenchType &type,
+                const std::string &filename, sbf::sbf_byte *data) {
+    char name[64];
+    for (int s = 0; s < SBF_BENCH_N_SIZES; s++) {
+        const std::size_t bytes = sbf_bench_sizes[s];
+        int iterations = 0;
+        double start = sbf_bench_now();
+        for (; !sbf_bench_done(start, iterations); iterations++) {
+            if (!write_file<T>(backend, filename, bytes, type.size, 1, data)) return false;
+        }
+        snprintf(name, sizeof(name), "write/%s/%zu", type.name, bytes);
+        sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, bytes);
+
+        iterations = 0;
+        start = sbf_bench_now();
+        for (; !sbf_bench_done(start, iterations); iterations++) {
+            if (!read_file<T>(backend, filename, data)) return false;
+        }
+        snprintf(name, sizeof(name), "read/%s/%zu", type.name, bytes);
+        sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, bytes);
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+    FILE *out = (argc > 1 && strcmp(argv[1], "-") != 0) ? fopen(argv[1], "w") : stdout;
+    const std::string filename = (argc > 2) ? argv[2] : "/tmp/sbf_bench_throughput_cpp.sbf";
+    if (out == nullptr) {
+        std::cerr << "Failed to open '" << argv[1] << "': " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+    std::vector<sbf::sbf_byte> data(sbf_bench_sizes[SBF_BENCH_N_SIZES - 1]);
+    for (std::size_t i = 0; i < data.size(); i++) data[i] = static_cast<sbf::sbf_byte>(i * 13);
+
+    sbf_Bench bench;
+    const std::string version = {sbf::sbf_version_major, '.', sbf::sbf_version_minor, '.',
+                                 sbf::sbf_version_minor_minor};
+    sbf_bench_begin(&bench, out, "cpp", version.c_str());
+    const sbf::IOBackend backends[] = {sbf::stream_io, sbf::direct_io};
+    for (const auto backend : backends) {
+        bench.binding = (backend == sbf::direct_io) ? "cpp_direct" : "cpp";
+        if (!bench_type<sbf::SBF_INT>(bench, backend, bench_types[0], filename, data.data()) ||
+            !bench_type<sbf::SBF_DOUBLE>(bench, backend, bench_types[1], filename, data.data()) ||
+            !bench_type<sbf::SBF_CDOUBLE>(bench, backend, bench_types[2], filename, data.data())) {
+            return EXIT_FAILURE;
+        }
+
+        char name[64];
+        for (int c = 0; c < SBF_BENCH_N_COUNTS; c++) {
+            if (!write_file<sbf::SBF_DOUBLE>(backend, filename, sizeof(sbf::sbf_double),
+                                             sizeof(sbf::sbf_double), sbf_bench_counts[c],
+                                             data.data())) {
+                return EXIT_FAILURE;
+            }
+            int iterations = 0;
+            double start = sbf_bench_now();
+            for (; !sbf_bench_done(start, iterations); iterations++) {
+                if (!read_file<sbf::SBF_DOUBLE>(backend, filename, nullptr)) return EXIT_FAILURE;
+            }
+            snprintf(name, sizeof(name), "open/%llu",
+                     static_cast<unsigned long long>(sbf_bench_counts[c]));
+            sbf_bench_report(&bench, name, iterations, sbf_bench_now() - start, 0);
+        }
+    }
+    sbf_bench_end(&bench);
+
+    std::remove(filename.c_str());
+    if (out != stdout) fclose(out);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+"""Measure sbf.File write/read throughput across dataset sizes and
+datatypes, and the latency of writing and reading a file as the number
+of datasets grows. Results are written in the same JSON layout as the
+C, C++ and Fortran benchmarks (see bench.h).
+
+Usage: throughput.py [results.json] [scratch filename]
+"""
+import datetime
+import json
+import os
+import sys
+import time
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+import sbf  # noqa: E402
+
+MIN_TIME = 0.5
+MIN_ITERATIONS = 3
+SIZES = [4 * 1024, 256 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024]
+COUNTS = [1, 16, 256, 4096]
+TYPES = [('int', np.int32), ('double', np.float64), ('cdouble', np.complex128)]
+
+
+def run(func):
+    """Call func until it has run for MIN_TIME seconds (and at least
+    MIN_ITERATIONS times), returning the iterations and time taken"""
+    iterations = 0
+    start = time.perf_counter()
+    while iterations < MIN_ITERATIONS or time.perf_counter() - start < MIN_TIME:
+        func()
+        iterations += 1
+    return iterations, time.perf_counter() - start
+
+
+def result(name, iterations, seconds, nbytes=0):
+    """A benchmark result, in the layout used by Google Benchmark"""
+    entry = {'name': name, 'binding': 'python', 'iterations': iterations,
+             'real_time': seconds / iterations * 1e6, 'time_unit': 'us'}
+    if nbytes:
+        entry['bytes_per_second'] = nbytes * iterations / seconds
+    return entry
+
+
+def write_file(filename, arrays):
+    """Write each of arrays to its own dataset"""
+    sbf_file = sbf.File(filename)
+    for i, array in enumerate(arrays):
+        sbf_file.add_dataset('dataset_{}'.format(i), array)
+    sbf_file.write()
+
+
+def read_file(filename):
+    """Read all of a file, returning its first dataset. The data is
+    mapped, so it is copied to make sure every page is read."""
+    sbf_file = sbf.File(filename)
+    sbf_file.read()
+    arrays = [np.array(dataset.data) for dataset in sbf_file.datasets()]
+    return arrays[0]
+
+
+def main():
+    output = sys.argv[1] if len(sys.argv) > 1 else '-'
+    filename = sys.argv[2] if len(sys.argv) > 2 else '/tmp/sbf_bench_throughput_py.sbf'
+    benchmarks = []
+    for type_name, dtype in TYPES:
+        for size in SIZES:
+            array = np.ones(size // np.dtype(dtype).itemsize, dtype=dtype)
+            iterations, seconds = run(lambda: write_file(filename, [array]))
+            benchmarks.append(result('write/{}/{}'.format(type_name, size),
+                                     iterations, seconds, size))
+            iterations, seconds = run(lambda: read_file(filename))
+            benchmarks.append(result('read/{}/{}'.format(type_name, size),
+                                     iterations, seconds, size))
+
+    for count in COUNTS:
+        arrays = [np.ones(1)] * count
+        iterations, seconds = run(lambda: write_file(filename, arrays))
+        benchmarks.append(result('write_datasets/{}'.format(count), iterations, seconds))
+        iterations, seconds = run(lambda: read_file(filename))
+        benchmarks.append(result('open/{}'.format(count), iterations, seconds))
+    os.remove(filename)
+
+    results = {
+        'context': {'binding': 'python', 'sbf_version': sbf.__version__,
+                    'date': datetime.datetime.now().isoformat(timespec='seconds'),
+                    'min_time': MIN_TIME, 'numpy_version': np.__version__},
+        'benchmarks': benchmarks,
+    }
+    if output == '-':
+        json.dump(results, sys.stdout, indent=2)
+        print()
+    else:
+        with open(output, 'w') as out:
+            json.dump(results, out, indent=2)
+
+
+if __name__ == '__main__':
+    main()
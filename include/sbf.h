@@ -7,10 +7,29 @@
  *
  */
 #include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "sbf_arena.h"
+#include "sbf_async.h"
+#include "sbf_byteswap.h"
+#include "sbf_checkpoint.h"
+#include "sbf_codec.h"
+#include "sbf_direct.h"
+#include "sbf_frames.h"
+#include "sbf_integrity.h"
+#include "sbf_name_index.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SBF_POSIX 1
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef SBF_DEBUG_OUTPUT
 #define SBF_DEBUG(...) fprintf(stderr, __VA_ARGS__);
@@ -19,19 +38,39 @@
 #endif
 
 #define SBF_VERSION_MAJOR '0'
-#define SBF_VERSION_MINOR '2'
-#define SBF_VERSION_MINOR_MINOR '0'
+#define SBF_VERSION_MINOR '3'
+#define SBF_VERSION_MINOR_MINOR '2'
 #define SBF_COMPATABILITY_VERSION_STRING "010"
-#define SBF_VERSION "0.2.0"
+// first version storing the number of datasets in 64 rather than 8 bits
+#define SBF_WIDE_COUNT_VERSION_STRING "030"
+// first version storing an index of dataset names, see sbf_name_index.h
+#define SBF_NAME_INDEX_VERSION_STRING "031"
+// first version recording the alignment of the blobs, see sbf_direct.h
+#define SBF_ALIGNMENT_VERSION_STRING "032"
+#define SBF_VERSION "0.3.2"
+
+// Size of the ranges datasets are split into for parallel I/O
+#ifndef SBF_PARALLEL_CHUNK_SIZE
+#define SBF_PARALLEL_CHUNK_SIZE (16 * 1024 * 1024)
+#endif
+// Bytes sbf_read_headers reads at once, enough for ~500 data headers
+#ifndef SBF_HEADER_READ_SIZE
+#define SBF_HEADER_READ_SIZE (64 * 1024)
+#endif
+// Bytes read back at once to checksum blobs, see sbf_integrity.h
+#ifndef SBF_CHECKSUM_READ_SIZE
+#define SBF_CHECKSUM_READ_SIZE (1024 * 1024)
+#endif
 
 #define SBF_MAX_DIM 8
-#define SBF_MAX_DATASETS 64
+// dataset tables are allocated as needed, this only bounds their indices
+#define SBF_MAX_DATASETS INT32_MAX
 #define SBF_NAME_LENGTH 62
 // Flag bits
 #define SBF_BIG_ENDIAN 0b10000000
 #define SBF_COLUMN_MAJOR 0b01000000
 #define SBF_CUSTOM_DATATYPE 0b00100000
-#define SBF_UNUSED_BIT 0b00010000
+#define SBF_COMPRESSED 0b00010000
 #define SBF_DIMENSION_BITS 0b00001111
 
 #define SBF_GET_DIMENSIONS(data_header)                                        \
@@ -51,6 +90,12 @@
 
 #define SBF_SET_COLUMN_MAJOR_FLAG(data_header) (data_header.flags |= SBF_COLUMN_MAJOR)
 
+// Compressed datasets are stored chunked, see sbf_codec.h
+#define SBF_CHECK_COMPRESSED_FLAG(data_header)                                 \
+    (data_header.flags & SBF_COMPRESSED)
+
+#define SBF_SET_COMPRESSED_FLAG(data_header) (data_header.flags |= SBF_COMPRESSED)
+
 #define SBF_PERROR(...) fprintf(stderr, __VA_ARGS__)
 
 #define FAIL_IF_NULL(arg)                                                      \
@@ -60,9 +105,7 @@
 #define SBF_WRITE_RAW(data, block_size, num_blocks, fp)                        \
     do {                                                                       \
         if (fwrite(data, block_size, num_blocks, fp) != num_blocks) {          \
-            SBF_PERROR("Failed to write to file, ferror=%d\nClosing file\n",   \
-                       ferror(fp));                                            \
-            sbf_close(sbf);                                                    \
+            SBF_PERROR("Failed to write to file, ferror=%d\n", ferror(fp));    \
             return SBF_RESULT_WRITE_FAILURE;                                   \
         }                                                                      \
     } while (0)
@@ -70,10 +113,8 @@
 #define SBF_READ_RAW(data, block_size, num_blocks, fp)                         \
     do {                                                                       \
         if (fread(data, block_size, num_blocks, fp) != num_blocks) {           \
-            SBF_PERROR("Failed to read from file, ferror=%d\nClosing file\n",  \
-                       ferror(fp));                                            \
-            sbf_close(sbf);                                                    \
-            return SBF_RESULT_WRITE_FAILURE;                                   \
+            SBF_PERROR("Failed to read from file, ferror=%d\n", ferror(fp));   \
+            return SBF_RESULT_READ_FAILURE;                                    \
         }                                                                      \
     } while (0)
 
@@ -123,13 +164,19 @@ typedef enum {
     SBF_RESULT_READ_FAILURE,
     SBF_RESULT_NULL_FAILURE,
     SBF_RESULT_MAX_DATASETS_EXCEEDED_FAILURE,
-    SBF_RESULT_INCOMPATIBLE_VERSION
+    SBF_RESULT_INCOMPATIBLE_VERSION,
+    SBF_RESULT_CHECKSUM_FAILURE
 } sbf_result;
 
+/*
+ * On disk the fields are packed, with n_datasets stored as a single
+ * byte before SBF_WIDE_COUNT_VERSION_STRING, see sbf_file_header_size.
+ */
 typedef struct {
     sbf_character token[3];
     sbf_character version_string[3];
-    sbf_byte n_datasets;
+    sbf_size n_datasets;
+    sbf_size alignment; // from SBF_ALIGNMENT_VERSION_STRING
 } sbf_FileHeader;
 
 typedef struct {
@@ -143,20 +190,50 @@ typedef struct {
     sbf_mode mode;
     const char *filename;
     FILE *fp;
-    sbf_byte n_datasets;
-    sbf_DataHeader datasets[SBF_MAX_DATASETS];
-    void *dataset_pointers[SBF_MAX_DATASETS];
+    sbf_character version_string[3]; // of the file read, or being written
+    sbf_size n_datasets;
+    sbf_size capacity;         // number of datasets the tables below can hold
+    sbf_DataHeader *datasets;
+    void **dataset_pointers;
+    sbf_size *data_offsets;    // relative to the first blob, see sbf_data_start
+    sbf_byte *codecs;          // used when writing compressed datasets
+    sbf_byte *filters;
+    sbf_size n_slots;          // open addressed index of the dataset names
+    sbf_NameSlot *name_index;
+    bool headers_only;         // data_offsets not yet known, see sbf_locate_datasets
+    sbf_size alignment;        // blobs start at multiples of this, see sbf_set_alignment
+    bool direct_io;            // bypass the page cache where possible, see sbf_open
+    int direct_fd;             // descriptor opened with O_DIRECT, or -1
+    sbf_size n_frames;         // of a multi-frame file, 0 otherwise, see sbf_frames.h
+    sbf_size frame_capacity;   // number of frames 'frame_offsets' can hold
+    sbf_size *frame_offsets;
+    bool atomic;               // write a temporary file, committed by sbf_close
+    char *temp_filename;       // being written, if 'atomic'
+    bool checksums;            // end the file with checksums, see sbf_integrity.h
+    bool verify;               // check datasets read against the checksums, if any
+    uint32_t *crcs;            // of each blob, if the file read has checksums
+    uint32_t headers_crc;      // of the headers, from the checksums
 } sbf_File;
 
+// packed size of the current sbf_FileHeader
+#define SBF_FILE_HEADER_SIZE (6 + 2 * sizeof(sbf_size))
+
 static const sbf_File sbf_new_file = {
-    .mode = SBF_FILE_READONLY, .filename = NULL, .fp = NULL, .n_datasets = 0,
+    .mode = SBF_FILE_READONLY, .filename = NULL, .fp = NULL,
+    .version_string = {SBF_VERSION_MAJOR, SBF_VERSION_MINOR, SBF_VERSION_MINOR_MINOR},
+    .n_datasets = 0, .capacity = 0, .datasets = NULL, .dataset_pointers = NULL,
+    .data_offsets = NULL, .codecs = NULL, .filters = NULL, .n_slots = 0,
+    .name_index = NULL, .headers_only = false, .alignment = 1, .direct_io = false,
+    .direct_fd = -1, .n_frames = 0, .frame_capacity = 0, .frame_offsets = NULL,
+    .atomic = false, .temp_filename = NULL, .checksums = false, .verify = false,
+    .crcs = NULL, .headers_crc = 0,
 };
 
 static const sbf_FileHeader sbf_new_file_header = {
     .token = {'S', 'B', 'F'},
     .version_string = {SBF_VERSION_MAJOR, SBF_VERSION_MINOR,
                        SBF_VERSION_MINOR_MINOR},
-    .n_datasets = 0};
+    .n_datasets = 0, .alignment = 1};
 
 static const sbf_DataHeader sbf_new_data_header = {
     .name = {0}, .data_type = 0, .shape = {0},
@@ -165,46 +242,202 @@ static const sbf_DataHeader sbf_new_data_header = {
 /*
  * Open 'filename', placing the resultant file pointer into 'sbf'
  *
+ * If 'direct_io' is set the file is also opened with O_DIRECT, which
+ * blobs are read and written through where they are aligned (see
+ * sbf_direct.h and sbf_set_alignment). Opening fails if the platform
+ * or file system doesn't support O_DIRECT; on Linux it is only defined
+ * when compiling with _GNU_SOURCE.
+ *
+ * If 'atomic' is set a file opened for writing is written as a
+ * temporary file, which sbf_close commits as 'filename' once complete
+ * (see sbf_integrity.h), and sbf_discard deletes.
+ *
  * Returns SBF_RESULT_SUCCESS if we opened the file, or corresponding error
  * values
  * if the file could not be opened.
  */
 sbf_result sbf_open(sbf_File *sbf) {
     FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->filename);
+
+    const char *path = sbf->filename;
+    sbf->temp_filename = NULL;
+    if (sbf->atomic && sbf->mode != SBF_FILE_READONLY) {
+        sbf->temp_filename = sbf_temp_filename(sbf->filename);
+        FAIL_IF_NULL(sbf->temp_filename);
+        path = sbf->temp_filename;
+    }
 
     switch (sbf->mode) {
     case SBF_FILE_WRITEONLY:
-        sbf->fp = fopen(sbf->filename, "wb");
+        sbf->fp = fopen(path, "wb");
         break;
     case SBF_FILE_READONLY:
-        sbf->fp = fopen(sbf->filename, "rb");
+        sbf->fp = fopen(path, "rb");
         break;
     case SBF_FILE_READWRITE:
-        sbf->fp = fopen(sbf->filename, "w+b");
+        sbf->fp = fopen(path, "w+b");
         break;
     }
 
     if (sbf->fp == NULL) {
-        SBF_PERROR("Failed to open file '%s': %s.\n", sbf->filename, strerror(errno));
+        SBF_PERROR("Failed to open file '%s': %s.\n", path, strerror(errno));
+        free(sbf->temp_filename);
+        sbf->temp_filename = NULL;
         return SBF_RESULT_FILE_OPEN_FAILURE;
     }
 
+    sbf->direct_fd = -1;
+    if (sbf->direct_io) {
+#ifdef SBF_O_DIRECT
+        int flags = (sbf->mode == SBF_FILE_READONLY) ? O_RDONLY : O_RDWR;
+        sbf->direct_fd = open(path, flags | O_DIRECT);
+        if (sbf->direct_fd < 0)
+            SBF_PERROR("Failed to open file '%s' with O_DIRECT: %s.\n", path, strerror(errno));
+#else
+        SBF_PERROR("Can't open file '%s' with O_DIRECT, which this build doesn't have.\n", path);
+#endif
+        if (sbf->direct_fd < 0) {
+            fclose(sbf->fp);
+            sbf->fp = NULL;
+            if (sbf->temp_filename != NULL)
+                remove(sbf->temp_filename);
+            free(sbf->temp_filename);
+            sbf->temp_filename = NULL;
+            return SBF_RESULT_FILE_OPEN_FAILURE;
+        }
+    }
     return SBF_RESULT_SUCCESS;
 }
 
 /*
- * Close the FILE * associated with 'sbf'
+ * Close the FILE * associated with 'sbf', and free its dataset tables.
+ * A file written with 'atomic' set is then committed as its filename.
  *
  * Returns SBF_RESULT_SUCCESS if there was no failure,
  * or corresponding error values if the file could not be closed.
  */
-sbf_result sbf_close(const sbf_File *file) {
+sbf_result sbf_close(sbf_File *file) {
     FAIL_IF_NULL(file);
+    free(file->crcs);
+    file->crcs = NULL;
+    free(file->datasets);
+    free(file->dataset_pointers);
+    free(file->data_offsets);
+    free(file->codecs);
+    free(file->filters);
+    free(file->name_index);
+    free(file->frame_offsets);
+    file->datasets = NULL;
+    file->dataset_pointers = NULL;
+    file->data_offsets = NULL;
+    file->codecs = NULL;
+    file->filters = NULL;
+    file->name_index = NULL;
+    file->frame_offsets = NULL;
+    file->n_datasets = file->capacity = file->n_slots = 0;
+    file->n_frames = file->frame_capacity = 0;
+#ifdef SBF_POSIX
+    if (file->direct_fd >= 0)
+        close(file->direct_fd);
+#endif
+    file->direct_fd = -1;
+    char *temp = file->temp_filename;
+    file->temp_filename = NULL;
     int ret = fclose(file->fp);
+    if (ret == 0 && temp != NULL && sbf_commit_file(temp, file->filename) != 0)
+        ret = -1;
     if (ret != 0) {
         SBF_PERROR("Failed to close file '%s': %s.\n", file->filename, strerror(errno));
-        return SBF_RESULT_FILE_CLOSE_FAILURE;
+        if (temp != NULL)
+            remove(temp);
+    }
+    free(temp);
+    return (ret == 0) ? SBF_RESULT_SUCCESS : SBF_RESULT_FILE_CLOSE_FAILURE;
+}
+
+/*
+ * Close 'sbf' after a failed write, without committing it: with
+ * 'atomic' set the temporary file is deleted and any previous file
+ * called 'filename' is left as it was.
+ */
+sbf_result sbf_discard(sbf_File *file) {
+    FAIL_IF_NULL(file);
+    char *temp = file->temp_filename;
+    file->temp_filename = NULL;
+    sbf_result res = sbf_close(file);
+    if (temp != NULL) {
+        remove(temp);
+        free(temp);
+    }
+    return res;
+}
+
+/*
+ * Number of bytes the file header of a file with 'version_string'
+ * occupies on disk, i.e. the offset of the first data header.
+ */
+sbf_size sbf_file_header_size(const sbf_character version_string[3]) {
+    if (strncmp(version_string, SBF_WIDE_COUNT_VERSION_STRING, 3) < 0)
+        return 7;
+    if (strncmp(version_string, SBF_ALIGNMENT_VERSION_STRING, 3) < 0)
+        return 6 + sizeof(sbf_size);
+    return SBF_FILE_HEADER_SIZE;
+}
+
+/*
+ * Grow the dataset tables of 'sbf' to hold at least 'capacity' datasets
+ */
+sbf_result sbf_reserve_datasets(sbf_File *sbf, sbf_size capacity) {
+    FAIL_IF_NULL(sbf);
+    if (capacity <= sbf->capacity)
+        return SBF_RESULT_SUCCESS;
+    if (capacity > SBF_MAX_DATASETS || capacity > SIZE_MAX / sizeof(sbf_DataHeader))
+        return SBF_RESULT_MAX_DATASETS_EXCEEDED_FAILURE;
+
+    // tables are only replaced once reallocated, so 'sbf' stays valid on failure
+    sbf_DataHeader *datasets = (sbf_DataHeader *)realloc(sbf->datasets, capacity * sizeof(*datasets));
+    FAIL_IF_NULL(datasets);
+    sbf->datasets = datasets;
+    void **pointers = (void **)realloc(sbf->dataset_pointers, capacity * sizeof(*pointers));
+    FAIL_IF_NULL(pointers);
+    sbf->dataset_pointers = pointers;
+    sbf_size *offsets = (sbf_size *)realloc(sbf->data_offsets, capacity * sizeof(*offsets));
+    FAIL_IF_NULL(offsets);
+    sbf->data_offsets = offsets;
+    sbf_byte *codecs = (sbf_byte *)realloc(sbf->codecs, capacity);
+    FAIL_IF_NULL(codecs);
+    sbf->codecs = codecs;
+    sbf_byte *filters = (sbf_byte *)realloc(sbf->filters, capacity);
+    FAIL_IF_NULL(filters);
+    sbf->filters = filters;
+    sbf->capacity = capacity;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Does a file with 'version_string' store an index of dataset names?
+ */
+bool sbf_has_name_index(const sbf_character version_string[3]) {
+    return strncmp(version_string, SBF_NAME_INDEX_VERSION_STRING, 3) >= 0;
+}
+
+/*
+ * Grow the name index of 'sbf' to have room for 'n' names
+ */
+sbf_result sbf_reserve_name_index(sbf_File *sbf, sbf_size n) {
+    sbf_size n_slots = sbf_name_index_slots(n);
+    if (n_slots <= sbf->n_slots)
+        return SBF_RESULT_SUCCESS;
+    sbf_NameSlot *slots = (sbf_NameSlot *)calloc(n_slots, sizeof(sbf_NameSlot));
+    FAIL_IF_NULL(slots);
+    if (sbf_name_index_rehash(sbf->name_index, sbf->n_slots, slots, n_slots, sbf->n_datasets) != 0) {
+        free(slots);
+        return SBF_RESULT_NULL_FAILURE;
     }
+    free(sbf->name_index);
+    sbf->name_index = slots;
+    sbf->n_slots = n_slots;
     return SBF_RESULT_SUCCESS;
 }
 
@@ -224,40 +457,6 @@ sbf_result sbf_valid_header(const sbf_FileHeader *header) {
     return SBF_RESULT_SUCCESS;
 }
 
-/*
- *  Add the dataset to the sbf, giving it 'name'
- *
- *  Creates a data header in the 'sbf' object for this dataset:
- *  Ensure the datatype is CORRECT
- *
- */
-sbf_result sbf_add_dataset(sbf_File *sbf, const char *name, sbf_data_type type,
-                           sbf_size shape[SBF_MAX_DIM], void *data) {
-    FAIL_IF_NULL(sbf);
-    FAIL_IF_NULL(name);
-    FAIL_IF_NULL(data);
-
-    // Fail if there are already too many datasets in the file
-    if (sbf->n_datasets >= SBF_MAX_DATASETS) {
-        SBF_PERROR("Number of datasets in '%s' (%d) exceeded SBF_MAX_DATASETS (%d)\n",
-                   sbf->filename, sbf->n_datasets, SBF_MAX_DATASETS);
-        return SBF_RESULT_MAX_DATASETS_EXCEEDED_FAILURE;
-    }
-
-    sbf_DataHeader header = sbf_new_data_header;
-    header.data_type = type;
-    strncpy(header.name, name, SBF_NAME_LENGTH);
-    int_fast32_t dimensions;
-    for (dimensions = 0; (dimensions < SBF_MAX_DIM) && (shape[dimensions != 0]); ++dimensions)
-        header.shape[dimensions] = shape[dimensions];
-    header.flags = 0b00000000;
-    SBF_SET_DIMENSIONS(header, dimensions);
-    sbf->datasets[sbf->n_datasets] = header;
-    sbf->dataset_pointers[sbf->n_datasets] = data;
-    sbf->n_datasets++;
-    return SBF_RESULT_SUCCESS;
-}
-
 /*
  * return the size of the datatype specified in 'header'
  * (basically a wrapper for sizeof(header.datatype) as that
@@ -294,6 +493,34 @@ sbf_size sbf_datatype_size(const sbf_DataHeader header) {
     return datatype_size;
 }
 
+/*
+ * Width of the words whose bytes are reversed to change the byte
+ * order of the dataset in 'header': complex numbers are swapped as
+ * their two components.
+ */
+sbf_size sbf_swap_width(const sbf_DataHeader header) {
+    if (header.data_type == SBF_CFLOAT || header.data_type == SBF_CDOUBLE)
+        return sbf_datatype_size(header) / 2;
+    return sbf_datatype_size(header);
+}
+
+/*
+ * Is the data of the dataset in 'header' stored in the byte order
+ * of this machine?
+ */
+bool sbf_is_native_endian(const sbf_DataHeader header) {
+    return !SBF_CHECK_BIG_ENDIAN_FLAG(header) == !SBF_HOST_BIG_ENDIAN;
+}
+
+/*
+ * Convert 'size' bytes of the data of the dataset in 'header', as
+ * read from the file, to the byte order of this machine in place.
+ */
+void sbf_to_host_order(const sbf_DataHeader header, void *data, sbf_size size) {
+    if (!sbf_is_native_endian(header))
+        sbf_byteswap(data, size, sbf_swap_width(header));
+}
+
 /*
  * Return the number of data blocks required to write
  * given the shape of the dataset.
@@ -312,84 +539,2030 @@ sbf_size sbf_num_blocks(const sbf_DataHeader h) {
     return num_blocks;
 }
 
-sbf_result sbf_write_headers(const sbf_File *sbf) {
+/*
+ *  Declare a dataset in the sbf, giving it 'name', without
+ *  providing its data.
+ *
+ *  The data for a declared dataset may be streamed to the file
+ *  later with the sbf_stream_* functions; sbf_write will leave
+ *  a hole in the file where it belongs.
+ */
+sbf_result sbf_declare_dataset(sbf_File *sbf, const char *name, sbf_data_type type,
+                               sbf_size shape[SBF_MAX_DIM]) {
     FAIL_IF_NULL(sbf);
-    FAIL_IF_NULL(sbf->fp);
-
-    sbf_FileHeader header =
-        sbf_new_file_header; // this gives us token/version at the beginning
-    header.n_datasets = sbf->n_datasets;
+    FAIL_IF_NULL(name);
 
-    SBF_WRITE_RAW(&header, sizeof(header), 1, sbf->fp);
+    // Fail if there are already too many datasets in the file
+    if (sbf->n_datasets >= SBF_MAX_DATASETS) {
+        SBF_PERROR("Number of datasets in '%s' (%"PRIu64") exceeded SBF_MAX_DATASETS (%d)\n",
+                   sbf->filename, sbf->n_datasets, SBF_MAX_DATASETS);
+        return SBF_RESULT_MAX_DATASETS_EXCEEDED_FAILURE;
+    }
+    if (sbf->n_datasets == sbf->capacity) {
+        sbf_result res = sbf_reserve_datasets(sbf, sbf->capacity ? 2 * sbf->capacity : 4);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+    }
+    sbf_result res = sbf_reserve_name_index(sbf, sbf->n_datasets + 1);
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
 
-    SBF_WRITE_RAW(sbf->datasets, sizeof(sbf->datasets[0]), header.n_datasets,
-                  sbf->fp);
+    sbf_DataHeader header = sbf_new_data_header;
+    header.data_type = type;
+    strncpy(header.name, name, SBF_NAME_LENGTH);
+    int_fast32_t dimensions;
+    for (dimensions = 0; (dimensions < SBF_MAX_DIM) && (shape[dimensions] != 0); ++dimensions)
+        header.shape[dimensions] = shape[dimensions];
+    header.flags = 0b00000000;
+    SBF_SET_BIG_ENDIAN_FLAG(header, SBF_HOST_BIG_ENDIAN);
+    SBF_SET_DIMENSIONS(header, dimensions);
+    sbf->datasets[sbf->n_datasets] = header;
+    sbf_name_index_insert(sbf->name_index, sbf->n_slots,
+                          sbf_name_hash(header.name, SBF_NAME_LENGTH), (uint32_t)sbf->n_datasets);
+    sbf->dataset_pointers[sbf->n_datasets] = NULL;
+    sbf->data_offsets[sbf->n_datasets] = 0;
+    sbf->codecs[sbf->n_datasets] = SBF_CODEC_LZ;
+    sbf->filters[sbf->n_datasets] = SBF_FILTER_SHUFFLE;
+    if (sbf->n_datasets > 0) {
+        sbf_DataHeader prev = sbf->datasets[sbf->n_datasets - 1];
+        sbf->data_offsets[sbf->n_datasets] = sbf->data_offsets[sbf->n_datasets - 1] +
+            sbf_align_up(sbf_datatype_size(prev) * sbf_num_blocks(prev), sbf->alignment);
+    }
+    sbf->n_datasets++;
+    return SBF_RESULT_SUCCESS;
+}
 
+/*
+ *  Add the dataset to the sbf, giving it 'name'
+ *
+ *  Creates a data header in the 'sbf' object for this dataset:
+ *  Ensure the datatype is CORRECT
+ *
+ */
+sbf_result sbf_add_dataset(sbf_File *sbf, const char *name, sbf_data_type type,
+                           sbf_size shape[SBF_MAX_DIM], void *data) {
+    FAIL_IF_NULL(data);
+    sbf_result res = sbf_declare_dataset(sbf, name, type, shape);
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    sbf->dataset_pointers[sbf->n_datasets - 1] = data;
     return SBF_RESULT_SUCCESS;
 }
 
 /*
- * Write the contents of 'sbf' specified
- * in its dataheaders to the FILE * in 'sbf->fp'.
+ *  Choose the filter pipeline (SBF_FILTER_* bits) and codec
+ *  (SBF_CODEC_*) that dataset 'index' is encoded with, marking it
+ *  as compressed. Declared datasets default to SBF_CODEC_LZ with
+ *  SBF_FILTER_SHUFFLE once SBF_SET_COMPRESSED_FLAG is used.
  *
- * If it fails, it fails totally.
+ *  SBF_CODEC_NONE with filters keeps the data the same size, but e.g.
+ *  SBF_FILTER_DELTA | SBF_FILTER_SHUFFLE makes floating point data far
+ *  more compressible by general purpose tools.
  */
-sbf_result sbf_write(const sbf_File *sbf) {
+sbf_result sbf_set_filters(sbf_File *sbf, int_fast32_t index, sbf_byte codec,
+                           sbf_byte filters) {
     FAIL_IF_NULL(sbf);
-    FAIL_IF_NULL(sbf->fp);
-
-    sbf_write_headers(sbf);
-
-    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
-        sbf_size datatype_size = sbf_datatype_size(sbf->datasets[dset]);
-        sbf_size expected_write_size = sbf_num_blocks(sbf->datasets[dset]);
+    if (index < 0 || (sbf_size)index >= sbf->n_datasets)
+        return SBF_RESULT_WRITE_FAILURE;
+    if (codec > SBF_CODEC_LZ) {
+        SBF_PERROR("Unknown codec %d for dataset '%s'\n", codec, sbf->datasets[index].name);
+        return SBF_RESULT_WRITE_FAILURE;
+    }
+    SBF_SET_COMPRESSED_FLAG(sbf->datasets[index]);
+    sbf->codecs[index] = codec;
+    sbf->filters[index] = filters;
+    return SBF_RESULT_SUCCESS;
+}
 
-        SBF_WRITE_RAW(sbf->dataset_pointers[dset], datatype_size,
-                      expected_write_size, sbf->fp);
+/*
+ *  Pad every blob in 'sbf' to start at a multiple of 'alignment'
+ *  bytes, a power of two, and record it in the file header.
+ *  SBF_DIRECT_ALIGNMENT lets whole datasets bypass the page cache
+ *  with 'direct_io'; 1 (the default) packs the blobs together.
+ */
+sbf_result sbf_set_alignment(sbf_File *sbf, sbf_size alignment) {
+    FAIL_IF_NULL(sbf);
+    if (!sbf_valid_alignment(alignment)) {
+        SBF_PERROR("Invalid alignment %"PRIu64" for '%s'\n", alignment, sbf->filename);
+        return SBF_RESULT_WRITE_FAILURE;
+    }
+    sbf->alignment = alignment;
+    for (sbf_size dset = 1; dset < sbf->n_datasets; dset++) {
+        sbf_DataHeader prev = sbf->datasets[dset - 1];
+        sbf->data_offsets[dset] = sbf->data_offsets[dset - 1] +
+            sbf_align_up(sbf_datatype_size(prev) * sbf_num_blocks(prev), alignment);
     }
     return SBF_RESULT_SUCCESS;
 }
 
 /*
- * Read the contents of a dataset in the file pointed to by 'sbf'
- * Expects 'data' to be an array already allocated of the correct size.
+ * Byte offset of the data header of dataset 'index' in the file
  */
-sbf_result sbf_read_dataset(sbf_File *sbf, const sbf_DataHeader header,
-                            void *data) {
+sbf_size sbf_header_offset(const sbf_File *sbf, sbf_size index) {
+    return sbf_file_header_size(sbf->version_string) + index * sizeof(sbf_DataHeader);
+}
+
+/*
+ * Size of everything before the first binary blob: the file
+ * header, the data headers and the name index (if any).
+ */
+sbf_size sbf_headers_size(const sbf_File *sbf) {
+    sbf_size size = sbf_header_offset(sbf, sbf->n_datasets);
+    if (sbf_has_name_index(sbf->version_string))
+        size += sizeof(sbf_size) + sbf->n_slots * sizeof(sbf_NameSlot);
+    return size;
+}
+
+/*
+ * Byte offset of the first binary blob in the file: the size of
+ * the headers, padded to the alignment of the file.
+ */
+sbf_size sbf_data_start(const sbf_File *sbf) {
+    return sbf_align_up(sbf_headers_size(sbf), sbf->alignment);
+}
+
+/*
+ * Byte offset of the binary blob of dataset 'index' in the file,
+ * i.e. the size of all headers plus the blobs before it.
+ */
+sbf_size sbf_data_offset(const sbf_File *sbf, sbf_size index) {
+    return sbf_data_start(sbf) + sbf->data_offsets[index];
+}
+
+/*
+ * Size of each frame of a multi-frame file (see sbf_frames.h): all of
+ * the blobs, padded to the alignment of the file.
+ */
+sbf_size sbf_frame_size(const sbf_File *sbf) {
+    if (sbf->n_datasets == 0)
+        return 0;
+    const sbf_DataHeader last = sbf->datasets[sbf->n_datasets - 1];
+    return sbf->data_offsets[sbf->n_datasets - 1] +
+           sbf_align_up(sbf_datatype_size(last) * sbf_num_blocks(last), sbf->alignment);
+}
+
+/*
+ * Byte offset of the blob of dataset 'index' in frame 'frame' of the
+ * file. Files that aren't multi-frame only have frame 0.
+ */
+sbf_size sbf_frame_offset(const sbf_File *sbf, sbf_size frame, sbf_size index) {
+    if (sbf->n_frames == 0)
+        return sbf_data_offset(sbf, index);
+    return sbf->frame_offsets[frame] + sbf->data_offsets[index];
+}
+
+/*
+ * Grow the frame index of 'sbf' to hold at least 'capacity' frames
+ */
+sbf_result sbf_reserve_frames(sbf_File *sbf, sbf_size capacity) {
     FAIL_IF_NULL(sbf);
-    FAIL_IF_NULL(sbf->fp);
-    FAIL_IF_NULL(data);
+    if (capacity <= sbf->frame_capacity)
+        return SBF_RESULT_SUCCESS;
+    if (capacity < 2 * sbf->frame_capacity)
+        capacity = 2 * sbf->frame_capacity;
+    if (capacity > SIZE_MAX / sizeof(sbf_size))
+        return SBF_RESULT_NULL_FAILURE;
+    sbf_size *offsets = (sbf_size *)realloc(sbf->frame_offsets, capacity * sizeof(sbf_size));
+    FAIL_IF_NULL(offsets);
+    sbf->frame_offsets = offsets;
+    sbf->frame_capacity = capacity;
+    return SBF_RESULT_SUCCESS;
+}
 
-    sbf_size num_blocks = sbf_num_blocks(header);
-    sbf_size datatype_size = sbf_datatype_size(header);
+/*
+ * fseek for files larger than 2 GiB, which fseek can't reach where
+ * long is 32 bits (e.g. on Windows). Returns 0 on success.
+ */
+int sbf_fseek(FILE *fp, int64_t offset, int whence) {
+#if defined(_WIN32)
+    return _fseeki64(fp, offset, whence);
+#elif defined(SBF_POSIX)
+    if ((int64_t)(off_t)offset != offset)
+        return -1;
+    return fseeko(fp, (off_t)offset, whence);
+#else
+    if ((int64_t)(long)offset != offset)
+        return -1;
+    return fseek(fp, (long)offset, whence);
+#endif
+}
 
-    SBF_READ_RAW(data, datatype_size, num_blocks, sbf->fp);
+/*
+ * ftell for files larger than 2 GiB, see sbf_fseek. Returns -1 on failure.
+ */
+int64_t sbf_ftell(FILE *fp) {
+#if defined(_WIN32)
+    return _ftelli64(fp);
+#elif defined(SBF_POSIX)
+    return (int64_t)ftello(fp);
+#else
+    return (int64_t)ftell(fp);
+#endif
+}
 
+/*
+ * Read 'size' bytes at 'offset' in the file pointed to by 'sbf',
+ * without using or moving the file position. Where pread is available
+ * this is safe to call concurrently from multiple threads.
+ */
+sbf_result sbf_pread(const sbf_File *sbf, void *data, sbf_size size, sbf_size offset) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+#ifdef SBF_O_DIRECT
+    if (sbf->direct_fd >= 0 && offset % SBF_DIRECT_ALIGNMENT == 0) {
+        if (sbf_direct_transfer(fileno(sbf->fp), sbf->direct_fd, data, size, offset, 0) != 0)
+            return SBF_RESULT_READ_FAILURE;
+        return SBF_RESULT_SUCCESS;
+    }
+#endif
+#ifdef SBF_POSIX
+    int fd = fileno(sbf->fp);
+    sbf_byte *dest = (sbf_byte *)data;
+    while (size > 0) {
+        ssize_t n = pread(fd, dest, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return SBF_RESULT_READ_FAILURE;
+        dest += n;
+        size -= n;
+        offset += n;
+    }
+#else
+    if (sbf_fseek(sbf->fp, (int64_t)offset, SEEK_SET) != 0)
+        return SBF_RESULT_READ_FAILURE;
+    if (fread(data, 1, size, sbf->fp) != size)
+        return SBF_RESULT_READ_FAILURE;
+#endif
     return SBF_RESULT_SUCCESS;
 }
 
 /*
- * Read the contents of the headers in the file pointed to by 'sbf'
- * Sets the relevant information into 'sbf'
+ * Write 'size' bytes at 'offset' in the file pointed to by 'sbf',
+ * without using or moving the file position. See sbf_pread.
  */
-sbf_result sbf_read_headers(sbf_File *sbf) {
+sbf_result sbf_pwrite(const sbf_File *sbf, const void *data, sbf_size size, sbf_size offset) {
     FAIL_IF_NULL(sbf);
     FAIL_IF_NULL(sbf->fp);
+#ifdef SBF_O_DIRECT
+    if (sbf->direct_fd >= 0 && offset % SBF_DIRECT_ALIGNMENT == 0) {
+        if (sbf_direct_transfer(fileno(sbf->fp), sbf->direct_fd, (void *)data, size, offset, 1) != 0)
+            return SBF_RESULT_WRITE_FAILURE;
+        return SBF_RESULT_SUCCESS;
+    }
+#endif
+#ifdef SBF_POSIX
+    int fd = fileno(sbf->fp);
+    const sbf_byte *src = (const sbf_byte *)data;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, src, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return SBF_RESULT_WRITE_FAILURE;
+        src += n;
+        size -= n;
+        offset += n;
+    }
+#else
+    if (sbf_fseek(sbf->fp, (int64_t)offset, SEEK_SET) != 0)
+        return SBF_RESULT_WRITE_FAILURE;
+    if (fwrite(data, 1, size, sbf->fp) != size)
+        return SBF_RESULT_WRITE_FAILURE;
+#endif
+    return SBF_RESULT_SUCCESS;
+}
 
-    sbf_result res = SBF_RESULT_SUCCESS;
-    sbf_FileHeader header =
-        sbf_new_file_header; // this gives us token/version at the beginning
-    SBF_READ_RAW(&header, sizeof(header), 1, sbf->fp);
-    if( (res = sbf_valid_header(&header)) != SBF_RESULT_SUCCESS) {
-        fprintf(stderr, "File '%s' is %s\n", sbf->filename,
-                (res == SBF_RESULT_INCOMPATIBLE_VERSION) ? "an incompatible SBF version" : "not a valid SBF file.");
+/*
+ * Read the chunk index of the compressed dataset whose blob starts at
+ * 'offset', allocating 'chunk_offsets' (n_chunks + 1 entries, relative
+ * to the end of the index) which the caller must free.
+ */
+sbf_result sbf_read_chunk_index(const sbf_File *sbf, sbf_size offset,
+                                sbf_ChunkIndexHeader *index, sbf_size **chunk_offsets) {
+    FAIL_IF_NULL(index);
+    FAIL_IF_NULL(chunk_offsets);
+    sbf_result res = sbf_pread(sbf, index, sizeof(*index), offset);
+    if (res != SBF_RESULT_SUCCESS)
         return res;
+    sbf_chunk_index_le(index, NULL, 0);
+    if (index->chunk_size == 0 || index->n_chunks > SIZE_MAX / sizeof(sbf_size) - 1)
+        return SBF_RESULT_READ_FAILURE;
+    *chunk_offsets = (sbf_size *)malloc((index->n_chunks + 1) * sizeof(sbf_size));
+    FAIL_IF_NULL(*chunk_offsets);
+    res = sbf_pread(sbf, *chunk_offsets, (index->n_chunks + 1) * sizeof(sbf_size),
+                    offset + sizeof(*index));
+    if (res != SBF_RESULT_SUCCESS) {
+        free(*chunk_offsets);
+        *chunk_offsets = NULL;
+    } else {
+        sbf_le_words(*chunk_offsets, (index->n_chunks + 1) * sizeof(sbf_size), sizeof(sbf_size));
     }
+    return res;
+}
 
-    sbf->n_datasets = header.n_datasets;
+/*
+ * Number of bytes a dataset's blob occupies in the file, which for
+ * compressed datasets is read from the chunk index at 'offset'.
+ */
+sbf_result sbf_stored_size(const sbf_File *sbf, const sbf_DataHeader header,
+                           sbf_size offset, sbf_size *size) {
+    FAIL_IF_NULL(size);
+    if (!SBF_CHECK_COMPRESSED_FLAG(header)) {
+        *size = sbf_datatype_size(header) * sbf_num_blocks(header);
+        return SBF_RESULT_SUCCESS;
+    }
+    sbf_ChunkIndexHeader index;
+    sbf_size *chunk_offsets = NULL;
+    sbf_result res = sbf_read_chunk_index(sbf, offset, &index, &chunk_offsets);
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    *size = sizeof(index) + (index.n_chunks + 1) * sizeof(sbf_size) +
+            chunk_offsets[index.n_chunks];
+    free(chunk_offsets);
+    return SBF_RESULT_SUCCESS;
+}
 
-    SBF_READ_RAW(&(sbf->datasets[0]), sizeof(sbf_DataHeader), header.n_datasets,
-                 sbf->fp);
+/*
+ * Decode chunk 'chunk' of a compressed dataset whose blob starts at
+ * 'offset' into 'data' (the start of the whole decoded dataset).
+ */
+sbf_result sbf_read_chunk(const sbf_File *sbf, const sbf_DataHeader header, sbf_size offset,
+                          const sbf_ChunkIndexHeader *index, const sbf_size *chunk_offsets,
+                          sbf_size chunk, void *data) {
+    sbf_size total = sbf_datatype_size(header) * sbf_num_blocks(header);
+    sbf_size start = chunk * index->chunk_size;
+    if (start >= total || chunk_offsets[chunk + 1] < chunk_offsets[chunk])
+        return SBF_RESULT_READ_FAILURE;
+    sbf_size n = total - start;
+    if (n > index->chunk_size)
+        n = index->chunk_size;
+    sbf_size stored = chunk_offsets[chunk + 1] - chunk_offsets[chunk];
+    if (stored > n)
+        return SBF_RESULT_READ_FAILURE;
 
-    return SBF_RESULT_SUCCESS;
+    sbf_byte *buffer = (sbf_byte *)malloc(stored + n);
+    FAIL_IF_NULL(buffer);
+    sbf_size table_size = sizeof(*index) + (index->n_chunks + 1) * sizeof(sbf_size);
+    sbf_result res = sbf_pread(sbf, buffer, stored, offset + table_size + chunk_offsets[chunk]);
+    if (res == SBF_RESULT_SUCCESS &&
+        sbf_decode_chunk(index->codec, index->filters, sbf_datatype_size(header),
+                         buffer, stored, (sbf_byte *)data + start, n, buffer + stored) != 0) {
+        SBF_PERROR("Corrupt chunk %"PRIu64" in compressed dataset '%s'\n", chunk, header.name);
+        res = SBF_RESULT_READ_FAILURE;
+    }
+    if (res == SBF_RESULT_SUCCESS)
+        sbf_to_host_order(header, (sbf_byte *)data + start, n);
+    free(buffer);
+    return res;
+}
+
+/*
+ * Read and decompress the whole of a compressed dataset whose blob
+ * starts at 'offset' into 'data'.
+ */
+sbf_result sbf_read_compressed(const sbf_File *sbf, const sbf_DataHeader header,
+                               sbf_size offset, void *data) {
+    sbf_ChunkIndexHeader index;
+    sbf_size *chunk_offsets = NULL;
+    sbf_result res = sbf_read_chunk_index(sbf, offset, &index, &chunk_offsets);
+    for (sbf_size chunk = 0; (res == SBF_RESULT_SUCCESS) && (chunk < index.n_chunks); chunk++)
+        res = sbf_read_chunk(sbf, header, offset, &index, chunk_offsets, chunk, data);
+    free(chunk_offsets);
+    return res;
+}
+
+/*
+ * Compress 'data' for dataset 'dset' using its codec and filters,
+ * writing the chunk index and chunks at the current position of 'sbf->fp'.
+ * If 'crc' isn't NULL it is set to the checksum of all that was written.
+ */
+sbf_result sbf_write_compressed(const sbf_File *sbf, int_fast32_t dset, const void *data,
+                                uint32_t *crc) {
+    const sbf_DataHeader header = sbf->datasets[dset];
+    const sbf_size elem = sbf_datatype_size(header);
+    const sbf_size total = elem * sbf_num_blocks(header);
+    sbf_ChunkIndexHeader index = {sbf->codecs[dset], sbf->filters[dset], {0}, 0, 0};
+    index.chunk_size = (SBF_COMPRESSION_CHUNK_SIZE / elem) * elem;
+    index.n_chunks = (total + index.chunk_size - 1) / index.chunk_size;
+
+    const int64_t start = sbf_ftell(sbf->fp);
+    sbf_size *chunk_offsets = (sbf_size *)calloc(index.n_chunks + 1, sizeof(sbf_size));
+    sbf_byte *buffer = (sbf_byte *)malloc(2 * index.chunk_size);
+    sbf_result res = SBF_RESULT_SUCCESS;
+    uint32_t chunks_crc = 0;
+    if (start < 0 || chunk_offsets == NULL || buffer == NULL) {
+        res = SBF_RESULT_WRITE_FAILURE;
+        goto cleanup;
+    }
+
+    // the chunk index is rewritten once the chunk sizes are known
+    if (fwrite(&index, sizeof(index), 1, sbf->fp) != 1 ||
+        fwrite(chunk_offsets, sizeof(sbf_size), index.n_chunks + 1, sbf->fp) != index.n_chunks + 1) {
+        res = SBF_RESULT_WRITE_FAILURE;
+        goto cleanup;
+    }
+    for (sbf_size chunk = 0; chunk < index.n_chunks; chunk++) {
+        sbf_size chunk_start = chunk * index.chunk_size;
+        sbf_size n = total - chunk_start;
+        if (n > index.chunk_size)
+            n = index.chunk_size;
+        sbf_size stored = sbf_encode_chunk(index.codec, index.filters, elem,
+                                           (const sbf_byte *)data + chunk_start, n,
+                                           buffer, buffer + index.chunk_size);
+        if (fwrite(buffer, 1, stored, sbf->fp) != stored) {
+            res = SBF_RESULT_WRITE_FAILURE;
+            goto cleanup;
+        }
+        if (crc != NULL)
+            chunks_crc = sbf_crc32c(chunks_crc, buffer, stored);
+        chunk_offsets[chunk + 1] = chunk_offsets[chunk] + stored;
+    }
+    const sbf_size n_offsets = index.n_chunks + 1, chunks_size = chunk_offsets[index.n_chunks];
+    sbf_chunk_index_le(&index, chunk_offsets, n_offsets);
+    if (crc != NULL) {
+        // the index comes first in the file, but is only now complete
+        *crc = sbf_crc32c(0, &index, sizeof(index));
+        *crc = sbf_crc32c(*crc, chunk_offsets, n_offsets * sizeof(sbf_size));
+        *crc = sbf_crc32c_combine(*crc, chunks_crc, chunks_size);
+    }
+    const int64_t end = sbf_ftell(sbf->fp);
+    if (end < 0 || sbf_fseek(sbf->fp, start, SEEK_SET) != 0 ||
+        fwrite(&index, sizeof(index), 1, sbf->fp) != 1 ||
+        fwrite(chunk_offsets, sizeof(sbf_size), n_offsets, sbf->fp) != n_offsets ||
+        sbf_fseek(sbf->fp, end, SEEK_SET) != 0) {
+        res = SBF_RESULT_WRITE_FAILURE;
+    }
+
+cleanup:
+    free(chunk_offsets);
+    free(buffer);
+    return res;
+}
+
+/*
+ * Move the file pointed to by 'sbf' forward to the next multiple of its
+ * alignment, where the next blob starts. Returns the new position, or
+ * -1 on failure.
+ */
+int64_t sbf_align_position(const sbf_File *sbf) {
+    const int64_t position = sbf_ftell(sbf->fp);
+    if (position < 0 || sbf->alignment <= 1)
+        return position;
+    const int64_t aligned = (int64_t)sbf_align_up((sbf_size)position, sbf->alignment);
+    if (aligned != position && sbf_fseek(sbf->fp, aligned, SEEK_SET) != 0)
+        return -1;
+    return aligned;
+}
+
+/*
+ * Convert the shapes of the 'n' data headers packed at 'headers'
+ * between host and little endian byte order, the order they are
+ * stored in. 'headers' need not be aligned.
+ */
+void sbf_data_headers_le(sbf_byte *headers, sbf_size n) {
+    for (sbf_size dset = 0; dset < n; dset++) {
+        sbf_le_words(headers + dset * sizeof(sbf_DataHeader) + offsetof(sbf_DataHeader, shape),
+                     SBF_MAX_DIM * sizeof(sbf_size), sizeof(sbf_size));
+    }
 }
+
+/*
+ * Pack the file header, data headers and name index of 'sbf' into
+ * 'out', which must hold sbf_headers_size(sbf) bytes, as
+ * sbf_write_headers would write them, with every integer little
+ * endian. Returns the number of bytes packed.
+ */
+sbf_size sbf_pack_headers(const sbf_File *sbf, sbf_byte *out) {
+    sbf_FileHeader header = sbf_new_file_header;
+    header.n_datasets = sbf_le64(sbf->n_datasets);
+    header.alignment = sbf_le64(sbf->alignment);
+    const sbf_size n_slots = sbf_le64(sbf->n_slots);
+    sbf_byte *start = out;
+    // fields are packed separately to avoid struct padding
+    memcpy(out, header.token, sizeof(header.token));
+    out += sizeof(header.token);
+    memcpy(out, header.version_string, sizeof(header.version_string));
+    out += sizeof(header.version_string);
+    memcpy(out, &header.n_datasets, sizeof(header.n_datasets));
+    out += sizeof(header.n_datasets);
+    memcpy(out, &header.alignment, sizeof(header.alignment));
+    out += sizeof(header.alignment);
+    memcpy(out, sbf->datasets, sbf->n_datasets * sizeof(sbf_DataHeader));
+    sbf_data_headers_le(out, sbf->n_datasets);
+    out += sbf->n_datasets * sizeof(sbf_DataHeader);
+    memcpy(out, &n_slots, sizeof(n_slots));
+    out += sizeof(n_slots);
+    memcpy(out, sbf->name_index, sbf->n_slots * sizeof(sbf_NameSlot));
+    sbf_le_words(out, sbf->n_slots * sizeof(sbf_NameSlot), sizeof(uint32_t));
+    out += sbf->n_slots * sizeof(sbf_NameSlot);
+    return (sbf_size)(out - start);
+}
+
+sbf_result sbf_write_headers(const sbf_File *sbf) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+
+    const sbf_size headers_size = sbf_headers_size(sbf);
+    sbf_byte *headers = (sbf_byte *)malloc(headers_size);
+    FAIL_IF_NULL(headers);
+    sbf_pack_headers(sbf, headers);
+    const size_t written = fwrite(headers, 1, headers_size, sbf->fp);
+    free(headers);
+    if (written != headers_size) {
+        SBF_PERROR("Failed to write to file, ferror=%d\n", ferror(sbf->fp));
+        return SBF_RESULT_WRITE_FAILURE;
+    }
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * CRC32C of the 'size' bytes at 'offset' in the file pointed to by
+ * 'sbf', read SBF_CHECKSUM_READ_SIZE bytes at a time into '*crc'.
+ */
+sbf_result sbf_checksum_range(const sbf_File *sbf, sbf_size offset, sbf_size size,
+                              uint32_t *crc) {
+    FAIL_IF_NULL(crc);
+    sbf_byte *buffer = (sbf_byte *)malloc(SBF_CHECKSUM_READ_SIZE);
+    FAIL_IF_NULL(buffer);
+    sbf_result res = SBF_RESULT_SUCCESS;
+    *crc = 0;
+    while (res == SBF_RESULT_SUCCESS && size > 0) {
+        sbf_size n = (size < SBF_CHECKSUM_READ_SIZE) ? size : SBF_CHECKSUM_READ_SIZE;
+        res = sbf_pread(sbf, buffer, n, offset);
+        if (res == SBF_RESULT_SUCCESS)
+            *crc = sbf_crc32c(*crc, buffer, n);
+        offset += n;
+        size -= n;
+    }
+    free(buffer);
+    return res;
+}
+
+/*
+ * End the file pointed to by 'sbf', positioned just after its last
+ * blob, with the checksums of its headers and of the blobs, 'crcs'
+ * (see sbf_integrity.h).
+ */
+sbf_result sbf_write_checksums(const sbf_File *sbf, const uint32_t *crcs) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    FAIL_IF_NULL(crcs);
+    const sbf_size headers_size = sbf_headers_size(sbf);
+    sbf_byte *headers = (sbf_byte *)malloc(headers_size);
+    FAIL_IF_NULL(headers);
+    sbf_pack_headers(sbf, headers);
+    const uint32_t headers_crc = sbf_crc32c(0, headers, headers_size);
+    free(headers);
+    uint32_t *table = (uint32_t *)malloc((sbf->n_datasets + 1) * sizeof(uint32_t));
+    FAIL_IF_NULL(table);
+    memcpy(table, crcs, sbf->n_datasets * sizeof(uint32_t));
+    sbf_checksums_le(NULL, table, sbf->n_datasets);
+    sbf_ChecksumTrailer trailer = sbf_checksum_trailer(headers_crc, table, sbf->n_datasets);
+    sbf_checksums_le(&trailer, NULL, 0);
+    sbf_result res = SBF_RESULT_SUCCESS;
+    if (fwrite(table, sizeof(uint32_t), sbf->n_datasets, sbf->fp) != sbf->n_datasets ||
+        fwrite(&trailer, sizeof(trailer), 1, sbf->fp) != 1)
+        res = SBF_RESULT_WRITE_FAILURE;
+    free(table);
+    return res;
+}
+
+/*
+ * Write the contents of 'sbf' specified
+ * in its dataheaders to the FILE * in 'sbf->fp'.
+ *
+ * Datasets without data (see sbf_declare_dataset) are
+ * skipped over, to be filled in by sbf_stream_write.
+ * Datasets with the SBF_COMPRESSED flag set are compressed,
+ * so must come after any datasets that are to be streamed.
+ * With 'checksums' set the file ends with a checksum of every
+ * blob (see sbf_integrity.h), so none can be streamed.
+ *
+ * If it fails, it fails totally.
+ */
+sbf_result sbf_write(const sbf_File *sbf) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+
+    uint32_t *crcs = NULL;
+    if (sbf->checksums) {
+        crcs = (uint32_t *)malloc((sbf->n_datasets + 1) * sizeof(uint32_t));
+        FAIL_IF_NULL(crcs);
+    }
+    sbf_result res = sbf_write_headers(sbf);
+    if (res != SBF_RESULT_SUCCESS)
+        goto cleanup;
+
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        sbf_size datatype_size = sbf_datatype_size(sbf->datasets[dset]);
+        sbf_size expected_write_size = sbf_num_blocks(sbf->datasets[dset]);
+        const void *data = sbf->dataset_pointers[dset];
+
+        int64_t offset = sbf_align_position(sbf);
+        if (offset < 0) {
+            res = SBF_RESULT_WRITE_FAILURE;
+            goto cleanup;
+        }
+        if (SBF_CHECK_COMPRESSED_FLAG(sbf->datasets[dset])) {
+            res = (data == NULL) ? SBF_RESULT_NULL_FAILURE
+                                 : sbf_write_compressed(sbf, dset, data, crcs ? &crcs[dset] : NULL);
+            if (res != SBF_RESULT_SUCCESS)
+                goto cleanup;
+            continue;
+        }
+        if (data == NULL) {
+            if (crcs != NULL) {
+                SBF_PERROR("Dataset '%s' has no data to checksum\n", sbf->datasets[dset].name);
+                res = SBF_RESULT_NULL_FAILURE;
+                goto cleanup;
+            }
+            if (sbf_fseek(sbf->fp, (int64_t)(datatype_size * expected_write_size), SEEK_CUR) != 0) {
+                res = SBF_RESULT_WRITE_FAILURE;
+                goto cleanup;
+            }
+            continue;
+        }
+        if (crcs != NULL)
+            crcs[dset] = sbf_crc32c(0, data, datatype_size * expected_write_size);
+        if (sbf->direct_fd >= 0) {
+            // bypass the stdio buffer, and with it the page cache
+            sbf_size size = datatype_size * expected_write_size;
+            if (fflush(sbf->fp) != 0) {
+                res = SBF_RESULT_WRITE_FAILURE;
+                goto cleanup;
+            }
+            res = sbf_pwrite(sbf, data, size, (sbf_size)offset);
+            if (res != SBF_RESULT_SUCCESS)
+                goto cleanup;
+            if (sbf_fseek(sbf->fp, offset + (int64_t)size, SEEK_SET) != 0) {
+                res = SBF_RESULT_WRITE_FAILURE;
+                goto cleanup;
+            }
+            continue;
+        }
+        if (fwrite(data, datatype_size, expected_write_size, sbf->fp) != expected_write_size) {
+            SBF_PERROR("Failed to write to file, ferror=%d\n", ferror(sbf->fp));
+            res = SBF_RESULT_WRITE_FAILURE;
+            goto cleanup;
+        }
+    }
+    if (crcs != NULL)
+        res = sbf_write_checksums(sbf, crcs);
+
+cleanup:
+    free(crcs);
+    return res;
+}
+
+/*
+ * State for streaming the data of a single dataset to a file
+ * in chunks along its slowest varying dimension (shape[0] for
+ * row major, shape[dims - 1] for column major data), so the whole
+ * dataset never needs to be held in memory.
+ */
+typedef struct {
+    sbf_File *sbf;
+    sbf_size index;      // which dataset in 'sbf' is being streamed
+    sbf_byte dimension;  // the slowest varying dimension
+    sbf_size slice_size; // bytes in a single slice along 'dimension'
+    sbf_size n_slices;   // number of slices written so far
+} sbf_DatasetStream;
+
+/*
+ * Begin streaming the data for dataset 'index' in 'sbf'.
+ * Headers must already have been written (e.g. by sbf_write).
+ *
+ * Only the last dataset in the file may end up with a different
+ * number of slices than declared in its header; all others must
+ * be written in full.
+ */
+sbf_result sbf_stream_begin(sbf_File *sbf, sbf_size index,
+                            sbf_DatasetStream *stream) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    FAIL_IF_NULL(stream);
+    if (index >= sbf->n_datasets)
+        return SBF_RESULT_WRITE_FAILURE;
+
+    sbf_DataHeader header = sbf->datasets[index];
+    sbf_byte dims = SBF_GET_DIMENSIONS(header);
+    if (dims == 0 || SBF_CHECK_COMPRESSED_FLAG(header))
+        return SBF_RESULT_WRITE_FAILURE;
+    for (sbf_size dset = 0; dset < index; dset++) {
+        if (SBF_CHECK_COMPRESSED_FLAG(sbf->datasets[dset])) {
+            SBF_PERROR("Can't stream '%s' after a compressed dataset\n", header.name);
+            return SBF_RESULT_WRITE_FAILURE;
+        }
+    }
+
+    stream->sbf = sbf;
+    stream->index = index;
+    stream->dimension = SBF_CHECK_COLUMN_MAJOR_FLAG(header) ? dims - 1 : 0;
+    stream->slice_size = sbf_datatype_size(header) *
+                         sbf_num_blocks(header) / header.shape[stream->dimension];
+    stream->n_slices = 0;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Write 'n_slices' slices of the slowest varying dimension from 'data'
+ * directly to their final position in the file.
+ */
+sbf_result sbf_stream_write(sbf_DatasetStream *stream, const void *data,
+                            sbf_size n_slices) {
+    FAIL_IF_NULL(stream);
+    FAIL_IF_NULL(data);
+    sbf_File *sbf = stream->sbf;
+    FAIL_IF_NULL(sbf);
+
+    sbf_DataHeader header = sbf->datasets[stream->index];
+    bool is_last = (stream->index == (sbf_size)(sbf->n_datasets - 1));
+    if (!is_last && (stream->n_slices + n_slices > header.shape[stream->dimension])) {
+        SBF_PERROR("Streaming %"PRIu64" slices to '%s' would overrun the next dataset\n",
+                   stream->n_slices + n_slices, header.name);
+        return SBF_RESULT_WRITE_FAILURE;
+    }
+
+    sbf_size offset = sbf_data_offset(sbf, stream->index) +
+                      stream->n_slices * stream->slice_size;
+    if (sbf_fseek(sbf->fp, (int64_t)offset, SEEK_SET) != 0)
+        return SBF_RESULT_WRITE_FAILURE;
+    SBF_WRITE_RAW(data, stream->slice_size, n_slices, sbf->fp);
+    stream->n_slices += n_slices;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Finish streaming a dataset, patching the shape in its header
+ * on disk (and in 'sbf') if the number of slices written differs
+ * from what was declared.
+ */
+sbf_result sbf_stream_end(sbf_DatasetStream *stream) {
+    FAIL_IF_NULL(stream);
+    sbf_File *sbf = stream->sbf;
+    FAIL_IF_NULL(sbf);
+
+    sbf_DataHeader *header = &(sbf->datasets[stream->index]);
+    if (stream->n_slices != header->shape[stream->dimension]) {
+        if (stream->index != (sbf_size)(sbf->n_datasets - 1)) {
+            SBF_PERROR("Dataset '%s' was only partially written (%"PRIu64"/%"PRIu64" slices)\n",
+                       header->name, stream->n_slices, header->shape[stream->dimension]);
+            return SBF_RESULT_WRITE_FAILURE;
+        }
+        header->shape[stream->dimension] = stream->n_slices;
+        if (sbf_fseek(sbf->fp, (int64_t)sbf_header_offset(sbf, stream->index), SEEK_SET) != 0)
+            return SBF_RESULT_WRITE_FAILURE;
+        sbf_DataHeader stored = *header;
+        sbf_data_headers_le((sbf_byte *)&stored, 1);
+        SBF_WRITE_RAW(&stored, sizeof(stored), 1, sbf->fp);
+    }
+    if (fflush(sbf->fp) != 0)
+        return SBF_RESULT_WRITE_FAILURE;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Append a frame to a multi-frame file (see sbf_frames.h), writing the
+ * blob of each dataset from the corresponding entry of 'data' (or of
+ * the pointers given to sbf_add_dataset, if 'data' is NULL) after the
+ * frames before it. Datasets whose entry is NULL are left unwritten.
+ *
+ * The headers must be written first with sbf_write_headers, and the
+ * frames only become visible to readers once sbf_write_frame_index is
+ * called, which may be done every few frames but must be done at the end.
+ */
+sbf_result sbf_append_frame(sbf_File *sbf, void *const *data) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    if (data == NULL)
+        data = sbf->dataset_pointers;
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        if (SBF_CHECK_COMPRESSED_FLAG(sbf->datasets[dset])) {
+            SBF_PERROR("Can't append compressed dataset '%s' to a frame\n",
+                       sbf->datasets[dset].name);
+            return SBF_RESULT_WRITE_FAILURE;
+        }
+    }
+    sbf_result res = sbf_reserve_frames(sbf, sbf->n_frames + 1);
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    const sbf_size frame_size = sbf_frame_size(sbf);
+    const sbf_size start = (sbf->n_frames == 0) ? sbf_data_start(sbf)
+        : sbf->frame_offsets[sbf->n_frames - 1] + frame_size;
+    // the headers must reach the file before the frame goes around stdio
+    if (fflush(sbf->fp) != 0)
+        return SBF_RESULT_WRITE_FAILURE;
+
+#ifdef SBF_CHECKPOINT_POSIX
+    // the blobs, and zeros over whatever (e.g. an earlier frame index) is between them
+    struct iovec *iov = (struct iovec *)malloc((2 * sbf->n_datasets + 1) * sizeof(*iov));
+    sbf_byte *padding = (sbf_byte *)calloc(sbf->alignment, 1);
+    if (iov == NULL || padding == NULL) {
+        res = SBF_RESULT_NULL_FAILURE;
+        goto cleanup;
+    }
+    int n_iov = 0;
+    sbf_size run = start, end = start;
+    for (sbf_size dset = 0; dset <= sbf->n_datasets; dset++) {
+        const bool last = (dset == sbf->n_datasets);
+        if (last || data[dset] == NULL) {
+            if (last && n_iov > 0 && start + frame_size > end)
+                iov[n_iov++] = (struct iovec){padding, start + frame_size - end};
+            // write the run before this hole
+            for (int i = 0; sbf->direct_fd >= 0 && i < n_iov && res == SBF_RESULT_SUCCESS; i++) {
+                res = sbf_pwrite(sbf, iov[i].iov_base, iov[i].iov_len, run);
+                run += iov[i].iov_len;
+            }
+            if (sbf->direct_fd < 0 && n_iov > 0 &&
+                sbf_write_gather(fileno(sbf->fp), iov, n_iov, run) != 0)
+                res = SBF_RESULT_WRITE_FAILURE;
+            if (res != SBF_RESULT_SUCCESS)
+                goto cleanup;
+            n_iov = 0;
+            continue;
+        }
+        const sbf_size offset = start + sbf->data_offsets[dset];
+        const sbf_size size = sbf_datatype_size(sbf->datasets[dset]) *
+                              sbf_num_blocks(sbf->datasets[dset]);
+        if (n_iov == 0)
+            run = end = offset;
+        if (offset > end)
+            iov[n_iov++] = (struct iovec){padding, offset - end};
+        if (size > 0)
+            iov[n_iov++] = (struct iovec){data[dset], size};
+        end = offset + size;
+    }
+#else
+    for (sbf_size dset = 0; dset < sbf->n_datasets && res == SBF_RESULT_SUCCESS; dset++) {
+        if (data[dset] == NULL)
+            continue;
+        res = sbf_pwrite(sbf, data[dset], sbf_datatype_size(sbf->datasets[dset]) *
+                         sbf_num_blocks(sbf->datasets[dset]), start + sbf->data_offsets[dset]);
+    }
+    if (res != SBF_RESULT_SUCCESS)
+        goto cleanup;
+#endif
+    sbf->frame_offsets[sbf->n_frames++] = start;
+
+cleanup:
+#ifdef SBF_CHECKPOINT_POSIX
+    free(iov);
+    free(padding);
+#endif
+    return res;
+}
+
+/*
+ * Write the frame index after the last frame appended with
+ * sbf_append_frame, making all of them visible to readers.
+ */
+sbf_result sbf_write_frame_index(const sbf_File *sbf) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    if (sbf->n_frames == 0)
+        return SBF_RESULT_WRITE_FAILURE;
+    sbf_FrameTrailer trailer = sbf_frame_trailer(sbf->n_frames);
+    const sbf_size index_size = sbf->n_frames * sizeof(sbf_size);
+    sbf_byte *footer = (sbf_byte *)malloc(index_size + sizeof(trailer));
+    FAIL_IF_NULL(footer);
+    memcpy(footer, sbf->frame_offsets, index_size);
+    sbf_frame_index_le(&trailer, (uint64_t *)footer, sbf->n_frames);
+    memcpy(footer + index_size, &trailer, sizeof(trailer));
+    sbf_result res = sbf_pwrite(sbf, footer, index_size + sizeof(trailer),
+                                sbf->frame_offsets[sbf->n_frames - 1] + sbf_frame_size(sbf));
+    free(footer);
+    return res;
+}
+
+/*
+ * Check the blob of dataset 'index', 'size' bytes as stored, against
+ * its checksum: from 'stored' if that holds it, otherwise by reading it
+ * back. Files without checksums, or read without 'verify', pass.
+ */
+sbf_result sbf_verify_blob(const sbf_File *sbf, sbf_size index, const void *stored,
+                           sbf_size size) {
+    if (!sbf->verify || sbf->crcs == NULL)
+        return SBF_RESULT_SUCCESS;
+    uint32_t crc = 0;
+    if (stored != NULL) {
+        crc = sbf_crc32c(0, stored, size);
+    } else {
+        sbf_result res = sbf_checksum_range(sbf, sbf_data_offset(sbf, index), size, &crc);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+    }
+    if (crc != sbf->crcs[index]) {
+        SBF_PERROR("Dataset '%s' in '%s' fails its checksum\n", sbf->datasets[index].name,
+                   sbf->filename);
+        return SBF_RESULT_CHECKSUM_FAILURE;
+    }
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Check dataset 'index' in 'sbf' against the checksums the file ends
+ * with (see sbf_integrity.h), without decoding it. They are read by
+ * sbf_read_headers if 'verify' is set, and datasets read in whole are
+ * checked as they are.
+ *
+ * Returns SBF_RESULT_CHECKSUM_FAILURE if the dataset is corrupt.
+ */
+sbf_result sbf_verify_dataset(const sbf_File *sbf, sbf_size index) {
+    FAIL_IF_NULL(sbf);
+    if (index >= sbf->n_datasets || sbf->headers_only)
+        return SBF_RESULT_READ_FAILURE;
+    sbf_size stored = 0;
+    sbf_result res = sbf_stored_size(sbf, sbf->datasets[index], sbf_data_offset(sbf, index),
+                                     &stored);
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    return sbf_verify_blob(sbf, index, NULL, stored);
+}
+
+/*
+ * Index of the dataset whose blob starts at byte 'offset' of the file,
+ * or n_datasets if none does
+ */
+sbf_size sbf_dataset_at_offset(const sbf_File *sbf, sbf_size offset) {
+    const sbf_size start = sbf_data_start(sbf);
+    sbf_size lo = 0, hi = sbf->n_datasets;
+    if (sbf->headers_only || offset < start)
+        return sbf->n_datasets;
+    while (lo < hi) {
+        sbf_size mid = lo + (hi - lo) / 2;
+        if (sbf->data_offsets[mid] < offset - start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < sbf->n_datasets && sbf->data_offsets[lo] == offset - start) ? lo
+                                                                           : sbf->n_datasets;
+}
+
+/*
+ * Read the contents of a dataset in the file pointed to by 'sbf'
+ * Expects 'data' to be an array already allocated of the correct size.
+ * Data written on a machine of the other byte order is swapped to
+ * this machine's, as it is by all the other read functions.
+ */
+sbf_result sbf_read_dataset(sbf_File *sbf, const sbf_DataHeader header,
+                            void *data) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    FAIL_IF_NULL(data);
+
+    sbf_size num_blocks = sbf_num_blocks(header);
+    sbf_size datatype_size = sbf_datatype_size(header);
+
+    if (SBF_CHECK_COMPRESSED_FLAG(header)) {
+        int64_t offset = sbf_align_position(sbf);
+        if (offset < 0)
+            return SBF_RESULT_READ_FAILURE;
+        // a compressed blob can only be decoded from its start
+        const sbf_size index = sbf_dataset_at_offset(sbf, (sbf_size)offset);
+        if (index >= sbf->n_datasets)
+            return SBF_RESULT_READ_FAILURE;
+        sbf_size stored = 0;
+        sbf_result res = sbf_stored_size(sbf, header, (sbf_size)offset, &stored);
+        if (res == SBF_RESULT_SUCCESS && sbf->crcs != NULL)
+            res = sbf_verify_blob(sbf, index, NULL, stored);
+        if (res == SBF_RESULT_SUCCESS)
+            res = sbf_read_compressed(sbf, header, (sbf_size)offset, data);
+        if (res == SBF_RESULT_SUCCESS &&
+            sbf_fseek(sbf->fp, offset + (int64_t)stored, SEEK_SET) != 0)
+            res = SBF_RESULT_READ_FAILURE;
+        return res;
+    }
+
+    int64_t offset = sbf_align_position(sbf);
+    if (offset < 0)
+        return SBF_RESULT_READ_FAILURE;
+    const sbf_size index = sbf_dataset_at_offset(sbf, (sbf_size)offset);
+    if (sbf->direct_fd >= 0) {
+        sbf_size size = datatype_size * num_blocks;
+        sbf_result res = sbf_pread(sbf, data, size, (sbf_size)offset);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+        if (sbf_fseek(sbf->fp, offset + (int64_t)size, SEEK_SET) != 0)
+            return SBF_RESULT_READ_FAILURE;
+    } else {
+        SBF_READ_RAW(data, datatype_size, num_blocks, sbf->fp);
+    }
+    if (index < sbf->n_datasets) {
+        sbf_result res = sbf_verify_blob(sbf, index, data, datatype_size * num_blocks);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+    }
+    sbf_to_host_order(header, data, datatype_size * num_blocks);
+
+    return SBF_RESULT_SUCCESS;
+}
+
+const char *sbf_dataset_name(const void *sbf, uint32_t index) {
+    return ((const sbf_File *)sbf)->datasets[index].name;
+}
+
+/*
+ * Index of the dataset called 'name' in 'sbf', or -1 if there is none.
+ * Uses the name index, so only datasets whose name hashes the same
+ * are compared against 'name'.
+ */
+int_fast32_t sbf_dataset_index(const sbf_File *sbf, const char *name) {
+    if (sbf == NULL || name == NULL)
+        return -1;
+    return (int_fast32_t)sbf_name_index_find(sbf->name_index, sbf->n_slots, name,
+                                             SBF_NAME_LENGTH, sbf_dataset_name, sbf);
+}
+
+/*
+ * Read dataset 'index' of frame 'frame' in a multi-frame file (see
+ * sbf_frames.h) into 'data'. See sbf_read_dataset_at.
+ */
+sbf_result sbf_read_frame_dataset(const sbf_File *sbf, sbf_size frame, sbf_size index,
+                                  void *data) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(data);
+    if (index >= sbf->n_datasets || sbf->headers_only)
+        return SBF_RESULT_READ_FAILURE;
+    if (frame >= sbf->n_frames && frame > 0)
+        return SBF_RESULT_READ_FAILURE;
+
+    const sbf_DataHeader header = sbf->datasets[index];
+    const sbf_size offset = sbf_frame_offset(sbf, frame, index);
+    sbf_result res = SBF_RESULT_SUCCESS;
+    if (SBF_CHECK_COMPRESSED_FLAG(header)) {
+        if (sbf->crcs != NULL)
+            res = sbf_verify_dataset(sbf, index);
+        return (res == SBF_RESULT_SUCCESS) ? sbf_read_compressed(sbf, header, offset, data) : res;
+    }
+    const sbf_size size = sbf_datatype_size(header) * sbf_num_blocks(header);
+    res = sbf_pread(sbf, data, size, offset);
+    if (res == SBF_RESULT_SUCCESS)
+        res = sbf_verify_blob(sbf, index, data, size);
+    if (res == SBF_RESULT_SUCCESS)
+        sbf_to_host_order(header, data, size);
+    return res;
+}
+
+/*
+ * Read the contents of dataset 'index' in the file pointed to by 'sbf',
+ * seeking directly to it rather than reading from the current position,
+ * so datasets may be read in any order (and from multiple threads).
+ * Expects 'data' to be an array already allocated of the correct size.
+ */
+sbf_result sbf_read_dataset_at(const sbf_File *sbf, sbf_size index, void *data) {
+    return sbf_read_frame_dataset(sbf, 0, index, data);
+}
+
+/*
+ * Read the contents of the dataset called 'name' in the file
+ * pointed to by 'sbf'. See sbf_read_dataset_at.
+ */
+sbf_result sbf_read_dataset_by_name(const sbf_File *sbf, const char *name, void *data) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(name);
+    int_fast32_t index = sbf_dataset_index(sbf, name);
+    if (index < 0) {
+        SBF_PERROR("No dataset named '%s' in '%s'\n", name, sbf->filename);
+        return SBF_RESULT_READ_FAILURE;
+    }
+    return sbf_read_dataset_at(sbf, index, data);
+}
+
+/*
+ * Read a hyperslab (N-dimensional sub-block) of dataset 'index' in 'sbf'.
+ *
+ * 'start', 'count' and 'stride' give, per dimension of the dataset, the
+ * first index, number of elements and step between elements to read.
+ * 'stride' may be NULL, in which case it is taken to be 1 everywhere.
+ *
+ * 'data' must hold the product of 'count' elements, and is filled in the
+ * same storage order (row or column major) as the dataset.
+ * Contiguous runs of elements are coalesced into single reads, so only
+ * the bytes required are read from the file.
+ */
+sbf_result sbf_read_hyperslab(const sbf_File *sbf, sbf_size index,
+                              const sbf_size start[SBF_MAX_DIM],
+                              const sbf_size count[SBF_MAX_DIM],
+                              const sbf_size stride[SBF_MAX_DIM], void *data) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    FAIL_IF_NULL(start);
+    FAIL_IF_NULL(count);
+    FAIL_IF_NULL(data);
+    if (index >= sbf->n_datasets || sbf->headers_only)
+        return SBF_RESULT_READ_FAILURE;
+
+    const sbf_DataHeader header = sbf->datasets[index];
+    if (SBF_CHECK_COMPRESSED_FLAG(header)) {
+        SBF_PERROR("Hyperslabs of compressed dataset '%s' are unsupported\n", header.name);
+        return SBF_RESULT_READ_FAILURE;
+    }
+    const int_fast32_t dims = SBF_GET_DIMENSIONS(header);
+    const bool column_major = SBF_CHECK_COLUMN_MAJOR_FLAG(header);
+    const sbf_size datatype_size = sbf_datatype_size(header);
+
+    // put everything in storage order, slowest varying dimension first
+    sbf_size shp[SBF_MAX_DIM], st[SBF_MAX_DIM], cnt[SBF_MAX_DIM], str[SBF_MAX_DIM];
+    sbf_size elem_stride[SBF_MAX_DIM], idx[SBF_MAX_DIM] = {0};
+    for (int_fast32_t i = 0; i < dims; i++) {
+        int_fast32_t d = column_major ? dims - 1 - i : i;
+        shp[i] = header.shape[d];
+        st[i] = start[d];
+        cnt[i] = count[d];
+        str[i] = (stride == NULL) ? 1 : stride[d];
+        if (cnt[i] == 0 || str[i] == 0 || st[i] + (cnt[i] - 1) * str[i] >= shp[i]) {
+            SBF_PERROR("Hyperslab out of bounds in dimension %d of '%s'\n",
+                       (int)d, header.name);
+            return SBF_RESULT_READ_FAILURE;
+        }
+    }
+    for (int_fast32_t i = dims - 1; i >= 0; i--)
+        elem_stride[i] = (i == dims - 1) ? 1 : elem_stride[i + 1] * shp[i + 1];
+
+    // find the longest contiguous run of elements from the fastest dimension
+    // inward; dimensions [0, outer) are iterated over, the rest are one read
+    sbf_size run = 1;
+    int_fast32_t outer = dims;
+    while (outer > 0 && str[outer - 1] == 1) {
+        outer--;
+        run *= cnt[outer];
+        if (cnt[outer] != shp[outer])
+            break;
+    }
+
+    sbf_size base = sbf_data_offset(sbf, index);
+    for (int_fast32_t i = outer; i < dims; i++)
+        base += st[i] * elem_stride[i] * datatype_size;
+
+    sbf_byte *dest = (sbf_byte *)data;
+    const sbf_size run_bytes = run * datatype_size;
+    while (true) {
+        sbf_size offset = base;
+        for (int_fast32_t i = 0; i < outer; i++)
+            offset += (st[i] + idx[i] * str[i]) * elem_stride[i] * datatype_size;
+        sbf_result res = sbf_pread(sbf, dest, run_bytes, offset);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+        sbf_to_host_order(header, dest, run_bytes);
+        dest += run_bytes;
+
+        // advance the index over the outer dimensions
+        int_fast32_t i = outer - 1;
+        for (; i >= 0; i--) {
+            if (++idx[i] < cnt[i])
+                break;
+            idx[i] = 0;
+        }
+        if (i < 0)
+            break;
+    }
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Make sure the first 'size' bytes of the file pointed to by 'sbf' are in
+ * '*buffer', which holds '*length' of them, growing it and reading the
+ * rest. At least SBF_HEADER_READ_SIZE bytes (or the whole file if it is
+ * smaller) are read, so the headers of most files take a single read.
+ */
+sbf_result sbf_read_prefix(const sbf_File *sbf, sbf_byte **buffer, sbf_size *length,
+                           sbf_size size, sbf_size file_size) {
+    if (size <= *length)
+        return SBF_RESULT_SUCCESS;
+    if (size > file_size)
+        return SBF_RESULT_READ_FAILURE;
+    if (size < SBF_HEADER_READ_SIZE)
+        size = (file_size < SBF_HEADER_READ_SIZE) ? file_size : SBF_HEADER_READ_SIZE;
+    sbf_byte *grown = (sbf_byte *)realloc(*buffer, size);
+    FAIL_IF_NULL(grown);
+    *buffer = grown;
+    sbf_result res = sbf_pread(sbf, grown + *length, size - *length, *length);
+    if (res == SBF_RESULT_SUCCESS)
+        *length = size;
+    return res;
+}
+
+/*
+ * Size in bytes of the file pointed to by 'sbf', into 'size'
+ */
+sbf_result sbf_file_size(const sbf_File *sbf, sbf_size *size) {
+    FAIL_IF_NULL(size);
+#ifdef SBF_POSIX
+    struct stat st;
+    if (fstat(fileno(sbf->fp), &st) != 0)
+        return SBF_RESULT_READ_FAILURE;
+    *size = (sbf_size)st.st_size;
+#else
+    const int64_t position = sbf_ftell(sbf->fp);
+    if (position < 0 || sbf_fseek(sbf->fp, 0, SEEK_END) != 0)
+        return SBF_RESULT_READ_FAILURE;
+    const int64_t end = sbf_ftell(sbf->fp);
+    if (end < 0 || sbf_fseek(sbf->fp, position, SEEK_SET) != 0)
+        return SBF_RESULT_READ_FAILURE;
+    *size = (sbf_size)end;
+#endif
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Read the frame index of 'sbf', if it is a multi-frame file (see
+ * sbf_frames.h). The index ends the file, so it is only looked for in
+ * files longer than one frame of uncompressed datasets.
+ */
+sbf_result sbf_read_frame_index(sbf_File *sbf) {
+    FAIL_IF_NULL(sbf);
+    sbf->n_frames = 0;
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        if (SBF_CHECK_COMPRESSED_FLAG(sbf->datasets[dset]))
+            return SBF_RESULT_SUCCESS;
+    }
+    sbf_size file_size = 0;
+    if (sbf_file_size(sbf, &file_size) != SBF_RESULT_SUCCESS)
+        return SBF_RESULT_READ_FAILURE;
+    const sbf_size data_start = sbf_data_start(sbf);
+    const sbf_size frame_size = sbf_frame_size(sbf);
+    sbf_FrameTrailer trailer;
+    if (frame_size == 0 || file_size < data_start + frame_size + sizeof(trailer))
+        return SBF_RESULT_SUCCESS;
+    sbf_result res = sbf_pread(sbf, &trailer, sizeof(trailer), file_size - sizeof(trailer));
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    sbf_frame_index_le(&trailer, NULL, 0);
+    const sbf_size index_start = sbf_frame_index_start(&trailer, file_size, data_start, frame_size);
+    if (index_start == 0)
+        return SBF_RESULT_SUCCESS;
+
+    if ((res = sbf_reserve_frames(sbf, trailer.n_frames)) != SBF_RESULT_SUCCESS ||
+        (res = sbf_pread(sbf, sbf->frame_offsets, trailer.n_frames * sizeof(sbf_size),
+                         index_start)) != SBF_RESULT_SUCCESS)
+        return res;
+    sbf_frame_index_le(NULL, sbf->frame_offsets, trailer.n_frames);
+    if (!sbf_frame_index_valid(sbf->frame_offsets, trailer.n_frames, data_start, frame_size,
+                               index_start, sbf->alignment)) {
+        SBF_PERROR("File '%s' has a corrupt frame index\n", sbf->filename);
+        return SBF_RESULT_READ_FAILURE;
+    }
+    sbf->n_frames = trailer.n_frames;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Read the checksums ending the file pointed to by 'sbf' (see
+ * sbf_integrity.h), if it has them, whose last blob ends at 'data_end'
+ */
+sbf_result sbf_read_checksums(sbf_File *sbf, sbf_size file_size, sbf_size data_end) {
+    FAIL_IF_NULL(sbf);
+    free(sbf->crcs);
+    sbf->crcs = NULL;
+    sbf_ChecksumTrailer trailer;
+    if (file_size < data_end + sizeof(trailer))
+        return SBF_RESULT_SUCCESS;
+    sbf_result res = sbf_pread(sbf, &trailer, sizeof(trailer), file_size - sizeof(trailer));
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    sbf_checksums_le(&trailer, NULL, 0);
+    const sbf_size table_start =
+        sbf_checksum_table_start(&trailer, file_size, data_end, sbf->n_datasets);
+    if (table_start == 0)
+        return SBF_RESULT_SUCCESS;
+
+    uint32_t *crcs = (uint32_t *)malloc((sbf->n_datasets + 1) * sizeof(uint32_t));
+    FAIL_IF_NULL(crcs);
+    res = sbf_pread(sbf, crcs, sbf->n_datasets * sizeof(uint32_t), table_start);
+    if (res == SBF_RESULT_SUCCESS &&
+        sbf_crc32c(0, crcs, sbf->n_datasets * sizeof(uint32_t)) != trailer.table_crc) {
+        SBF_PERROR("File '%s' has corrupt checksums\n", sbf->filename);
+        res = SBF_RESULT_CHECKSUM_FAILURE;
+    }
+    if (res != SBF_RESULT_SUCCESS) {
+        free(crcs);
+        return res;
+    }
+    sbf_checksums_le(NULL, crcs, sbf->n_datasets);
+    sbf->crcs = crcs;
+    sbf->headers_crc = trailer.headers_crc;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Find where the data of each dataset in 'sbf' starts, which for
+ * compressed datasets means reading their chunk indexes, along with the
+ * frames of a multi-frame file, and clear 'headers_only'. Called by
+ * sbf_read_headers unless 'headers_only' is set.
+ *
+ * Files too short to hold all of their blobs, e.g. left by a writer
+ * that was killed, are rejected. With 'verify' set the checksums of
+ * the blobs are read too, if the file has them.
+ */
+sbf_result sbf_locate_datasets(sbf_File *sbf) {
+    FAIL_IF_NULL(sbf);
+    sbf_size offset = 0, data_end = sbf_headers_size(sbf), file_size = 0;
+    const sbf_size data_start = sbf_data_start(sbf);
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        sbf->data_offsets[dset] = offset;
+        sbf_size stored = 0;
+        sbf_result res = sbf_stored_size(sbf, sbf->datasets[dset], data_start + offset, &stored);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+        data_end = data_start + offset + stored;
+        offset += sbf_align_up(stored, sbf->alignment);
+    }
+    if (sbf_file_size(sbf, &file_size) != SBF_RESULT_SUCCESS)
+        return SBF_RESULT_READ_FAILURE;
+    if (file_size < data_end) {
+        SBF_PERROR("File '%s' is truncated, %"PRIu64" of %"PRIu64" bytes\n",
+                   sbf->filename, file_size, data_end);
+        return SBF_RESULT_READ_FAILURE;
+    }
+    sbf->headers_only = false;
+    sbf_result res = sbf_read_frame_index(sbf);
+    if (res == SBF_RESULT_SUCCESS && sbf->verify && sbf->n_frames == 0)
+        res = sbf_read_checksums(sbf, file_size, data_end);
+    return res;
+}
+
+/*
+ * Read the contents of the headers in the file pointed to by 'sbf'
+ * Sets the relevant information into 'sbf'
+ *
+ * The headers are read into one buffer (see sbf_read_prefix) and parsed
+ * from memory, leaving the file positioned at the first dataset.
+ * If 'headers_only' is set on 'sbf' no data is read: datasets may then
+ * only be read in order with sbf_read_dataset until sbf_locate_datasets.
+ * Otherwise, with 'verify' set, the headers are checked against the
+ * checksums of a file which has them.
+ */
+sbf_result sbf_read_headers(sbf_File *sbf) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+
+    sbf_result res = SBF_RESULT_SUCCESS;
+    sbf_FileHeader header =
+        sbf_new_file_header; // this gives us token/version at the beginning
+    sbf_byte *buffer = NULL;
+    sbf_size length = 0, offset = 0;
+
+    // don't trust a count the file can't possibly hold
+    sbf_size file_size = 0;
+    if (sbf_file_size(sbf, &file_size) != SBF_RESULT_SUCCESS ||
+        sbf_fseek(sbf->fp, 0, SEEK_SET) != 0)
+        return SBF_RESULT_READ_FAILURE;
+
+    res = sbf_read_prefix(sbf, &buffer, &length, sizeof(header.token) +
+                          sizeof(header.version_string), file_size);
+    if (res != SBF_RESULT_SUCCESS)
+        goto cleanup;
+    memcpy(header.token, buffer, sizeof(header.token));
+    memcpy(header.version_string, buffer + sizeof(header.token), sizeof(header.version_string));
+    if( (res = sbf_valid_header(&header)) != SBF_RESULT_SUCCESS) {
+        fprintf(stderr, "File '%s' is %s\n", sbf->filename,
+                (res == SBF_RESULT_INCOMPATIBLE_VERSION) ? "an incompatible SBF version" : "not a valid SBF file.");
+        goto cleanup;
+    }
+    memcpy(sbf->version_string, header.version_string, sizeof(sbf->version_string));
+    offset = sbf_file_header_size(header.version_string);
+    res = sbf_read_prefix(sbf, &buffer, &length, offset, file_size);
+    if (res != SBF_RESULT_SUCCESS)
+        goto cleanup;
+    // every integer of the headers is little endian, see sbf_pack_headers
+    if (strncmp(header.version_string, SBF_WIDE_COUNT_VERSION_STRING, 3) >= 0) {
+        memcpy(&header.n_datasets, buffer + 6, sizeof(header.n_datasets));
+        header.n_datasets = sbf_le64(header.n_datasets);
+    } else {
+        header.n_datasets = buffer[offset - 1];
+    }
+    if (offset == SBF_FILE_HEADER_SIZE) {
+        memcpy(&header.alignment, buffer + offset - sizeof(header.alignment),
+               sizeof(header.alignment));
+        header.alignment = sbf_le64(header.alignment);
+    }
+    if (!sbf_valid_alignment(header.alignment)) {
+        SBF_PERROR("File '%s' has an invalid alignment %"PRIu64"\n",
+                   sbf->filename, header.alignment);
+        res = SBF_RESULT_READ_FAILURE;
+        goto cleanup;
+    }
+    sbf->alignment = header.alignment;
+
+    if (header.n_datasets > (file_size - offset) / sizeof(sbf_DataHeader)) {
+        SBF_PERROR("File '%s' is too short for its %"PRIu64" datasets\n",
+                   sbf->filename, header.n_datasets);
+        res = SBF_RESULT_READ_FAILURE;
+        goto cleanup;
+    }
+    if ((res = sbf_reserve_datasets(sbf, header.n_datasets)) != SBF_RESULT_SUCCESS)
+        goto cleanup;
+    sbf->n_datasets = header.n_datasets;
+
+    // the data headers, and the number of name index slots following them
+    const sbf_size headers_size = header.n_datasets * sizeof(sbf_DataHeader);
+    const bool has_name_index = sbf_has_name_index(sbf->version_string);
+    res = sbf_read_prefix(sbf, &buffer, &length, offset + headers_size +
+                          (has_name_index ? sizeof(sbf_size) : 0), file_size);
+    if (res != SBF_RESULT_SUCCESS)
+        goto cleanup;
+    if (headers_size > 0) {
+        memcpy(sbf->datasets, buffer + offset, headers_size);
+        sbf_data_headers_le((sbf_byte *)sbf->datasets, sbf->n_datasets);
+    }
+    offset += headers_size;
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        sbf->dataset_pointers[dset] = NULL;
+        sbf->codecs[dset] = SBF_CODEC_LZ;
+        sbf->filters[dset] = SBF_FILTER_SHUFFLE;
+    }
+
+    free(sbf->name_index);
+    sbf->name_index = NULL;
+    sbf->n_slots = 0;
+    if (has_name_index) {
+        sbf_size n_slots = 0;
+        memcpy(&n_slots, buffer + offset, sizeof(n_slots));
+        n_slots = sbf_le64(n_slots);
+        offset += sizeof(n_slots);
+        if (n_slots > (file_size - offset) / sizeof(sbf_NameSlot)) {
+            res = SBF_RESULT_READ_FAILURE;
+            goto cleanup;
+        }
+        res = sbf_read_prefix(sbf, &buffer, &length, offset + n_slots * sizeof(sbf_NameSlot),
+                              file_size);
+        if (res != SBF_RESULT_SUCCESS)
+            goto cleanup;
+        if (n_slots > 0) {
+            sbf->name_index = (sbf_NameSlot *)malloc(n_slots * sizeof(sbf_NameSlot));
+            if (sbf->name_index == NULL) {
+                res = SBF_RESULT_NULL_FAILURE;
+                goto cleanup;
+            }
+            memcpy(sbf->name_index, buffer + offset, n_slots * sizeof(sbf_NameSlot));
+            sbf_le_words(sbf->name_index, n_slots * sizeof(sbf_NameSlot), sizeof(uint32_t));
+        }
+        sbf->n_slots = n_slots;
+        if (!sbf_name_index_valid(sbf->name_index, n_slots, sbf->n_datasets)) {
+            SBF_PERROR("File '%s' has a corrupt dataset name index\n", sbf->filename);
+            res = SBF_RESULT_READ_FAILURE;
+            goto cleanup;
+        }
+    } else {
+        // older files have no index, so build it
+        if ((res = sbf_reserve_name_index(sbf, sbf->n_datasets)) != SBF_RESULT_SUCCESS)
+            goto cleanup;
+        for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+            sbf_name_index_insert(sbf->name_index, sbf->n_slots,
+                                  sbf_name_hash(sbf->datasets[dset].name, SBF_NAME_LENGTH),
+                                  (uint32_t)dset);
+        }
+    }
+
+    // leave the file at the first dataset, for sbf_read_dataset
+    if (sbf_fseek(sbf->fp, (int64_t)sbf_data_start(sbf), SEEK_SET) != 0) {
+        res = SBF_RESULT_READ_FAILURE;
+        goto cleanup;
+    }
+    if (!sbf->headers_only)
+        res = sbf_locate_datasets(sbf);
+    if (res == SBF_RESULT_SUCCESS && sbf->crcs != NULL &&
+        sbf_crc32c(0, buffer, sbf_headers_size(sbf)) != sbf->headers_crc) {
+        SBF_PERROR("File '%s' has corrupt headers\n", sbf->filename);
+        res = SBF_RESULT_CHECKSUM_FAILURE;
+    }
+
+cleanup:
+    free(buffer);
+    return res;
+}
+
+/*
+ * Shared state for the workers in sbf_parallel_io. Every dataset is split
+ * into ranges of at most SBF_PARALLEL_CHUNK_SIZE bytes (or its chunks,
+ * if compressed), and workers take the next range until none are left.
+ */
+typedef struct {
+    const sbf_File *sbf;
+    void *const *pointers;
+    bool write;
+    sbf_size *first_task; // index of the first range of each dataset
+    sbf_ChunkIndexHeader *indices; // chunk indices of compressed datasets,
+    sbf_size **chunk_offsets;      // whose ranges are their chunks
+    sbf_size n_tasks;
+    sbf_size next_task;
+    sbf_result result;
+#ifdef SBF_POSIX
+    pthread_mutex_t lock;
+#endif
+} sbf_ParallelIO;
+
+sbf_result sbf_parallel_io_task(sbf_ParallelIO *io, sbf_size task) {
+    // binary search for the dataset this range belongs to
+    sbf_size lo = 0, hi = io->sbf->n_datasets;
+    while (hi - lo > 1) {
+        sbf_size mid = (lo + hi) / 2;
+        if (io->first_task[mid] <= task) lo = mid;
+        else hi = mid;
+    }
+    const sbf_DataHeader header = io->sbf->datasets[lo];
+    if (io->chunk_offsets[lo] != NULL) {
+        return sbf_read_chunk(io->sbf, header, sbf_data_offset(io->sbf, lo),
+                              &io->indices[lo], io->chunk_offsets[lo],
+                              task - io->first_task[lo], io->pointers[lo]);
+    }
+    sbf_size size = sbf_datatype_size(header) * sbf_num_blocks(header);
+    sbf_size start = (task - io->first_task[lo]) * SBF_PARALLEL_CHUNK_SIZE;
+    sbf_size length = size - start;
+    if (length > SBF_PARALLEL_CHUNK_SIZE)
+        length = SBF_PARALLEL_CHUNK_SIZE;
+    sbf_size offset = sbf_data_offset(io->sbf, lo) + start;
+    sbf_byte *data = (sbf_byte *)io->pointers[lo] + start;
+    if (io->write)
+        return sbf_pwrite(io->sbf, data, length, offset);
+    sbf_result res = sbf_pread(io->sbf, data, length, offset);
+    if (res == SBF_RESULT_SUCCESS)
+        sbf_to_host_order(header, data, length);
+    return res;
+}
+
+void *sbf_parallel_io_worker(void *arg) {
+    sbf_ParallelIO *io = (sbf_ParallelIO *)arg;
+    while (true) {
+#ifdef SBF_POSIX
+        pthread_mutex_lock(&io->lock);
+#endif
+        sbf_size task = io->next_task++;
+        bool done = (task >= io->n_tasks) || (io->result != SBF_RESULT_SUCCESS);
+#ifdef SBF_POSIX
+        pthread_mutex_unlock(&io->lock);
+#endif
+        if (done)
+            break;
+        sbf_result res = sbf_parallel_io_task(io, task);
+        if (res != SBF_RESULT_SUCCESS) {
+#ifdef SBF_POSIX
+            pthread_mutex_lock(&io->lock);
+            io->result = res;
+            pthread_mutex_unlock(&io->lock);
+#else
+            io->result = res;
+#endif
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read or write the blobs of all datasets in 'sbf' from/to 'pointers'
+ * concurrently using 'n_threads' threads (or one per online processor
+ * if n_threads < 1). Datasets with a NULL pointer are skipped.
+ */
+sbf_result sbf_parallel_io(const sbf_File *sbf, void *const *pointers, bool write,
+                           int n_threads) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    FAIL_IF_NULL(pointers);
+    if (sbf->headers_only)
+        return SBF_RESULT_READ_FAILURE;
+
+    sbf_ParallelIO io = {.sbf = sbf, .pointers = pointers, .write = write,
+                         .n_tasks = 0, .next_task = 0, .result = SBF_RESULT_SUCCESS};
+    io.first_task = malloc((sbf->n_datasets + 1) * sizeof(sbf_size));
+    io.indices = calloc(sbf->n_datasets + 1, sizeof(sbf_ChunkIndexHeader));
+    io.chunk_offsets = calloc(sbf->n_datasets + 1, sizeof(sbf_size *));
+    if (io.first_task == NULL || io.indices == NULL || io.chunk_offsets == NULL) {
+        io.result = SBF_RESULT_NULL_FAILURE;
+        goto cleanup;
+    }
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        io.first_task[dset] = io.n_tasks;
+        if (pointers[dset] == NULL)
+            continue;
+        if (SBF_CHECK_COMPRESSED_FLAG(sbf->datasets[dset])) {
+            if (write) {
+                SBF_PERROR("Can't write compressed dataset '%s' in parallel\n",
+                           sbf->datasets[dset].name);
+                io.result = SBF_RESULT_WRITE_FAILURE;
+                goto cleanup;
+            }
+            io.result = sbf_read_chunk_index(sbf, sbf_data_offset(sbf, dset),
+                                             &io.indices[dset], &io.chunk_offsets[dset]);
+            if (io.result != SBF_RESULT_SUCCESS)
+                goto cleanup;
+            io.n_tasks += io.indices[dset].n_chunks;
+            continue;
+        }
+        sbf_size size = sbf_datatype_size(sbf->datasets[dset]) *
+                        sbf_num_blocks(sbf->datasets[dset]);
+        io.n_tasks += (size + SBF_PARALLEL_CHUNK_SIZE - 1) / SBF_PARALLEL_CHUNK_SIZE;
+    }
+    io.first_task[sbf->n_datasets] = io.n_tasks;
+
+#ifdef SBF_POSIX
+    if (n_threads < 1)
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ((sbf_size)n_threads > io.n_tasks)
+        n_threads = (int)io.n_tasks;
+    pthread_mutex_init(&io.lock, NULL);
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    int started = 0;
+    if (threads != NULL) {
+        for (; started < n_threads - 1; started++) {
+            if (pthread_create(&threads[started], NULL, sbf_parallel_io_worker, &io) != 0)
+                break;
+        }
+    }
+    // the calling thread takes part too, and picks up everything
+    // if no threads could be started
+    sbf_parallel_io_worker(&io);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&io.lock);
+#else
+    sbf_parallel_io_worker(&io);
+#endif
+
+cleanup:
+    for (sbf_size dset = 0; io.chunk_offsets != NULL && dset < sbf->n_datasets; dset++)
+        free(io.chunk_offsets[dset]);
+    free(io.chunk_offsets);
+    free(io.indices);
+    free(io.first_task);
+    return io.result;
+}
+
+/*
+ * Write the contents of 'sbf' like sbf_write, but write the
+ * dataset blobs concurrently with 'n_threads' threads.
+ * With 'checksums' set the checksum trailer is written once
+ * all of the blobs are.
+ */
+sbf_result sbf_write_parallel(const sbf_File *sbf, int n_threads) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+
+    uint32_t *crcs = NULL;
+    if (sbf->checksums) {
+        crcs = (uint32_t *)malloc((sbf->n_datasets + 1) * sizeof(uint32_t));
+        FAIL_IF_NULL(crcs);
+    }
+    for (sbf_size dset = 0; crcs != NULL && dset < sbf->n_datasets; dset++) {
+        if (sbf->dataset_pointers[dset] == NULL) {
+            SBF_PERROR("Dataset '%s' has no data to checksum\n", sbf->datasets[dset].name);
+            free(crcs);
+            return SBF_RESULT_NULL_FAILURE;
+        }
+    }
+    sbf_result res = sbf_write_headers(sbf);
+    if (res != SBF_RESULT_SUCCESS)
+        goto cleanup;
+    if (fflush(sbf->fp) != 0) {
+        res = SBF_RESULT_WRITE_FAILURE;
+        goto cleanup;
+    }
+    res = sbf_parallel_io(sbf, sbf->dataset_pointers, true, n_threads);
+    if (res != SBF_RESULT_SUCCESS || crcs == NULL)
+        goto cleanup;
+
+    // the blobs went straight to the descriptor, so the trailer
+    // is appended after the last of them
+    sbf_size end = sbf_data_start(sbf);
+    for (sbf_size dset = 0; dset < sbf->n_datasets; dset++) {
+        const sbf_size size = sbf_datatype_size(sbf->datasets[dset]) *
+                              sbf_num_blocks(sbf->datasets[dset]);
+        crcs[dset] = sbf_crc32c(0, sbf->dataset_pointers[dset], size);
+        end = sbf_data_offset(sbf, dset) + size;
+    }
+    if (sbf_fseek(sbf->fp, (int64_t)end, SEEK_SET) != 0) {
+        res = SBF_RESULT_WRITE_FAILURE;
+        goto cleanup;
+    }
+    res = sbf_write_checksums(sbf, crcs);
+
+cleanup:
+    free(crcs);
+    return res;
+}
+
+/*
+ * Read every dataset in 'sbf' into the corresponding (pre-allocated)
+ * entry of 'data' concurrently with 'n_threads' threads.
+ * Datasets whose entry in 'data' is NULL are not read.
+ */
+sbf_result sbf_read_parallel(const sbf_File *sbf, void *const *data, int n_threads) {
+    return sbf_parallel_io(sbf, data, false, n_threads);
+}
+
+/*
+ * Bytes of an arena (see sbf_arena.h) needed to hold every dataset
+ * in 'sbf', as read by sbf_read_datasets_into
+ */
+sbf_size sbf_datasets_arena_size(const sbf_File *sbf) {
+    sbf_size total = 0;
+    for (sbf_size i = 0; i < sbf->n_datasets; i++) {
+        const sbf_DataHeader header = sbf->datasets[i];
+        total += sbf_arena_padded(sbf_datatype_size(header) * sbf_num_blocks(header));
+    }
+    return total;
+}
+
+/*
+ * Read every dataset in 'sbf' into one allocation from 'arena', sized
+ * from the headers, setting each entry of 'data' to the dataset of the
+ * same index. The arena is reserved first, releasing whatever it held,
+ * so reusing one arena for file after file only allocates when a file
+ * needs more memory than any before it. The data is valid until then.
+ */
+sbf_result sbf_read_datasets_into(const sbf_File *sbf, sbf_Arena *arena, void **data) {
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(arena);
+    FAIL_IF_NULL(data);
+    if (sbf_arena_reserve(arena, sbf_datasets_arena_size(sbf)) != 0) {
+        SBF_PERROR("Failed to allocate the datasets of '%s'\n", sbf->filename);
+        return SBF_RESULT_NULL_FAILURE;
+    }
+    for (sbf_size i = 0; i < sbf->n_datasets; i++) {
+        const sbf_DataHeader header = sbf->datasets[i];
+        data[i] = sbf_arena_alloc(arena, sbf_datatype_size(header) * sbf_num_blocks(header));
+        sbf_result res = sbf_read_dataset_at(sbf, i, data[i]);
+        if (res != SBF_RESULT_SUCCESS)
+            return res;
+    }
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Writes files holding the same datasets over and over, e.g. a
+ * checkpoint every N timesteps, see sbf_checkpoint.h. The headers and
+ * offsets are worked out once by sbf_checkpoint_init, and everything
+ * each write needs is allocated up front.
+ */
+typedef struct {
+    sbf_size n_datasets;
+    sbf_byte *headers;     // packed headers, padded to the first blob
+    sbf_size headers_size; // i.e. sbf_data_start
+    sbf_size *offsets;     // of each blob in the file
+    sbf_size *sizes;       // of each blob
+    const void **data;     // to write for each dataset, or NULL
+    sbf_size file_size;
+    sbf_byte *padding;     // zeros, to fill the gaps between aligned blobs
+#ifdef SBF_CHECKPOINT_POSIX
+    struct iovec *iov;     // room for every blob and gap
+#endif
+} sbf_Checkpoint;
+
+/*
+ * Release everything allocated by sbf_checkpoint_init
+ */
+void sbf_checkpoint_free(sbf_Checkpoint *cp) {
+    if (cp == NULL)
+        return;
+    free(cp->headers);
+    free(cp->offsets);
+    free(cp->sizes);
+    free((void *)cp->data);
+    free(cp->padding);
+#ifdef SBF_CHECKPOINT_POSIX
+    free(cp->iov);
+#endif
+    memset(cp, 0, sizeof(*cp));
+}
+
+/*
+ * Lay out a checkpoint of the datasets declared or added to 'layout',
+ * which need not be open. The data pointers given to sbf_add_dataset
+ * are written each time (so arrays updated in place need no further
+ * calls), and may be changed with sbf_checkpoint_set_data.
+ * Compressed datasets vary in size, so can't be checkpointed.
+ *
+ * Release the checkpoint with sbf_checkpoint_free.
+ */
+sbf_result sbf_checkpoint_init(sbf_Checkpoint *cp, const sbf_File *layout) {
+    FAIL_IF_NULL(cp);
+    FAIL_IF_NULL(layout);
+    memset(cp, 0, sizeof(*cp));
+    for (sbf_size dset = 0; dset < layout->n_datasets; dset++) {
+        if (SBF_CHECK_COMPRESSED_FLAG(layout->datasets[dset])) {
+            SBF_PERROR("Can't checkpoint compressed dataset '%s'\n",
+                       layout->datasets[dset].name);
+            return SBF_RESULT_WRITE_FAILURE;
+        }
+    }
+
+    const sbf_size n = layout->n_datasets;
+    cp->n_datasets = n;
+    cp->headers_size = sbf_data_start(layout);
+    cp->headers = (sbf_byte *)calloc(cp->headers_size, 1);
+    cp->offsets = (sbf_size *)malloc((n + 1) * sizeof(sbf_size));
+    cp->sizes = (sbf_size *)malloc((n + 1) * sizeof(sbf_size));
+    cp->data = (const void **)calloc(n + 1, sizeof(void *));
+    cp->padding = (sbf_byte *)calloc(layout->alignment, 1);
+#ifdef SBF_CHECKPOINT_POSIX
+    cp->iov = (struct iovec *)malloc((2 * n + 1) * sizeof(struct iovec));
+    if (cp->iov == NULL)
+        goto fail;
+#endif
+    if (cp->headers == NULL || cp->offsets == NULL || cp->sizes == NULL ||
+        cp->data == NULL || cp->padding == NULL)
+        goto fail;
+
+    sbf_pack_headers(layout, cp->headers);
+    cp->file_size = cp->headers_size;
+    for (sbf_size dset = 0; dset < n; dset++) {
+        cp->offsets[dset] = sbf_data_offset(layout, dset);
+        cp->sizes[dset] = sbf_datatype_size(layout->datasets[dset]) *
+                          sbf_num_blocks(layout->datasets[dset]);
+        cp->data[dset] = layout->dataset_pointers[dset];
+        cp->file_size = cp->offsets[dset] + cp->sizes[dset];
+    }
+    return SBF_RESULT_SUCCESS;
+
+fail:
+    sbf_checkpoint_free(cp);
+    return SBF_RESULT_NULL_FAILURE;
+}
+
+/*
+ * Write dataset 'index' from 'data' in the checkpoints that follow.
+ * With NULL it is left unwritten: a hole in new files, and whatever
+ * the previous checkpoint held in a spare (see sbf_checkpoint_swap).
+ */
+sbf_result sbf_checkpoint_set_data(sbf_Checkpoint *cp, sbf_size index, const void *data) {
+    FAIL_IF_NULL(cp);
+    if (index >= cp->n_datasets)
+        return SBF_RESULT_WRITE_FAILURE;
+    cp->data[index] = data;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Write the checkpoint to 'filename'. Unless 'reuse', the file is
+ * truncated first; otherwise it is overwritten in place, keeping its
+ * blocks. On POSIX systems this takes one pwritev per run of datasets
+ * with data (so usually just one) between the open and close.
+ */
+sbf_result sbf_checkpoint_write_file(sbf_Checkpoint *cp, const char *filename, bool reuse) {
+    FAIL_IF_NULL(cp);
+    FAIL_IF_NULL(cp->headers);
+    FAIL_IF_NULL(filename);
+#ifdef SBF_CHECKPOINT_POSIX
+    int fd = open(filename, O_WRONLY | O_CREAT | (reuse ? 0 : O_TRUNC), 0666);
+    if (fd < 0) {
+        SBF_PERROR("Failed to open file '%s': %s.\n", filename, strerror(errno));
+        return SBF_RESULT_FILE_OPEN_FAILURE;
+    }
+    sbf_result res = SBF_RESULT_SUCCESS;
+    struct iovec *iov = cp->iov;
+    int n_iov = 1;
+    sbf_size start = 0, end = cp->headers_size;
+    iov[0] = (struct iovec){cp->headers, cp->headers_size};
+    for (sbf_size dset = 0; dset < cp->n_datasets; dset++) {
+        if (cp->data[dset] == NULL) {
+            // leave a hole, so write the run before it
+            if (n_iov > 0 && sbf_write_gather(fd, iov, n_iov, start) != 0)
+                res = SBF_RESULT_WRITE_FAILURE;
+            n_iov = 0;
+            continue;
+        }
+        if (n_iov == 0)
+            start = end = cp->offsets[dset];
+        if (cp->offsets[dset] > end)
+            iov[n_iov++] = (struct iovec){cp->padding, cp->offsets[dset] - end};
+        if (cp->sizes[dset] > 0)
+            iov[n_iov++] = (struct iovec){(void *)cp->data[dset], cp->sizes[dset]};
+        end = cp->offsets[dset] + cp->sizes[dset];
+    }
+    if (n_iov > 0 && sbf_write_gather(fd, iov, n_iov, start) != 0)
+        res = SBF_RESULT_WRITE_FAILURE;
+    if (res == SBF_RESULT_SUCCESS && (reuse || end != cp->file_size) &&
+        ftruncate(fd, (off_t)cp->file_size) != 0)
+        res = SBF_RESULT_WRITE_FAILURE;
+    if (close(fd) != 0 && res == SBF_RESULT_SUCCESS)
+        res = SBF_RESULT_FILE_CLOSE_FAILURE;
+    return res;
+#else
+    (void)reuse;
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        SBF_PERROR("Failed to open file '%s': %s.\n", filename, strerror(errno));
+        return SBF_RESULT_FILE_OPEN_FAILURE;
+    }
+    sbf_result res = SBF_RESULT_SUCCESS;
+    if (fwrite(cp->headers, 1, cp->headers_size, fp) != cp->headers_size)
+        res = SBF_RESULT_WRITE_FAILURE;
+    for (sbf_size dset = 0; res == SBF_RESULT_SUCCESS && dset < cp->n_datasets; dset++) {
+        if (cp->data[dset] == NULL)
+            continue;
+        if (sbf_fseek(fp, (int64_t)cp->offsets[dset], SEEK_SET) != 0 ||
+            fwrite(cp->data[dset], 1, cp->sizes[dset], fp) != cp->sizes[dset])
+            res = SBF_RESULT_WRITE_FAILURE;
+    }
+    if (fclose(fp) != 0 && res == SBF_RESULT_SUCCESS)
+        res = SBF_RESULT_FILE_CLOSE_FAILURE;
+    return res;
+#endif
+}
+
+/*
+ * Write a complete checkpoint to a new file 'filename', replacing any
+ * file of that name.
+ */
+sbf_result sbf_checkpoint_write(sbf_Checkpoint *cp, const char *filename) {
+    return sbf_checkpoint_write_file(cp, filename, false);
+}
+
+/*
+ * Double buffered checkpointing: write the checkpoint over the one
+ * held by 'spare', then atomically exchange it with 'filename', so
+ * that readers of 'filename' only ever see a complete checkpoint.
+ * 'spare' is left with the previous one, to be overwritten next time.
+ */
+sbf_result sbf_checkpoint_swap(sbf_Checkpoint *cp, const char *filename, const char *spare) {
+    FAIL_IF_NULL(filename);
+    sbf_result res = sbf_checkpoint_write_file(cp, spare, true);
+    if (res != SBF_RESULT_SUCCESS)
+        return res;
+    if (sbf_replace_file(spare, filename) != 0) {
+        SBF_PERROR("Failed to replace '%s' with '%s': %s.\n", filename, spare, strerror(errno));
+        return SBF_RESULT_WRITE_FAILURE;
+    }
+    return SBF_RESULT_SUCCESS;
+}
+
+#ifdef SBF_ASYNC_POSIX
+/*
+ * Prepare and submit 'request' to move the blob of dataset 'index' in 'sbf'
+ * through 'queue'. Whole blocks at aligned offsets go through the O_DIRECT
+ * descriptor if there is one, see sbf_open.
+ */
+sbf_result sbf_async_dataset_io(const sbf_File *sbf, sbf_IOQueue *queue, sbf_size index,
+                                void *data, bool write, sbf_IORequest *request) {
+    const sbf_result failure = write ? SBF_RESULT_WRITE_FAILURE : SBF_RESULT_READ_FAILURE;
+    FAIL_IF_NULL(sbf);
+    FAIL_IF_NULL(sbf->fp);
+    FAIL_IF_NULL(queue);
+    FAIL_IF_NULL(data);
+    FAIL_IF_NULL(request);
+    if (sbf->headers_only || index >= sbf->n_datasets)
+        return failure;
+    const sbf_DataHeader header = sbf->datasets[index];
+    if (SBF_CHECK_COMPRESSED_FLAG(header)) {
+        SBF_PERROR("Can't transfer compressed dataset '%s' asynchronously\n", header.name);
+        return failure;
+    }
+    // the headers (and anything else buffered) must reach the file first
+    if (write && fflush(sbf->fp) != 0)
+        return failure;
+
+    const sbf_size size = sbf_datatype_size(header) * sbf_num_blocks(header);
+    const sbf_size offset = sbf_data_offset(sbf, index);
+    int fd = fileno(sbf->fp);
+    if (sbf->direct_fd >= 0 && offset % SBF_DIRECT_ALIGNMENT == 0 &&
+        size % SBF_DIRECT_ALIGNMENT == 0 && (uintptr_t)data % SBF_DIRECT_ALIGNMENT == 0)
+        fd = sbf->direct_fd;
+    sbf_io_prepare(request, fd, data, size, offset, write,
+                   (write || sbf_is_native_endian(header)) ? 0 : sbf_swap_width(header));
+    return (sbf_io_queue_submit(queue, request) == 0) ? SBF_RESULT_SUCCESS : failure;
+}
+
+/*
+ * Start writing the blob of dataset 'index' in 'sbf' from 'data' through
+ * 'queue' (see sbf_async.h), returning as soon as it is submitted so the
+ * caller can carry on computing. The headers must already have been written,
+ * e.g. with sbf_write_headers. 'data' and 'request' must be left alone
+ * (and the file left open) until sbf_async_poll or sbf_async_wait says
+ * the write has finished. Compressed datasets can only be written with
+ * sbf_write.
+ */
+sbf_result sbf_async_write_dataset(const sbf_File *sbf, sbf_IOQueue *queue, sbf_size index,
+                                   const void *data, sbf_IORequest *request) {
+    return sbf_async_dataset_io(sbf, queue, index, (void *)data, true, request);
+}
+
+/*
+ * Start reading the blob of dataset 'index' in 'sbf' into 'data', which is
+ * swapped to this machine's byte order once read. See sbf_async_write_dataset.
+ */
+sbf_result sbf_async_read_dataset(const sbf_File *sbf, sbf_IOQueue *queue, sbf_size index,
+                                  void *data, sbf_IORequest *request) {
+    return sbf_async_dataset_io(sbf, queue, index, data, false, request);
+}
+
+/*
+ * Has 'request' finished (successfully or not)? Never blocks.
+ */
+bool sbf_async_poll(sbf_IOQueue *queue, sbf_IORequest *request) {
+    return sbf_io_queue_poll(queue, request) != SBF_IO_PENDING;
+}
+
+/*
+ * Wait for 'request' to finish, returning SBF_RESULT_SUCCESS if all of
+ * its data was transferred.
+ */
+sbf_result sbf_async_wait(sbf_IOQueue *queue, sbf_IORequest *request) {
+    FAIL_IF_NULL(queue);
+    FAIL_IF_NULL(request);
+    if (sbf_io_queue_wait(queue, request) == SBF_IO_COMPLETE)
+        return SBF_RESULT_SUCCESS;
+    return request->write ? SBF_RESULT_WRITE_FAILURE : SBF_RESULT_READ_FAILURE;
+}
+#endif
@@ -1,8 +1,12 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <iterator>
 #include <array>
@@ -10,6 +14,24 @@
 #include <complex>
 #include <cstdint>
 #include <string>
+#include <thread>
+#include "sbf_async.h"
+#include "sbf_byteswap.h"
+#include "sbf_checkpoint.h"
+#include "sbf_codec.h"
+#include "sbf_direct.h"
+#include "sbf_frames.h"
+#include "sbf_integrity.h"
+#include "sbf_name_index.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SBF_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 /*
  * sbf.hpp
@@ -31,23 +53,43 @@ typedef std::complex<float> sbf_complex_float;
 typedef std::complex<double> sbf_complex_double;
 
 constexpr sbf_byte sbf_version_major('0');
-constexpr sbf_byte sbf_version_minor('2');
-constexpr sbf_byte sbf_version_minor_minor('0');
+constexpr sbf_byte sbf_version_minor('3');
+constexpr sbf_byte sbf_version_minor_minor('2');
 
 namespace limits {
 constexpr sbf_size max_dataset_dimensions(8);
 constexpr sbf_size name_length(62);
-constexpr sbf_size n_datasets_max(64);
+// the header table is sized as needed, this only bounds dataset indices
+constexpr sbf_size n_datasets_max(INT32_MAX);
+// size of the ranges a dataset is split into for parallel I/O
+constexpr sbf_size parallel_chunk_size(16 * 1024 * 1024);
+// bytes read when opening a file, enough for the headers of ~500 datasets
+constexpr sbf_size header_read_size(64 * 1024);
+// block size uncached_io transfers in, see set_alignment()
+constexpr sbf_size direct_alignment(SBF_DIRECT_ALIGNMENT);
 }
 
 namespace flags {
 constexpr sbf_byte big_endian(0b10000000);
 constexpr sbf_byte column_major(0b01000000);
 constexpr sbf_byte custom_datatype(0b00101111);
-constexpr sbf_byte unused_bit(0b00010000);
+// dataset is stored compressed in chunks, see sbf_codec.h
+constexpr sbf_byte compressed(0b00010000);
 constexpr sbf_byte dimension_bits(0b00001111);
 // changes depending on platform
-constexpr sbf_byte default_flags(0b00000000);
+constexpr sbf_byte default_flags(SBF_HOST_BIG_ENDIAN ? big_endian : 0b00000000);
+}
+
+// codecs and filters for compressed datasets, see sbf_codec.h
+namespace codecs {
+constexpr sbf_byte none(SBF_CODEC_NONE);
+constexpr sbf_byte lz(SBF_CODEC_LZ);
+}
+
+namespace filters {
+constexpr sbf_byte none(0);
+constexpr sbf_byte shuffle(SBF_FILTER_SHUFFLE);
+constexpr sbf_byte delta(SBF_FILTER_DELTA);
 }
 
 typedef std::array<sbf_size, limits::max_dataset_dimensions> sbf_dimensions;
@@ -81,6 +123,31 @@ enum DataType : sbf_byte {
 
 enum AccessMode { reading = std::ios::in, writing = std::ios::out };
 
+/*
+ * How a File does its I/O: through a std::fstream, or with pread/pwrite
+ * directly on a file descriptor, which avoids the stream's buffering and
+ * writes the headers (and the first dataset after them) in one call.
+ * direct_io falls back to stream_io where POSIX I/O isn't available.
+ *
+ * uncached_io is direct_io that also bypasses the page cache with
+ * O_DIRECT, for datasets too large to be worth caching. Only blobs at
+ * multiples of limits::direct_alignment are, so it is meant for files
+ * written with set_alignment(limits::direct_alignment), and buffers
+ * from an AlignedAllocator avoid a copy. Opening a File with it fails
+ * where the platform or file system doesn't support O_DIRECT.
+ */
+enum IOBackend { stream_io, direct_io, uncached_io };
+
+/*
+ * How a File does asynchronous I/O (see sbf_async.h): async_auto uses
+ * io_uring where the kernel allows it, and a pool of threads otherwise.
+ */
+enum AsyncBackend {
+    async_auto = 0,
+    async_io_uring = 1,
+    async_threads = 2
+};
+
 // RESULT TYPE FLAGS
 enum ResultType {
     success = 1,
@@ -89,7 +156,8 @@ enum ResultType {
     write_failure,
     read_failure,
     null_failure,
-    max_datasets_exceeded_failure
+    max_datasets_exceeded_failure,
+    checksum_failure
 } sbf_result;
 
 /*
@@ -97,17 +165,44 @@ enum ResultType {
  *
  * Contains SBF basic information such as token and
  * version strings, along with the number of datasets
- * in the file.
+ * in the file and the alignment of its blobs. Versions
+ * before 0.3.0 store the number of datasets in a single
+ * byte, and those before 0.3.2 have no alignment.
  */
 struct FileHeader {
     FileHeader() {
         token_version_string = {{'S', 'B', 'F', sbf_version_major, sbf_version_minor, sbf_version_minor_minor}};
         n_datasets = 0;
+        alignment = 1;
     }
 
     std::array<sbf_character, 6> token_version_string;
-    sbf_byte n_datasets;
-    constexpr static size_t header_size = sizeof(token_version_string) + sizeof(n_datasets);
+    sbf_size n_datasets;
+    sbf_size alignment;
+    constexpr static size_t header_size =
+        sizeof(token_version_string) + sizeof(n_datasets) + sizeof(alignment);
+
+    /* Is n_datasets stored as 64 bits, i.e. is this version 0.3.0 or later? */
+    bool has_wide_count() const {
+        return std::string(token_version_string.data() + 3, 3) >= "030";
+    }
+
+    /* Is an index of dataset names stored after the data headers,
+     * i.e. is this version 0.3.1 or later? */
+    bool has_name_index() const {
+        return std::string(token_version_string.data() + 3, 3) >= "031";
+    }
+
+    /* Is the alignment of the blobs stored, i.e. is this version 0.3.2 or later? */
+    bool has_alignment() const {
+        return std::string(token_version_string.data() + 3, 3) >= "032";
+    }
+
+    /* Number of bytes this header occupies in the file */
+    size_t size() const {
+        if (!has_wide_count()) return sizeof(token_version_string) + 1;
+        return has_alignment() ? header_size : header_size - sizeof(alignment);
+    }
 };
 
 /*
@@ -115,11 +210,19 @@ struct FileHeader {
  */
 std::ostream &operator<<(std::ostream &os, const FileHeader &f) {
     // Fields are done separately in order to avoid potential struct padding
-    // issues
+    // issues, and the integers are little endian
     os.write(reinterpret_cast<const char *>(&(f.token_version_string)),
              sizeof(f.token_version_string));
-    os.write(reinterpret_cast<const char *>(&(f.n_datasets)),
-             sizeof(f.n_datasets));
+    if (f.has_wide_count()) {
+        const sbf_size n_datasets = sbf_le64(f.n_datasets), alignment = sbf_le64(f.alignment);
+        os.write(reinterpret_cast<const char *>(&n_datasets), sizeof(n_datasets));
+        if (f.has_alignment()) {
+            os.write(reinterpret_cast<const char *>(&alignment), sizeof(alignment));
+        }
+    } else {
+        const sbf_byte n_datasets = static_cast<sbf_byte>(f.n_datasets);
+        os.write(reinterpret_cast<const char *>(&n_datasets), sizeof(n_datasets));
+    }
     return os;
 }
 
@@ -129,32 +232,47 @@ std::ostream &operator<<(std::ostream &os, const FileHeader &f) {
 std::istream &operator>>(std::istream &is, FileHeader &f) {
     is.read(reinterpret_cast<char *>(&(f.token_version_string)),
             sizeof(f.token_version_string));
-    is.read(reinterpret_cast<char *>(&(f.n_datasets)), sizeof(f.n_datasets));
+    if (f.has_wide_count()) {
+        is.read(reinterpret_cast<char *>(&(f.n_datasets)), sizeof(f.n_datasets));
+        f.n_datasets = sbf_le64(f.n_datasets);
+        if (f.has_alignment()) {
+            is.read(reinterpret_cast<char *>(&(f.alignment)), sizeof(f.alignment));
+            f.alignment = sbf_le64(f.alignment);
+        }
+    } else {
+        sbf_byte n_datasets = 0;
+        is.read(reinterpret_cast<char *>(&n_datasets), sizeof(n_datasets));
+        f.n_datasets = n_datasets;
+    }
     return is;
 }
 
+/*
+ * The DataType stored for each C++ type. Only the sbf_* types have
+ * traits, so reading or writing any other type fails to compile
+ * rather than being taken for bytes.
+ */
 template <typename T> struct SBFTypeTraits {
-    static constexpr char const *type_name = "sbf_byte";
-    static const size_t size = 1;
     static const bool is_specialized = false;
-    static const DataType type = SBF_BYTE;
 };
 
-template<>
-struct SBFTypeTraits<sbf_integer> {
-    static constexpr char const *type_name = "sbf_integer";
-    static const size_t size = sizeof(sbf_integer);
-    static const bool is_specialized = true;
-    static const DataType type = SBF_INT;
-};
+#define SBF_TYPE_TRAITS(T, data_type)                       \
+    template <> struct SBFTypeTraits<T> {                  \
+        static constexpr char const *type_name = #T;        \
+        static const size_t size = sizeof(T);               \
+        static const bool is_specialized = true;            \
+        static const DataType type = data_type;             \
+    };
 
-template<>
-struct SBFTypeTraits<sbf_double> {
-    static constexpr char const *type_name = "sbf_double";
-    static const size_t size = sizeof(sbf_double);
-    static const bool is_specialized = true;
-    static const DataType type = SBF_DOUBLE;
-};
+SBF_TYPE_TRAITS(sbf_byte, SBF_BYTE)
+SBF_TYPE_TRAITS(sbf_integer, SBF_INT)
+SBF_TYPE_TRAITS(sbf_long, SBF_LONG)
+SBF_TYPE_TRAITS(sbf_float, SBF_FLOAT)
+SBF_TYPE_TRAITS(sbf_double, SBF_DOUBLE)
+SBF_TYPE_TRAITS(sbf_complex_float, SBF_CFLOAT)
+SBF_TYPE_TRAITS(sbf_complex_double, SBF_CDOUBLE)
+SBF_TYPE_TRAITS(sbf_character, SBF_CHAR)
+#undef SBF_TYPE_TRAITS
 
 
 /*
@@ -168,6 +286,7 @@ struct SBFTypeTraits<sbf_double> {
  */
 class Dataset {
 friend class File;
+friend class Checkpoint;
 
 private:
 size_t _offset = 0;
@@ -176,6 +295,12 @@ sbf_byte _flags = flags::default_flags;
 DataType _type = SBF_BYTE;     // how big is each block of data
 sbf_dimensions _shape = {{0}}; // how many blocks of data do we have
 bool _written_to_file = false;
+std::size_t _stored_size = 0; // bytes occupied in the file, if read/written
+sbf_size _slices_written = 0; // progress when streamed with File::write_chunk
+sbf_byte _codec = codecs::lz; // pipeline used when compressed
+sbf_byte _filters = filters::shuffle;
+uint32_t _crc = 0;            // of the blob as stored, see sbf_integrity.h
+bool _has_crc = false;
 
 public:
 constexpr static size_t header_size = sizeof(_name) +
@@ -214,6 +339,42 @@ inline const bool is_little_endian() const {
     return !is_big_endian();
 }
 
+/* Is the data stored in the byte order of this machine? */
+inline const bool is_native_endian() const {
+    return is_big_endian() == static_cast<bool>(SBF_HOST_BIG_ENDIAN);
+}
+
+/* Is the 'flags' column major bit set?*/
+inline const bool is_column_major() const {
+    return _flags & flags::column_major;
+}
+
+/* Is the 'flags' compressed bit set?*/
+inline const bool is_compressed() const {
+    return _flags & flags::compressed;
+}
+
+/*
+ * Set the filter pipeline (filters::* bits, applied delta first, then
+ * shuffle) and codec this dataset is encoded with, which sets the
+ * 'flags' compressed bit. With codecs::none the filters alone are
+ * applied, e.g. filters::delta | filters::shuffle for floating point
+ * data that will later be compressed by general purpose tools.
+ */
+inline void set_filters(sbf_byte filter_bits, sbf_byte codec = codecs::lz) {
+    _flags |= flags::compressed;
+    _filters = filter_bits;
+    _codec = codec;
+}
+
+inline const sbf_byte get_filters() const {
+    return _filters;
+}
+
+inline const sbf_byte get_codec() const {
+    return _codec;
+}
+
 inline const bool is_empty() const {
     return get_dimensions() == 0;
 }
@@ -279,6 +440,24 @@ const std::size_t datatype_size() const {
     return bytes;
 }
 
+/*
+ * Width of the words whose bytes are reversed to change the byte
+ * order of this dataset: complex numbers are swapped as their two
+ * components.
+ */
+const std::size_t swap_width() const {
+    if (_type == SBF_CFLOAT || _type == SBF_CDOUBLE) return datatype_size() / 2;
+    return datatype_size();
+}
+
+/*
+ * Convert 'size' bytes of this dataset's data, as read from the
+ * file, to the byte order of this machine in place.
+ */
+void to_host_order(void *data, std::size_t size) const {
+    if (!is_native_endian()) sbf_byteswap(data, size, swap_width());
+}
+
 /* Total number of bytes occupied by the binary blob of this dataset,
  * i.e. num_blocks * block_size
  */
@@ -292,6 +471,54 @@ const std::size_t size() const {
     return product;
 }
 
+/* Byte offset of the binary blob of this dataset in its file */
+const std::size_t offset() const {
+    return _offset;
+}
+
+/* The slowest varying dimension of this dataset, i.e. the first
+ * for row major storage and the last for column major.
+ */
+const sbf_byte slowest_dimension() const {
+    sbf_byte dims = get_dimensions();
+    return (is_column_major() && dims > 0) ? dims - 1 : 0;
+}
+
+/* Number of bytes in a single slice along the slowest varying dimension */
+const std::size_t slice_size() const {
+    sbf_size slices = _shape[slowest_dimension()];
+    return slices ? size() / slices : 0;
+}
+
+/* Pack this header into the header_size bytes at 'out', returning the end */
+char *pack(char *out) const {
+    // Fields are done separately in order to avoid potential struct padding
+    // issues
+    std::memcpy(out, &_name, sizeof(_name));
+    out += sizeof(_name);
+    std::memcpy(out, &_flags, sizeof(_flags));
+    out += sizeof(_flags);
+    std::memcpy(out, &_type, sizeof(_type));
+    out += sizeof(_type);
+    std::memcpy(out, &_shape, sizeof(_shape));
+    sbf_le_words(out, sizeof(_shape), sizeof(sbf_size));
+    return out + sizeof(_shape);
+}
+
+/* Unpack a header from the header_size bytes at 'in', returning the end */
+const char *unpack(const char *in) {
+    _written_to_file = true;
+    std::memcpy(&_name, in, sizeof(_name));
+    in += sizeof(_name);
+    std::memcpy(&_flags, in, sizeof(_flags));
+    in += sizeof(_flags);
+    std::memcpy(&_type, in, sizeof(_type));
+    in += sizeof(_type);
+    std::memcpy(&_shape, in, sizeof(_shape));
+    sbf_le_words(_shape.data(), sizeof(_shape), sizeof(sbf_size));
+    return in + sizeof(_shape);
+}
+
 friend std::ostream &operator<<(std::ostream &os, const Dataset &dset);
 friend std::istream &operator>>(std::istream &is, Dataset &dset);
 
@@ -301,12 +528,9 @@ friend std::istream &operator>>(std::istream &is, Dataset &dset);
  * Serialize this Dataset into a datastream
  */
 std::ostream &operator<<(std::ostream &os, const Dataset &dset) {
-    // Fields are done separately in order to avoid potential struct padding
-    // issues
-    os.write(reinterpret_cast<const char *>(&(dset._name)), sizeof(dset._name));
-    os.write(reinterpret_cast<const char *>(&(dset._flags)), sizeof(dset._flags));
-    os.write(reinterpret_cast<const char *>(&(dset._type)), sizeof(dset._type));
-    os.write(reinterpret_cast<const char *>(&(dset._shape)), sizeof(dset._shape));
+    char header[Dataset::header_size];
+    dset.pack(header);
+    os.write(header, sizeof(header));
     return os;
 }
 
@@ -314,14 +538,321 @@ std::ostream &operator<<(std::ostream &os, const Dataset &dset) {
  * Deserialize from a data stream into this Dataset
  */
 std::istream &operator>>(std::istream &is, Dataset &dset) {
-    dset._written_to_file = true;
-    is.read(reinterpret_cast<char *>(&(dset._name)), sizeof(dset._name));
-    is.read(reinterpret_cast<char *>(&(dset._flags)), sizeof(dset._flags));
-    is.read(reinterpret_cast<char *>(&(dset._type)), sizeof(dset._type));
-    is.read(reinterpret_cast<char *>(&(dset._shape)), sizeof(dset._shape));
+    char header[Dataset::header_size];
+    if (is.read(header, sizeof(header))) dset.unpack(header);
     return is;
 }
 
+/*
+ * Allocator of memory aligned to limits::direct_alignment, e.g.
+ * std::vector<double, AlignedAllocator<double>>, which uncached_io
+ * reads into and writes from without going through a bounce buffer.
+ */
+template <typename T> struct AlignedAllocator {
+    typedef T value_type;
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(std::size_t n) {
+        void *ptr = sbf_aligned_alloc(n * sizeof(T));
+        if (ptr == nullptr) throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+    void deallocate(T *ptr, std::size_t) { sbf_aligned_free(ptr); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+/*
+ * Read-only typed view of the binary blob of a Dataset
+ *
+ * Does not own its data: the memory is owned by whoever
+ * created the view (e.g. a memory mapped File), so a view
+ * must not outlive it.
+ */
+template <typename T> class DatasetView {
+  public:
+    DatasetView() {}
+    DatasetView(const T *data, const Dataset &dset)
+        : m_data(data), m_shape(dset.get_shape()),
+          m_dimensions(dset.get_dimensions()),
+          m_column_major(dset.is_column_major()) {}
+
+    const T *data() const { return m_data; }
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + size(); }
+    bool empty() const { return m_data == nullptr; }
+
+    /* Number of elements (not bytes) in this view */
+    std::size_t size() const {
+        if (m_data == nullptr) return 0;
+        std::size_t product = 1;
+        for (sbf_byte dim = 0; dim < m_dimensions; dim++) {
+            product *= m_shape[dim];
+        }
+        return product;
+    }
+
+    const sbf_dimensions &shape() const { return m_shape; }
+    sbf_byte dimensions() const { return m_dimensions; }
+    bool is_column_major() const { return m_column_major; }
+
+    const T &operator[](std::size_t i) const { return m_data[i]; }
+
+    /*
+     * Element access by N-dimensional index, taking the
+     * storage order of the dataset into account.
+     */
+    template <typename... Indices>
+    const T &operator()(Indices... indices) const {
+        const sbf_size idx[] = {static_cast<sbf_size>(indices)...};
+        return m_data[offset_of(idx, sizeof...(Indices))];
+    }
+
+  private:
+    std::size_t offset_of(const sbf_size *idx, std::size_t n) const {
+        std::size_t offset = 0, stride = 1;
+        if (m_column_major) {
+            for (std::size_t dim = 0; dim < n; dim++) {
+                offset += idx[dim] * stride;
+                stride *= m_shape[dim];
+            }
+        } else {
+            for (std::size_t dim = n; dim > 0; dim--) {
+                offset += idx[dim - 1] * stride;
+                stride *= m_shape[dim - 1];
+            }
+        }
+        return offset;
+    }
+
+    const T *m_data = nullptr;
+    sbf_dimensions m_shape = {{0}};
+    sbf_byte m_dimensions = 0;
+    bool m_column_major = false;
+};
+
+/*
+ * Pool of buffers for File::read to reuse, so that reading the same
+ * datasets over and over (e.g. each step of a loop) doesn't allocate.
+ *
+ * A DatasetBuffer drawn from the pool gives its memory back when it is
+ * destroyed, and the next read of the same size or less takes it again.
+ * Copies of a pool share its buffers, which may be returned from any
+ * thread, and buffers may outlive the pool. Buffers are aligned to
+ * limits::direct_alignment, so uncached_io reads into them directly.
+ */
+class BufferPool {
+  public:
+    BufferPool() : m_blocks(std::make_shared<Blocks>()) {}
+
+    /* Bytes held by the pool for reuse, i.e. not in use */
+    std::size_t bytes_held() const {
+        std::lock_guard<std::mutex> lock(m_blocks->mutex);
+        std::size_t total = 0;
+        for (const auto &block : m_blocks->free) total += block.first;
+        return total;
+    }
+
+    /* Free the buffers held for reuse */
+    void clear() { m_blocks->clear(); }
+
+  private:
+    template <typename T> friend class DatasetBuffer;
+
+    // free buffers by capacity, in bytes
+    struct Blocks {
+        std::mutex mutex;
+        std::multimap<std::size_t, void *> free;
+
+        ~Blocks() { clear(); }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &block : free) sbf_aligned_free(block.second);
+            free.clear();
+        }
+
+        // the smallest free buffer of at least 'size' bytes, or a new one
+        void *acquire(std::size_t size, std::size_t &capacity) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto block = free.lower_bound(size);
+                if (block != free.end()) {
+                    capacity = block->first;
+                    void *ptr = block->second;
+                    free.erase(block);
+                    return ptr;
+                }
+            }
+            capacity = size;
+            return sbf_aligned_alloc(size);
+        }
+
+        void release(void *ptr, std::size_t capacity) {
+            std::lock_guard<std::mutex> lock(mutex);
+            free.emplace(capacity, ptr);
+        }
+    };
+
+    std::shared_ptr<Blocks> m_blocks;
+};
+
+/*
+ * Contiguous buffer holding all of a dataset, as returned by File::read
+ *
+ * Owns its data, which is freed (or given back to the BufferPool it
+ * came from) when it is destroyed. Buffers can be moved but not copied.
+ * A buffer that couldn't be read is empty, with the reason in result().
+ */
+template <typename T> class DatasetBuffer {
+  public:
+    DatasetBuffer() {}
+    explicit DatasetBuffer(ResultType result) : m_result(result) {}
+
+    DatasetBuffer(const Dataset &dset, BufferPool *pool)
+        : m_size(dset.size() / sizeof(T)), m_dataset(dset),
+          m_pool(pool ? pool->m_blocks : nullptr) {
+        const std::size_t bytes = m_size * sizeof(T);
+        void *ptr = nullptr;
+        if (m_pool) {
+            ptr = m_pool->acquire(bytes, m_capacity);
+        } else {
+            ptr = sbf_aligned_alloc(bytes);
+            m_capacity = bytes;
+        }
+        if (ptr == nullptr) throw std::bad_alloc();
+        m_data = static_cast<T *>(ptr);
+    }
+
+    DatasetBuffer(DatasetBuffer &&other) { swap(other); }
+
+    DatasetBuffer &operator=(DatasetBuffer &&other) {
+        if (this != &other) {
+            DatasetBuffer(std::move(other)).swap(*this);
+        }
+        return *this;
+    }
+
+    DatasetBuffer(const DatasetBuffer &) = delete;
+    DatasetBuffer &operator=(const DatasetBuffer &) = delete;
+
+    ~DatasetBuffer() {
+        if (m_data == nullptr) return;
+        if (m_pool) m_pool->release(m_data, m_capacity);
+        else sbf_aligned_free(m_data);
+    }
+
+    void swap(DatasetBuffer &other) {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_dataset, other.m_dataset);
+        std::swap(m_pool, other.m_pool);
+        std::swap(m_result, other.m_result);
+    }
+
+    T *data() { return m_data; }
+    const T *data() const { return m_data; }
+    T *begin() { return m_data; }
+    T *end() { return m_data + m_size; }
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+
+    /* Number of elements (not bytes) in this buffer */
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_data == nullptr; }
+    ResultType result() const { return m_result; }
+
+    /* The header of the dataset this buffer was read from */
+    const Dataset &dataset() const { return m_dataset; }
+    sbf_dimensions shape() const { return m_dataset.get_shape(); }
+    bool is_column_major() const { return m_dataset.is_column_major(); }
+
+    T &operator[](std::size_t i) { return m_data[i]; }
+    const T &operator[](std::size_t i) const { return m_data[i]; }
+
+    /*
+     * View of this buffer, e.g. to access elements by N-dimensional
+     * index, valid for as long as the buffer is.
+     */
+    DatasetView<T> view() const {
+        return empty() ? DatasetView<T>() : DatasetView<T>(m_data, m_dataset);
+    }
+
+  private:
+    T *m_data = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = 0; // in bytes, may exceed the size if pooled
+    Dataset m_dataset;
+    std::shared_ptr<BufferPool::Blocks> m_pool;
+    ResultType m_result = success;
+};
+
+#ifdef SBF_ASYNC_POSIX
+typedef std::shared_ptr<sbf_IOQueue> AsyncQueue;
+#endif
+
+/*
+ * Handle to a read or write started by File::read_async/write_async.
+ *
+ * The data passed to it must not be touched until ready() is true or
+ * wait() has returned, which the destructor does if need be. Handles
+ * may outlive their File, whose close() waits for all of them.
+ */
+class AsyncRequest {
+  public:
+    AsyncRequest(ResultType failure = read_failure) : m_failure(failure) {}
+    AsyncRequest(AsyncRequest &&) = default;
+    AsyncRequest &operator=(AsyncRequest &&other) {
+        wait();
+#ifdef SBF_ASYNC_POSIX
+        m_queue = std::move(other.m_queue);
+        m_request = std::move(other.m_request);
+#endif
+        m_failure = other.m_failure;
+        return *this;
+    }
+    ~AsyncRequest() { wait(); }
+
+    /* Was the transfer started? */
+    bool valid() const {
+#ifdef SBF_ASYNC_POSIX
+        return m_request != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    /* Has the transfer finished (or never started)? Never blocks. */
+    bool ready() {
+#ifdef SBF_ASYNC_POSIX
+        return !valid() || sbf_io_queue_poll(m_queue.get(), m_request.get()) != SBF_IO_PENDING;
+#else
+        return true;
+#endif
+    }
+
+    /* Wait for the transfer to finish, returning success if all the data was moved */
+    ResultType wait() {
+#ifdef SBF_ASYNC_POSIX
+        if (valid() && sbf_io_queue_wait(m_queue.get(), m_request.get()) == SBF_IO_COMPLETE) {
+            return success;
+        }
+#endif
+        return m_failure;
+    }
+
+  private:
+    friend class File;
+#ifdef SBF_ASYNC_POSIX
+    AsyncQueue m_queue;
+    std::unique_ptr<sbf_IORequest> m_request;
+#endif
+    ResultType m_failure;
+};
+
 /*
  * SBF container class
  *
@@ -340,8 +871,14 @@ class File {
     };
 
     File() {}
-    File(std::string name, AccessMode mode = reading, bool read = true)
-        : accessmode(mode), filename(name), m_status(Closed), datasets({}) {
+    /*
+     * When reading, open 'name' and read its headers unless 'read' is false.
+     * With 'headers_only' no data is read until a dataset is, see read_headers().
+     */
+    File(std::string name, AccessMode mode = reading, bool read = true,
+         IOBackend backend = stream_io, bool headers_only = false)
+        : accessmode(mode), filename(name), m_status(Closed), datasets({}),
+          m_backend(backend) {
 
         if(mode == sbf::writing || !read) return;
         auto status = open();
@@ -351,7 +888,7 @@ class File {
         }
         else m_status = Open;
 
-        status = read_headers();
+        status = read_headers(headers_only);
         if (status != sbf::success) {
             m_status = FailedReadingHeaders;
             return;
@@ -359,12 +896,34 @@ class File {
     }
 
     ResultType open() {
+        if (m_atomic && accessmode == writing) m_temp = filename + SBF_TEMP_SUFFIX;
+#ifdef SBF_POSIX
+        if (m_backend == direct_io || m_backend == uncached_io) {
+            const int flags = (accessmode == writing) ? O_WRONLY : O_RDONLY;
+            m_fd = ::open(path().c_str(), (accessmode == writing) ? flags | O_CREAT | O_TRUNC
+                                                                  : flags, 0644);
+            if (m_fd < 0) return file_open_failure;
+            if (m_backend != uncached_io) return success;
+#ifdef SBF_O_DIRECT
+            m_direct_fd = ::open(path().c_str(), flags | O_DIRECT);
+#endif
+            if (m_direct_fd < 0) {
+                ::close(m_fd);
+                m_fd = -1;
+                if (!m_temp.empty()) std::remove(m_temp.c_str());
+                return file_open_failure;
+            }
+            return success;
+        }
+#endif
+        // there's no O_DIRECT without POSIX I/O
+        if (m_backend == uncached_io) return file_open_failure;
         switch (accessmode) {
         case reading:
-            file_stream.open(filename, std::ios::binary | std::ios::in);
+            file_stream.open(path(), std::ios::binary | std::ios::in);
             break;
         case writing:
-            file_stream.open(filename, std::ios::binary | std::ios::out);
+            file_stream.open(path(), std::ios::binary | std::ios::out);
         }
         if (!file_stream.is_open()) {
             return file_open_failure;
@@ -372,107 +931,659 @@ class File {
         return success;
     }
 
-    ResultType close() {
-        file_stream.close();
-        return success;
+    /*
+     * Moving a File hands over its open file, mapping and any file being
+     * written with set_atomic(), leaving the File moved from closed.
+     */
+    File(File &&other) : File() { swap(other); }
+    File &operator=(File &&other) {
+        // the file this held is closed as the temporary is destroyed
+        File(std::move(other)).swap(*this);
+        return *this;
     }
 
-    ResultType write_headers() {
-        ResultType res = success;
+    /*
+     * A File still open is closed, or discarded with set_atomic(), but
+     * failures then go unreported: call close() to see whether the frame
+     * index, checksums and the file itself were written.
+     */
+    ~File() {
+        if (m_temp.empty()) close();
+        else discard();
+        unmap();
+    }
 
-        FileHeader file_header;
-        file_header.n_datasets = datasets.size();
-        file_stream << file_header;
+    void swap(File &other) {
+        using std::swap;
+        file_stream.swap(other.file_stream);
+        swap(accessmode, other.accessmode);
+        swap(filename, other.filename);
+        swap(m_status, other.m_status);
+        swap(m_name_index, other.m_name_index);
+        swap(empty, other.empty);
+        swap(datasets, other.datasets);
+        swap(m_map, other.m_map);
+        swap(m_map_size, other.m_map_size);
+        swap(m_io_threads, other.m_io_threads);
+        swap(m_backend, other.m_backend);
+        swap(m_fd, other.m_fd);
+        swap(m_direct_fd, other.m_direct_fd);
+        swap(m_async_backend, other.m_async_backend);
+#ifdef SBF_ASYNC_POSIX
+        swap(m_async_queue, other.m_async_queue);
+        swap(m_async_fd, other.m_async_fd);
+#endif
+        swap(m_alignment, other.m_alignment);
+        swap(m_data_start, other.m_data_start);
+        swap(m_located, other.m_located);
+        swap(m_laid_out, other.m_laid_out);
+        swap(m_blobs_size, other.m_blobs_size);
+        swap(m_frame_offsets, other.m_frame_offsets);
+        swap(m_frame, other.m_frame);
+        swap(m_frames_dirty, other.m_frames_dirty);
+        swap(m_pending_headers, other.m_pending_headers);
+        swap(m_atomic, other.m_atomic);
+        swap(m_temp, other.m_temp);
+        swap(m_checksums, other.m_checksums);
+        swap(m_verify, other.m_verify);
+        swap(m_headers_crc, other.m_headers_crc);
+    }
 
-        if (!file_stream) {
-            res = write_failure;
-        } else {
-            for (auto item: datasets) {
-                file_stream << item;
-                if (!file_stream) {
-                    res = write_failure;
-                    break;
-                }
+    /*
+     * Finish writing the file and close it. With set_atomic() the file is
+     * only now committed as 'filename', and only if everything succeeded.
+     */
+    ResultType close() {
+        ResultType res = flush_headers();
+        if (res == success && m_frames_dirty) res = write_frame_index();
+        if (res == success && m_checksums && accessmode == writing && is_open())
+            res = write_checksums();
+#ifdef SBF_ASYNC_POSIX
+        // outstanding asynchronous requests must finish before their descriptor closes
+        if (m_async_queue) sbf_io_queue_destroy(m_async_queue.get());
+        m_async_queue.reset();
+        if (m_async_fd >= 0) ::close(m_async_fd);
+        m_async_fd = -1;
+#endif
+#ifdef SBF_POSIX
+        if (m_fd >= 0 && ::close(m_fd) != 0) res = file_close_failure;
+        if (m_direct_fd >= 0) ::close(m_direct_fd);
+        m_fd = m_direct_fd = -1;
+#endif
+        if (file_stream.is_open()) file_stream.close();
+        if (!m_temp.empty()) {
+            if (res == success && (file_stream.fail() ||
+                                   sbf_commit_file(m_temp.c_str(), filename.c_str()) != 0)) {
+                res = file_close_failure;
             }
+            if (res != success) std::remove(m_temp.c_str());
+            m_temp.clear();
         }
-        std::cerr << "Error " << strerror(errno) << std::endl;
         return res;
     }
 
-    ResultType read_headers() {
+    /*
+     * Close a file being written with set_atomic() without committing it,
+     * e.g. after a write failed, leaving any previous 'filename' as it was.
+     */
+    ResultType discard() {
+        std::string temp;
+        temp.swap(m_temp);
+        ResultType res = close();
+        if (!temp.empty()) std::remove(temp.c_str());
+        return res;
+    }
+
+    /*
+     * Write the file as 'filename' SBF_TEMP_SUFFIX, which close() commits
+     * as 'filename' once complete (see sbf_integrity.h), so readers never
+     * see part of a file. A File destroyed without being closed, e.g. by
+     * an exception, is discarded. Must be called before open().
+     */
+    void set_atomic(bool atomic) { m_atomic = atomic; }
+
+    /*
+     * When writing, end the file with checksums of its headers and blobs
+     * (see sbf_integrity.h), so every dataset must be written before
+     * close(). Multi-frame files can't have checksums.
+     */
+    void set_checksums(bool checksums) { m_checksums = checksums; }
+
+    /*
+     * When reading, check the headers and each dataset read in whole by
+     * read_data() against the checksums of a file that has them, failing
+     * with checksum_failure. Must be called before read_headers().
+     */
+    void set_verify(bool verify) { m_verify = verify; }
+
+    /*
+     * Memory map the whole file read-only, so that datasets
+     * may be accessed through view<T>() without copying.
+     *
+     * Headers must already have been read. The mapping stays valid
+     * after close() until unmap() is called or the File is destroyed.
+     */
+    ResultType map() {
+#ifdef SBF_POSIX
+        if (m_map != nullptr) return success;
+        if (locate_datasets() != success) return read_failure;
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return file_open_failure;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return read_failure;
+        }
+        std::size_t length = static_cast<std::size_t>(st.st_size);
+        for (const auto &dset : datasets) {
+            if (dset._offset + dset._stored_size > length) {
+                ::close(fd);
+                return read_failure;
+            }
+        }
+        if (!m_frame_offsets.empty() && m_frame_offsets.back() + frame_size() > length) {
+            ::close(fd);
+            return read_failure;
+        }
+        void *addr = nullptr;
+        if (length > 0) {
+            addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (addr == MAP_FAILED || addr == nullptr) return read_failure;
+        m_map = static_cast<const sbf_byte *>(addr);
+        m_map_size = length;
+        return success;
+#else
+        return file_open_failure;
+#endif
+    }
+
+    ResultType unmap() {
+#ifdef SBF_POSIX
+        if (m_map != nullptr) {
+            munmap(const_cast<sbf_byte *>(m_map), m_map_size);
+        }
+#endif
+        m_map = nullptr;
+        m_map_size = 0;
+        return success;
+    }
+
+    bool is_mapped() const { return m_map != nullptr; }
+
+    /*
+     * Zero-copy view of a dataset in a mapped file.
+     * Dataset blobs are packed unless set_alignment() was used
+     * when writing, so a blob may not be aligned for T; use
+     * set_alignment() for files that are meant to be viewed.
+     *
+     * Returns an empty view if the file is not mapped, the dataset
+     * does not exist, is compressed, is stored in the other byte
+     * order (it can't be swapped in place), is not aligned for T
+     * or the types do not match.
+     */
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    DatasetView<T> view(const std::string& dset_name) const {
+        auto dset = get_dataset(dset_name);
+        if (m_map == nullptr || dset.is_empty() || dset.is_compressed() ||
+            !dset.is_native_endian())
+            return DatasetView<T>();
+        if (Traits::type != dset.get_type()) return DatasetView<T>();
+        const sbf_byte *blob = m_map + data_offset(dset);
+        if (reinterpret_cast<std::uintptr_t>(blob) % alignof(T) != 0)
+            return DatasetView<T>();
+        return DatasetView<T>(reinterpret_cast<const T *>(blob), dset);
+    }
+
+    /*
+     * Write the file header, data headers and name index, packed into a
+     * single buffer so they take one write. With direct_io the write is
+     * deferred, so that it can be combined with the data of the first
+     * dataset if that is written next. The buffer is padded out to the
+     * start of the first blob, see set_alignment().
+     */
+    ResultType write_headers() {
+        lay_out();
+        std::vector<char> headers = pack_headers();
+        if (m_fd >= 0) {
+            m_pending_headers.swap(headers);
+            return success;
+        }
+        return write_at(headers.data(), headers.size(), 0);
+    }
+
+    /*
+     * Read the file header, data headers and name index. They are read
+     * into one buffer, with a single read for files of up to a few
+     * hundred datasets, and parsed from memory.
+     *
+     * If 'headers_only' the data is not touched: the chunk indexes of
+     * compressed datasets, needed to locate the datasets after them,
+     * are read when a dataset is first read or the file is mapped.
+     */
+    ResultType read_headers(bool headers_only = false) {
+        const std::size_t length = file_size();
+        std::vector<char> headers;
+        // make sure the first 'size' bytes of the file have been read
+        auto have = [&](std::size_t size) {
+            if (size <= headers.size()) return true;
+            if (size > length) return false;
+            const std::size_t start = headers.size();
+            headers.resize(std::max<std::size_t>(size, std::min<std::size_t>(
+                                                           length, limits::header_read_size)));
+            return read_at(headers.data() + start, headers.size() - start, start) == success;
+        };
+
         FileHeader file_header;
-        file_stream >> file_header;
+        if (!have(file_header.token_version_string.size())) return read_failure;
+        std::memcpy(file_header.token_version_string.data(), headers.data(),
+                    file_header.token_version_string.size());
+        if (!have(file_header.size())) return read_failure;
+        const char *count = headers.data() + file_header.token_version_string.size();
+        // every integer of the headers is little endian, see pack_headers()
+        if (file_header.has_wide_count()) {
+            std::memcpy(&file_header.n_datasets, count, sizeof(file_header.n_datasets));
+            file_header.n_datasets = sbf_le64(file_header.n_datasets);
+        } else {
+            file_header.n_datasets = static_cast<sbf_byte>(*count);
+        }
+        if (file_header.has_alignment()) {
+            std::memcpy(&file_header.alignment, count + sizeof(file_header.n_datasets),
+                        sizeof(file_header.alignment));
+            file_header.alignment = sbf_le64(file_header.alignment);
+        }
+        if (!sbf_valid_alignment(file_header.alignment)) return read_failure;
+        m_alignment = file_header.alignment;
 
-        if (file_stream.fail() || file_stream.bad()) {
+        // don't trust a count the file can't possibly hold
+        if (file_header.n_datasets > limits::n_datasets_max ||
+            file_header.n_datasets * Dataset::header_size > length) {
+            return read_failure;
+        }
+        std::size_t offset = file_header.size();
+        const std::size_t headers_end = offset + file_header.n_datasets * Dataset::header_size;
+        if (!have(headers_end + (file_header.has_name_index() ? sizeof(sbf_size) : 0))) {
             return read_failure;
         }
+        datasets.resize(file_header.n_datasets);
+        for (auto &dset: datasets) {
+            dset.unpack(headers.data() + offset);
+            offset += Dataset::header_size;
+        }
 
-        size_t offset = Dataset::header_size * file_header.n_datasets + FileHeader::header_size;
-        for (auto i = 0; i < file_header.n_datasets; i++) {
-            Dataset dset;
-            file_stream >> dset;
-            if (file_stream.fail()) {
+        m_name_index.clear();
+        if (file_header.has_name_index()) {
+            sbf_size n_slots = 0;
+            std::memcpy(&n_slots, headers.data() + offset, sizeof(n_slots));
+            n_slots = sbf_le64(n_slots);
+            offset += sizeof(n_slots);
+            if (n_slots > limits::n_datasets_max * 4 ||
+                !have(offset + n_slots * sizeof(sbf_NameSlot))) {
                 return read_failure;
             }
-            dset._offset = offset;
-            m_dataset_names[dset.name()] = static_cast<int>(datasets.size());
-            datasets.push_back(dset);
-            offset += dset.size();
+            m_name_index.resize(n_slots);
+            std::memcpy(m_name_index.data(), headers.data() + offset,
+                        n_slots * sizeof(sbf_NameSlot));
+            sbf_le_words(m_name_index.data(), n_slots * sizeof(sbf_NameSlot), sizeof(uint32_t));
+            if (!sbf_name_index_valid(m_name_index.data(), n_slots, datasets.size())) {
+                return read_failure;
+            }
+            offset += n_slots * sizeof(sbf_NameSlot);
+        } else {
+            // older files have no index, so build it
+            for (std::size_t i = 0; i < datasets.size(); i++) index_name(i);
         }
-        return success;
+        m_data_start = offset;
+        if (m_verify) m_headers_crc = sbf_crc32c(0, headers.data(), offset);
+        m_located = false;
+        return headers_only ? success : locate_datasets();
     }
 
+    /* Has read_headers() been called with 'headers_only', and no data read since? */
+    bool headers_only() const { return !m_located; }
+
     // read a dataset
     template<typename T, class Traits = SBFTypeTraits<T>>
     ResultType read_data(const std::string& dset_name, T *data) {
+        if(locate_datasets() != success) return ResultType::read_failure;
         auto dset = get_dataset(dset_name);
         bool valid = (Traits::type == dset.get_type());
         if(!valid) return ResultType::read_failure;
         if(!is_open()) return ResultType::read_failure;
-        file_stream.seekg(dset._offset);
-        file_stream.read(reinterpret_cast<char*>(data),
-                         static_cast<std::streamsize>(dset.size()));
+        if(dset.is_compressed()) {
+            return read_compressed(dset, reinterpret_cast<char *>(data));
+        }
+        // checksums are of the data as stored, before it is swapped
+        const bool verifying = m_verify && dset._has_crc;
+        if(m_io_threads > 1 && !verifying) {
+            return parallel_io(reinterpret_cast<char *>(data), dset.size(),
+                               data_offset(dset), false,
+                               dset.is_native_endian() ? 0 : dset.swap_width());
+        }
+        if(m_io_threads > 1) {
+            if(parallel_io(reinterpret_cast<char *>(data), dset.size(), data_offset(dset),
+                           false) != success)
+                return ResultType::read_failure;
+        }
+        else if(read_at(reinterpret_cast<char *>(data), dset.size(), data_offset(dset)) != success)
+            return ResultType::read_failure;
+        if(verifying && verify(dset, sbf_crc32c(0, data, dset.size())) != success)
+            return ResultType::checksum_failure;
+        dset.to_host_order(data, dset.size());
         return ResultType::success; 
     }
 
-    // read a dataset
+    /*
+     * Read a whole dataset into a buffer sized to hold it, drawn from
+     * 'pool' if given, e.g. to reuse the memory of earlier reads:
+     *
+     *     sbf::BufferPool pool;
+     *     for (...) {
+     *         auto positions = file.read<sbf::sbf_double>("positions", &pool);
+     *     }
+     *
+     * Returns an empty buffer whose result() says why if the dataset
+     * does not exist, the types do not match or it can't be read.
+     */
     template<typename T, class Traits = SBFTypeTraits<T>>
-    ResultType write_data(const std::string& dset_name, T *data) {
+    DatasetBuffer<T> read(const std::string& dset_name, BufferPool *pool = nullptr) {
+        if(locate_datasets() != success) return DatasetBuffer<T>(read_failure);
+        const int index = find_dataset(dset_name);
+        if(index < 0 || Traits::type != datasets[index].get_type())
+            return DatasetBuffer<T>(read_failure);
+        DatasetBuffer<T> buffer(datasets[index], pool);
+        const ResultType res = read_data<T, Traits>(dset_name, buffer.data());
+        if(res != success) return DatasetBuffer<T>(res);
+        return buffer;
+    }
+
+    /*
+     * Read a hyperslab (N-dimensional sub-block) of a dataset, given the
+     * first index, number of elements and step between elements in each
+     * dimension. 'data' must hold the product of 'count' elements, and
+     * is filled in the same storage order as the dataset.
+     *
+     * Contiguous runs of elements are coalesced into single reads.
+     */
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    ResultType read_hyperslab(const std::string& dset_name,
+                              const sbf_dimensions& start,
+                              const sbf_dimensions& count,
+                              const sbf_dimensions& stride, T *data) {
+        if(locate_datasets() != success) return ResultType::read_failure;
         auto dset = get_dataset(dset_name);
+        if(Traits::type != dset.get_type()) return ResultType::read_failure;
+        if(!is_open() || dset.is_compressed()) return ResultType::read_failure;
+
+        // storage order, slowest varying dimension first
+        const std::size_t dims = dset.get_dimensions();
+        sbf_dimensions shp{{0}}, st{{0}}, cnt{{0}}, str{{0}}, elem_stride{{0}}, idx{{0}};
+        for(std::size_t i = 0; i < dims; i++) {
+            std::size_t d = dset.is_column_major() ? dims - 1 - i : i;
+            shp[i] = dset._shape[d];
+            st[i] = start[d];
+            cnt[i] = count[d];
+            str[i] = stride[d];
+            if(cnt[i] == 0 || str[i] == 0 || st[i] + (cnt[i] - 1) * str[i] >= shp[i])
+                return ResultType::read_failure;
+        }
+        for(std::size_t i = dims; i > 0; i--)
+            elem_stride[i - 1] = (i == dims) ? 1 : elem_stride[i] * shp[i];
+
+        // dimensions [0, outer) are iterated, the rest form a contiguous run
+        std::size_t run = 1, outer = dims;
+        while(outer > 0 && str[outer - 1] == 1) {
+            outer--;
+            run *= cnt[outer];
+            if(cnt[outer] != shp[outer]) break;
+        }
+
+        const std::size_t datatype_size = dset.datatype_size();
+        std::size_t base = data_offset(dset);
+        for(std::size_t i = outer; i < dims; i++)
+            base += st[i] * elem_stride[i] * datatype_size;
+
+        char *dest = reinterpret_cast<char *>(data);
+        const std::size_t run_bytes = run * datatype_size;
+        while(true) {
+            std::size_t offset = base;
+            for(std::size_t i = 0; i < outer; i++)
+                offset += (st[i] + idx[i] * str[i]) * elem_stride[i] * datatype_size;
+            if(read_at(dest, run_bytes, offset) != success) return ResultType::read_failure;
+            dset.to_host_order(dest, run_bytes);
+            dest += run_bytes;
+
+            std::size_t i = outer;
+            for(; i > 0; i--) {
+                if(++idx[i - 1] < cnt[i - 1]) break;
+                idx[i - 1] = 0;
+            }
+            if(i == 0) break;
+        }
+        return ResultType::success;
+    }
+
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    ResultType read_hyperslab(const std::string& dset_name,
+                              const sbf_dimensions& start,
+                              const sbf_dimensions& count, T *data) {
+        sbf_dimensions stride;
+        stride.fill(1);
+        return read_hyperslab<T, Traits>(dset_name, start, count, stride, data);
+    }
+
+    // write a dataset
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    ResultType write_data(const std::string& dset_name, T *data) {
+        lay_out();
+        const int index = find_dataset(dset_name);
+        if(index < 0) return ResultType::write_failure;
+        Dataset &dset = datasets[index];
         bool valid = (Traits::type == dset.get_type());
         if(!valid) return ResultType::write_failure;
-        if(data != nullptr) {
-            file_stream.seekg(dset._offset);
-            std::cout << "File@ " << file_stream.tellg() 
-                << " should be @ " << dset._offset << "\n";
-            file_stream.write(
-                    reinterpret_cast<const char *>(data),
-                    static_cast<std::streamsize>(dset.size()));
+        // the offset isn't known until compressed datasets before it are written
+        for(int i = 0; i < index; i++) {
+            if(datasets[i].is_compressed() && !datasets[i]._written_to_file)
+                return ResultType::write_failure;
+        }
+        if(data != nullptr && !dset.is_compressed()) checksum(dset, data, dset.size());
+        if(data != nullptr && dset.is_compressed()) {
+            auto res = write_compressed(index, reinterpret_cast<const char *>(data));
+            if(res != ResultType::success) return res;
+        }
+        else if(data != nullptr && m_io_threads > 1) {
+            auto res = parallel_io(reinterpret_cast<char *>(const_cast<T *>(data)),
+                                   dset.size(), data_offset(dset), true);
+            if(res != ResultType::success) return res;
+        }
+        else if(data != nullptr) {
+            auto res = write_data_at(reinterpret_cast<const char *>(data), dset.size(),
+                                     data_offset(dset));
+            if(res != ResultType::success) return res;
         }
         dset._written_to_file = true;
         return ResultType::success; 
     }
 
+    /*
+     * Start writing a dataset in the background, returning a handle to wait
+     * on once the computation it overlaps with is done. Headers must already
+     * have been written, and compressed datasets can only use write_data().
+     */
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    AsyncRequest write_async(const std::string& dset_name, const T *data) {
+        lay_out();
+        const int index = find_dataset(dset_name);
+        if(index < 0 || data == nullptr) return AsyncRequest(write_failure);
+        Dataset &dset = datasets[index];
+        if(Traits::type != dset.get_type() || dset.is_compressed())
+            return AsyncRequest(write_failure);
+        for(int i = 0; i < index; i++) {
+            if(datasets[i].is_compressed() && !datasets[i]._written_to_file)
+                return AsyncRequest(write_failure);
+        }
+        // the headers must reach the file before the data goes around the stream
+        if(flush() != success) return AsyncRequest(write_failure);
+        checksum(dset, data, dset.size());
+        AsyncRequest request = submit_async(const_cast<T *>(data), dset.size(),
+                                            data_offset(dset), true, 0);
+        if(request.valid()) dset._written_to_file = true;
+        return request;
+    }
 
+    /*
+     * Start reading a dataset in the background, see write_async(). The
+     * data is in this machine's byte order once the request is ready().
+     */
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    AsyncRequest read_async(const std::string& dset_name, T *data) {
+        if(locate_datasets() != success || data == nullptr) return AsyncRequest(read_failure);
+        auto dset = get_dataset(dset_name);
+        if(Traits::type != dset.get_type() || dset.is_compressed() || !is_open())
+            return AsyncRequest(read_failure);
+        return submit_async(data, dset.size(), data_offset(dset), false,
+                            dset.is_native_endian() ? 0 : dset.swap_width());
+    }
 
-    ResultType add_dataset(Dataset& dset) {
-        // add +1 for this dataset
-        size_t offset = FileHeader::header_size + (datasets.size() + 1) * Dataset::header_size;
-        for(auto& x: datasets) {
-            x._offset = offset; 
-            offset += x.size(); 
+    /*
+     * Backend for the queue read_async/write_async use, which is started
+     * when first needed. Returns the backend in use once it has been.
+     */
+    void set_async_backend(AsyncBackend backend) { m_async_backend = backend; }
+
+    AsyncBackend async_backend() const {
+#ifdef SBF_ASYNC_POSIX
+        if(m_async_queue) return static_cast<AsyncBackend>(m_async_queue->backend);
+#endif
+        return m_async_backend;
+    }
+
+    /*
+     * Stream 'n_slices' slices along the slowest varying dimension of a
+     * dataset directly to their final offset in the file, so that datasets
+     * larger than memory may be written in chunks. Headers must already
+     * have been written.
+     *
+     * Only the last dataset of a file that isn't multi-frame may grow
+     * beyond its declared shape; call finish_dataset() once done to
+     * patch the shape in its header.
+     */
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    ResultType write_chunk(const std::string& dset_name, const T *data,
+                           sbf_size n_slices) {
+        lay_out();
+        const int found = find_dataset(dset_name);
+        if(found < 0) return ResultType::write_failure;
+        std::size_t index = found;
+        Dataset &dset = datasets[index];
+        if(Traits::type != dset.get_type() || dset.is_empty() || dset.is_compressed())
+            return ResultType::write_failure;
+        for(std::size_t i = 0; i < index; i++) {
+            if(datasets[i].is_compressed()) return ResultType::write_failure;
+        }
+        // growing would run into the next frame or the frame index
+        bool may_grow = (index + 1 == datasets.size()) && m_frame_offsets.empty();
+        if(!may_grow && dset._slices_written + n_slices > dset._shape[dset.slowest_dimension()])
+            return ResultType::write_failure;
+        if(write_at(reinterpret_cast<const char *>(data), n_slices * dset.slice_size(),
+                    data_offset(dset) + dset._slices_written * dset.slice_size()) != success) {
+            return ResultType::write_failure;
         }
-        std::cout << "Offset of '" << dset.name() <<  "' data = " << offset << "\n";
-        m_dataset_names[dset.name()] = static_cast<int>(datasets.size());
-        dset._offset = offset;
+        checksum(dset, data, n_slices * dset.slice_size(), dset._slices_written > 0);
+        dset._slices_written += n_slices;
+        return ResultType::success;
+    }
+
+    /*
+     * Finish streaming a dataset with write_chunk(), rewriting its
+     * header if the number of slices written differs from its shape.
+     */
+    ResultType finish_dataset(const std::string& dset_name) {
+        const int found = find_dataset(dset_name);
+        if(found < 0) return ResultType::write_failure;
+        std::size_t index = found;
+        Dataset &dset = datasets[index];
+        sbf_size &slices = dset._shape[dset.slowest_dimension()];
+        if(dset._slices_written != slices) {
+            // the frames of a multi-frame file are all the same shape
+            if(index + 1 != datasets.size() || !m_frame_offsets.empty())
+                return ResultType::write_failure;
+            slices = dset._slices_written;
+            char header[Dataset::header_size];
+            dset.pack(header);
+            if(write_at(header, sizeof(header),
+                        FileHeader::header_size + index * Dataset::header_size) != success) {
+                return ResultType::write_failure;
+            }
+        }
+        dset._written_to_file = true;
+        return flush();
+    }
+
+    ResultType add_dataset(Dataset& dset) {
+        if(datasets.size() >= limits::n_datasets_max) return max_datasets_exceeded_failure;
         datasets.push_back(dset);
+        index_name(datasets.size() - 1);
+        // the headers grew, moving every blob: they're laid out again when next written
+        datasets.back()._offset = dset._offset = data_start() + m_blobs_size;
+        m_blobs_size += sbf_align_up(dset.size(), m_alignment);
+        m_laid_out = false;
+        return success;
+    }
+
+    /*
+     * Pad every blob to start at a multiple of 'alignment' bytes, a power
+     * of two, which is recorded in the file header. With
+     * limits::direct_alignment whole datasets may be written and read with
+     * uncached_io. Must be called before any data is written.
+     */
+    ResultType set_alignment(sbf_size alignment) {
+        if(!sbf_valid_alignment(alignment)) return write_failure;
+        m_alignment = alignment;
+        assign_offsets();
         return success;
     }
 
+    sbf_size alignment() const { return m_alignment; }
+
+    /*
+     * Start a new frame of a multi-frame file (see sbf_frames.h) after
+     * the last, which write_data() etc. then write to. Headers must
+     * already have been written, and close() writes the frame index.
+     * Every frame holds the same datasets, which can't be compressed.
+     */
+    ResultType append_frame() {
+        if(accessmode != writing || datasets.empty()) return write_failure;
+        for(const auto &dset: datasets) {
+            if(dset.is_compressed()) return write_failure;
+        }
+        lay_out();
+        m_frame_offsets.push_back(m_frame_offsets.empty() ? datasets.front()._offset
+                                                          : m_frame_offsets.back() + frame_size());
+        m_frame = m_frame_offsets.size() - 1;
+        m_frames_dirty = true;
+        return success;
+    }
+
+    /* Number of frames in a multi-frame file, 0 for others (whose data is frame 0) */
+    std::size_t n_frames() const { return m_frame_offsets.size(); }
+
+    /* Read (or write) frame 'frame' of a multi-frame file from now on */
+    ResultType set_frame(std::size_t frame) {
+        if(frame > 0 && frame >= m_frame_offsets.size()) return read_failure;
+        m_frame = frame;
+        return success;
+    }
+
+    std::size_t frame() const { return m_frame; }
+
     bool is_open() const {
-        return file_stream.is_open();
+        return m_fd >= 0 || file_stream.is_open();
     }
 
+    IOBackend backend() const { return m_backend; }
+
     std::size_t n_datasets() const {
         return datasets.size();
     }
@@ -481,11 +1592,9 @@ class File {
         return datasets;
     }
 
-    const Dataset get_dataset(std::string name) const {
-        auto search = m_dataset_names.find(name);
-        int index = -1;
-        if(search != m_dataset_names.end()) {
-            index = search->second;
+    const Dataset get_dataset(const std::string &name) const {
+        const int index = find_dataset(name);
+        if(index >= 0) {
             return datasets[index];
         }
         else {
@@ -493,16 +1602,775 @@ class File {
         }
     }
 
+    /* Index of the dataset called 'name', or -1 if there is none */
+    int find_dataset(const std::string &name) const {
+        return static_cast<int>(sbf_name_index_find(m_name_index.data(), m_name_index.size(),
+                                                    name.c_str(), limits::name_length,
+                                                    &File::dataset_name, this));
+    }
+
     const Status status() const { return m_status; }
 
+    /*
+     * Number of threads used by read_data/write_data. With more than
+     * one, datasets are split into ranges of limits::parallel_chunk_size
+     * bytes which are transferred concurrently with pread/pwrite.
+     */
+    void set_io_threads(unsigned n_threads) {
+        m_io_threads = (n_threads == 0) ? std::thread::hardware_concurrency() : n_threads;
+        if(m_io_threads == 0) m_io_threads = 1;
+    }
+
+    unsigned io_threads() const { return m_io_threads; }
+
   private:
+    friend class Checkpoint;
+
+    static const char *dataset_name(const void *file, uint32_t index) {
+        return static_cast<const File *>(file)->datasets[index]._name.data();
+    }
+
+    /* Add dataset 'index' to the name index, growing it if needed */
+    void index_name(std::size_t index) {
+        const std::size_t n_slots = sbf_name_index_slots(index + 1);
+        if(n_slots > m_name_index.size()) {
+            std::vector<sbf_NameSlot> slots(n_slots, sbf_NameSlot{0, 0});
+            sbf_name_index_rehash(m_name_index.data(), m_name_index.size(),
+                                  slots.data(), n_slots, index);
+            m_name_index.swap(slots);
+        }
+        const sbf_string &name = datasets[index]._name;
+        sbf_name_index_insert(m_name_index.data(), m_name_index.size(),
+                              sbf_name_hash(name.data(), name.size()),
+                              static_cast<uint32_t>(index));
+    }
+
+    /* File being written or read, which with set_atomic() is a temporary one */
+    const std::string &path() const { return m_temp.empty() ? filename : m_temp; }
+
+    /* Number of bytes the name index occupies in the file */
+    std::size_t name_index_size() const {
+        return sizeof(sbf_size) + m_name_index.size() * sizeof(sbf_NameSlot);
+    }
+
+    /* Size of the headers of a file being written, up to the padding */
+    std::size_t headers_size() const {
+        return FileHeader::header_size + datasets.size() * Dataset::header_size +
+               name_index_size();
+    }
+
+    /* Offset of the first blob in a file being written */
+    std::size_t data_start() const {
+        return sbf_align_up(headers_size(), m_alignment);
+    }
+
+    /*
+     * With set_checksums(), checksum 'size' bytes of 'data' written as the
+     * blob of 'dset', or with 'more' as the next part of it
+     */
+    void checksum(Dataset &dset, const void *data, std::size_t size, bool more = false) {
+        if(!m_checksums) return;
+        dset._crc = sbf_crc32c(more ? dset._crc : 0, data, size);
+        dset._has_crc = true;
+    }
+
+    /* Does 'crc' match the checksum of the blob of 'dset', if it is to be verified? */
+    ResultType verify(const Dataset &dset, uint32_t crc) const {
+        return (!m_verify || !dset._has_crc || crc == dset._crc) ? success : checksum_failure;
+    }
+
+    /* End of the blob of the last dataset written */
+    std::size_t data_end() const {
+        if(datasets.empty()) return headers_size();
+        const Dataset &last = datasets.back();
+        return last._offset + (last.is_compressed() ? last._stored_size : last.size());
+    }
+
+    /*
+     * End the file with the checksums of its headers and blobs, see
+     * sbf_integrity.h. Every dataset must have been written in whole.
+     */
+    ResultType write_checksums() {
+        if(!m_frame_offsets.empty()) return write_failure;
+        lay_out();
+        std::vector<uint32_t> crcs;
+        for(const auto &dset: datasets) {
+            if(!dset._has_crc) return write_failure;
+            crcs.push_back(dset._crc);
+        }
+        const std::vector<char> headers = pack_headers();
+        sbf_checksums_le(nullptr, crcs.data(), crcs.size());
+        sbf_ChecksumTrailer trailer = sbf_checksum_trailer(
+            sbf_crc32c(0, headers.data(), headers_size()), crcs.data(), crcs.size());
+        sbf_checksums_le(&trailer, nullptr, 0);
+        std::vector<char> footer(crcs.size() * sizeof(uint32_t) + sizeof(trailer));
+        if(!crcs.empty()) std::memcpy(footer.data(), crcs.data(), crcs.size() * sizeof(uint32_t));
+        std::memcpy(footer.data() + crcs.size() * sizeof(uint32_t), &trailer, sizeof(trailer));
+        return write_at(footer.data(), footer.size(), data_end());
+    }
+
+    /*
+     * Read the checksums ending the file of 'length' bytes, whose last
+     * blob ends at 'end', if it has them, and check the headers against them
+     */
+    ResultType read_checksums(std::size_t length, std::size_t end) {
+        for(auto &dset: datasets) dset._has_crc = false;
+        sbf_ChecksumTrailer trailer;
+        if(length < end + sizeof(trailer)) return success;
+        if(read_at(reinterpret_cast<char *>(&trailer), sizeof(trailer),
+                   length - sizeof(trailer)) != success) {
+            return read_failure;
+        }
+        sbf_checksums_le(&trailer, nullptr, 0);
+        const std::size_t table_start = sbf_checksum_table_start(&trailer, length, end,
+                                                                 datasets.size());
+        if(table_start == 0) return success;
+        std::vector<uint32_t> crcs(datasets.size() + 1);
+        if(read_at(reinterpret_cast<char *>(crcs.data()), datasets.size() * sizeof(uint32_t),
+                   table_start) != success) {
+            return read_failure;
+        }
+        if(sbf_crc32c(0, crcs.data(), datasets.size() * sizeof(uint32_t)) != trailer.table_crc ||
+           trailer.headers_crc != m_headers_crc) {
+            return checksum_failure;
+        }
+        sbf_checksums_le(nullptr, crcs.data(), datasets.size());
+        for(std::size_t i = 0; i < datasets.size(); i++) {
+            datasets[i]._crc = crcs[i];
+            datasets[i]._has_crc = true;
+        }
+        return success;
+    }
+
+    /* Lay out the datasets to be written one after the other */
+    void assign_offsets() {
+        const std::size_t start = data_start();
+        m_blobs_size = 0;
+        for(auto& x: datasets) {
+            x._offset = start + m_blobs_size;
+            m_blobs_size += sbf_align_up(x.size(), m_alignment);
+        }
+        m_laid_out = true;
+    }
+
+    /* Lay out the datasets again if any have been added since */
+    void lay_out() {
+        if(!m_laid_out) assign_offsets();
+    }
+
+    /* Size of each frame of a multi-frame file: all the blobs, padded */
+    std::size_t frame_size() const {
+        if(datasets.empty()) return 0;
+        return datasets.back()._offset + sbf_align_up(datasets.back().size(), m_alignment) -
+               datasets.front()._offset;
+    }
+
+    /* Offset of the blob of 'dset' in the current frame */
+    std::size_t data_offset(const Dataset &dset) const {
+        if(m_frame_offsets.empty()) return dset._offset;
+        return dset._offset + m_frame_offsets[m_frame] - m_frame_offsets.front();
+    }
+
+    /* Write the frame index after the last frame */
+    ResultType write_frame_index() {
+        sbf_FrameTrailer trailer = sbf_frame_trailer(m_frame_offsets.size());
+        const std::size_t index_size = m_frame_offsets.size() * sizeof(sbf_size);
+        std::vector<char> footer(index_size + sizeof(trailer));
+        std::memcpy(footer.data(), m_frame_offsets.data(), index_size);
+        sbf_frame_index_le(&trailer, reinterpret_cast<uint64_t *>(footer.data()),
+                           m_frame_offsets.size());
+        std::memcpy(footer.data() + index_size, &trailer, sizeof(trailer));
+        if(write_at(footer.data(), footer.size(), m_frame_offsets.back() + frame_size()) != success)
+            return write_failure;
+        m_frames_dirty = false;
+        return success;
+    }
+
+    /*
+     * Read the frame index, if this is a multi-frame file. The index ends
+     * the file, so it is only looked for in files longer than one frame
+     * of uncompressed datasets.
+     */
+    ResultType read_frame_index() {
+        m_frame_offsets.clear();
+        m_frame = 0;
+        for(const auto &dset: datasets) {
+            if(dset.is_compressed()) return success;
+        }
+        const std::size_t length = file_size();
+        const std::size_t start = datasets.empty() ? 0 : datasets.front()._offset;
+        sbf_FrameTrailer trailer;
+        if(frame_size() == 0 || length < start + frame_size() + sizeof(trailer)) return success;
+        if(read_at(reinterpret_cast<char *>(&trailer), sizeof(trailer),
+                   length - sizeof(trailer)) != success) {
+            return read_failure;
+        }
+        sbf_frame_index_le(&trailer, nullptr, 0);
+        const std::size_t index_start = sbf_frame_index_start(&trailer, length, start, frame_size());
+        if(index_start == 0) return success;
+        std::vector<sbf_size> offsets(trailer.n_frames);
+        if(read_at(reinterpret_cast<char *>(offsets.data()), offsets.size() * sizeof(sbf_size),
+                   index_start) != success) {
+            return read_failure;
+        }
+        sbf_frame_index_le(nullptr, offsets.data(), offsets.size());
+        if(!sbf_frame_index_valid(offsets.data(), offsets.size(), start, frame_size(),
+                                  index_start, m_alignment)) {
+            return read_failure;
+        }
+        m_frame_offsets.swap(offsets);
+        return success;
+    }
+
+    /*
+     * Pack the file header, data headers and name index into one
+     * buffer, padded out to the start of the first blob, with every
+     * integer little endian.
+     */
+    std::vector<char> pack_headers() const {
+        FileHeader file_header;
+        file_header.n_datasets = sbf_le64(datasets.size());
+        file_header.alignment = sbf_le64(m_alignment);
+        const sbf_size n_slots = sbf_le64(m_name_index.size());
+        std::vector<char> headers(data_start());
+        char *out = headers.data();
+        std::memcpy(out, file_header.token_version_string.data(),
+                    sizeof(file_header.token_version_string));
+        out += sizeof(file_header.token_version_string);
+        std::memcpy(out, &file_header.n_datasets, sizeof(file_header.n_datasets));
+        out += sizeof(file_header.n_datasets);
+        std::memcpy(out, &file_header.alignment, sizeof(file_header.alignment));
+        out += sizeof(file_header.alignment);
+        for (const auto &dset : datasets) out = dset.pack(out);
+        std::memcpy(out, &n_slots, sizeof(n_slots));
+        out += sizeof(n_slots);
+        std::memcpy(out, m_name_index.data(), m_name_index.size() * sizeof(sbf_NameSlot));
+        sbf_le_words(out, m_name_index.size() * sizeof(sbf_NameSlot), sizeof(uint32_t));
+        return headers;
+    }
+
+#ifdef SBF_POSIX
+    /* pread or pwrite all 'length' bytes at 'ptr', retrying short transfers */
+    static bool transfer(int fd, char *ptr, std::size_t length, std::size_t offset, bool write) {
+        off_t pos = static_cast<off_t>(offset);
+        while(length > 0) {
+            ssize_t n = write ? ::pwrite(fd, ptr, length, pos) : ::pread(fd, ptr, length, pos);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            ptr += n;
+            pos += n;
+            length -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    /* As above, but bypassing the page cache through 'direct_fd' if it is open */
+    static bool transfer(int fd, int direct_fd, char *ptr, std::size_t length,
+                         std::size_t offset, bool write) {
+#ifdef SBF_O_DIRECT
+        if(direct_fd >= 0) return sbf_direct_transfer(fd, direct_fd, ptr, length, offset, write) == 0;
+#endif
+        return transfer(fd, ptr, length, offset, write);
+    }
+
+    /* The O_DIRECT descriptor, if open and usable at 'offset', otherwise -1 */
+    int uncached_fd(std::size_t offset) const {
+        return (offset % limits::direct_alignment == 0) ? m_direct_fd : -1;
+    }
+#endif
+
+    /* Write 'size' bytes of 'data' at 'offset' in the file */
+    ResultType write_at(const char *data, std::size_t size, std::size_t offset) {
+        if(flush_headers() != success) return write_failure;
+#ifdef SBF_POSIX
+        if(m_fd >= 0) {
+            return transfer(m_fd, uncached_fd(offset), const_cast<char *>(data), size, offset,
+                            true) ? success : write_failure;
+        }
+#endif
+        file_stream.seekp(offset);
+        file_stream.write(data, static_cast<std::streamsize>(size));
+        return file_stream ? success : write_failure;
+    }
+
+    /* Read 'size' bytes at 'offset' in the file into 'data' */
+    ResultType read_at(char *data, std::size_t size, std::size_t offset) {
+#ifdef SBF_POSIX
+        if(m_fd >= 0) {
+            return transfer(m_fd, uncached_fd(offset), data, size, offset, false) ? success
+                                                                                  : read_failure;
+        }
+#endif
+        file_stream.seekg(offset);
+        file_stream.read(data, static_cast<std::streamsize>(size));
+        return file_stream ? success : read_failure;
+    }
+
+    /*
+     * Write the data of a dataset at 'offset'. If headers deferred by
+     * write_headers() end there, both are written with one pwritev.
+     */
+    ResultType write_data_at(const char *data, std::size_t size, std::size_t offset) {
+#ifdef SBF_POSIX
+        if(m_fd >= 0 && m_direct_fd < 0 && !m_pending_headers.empty() &&
+           m_pending_headers.size() == offset) {
+            std::vector<char> headers;
+            headers.swap(m_pending_headers);
+            struct iovec iov[2] = {{headers.data(), headers.size()},
+                                   {const_cast<char *>(data), size}};
+            ssize_t n;
+            do {
+                n = ::pwritev(m_fd, iov, 2, 0);
+            } while(n < 0 && errno == EINTR);
+            if(n < 0) return write_failure;
+            // finish off a short write
+            std::size_t written = static_cast<std::size_t>(n);
+            if(written < offset &&
+               !transfer(m_fd, headers.data() + written, offset - written, written, true)) {
+                return write_failure;
+            }
+            std::size_t data_written = (written > offset) ? written - offset : 0;
+            return transfer(m_fd, const_cast<char *>(data) + data_written, size - data_written,
+                            offset + data_written, true) ? success : write_failure;
+        }
+#endif
+        return write_at(data, size, offset);
+    }
+
+    /* Write headers deferred by write_headers(), if any */
+    ResultType flush_headers() {
+        if(m_pending_headers.empty()) return success;
+        std::vector<char> headers;
+        headers.swap(m_pending_headers);
+        return write_at(headers.data(), headers.size(), 0);
+    }
+
+    /* Make sure everything written so far has reached the file */
+    ResultType flush() {
+        if(flush_headers() != success) return write_failure;
+        if(file_stream.is_open()) file_stream.flush();
+        return file_stream ? success : write_failure;
+    }
+
+    /* Size of the file in bytes, or 0 if it can't be found */
+    /*
+     * Find where the data of each dataset starts, which for compressed
+     * datasets means reading their chunk indexes, and with set_verify()
+     * read the checksums. Only done once.
+     */
+    ResultType locate_datasets() {
+        if(m_located) return success;
+        std::size_t offset = sbf_align_up(m_data_start, m_alignment);
+        for(auto& dset: datasets) {
+            dset._offset = offset;
+            dset._stored_size = dset.size();
+            if(dset.is_compressed()) {
+                sbf_ChunkIndexHeader index;
+                std::vector<sbf_size> chunk_offsets;
+                if(read_chunk_index(dset, index, chunk_offsets) != success) {
+                    return read_failure;
+                }
+                dset._stored_size = chunk_table_size(index) + chunk_offsets.back();
+                dset._codec = index.codec;
+                dset._filters = index.filters;
+            }
+            offset += sbf_align_up(dset._stored_size, m_alignment);
+        }
+        // a writer killed part way through leaves the file short
+        const std::size_t length = file_size();
+        const std::size_t end = datasets.empty() ? m_data_start : data_end();
+        if(length < end) return read_failure;
+        if(read_frame_index() != success) return read_failure;
+        if(m_verify && m_frame_offsets.empty()) {
+            ResultType res = read_checksums(length, end);
+            if(res != success) return res;
+        }
+        m_located = true;
+        return success;
+    }
+
+    std::size_t file_size() {
+#ifdef SBF_POSIX
+        struct stat st;
+        if(m_fd >= 0) return (fstat(m_fd, &st) == 0) ? static_cast<std::size_t>(st.st_size) : 0;
+#endif
+        const auto position = file_stream.tellg();
+        file_stream.seekg(0, std::ios::end);
+        const auto end = file_stream.tellg();
+        file_stream.seekg(position);
+        return (end > 0) ? static_cast<std::size_t>(end) : 0;
+    }
+
+    static std::size_t chunk_table_size(const sbf_ChunkIndexHeader &index) {
+        return sizeof(index) + (index.n_chunks + 1) * sizeof(sbf_size);
+    }
+
+    /*
+     * Read the chunk index of compressed dataset 'dset', and if 'crc'
+     * isn't null the checksum of the index as stored (little endian)
+     */
+    ResultType read_chunk_index(const Dataset &dset, sbf_ChunkIndexHeader &index,
+                                std::vector<sbf_size> &chunk_offsets, uint32_t *crc = nullptr) {
+        if(read_at(reinterpret_cast<char *>(&index), sizeof(index), dset._offset) != success)
+            return read_failure;
+        if(crc) *crc = sbf_crc32c(0, &index, sizeof(index));
+        sbf_chunk_index_le(&index, nullptr, 0);
+        if(index.chunk_size == 0) return read_failure;
+        chunk_offsets.resize(index.n_chunks + 1);
+        const std::size_t size = chunk_offsets.size() * sizeof(sbf_size);
+        if(read_at(reinterpret_cast<char *>(chunk_offsets.data()), size,
+                   dset._offset + sizeof(index)) != success) {
+            return read_failure;
+        }
+        if(crc) *crc = sbf_crc32c(*crc, chunk_offsets.data(), size);
+        sbf_le_words(chunk_offsets.data(), size, sizeof(sbf_size));
+        return success;
+    }
+
+    /*
+     * Read all the chunks of a compressed dataset in one go, then
+     * decode them (concurrently if io_threads() > 1).
+     */
+    ResultType read_compressed(const Dataset &dset, char *data) {
+        sbf_ChunkIndexHeader index;
+        std::vector<sbf_size> chunk_offsets;
+        uint32_t crc = 0;
+        if(read_chunk_index(dset, index, chunk_offsets, &crc) != success) return read_failure;
+        std::vector<char> stored(chunk_offsets.back());
+        if(read_at(stored.data(), stored.size(), dset._offset + chunk_table_size(index)) != success)
+            return read_failure;
+        if(m_verify && dset._has_crc) {
+            if(verify(dset, sbf_crc32c(crc, stored.data(), stored.size())) != success)
+                return checksum_failure;
+        }
+
+        const std::size_t total = dset.size();
+        std::atomic<std::size_t> next(0);
+        std::atomic<bool> failed(false);
+        auto worker = [&]() {
+            std::vector<uint8_t> scratch(index.chunk_size);
+            for(std::size_t i = next++; i < index.n_chunks && !failed; i = next++) {
+                std::size_t start = i * index.chunk_size;
+                std::size_t stored_size = chunk_offsets[i + 1] - chunk_offsets[i];
+                if(start >= total || chunk_offsets[i + 1] < chunk_offsets[i]) {
+                    failed = true;
+                    break;
+                }
+                std::size_t n = std::min<std::size_t>(index.chunk_size, total - start);
+                if(stored_size > n || sbf_decode_chunk(index.codec, index.filters, dset.datatype_size(),
+                        reinterpret_cast<const uint8_t *>(stored.data()) + chunk_offsets[i],
+                        stored_size, reinterpret_cast<uint8_t *>(data) + start, n,
+                        scratch.data()) != 0) {
+                    failed = true;
+                    break;
+                }
+                dset.to_host_order(data + start, n);
+            }
+        };
+        std::vector<std::thread> threads;
+        for(std::size_t t = 1; t < std::min<std::size_t>(m_io_threads, index.n_chunks); t++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for(auto &thread: threads) thread.join();
+        return failed ? read_failure : success;
+    }
+
+    /*
+     * Compress dataset 'index' from 'data' into chunks, write them and
+     * shift the offsets of all following datasets by the change in size.
+     */
+    ResultType write_compressed(std::size_t index, const char *data) {
+        Dataset &dset = datasets[index];
+        const std::size_t elem = dset.datatype_size();
+        const std::size_t total = dset.size();
+        sbf_ChunkIndexHeader chunk_index = {dset._codec, dset._filters, {0}, 0, 0};
+        chunk_index.chunk_size = (SBF_COMPRESSION_CHUNK_SIZE / elem) * elem;
+        chunk_index.n_chunks = (total + chunk_index.chunk_size - 1) / chunk_index.chunk_size;
+
+        std::vector<sbf_size> chunk_offsets(chunk_index.n_chunks + 1, 0);
+        std::vector<uint8_t> chunks, buffer(2 * chunk_index.chunk_size);
+        for(std::size_t i = 0; i < chunk_index.n_chunks; i++) {
+            std::size_t start = i * chunk_index.chunk_size;
+            std::size_t n = std::min<std::size_t>(chunk_index.chunk_size, total - start);
+            std::size_t stored = sbf_encode_chunk(chunk_index.codec, chunk_index.filters, elem,
+                    reinterpret_cast<const uint8_t *>(data) + start, n,
+                    buffer.data(), buffer.data() + chunk_index.chunk_size);
+            chunks.insert(chunks.end(), buffer.begin(), buffer.begin() + stored);
+            chunk_offsets[i + 1] = chunk_offsets[i] + stored;
+        }
+
+        const std::size_t table_size = chunk_table_size(chunk_index);
+        // the index is stored, and checksummed, little endian
+        sbf_chunk_index_le(&chunk_index, chunk_offsets.data(), chunk_offsets.size());
+        checksum(dset, &chunk_index, sizeof(chunk_index));
+        checksum(dset, chunk_offsets.data(), chunk_offsets.size() * sizeof(sbf_size), true);
+        checksum(dset, chunks.data(), chunks.size(), true);
+        if(write_at(reinterpret_cast<const char *>(&chunk_index), sizeof(chunk_index),
+                    dset._offset) != success ||
+           write_at(reinterpret_cast<const char *>(chunk_offsets.data()),
+                    chunk_offsets.size() * sizeof(sbf_size),
+                    dset._offset + sizeof(chunk_index)) != success ||
+           write_at(reinterpret_cast<const char *>(chunks.data()), chunks.size(),
+                    dset._offset + table_size) != success) {
+            return write_failure;
+        }
+
+        dset._stored_size = table_size + chunks.size();
+        for(std::size_t i = index + 1; i < datasets.size(); i++) {
+            datasets[i]._offset = datasets[i]._offset + sbf_align_up(dset._stored_size, m_alignment) -
+                                  sbf_align_up(total, m_alignment);
+        }
+        return success;
+    }
+
+    /* Submit a transfer to the asynchronous queue, starting it if need be */
+    AsyncRequest submit_async(void *data, std::size_t size, std::size_t offset, bool write,
+                              std::size_t swap_width) {
+        const ResultType failure = write ? write_failure : read_failure;
+        AsyncRequest request(failure);
+#ifdef SBF_ASYNC_POSIX
+        if(!m_async_queue) {
+            AsyncQueue queue(new sbf_IOQueue, [](sbf_IOQueue *q) {
+                sbf_io_queue_destroy(q);
+                delete q;
+            });
+            if(sbf_io_queue_init(queue.get(), m_async_backend, 0, m_io_threads) != 0) {
+                return request;
+            }
+            m_async_queue = queue;
+        }
+        // stream_io has no descriptor of its own
+        int fd = m_fd;
+        if(fd < 0 && m_async_fd < 0) {
+            m_async_fd = ::open(path().c_str(), (accessmode == writing) ? O_WRONLY : O_RDONLY);
+        }
+        if(fd < 0) fd = m_async_fd;
+        if(fd < 0) return request;
+        if(uncached_fd(offset) >= 0 && size % limits::direct_alignment == 0 &&
+           reinterpret_cast<std::uintptr_t>(data) % limits::direct_alignment == 0) {
+            fd = m_direct_fd;
+        }
+        request.m_queue = m_async_queue;
+        request.m_request.reset(new sbf_IORequest);
+        sbf_io_prepare(request.m_request.get(), fd, data, size, offset, write, swap_width);
+        if(sbf_io_queue_submit(m_async_queue.get(), request.m_request.get()) != 0) {
+            request.m_request.reset();
+        }
+#endif
+        return request;
+    }
+
+    /*
+     * Transfer 'size' bytes between 'data' and 'offset' in the file with
+     * m_io_threads threads; read ranges are byte swapped in words of
+     * 'swap_width' bytes (if more than 1) while still in cache.
+     */
+    ResultType parallel_io(char *data, std::size_t size, std::size_t offset, bool write,
+                           std::size_t swap_width = 0) {
+        const ResultType failure = write ? write_failure : read_failure;
+#ifdef SBF_POSIX
+        // anything buffered must be on disk before we bypass it
+        if(flush() != success) return failure;
+        int fd = ::open(path().c_str(), write ? O_WRONLY : O_RDONLY);
+        if(fd < 0) return failure;
+        int direct_fd = -1;
+#ifdef SBF_O_DIRECT
+        if(uncached_fd(offset) >= 0)
+            direct_fd = ::open(path().c_str(), (write ? O_WRONLY : O_RDONLY) | O_DIRECT);
+#endif
+
+        const std::size_t chunk = limits::parallel_chunk_size;
+        const std::size_t n_chunks = (size + chunk - 1) / chunk;
+        std::atomic<std::size_t> next(0);
+        std::atomic<bool> failed(false);
+        auto worker = [&]() {
+            for(std::size_t i = next++; i < n_chunks && !failed; i = next++) {
+                std::size_t start = i * chunk;
+                std::size_t length = std::min(chunk, size - start);
+                if(!transfer(fd, direct_fd, data + start, length, offset + start, write)) {
+                    failed = true;
+                    break;
+                }
+                if(!write) sbf_byteswap(data + start, length, swap_width);
+            }
+        };
+        std::vector<std::thread> threads;
+        for(std::size_t t = 1; t < std::min<std::size_t>(m_io_threads, n_chunks); t++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for(auto &thread: threads) thread.join();
+        if(direct_fd >= 0) ::close(direct_fd);
+        ::close(fd);
+        return failed ? failure : success;
+#else
+        return failure;
+#endif
+    }
+
     std::fstream file_stream;
-    AccessMode accessmode;
+    AccessMode accessmode = reading;
     std::string filename;
-    Status m_status;
-    std::map<std::string, int> m_dataset_names;
+    Status m_status = Closed;
+    std::vector<sbf_NameSlot> m_name_index;
     Dataset empty;
     std::vector<Dataset> datasets;
+    const sbf_byte *m_map = nullptr;
+    std::size_t m_map_size = 0;
+    unsigned m_io_threads = 1;
+    IOBackend m_backend = stream_io;
+    int m_fd = -1;                       // with direct_io
+    int m_direct_fd = -1;                // opened with O_DIRECT, with uncached_io
+    AsyncBackend m_async_backend = async_auto;
+#ifdef SBF_ASYNC_POSIX
+    AsyncQueue m_async_queue;            // started by the first read_async/write_async
+    int m_async_fd = -1;                 // for them, with stream_io
+#endif
+    sbf_size m_alignment = 1;            // of the blobs, see set_alignment()
+    std::size_t m_data_start = 0;        // end of the headers read
+    bool m_located = true;               // are dataset offsets known?
+    bool m_laid_out = true;              // are they, for the datasets added?
+    std::size_t m_blobs_size = 0;        // padded size of the blobs added
+    std::vector<sbf_size> m_frame_offsets; // of a multi-frame file, see append_frame()
+    std::size_t m_frame = 0;             // being read or written
+    bool m_frames_dirty = false;         // has the frame index to be written?
+    std::vector<char> m_pending_headers; // deferred by write_headers()
+    bool m_atomic = false;               // see set_atomic()
+    std::string m_temp;                  // being written, to be committed by close()
+    bool m_checksums = false;            // see set_checksums()
+    bool m_verify = false;               // see set_verify()
+    uint32_t m_headers_crc = 0;          // of the headers read, with m_verify
+};
+
+/*
+ * Writes files holding the same datasets over and over, e.g. a
+ * checkpoint every N timesteps, see sbf_checkpoint.h. The headers and
+ * offsets are worked out once from the datasets added to a File, and
+ * each checkpoint is then written with a single gathered write:
+ *
+ *     sbf::Checkpoint checkpoint(layout);
+ *     checkpoint.set_data("positions", positions.data());
+ *     for (...) {
+ *         step(positions);
+ *         checkpoint.swap("state.sbf", "state.sbf.spare");
+ *     }
+ */
+class Checkpoint {
+  public:
+    Checkpoint() {}
+
+    /*
+     * Lay out the datasets added to 'layout', which need not be open.
+     * Compressed datasets vary in size, so can't be checkpointed: the
+     * checkpoint is then not valid().
+     */
+    explicit Checkpoint(File &layout) {
+        layout.lay_out();
+        for (const auto &dset : layout.datasets) {
+            if (dset.is_compressed()) return;
+        }
+        m_datasets = layout.datasets;
+        m_name_index = layout.m_name_index;
+        m_data.assign(m_datasets.size(), nullptr);
+        m_padding.assign(layout.m_alignment, 0);
+        m_headers = layout.pack_headers();
+        m_file_size = m_headers.size();
+        if (!m_datasets.empty()) m_file_size = m_datasets.back()._offset + m_datasets.back().size();
+#ifdef SBF_CHECKPOINT_POSIX
+        m_iov.resize(2 * m_datasets.size() + 1);
+#endif
+    }
+
+    bool valid() const { return !m_headers.empty(); }
+
+    /*
+     * Write dataset 'dset_name' from 'data' in the checkpoints that
+     * follow. With nullptr (the default) it is left unwritten: a hole in
+     * new files, and whatever the previous checkpoint held in a spare.
+     */
+    template<typename T, class Traits = SBFTypeTraits<T>>
+    ResultType set_data(const std::string &dset_name, const T *data) {
+        const int index = static_cast<int>(sbf_name_index_find(
+            m_name_index.data(), m_name_index.size(), dset_name.c_str(), limits::name_length,
+            &Checkpoint::dataset_name, this));
+        if (index < 0 || Traits::type != m_datasets[index].get_type()) return write_failure;
+        m_data[index] = data;
+        return success;
+    }
+
+    /* Write a complete checkpoint to a new file 'filename', replacing any of that name */
+    ResultType write(const std::string &filename) { return write_file(filename, false); }
+
+    /*
+     * Double buffered checkpointing: write over the checkpoint held by
+     * 'spare', then atomically exchange it with 'filename', so readers
+     * of 'filename' only ever see a complete checkpoint. 'spare' is
+     * left with the previous one, to be overwritten next time.
+     */
+    ResultType swap(const std::string &filename, const std::string &spare) {
+        if (write_file(spare, true) != success) return write_failure;
+        return sbf_replace_file(spare.c_str(), filename.c_str()) == 0 ? success : write_failure;
+    }
+
+  private:
+    static const char *dataset_name(const void *checkpoint, uint32_t index) {
+        return static_cast<const Checkpoint *>(checkpoint)->m_datasets[index]._name.data();
+    }
+
+    /* Write the checkpoint to 'filename', in place if 'reuse' */
+    ResultType write_file(const std::string &filename, bool reuse) {
+        if (!valid()) return write_failure;
+#ifdef SBF_CHECKPOINT_POSIX
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | (reuse ? 0 : O_TRUNC), 0644);
+        if (fd < 0) return file_open_failure;
+        bool ok = true;
+        int n_iov = 1;
+        std::size_t start = 0, end = m_headers.size();
+        m_iov[0] = {m_headers.data(), m_headers.size()};
+        for (std::size_t i = 0; i < m_datasets.size(); i++) {
+            const Dataset &dset = m_datasets[i];
+            if (m_data[i] == nullptr) {
+                // leave a hole, so write the run before it
+                if (n_iov > 0) ok = ok && sbf_write_gather(fd, m_iov.data(), n_iov, start) == 0;
+                n_iov = 0;
+                continue;
+            }
+            if (n_iov == 0) start = end = dset._offset;
+            if (dset._offset > end) m_iov[n_iov++] = {m_padding.data(), dset._offset - end};
+            if (dset.size() > 0) m_iov[n_iov++] = {const_cast<void *>(m_data[i]), dset.size()};
+            end = dset._offset + dset.size();
+        }
+        if (n_iov > 0) ok = ok && sbf_write_gather(fd, m_iov.data(), n_iov, start) == 0;
+        if (ok && (reuse || end != m_file_size))
+            ok = ::ftruncate(fd, static_cast<off_t>(m_file_size)) == 0;
+        if (::close(fd) != 0 && ok) return file_close_failure;
+        return ok ? success : write_failure;
+#else
+        (void)reuse;
+        std::ofstream out(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!out.is_open()) return file_open_failure;
+        out.write(m_headers.data(), static_cast<std::streamsize>(m_headers.size()));
+        for (std::size_t i = 0; i < m_datasets.size(); i++) {
+            if (m_data[i] == nullptr) continue;
+            out.seekp(m_datasets[i]._offset);
+            out.write(static_cast<const char *>(m_data[i]),
+                      static_cast<std::streamsize>(m_datasets[i].size()));
+        }
+        out.close();
+        return out ? success : write_failure;
+#endif
+    }
+
+    std::vector<char> m_headers;         // packed, and padded to the first blob
+    std::vector<Dataset> m_datasets;
+    std::vector<sbf_NameSlot> m_name_index;
+    std::vector<const void *> m_data;    // to write for each dataset, or nullptr
+    std::vector<char> m_padding;         // zeros, for the gaps between aligned blobs
+    std::size_t m_file_size = 0;
+#ifdef SBF_CHECKPOINT_POSIX
+    std::vector<struct iovec> m_iov;     // room for every blob and gap
+#endif
 };
 
 }
@@ -0,0 +1,111 @@
+#pragma once
+/*
+ * sbf_arena.h
+ *
+ * Bump allocator for reading datasets in batches, used by sbf.h and
+ * sbftool.
+ *
+ * An arena is a single allocation, sized up front (e.g. from the
+ * headers of a file, to hold all of its datasets) and handed out in
+ * pieces by bumping an offset. Pieces aren't freed one at a time:
+ * reserving the arena again releases them all, and it keeps its memory
+ * unless it needs to grow. Reading file after file into one arena then
+ * costs a handful of allocations rather than one per dataset, and the
+ * pages it has already touched aren't faulted in again.
+ *
+ * The memory is not zeroed. Arenas of SBF_ARENA_HUGE_PAGE bytes or more
+ * are mapped directly and, where the system has them, marked for
+ * transparent huge pages.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "sbf_direct.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SBF_ARENA_MMAP 1
+#include <sys/mman.h>
+#endif
+
+// alignment of every piece, a cache line
+#define SBF_ARENA_ALIGNMENT 64
+// arenas at least this large are mapped, in multiples of it
+#define SBF_ARENA_HUGE_PAGE (2 * 1024 * 1024)
+
+typedef struct {
+    uint8_t *base;
+    size_t capacity;
+    size_t used;
+    int mapped; // 'base' is from mmap rather than sbf_aligned_alloc
+} sbf_Arena;
+
+static const sbf_Arena sbf_new_arena = {NULL, 0, 0, 0};
+
+/*
+ * Bytes of an arena taken by a piece of 'size' bytes
+ */
+size_t sbf_arena_padded(size_t size) {
+    return (size_t)sbf_align_up(size ? size : 1, SBF_ARENA_ALIGNMENT);
+}
+
+/*
+ * Release the memory of 'arena', leaving it empty
+ */
+void sbf_arena_free(sbf_Arena *arena) {
+#ifdef SBF_ARENA_MMAP
+    if (arena->mapped)
+        munmap(arena->base, arena->capacity);
+    else
+#endif
+        sbf_aligned_free(arena->base);
+    *arena = sbf_new_arena;
+}
+
+/*
+ * Release every piece of 'arena' and make sure it can hold 'size' bytes
+ * of pieces (see sbf_arena_padded), growing it if need be. Returns 0 on
+ * success, -1 on failure (leaving the arena empty).
+ */
+int sbf_arena_reserve(sbf_Arena *arena, size_t size) {
+    arena->used = 0;
+    if (size <= arena->capacity)
+        return 0;
+    // grow by half again at least, so slowly growing sizes rarely reallocate
+    size_t capacity = arena->capacity + arena->capacity / 2;
+    if (capacity < size)
+        capacity = size;
+    sbf_arena_free(arena);
+#ifdef SBF_ARENA_MMAP
+    if (capacity >= SBF_ARENA_HUGE_PAGE) {
+        capacity = (size_t)sbf_align_up(capacity, SBF_ARENA_HUGE_PAGE);
+        void *base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return -1;
+#ifdef MADV_HUGEPAGE
+        madvise(base, capacity, MADV_HUGEPAGE);
+#endif
+        arena->base = (uint8_t *)base;
+        arena->capacity = capacity;
+        arena->mapped = 1;
+        return 0;
+    }
+#endif
+    arena->base = (uint8_t *)sbf_aligned_alloc(capacity);
+    if (arena->base == NULL)
+        return -1;
+    arena->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Take 'size' bytes from 'arena', aligned to SBF_ARENA_ALIGNMENT.
+ * Returns NULL if they weren't reserved.
+ */
+void *sbf_arena_alloc(sbf_Arena *arena, size_t size) {
+    const size_t padded = sbf_arena_padded(size);
+    if (padded < size || padded > arena->capacity - arena->used)
+        return NULL;
+    void *ptr = arena->base + arena->used;
+    arena->used += padded;
+    return ptr;
+}
@@ -0,0 +1,413 @@
+#pragma once
+/*
+ * sbf_async.h
+ *
+ * Asynchronous reads and writes of dataset blobs, shared by sbf.h and
+ * sbf.hpp, so that I/O can overlap with computation.
+ *
+ * A request (sbf_IORequest) moves a contiguous range of bytes between
+ * memory and a file descriptor. It is submitted to a queue
+ * (sbf_IOQueue), then polled or waited on. The caller must keep the
+ * request and its buffer alive, and not touch the buffer, until the
+ * request has completed.
+ *
+ * There are two backends:
+ * - io_uring, on Linux. It is used through the raw system calls, so
+ *   liburing is not needed, and one thread can keep any number of
+ *   requests in flight.
+ * - A pool of pthreads doing pread/pwrite. This is the fallback where
+ *   io_uring is missing or not allowed (e.g. by a seccomp filter).
+ *
+ * An io_uring queue must only be used from one thread at a time. The
+ * thread pool may be used from any number of threads.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sbf_byteswap.h"
+#include "sbf_direct.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SBF_ASYNC_POSIX 1
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#if defined(__linux__) && !defined(SBF_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SBF_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#ifdef SBF_ASYNC_POSIX
+
+// which backend a queue uses; SBF_IO_AUTO picks io_uring if it can
+#define SBF_IO_AUTO 0
+#define SBF_IO_URING_BACKEND 1
+#define SBF_IO_THREADS 2
+
+// state of a request
+#define SBF_IO_PENDING 0
+#define SBF_IO_COMPLETE 1
+#define SBF_IO_FAILED 2
+
+// default number of requests in flight, and of threads in the pool
+#define SBF_IO_QUEUE_DEPTH 64
+#define SBF_IO_THREADS_DEFAULT 4
+// largest single transfer handed to io_uring, the rest is resubmitted
+#define SBF_IO_MAX_TRANSFER (1u << 30)
+
+typedef struct sbf_IORequest {
+    int fd;
+    uint8_t *data;
+    uint64_t size;
+    uint64_t offset;
+    int write;
+    size_t swap_width;          // reads are byte swapped in words of this, if > 1
+    uint64_t done;              // bytes transferred so far
+    int state;                  // SBF_IO_PENDING etc., read with sbf_io_state
+    struct iovec iov;           // the range in flight, with io_uring
+    struct sbf_IORequest *next; // queued for the thread pool
+} sbf_IORequest;
+
+typedef struct {
+    int backend;
+#ifdef SBF_IO_URING
+    int ring_fd;
+    unsigned cq_entries, in_flight;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+#endif
+    pthread_t *threads;
+    int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    sbf_IORequest *head, *tail; // waiting for a thread
+    int stopping;
+} sbf_IOQueue;
+
+/*
+ * Set up 'request' to read or write 'size' bytes of 'data' at 'offset'
+ * in 'fd', byte swapping read data in words of 'swap_width' bytes
+ */
+void sbf_io_prepare(sbf_IORequest *request, int fd, void *data, uint64_t size,
+                    uint64_t offset, int write, size_t swap_width) {
+    memset(request, 0, sizeof(*request));
+    request->fd = fd;
+    request->data = (uint8_t *)data;
+    request->size = size;
+    request->offset = offset;
+    request->write = write;
+    request->swap_width = swap_width;
+    request->state = SBF_IO_PENDING;
+}
+
+int sbf_io_state(const sbf_IORequest *request) {
+    return __atomic_load_n(&request->state, __ATOMIC_ACQUIRE);
+}
+
+void sbf_io_finish(sbf_IORequest *request, int state) {
+    if (state == SBF_IO_COMPLETE && !request->write)
+        sbf_byteswap(request->data, request->size, request->swap_width);
+    __atomic_store_n(&request->state, state, __ATOMIC_RELEASE);
+}
+
+#ifdef SBF_IO_URING
+int sbf_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/*
+ * Set up an io_uring with room for 'depth' requests. Returns 0, or -1
+ * if io_uring isn't available.
+ */
+int sbf_io_uring_init(sbf_IOQueue *queue, unsigned depth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    queue->ring_fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (queue->ring_fd < 0)
+        return -1;
+    queue->cq_entries = params.cq_entries;
+    queue->in_flight = 0;
+    queue->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    queue->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    queue->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (queue->cq_ring_size > queue->sq_ring_size)
+            queue->sq_ring_size = queue->cq_ring_size;
+        queue->cq_ring_size = 0;
+    }
+    queue->sq_ring = mmap(NULL, queue->sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, queue->ring_fd, IORING_OFF_SQ_RING);
+    queue->cq_ring = queue->sq_ring;
+    if (queue->sq_ring != MAP_FAILED && queue->cq_ring_size > 0) {
+        queue->cq_ring = mmap(NULL, queue->cq_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, queue->ring_fd, IORING_OFF_CQ_RING);
+    }
+    queue->sqes = (struct io_uring_sqe *)mmap(NULL, queue->sqes_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, queue->ring_fd,
+                                              IORING_OFF_SQES);
+    if (queue->sq_ring == MAP_FAILED || queue->cq_ring == MAP_FAILED ||
+        (void *)queue->sqes == MAP_FAILED) {
+        if (queue->sq_ring != MAP_FAILED)
+            munmap(queue->sq_ring, queue->sq_ring_size);
+        if (queue->cq_ring_size > 0 && queue->cq_ring != MAP_FAILED)
+            munmap(queue->cq_ring, queue->cq_ring_size);
+        if ((void *)queue->sqes != MAP_FAILED)
+            munmap(queue->sqes, queue->sqes_size);
+        close(queue->ring_fd);
+        return -1;
+    }
+    uint8_t *sq = (uint8_t *)queue->sq_ring, *cq = (uint8_t *)queue->cq_ring;
+    queue->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    queue->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    queue->sq_array = (unsigned *)(sq + params.sq_off.array);
+    queue->cq_head = (unsigned *)(cq + params.cq_off.head);
+    queue->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    queue->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    queue->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/* Hand the rest of 'request' to the kernel. Returns 0, or -1 on failure. */
+int sbf_io_uring_submit(sbf_IOQueue *queue, sbf_IORequest *request) {
+    uint64_t n = request->size - request->done;
+    if (n > SBF_IO_MAX_TRANSFER)
+        n = SBF_IO_MAX_TRANSFER;
+    request->iov.iov_base = request->data + request->done;
+    request->iov.iov_len = (size_t)n;
+
+    // nothing is left in the submission queue between calls, so there is room
+    const unsigned tail = *queue->sq_tail;
+    const unsigned index = tail & *queue->sq_mask;
+    struct io_uring_sqe *sqe = &queue->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&request->iov;
+    sqe->len = 1;
+    sqe->off = request->offset + request->done;
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+    queue->sq_array[index] = index;
+    __atomic_store_n(queue->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = sbf_io_uring_enter(queue->ring_fd, 1, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1) {
+        // take it back, so the next submission doesn't resubmit it
+        __atomic_store_n(queue->sq_tail, tail, __ATOMIC_RELEASE);
+        return -1;
+    }
+    queue->in_flight++;
+    return 0;
+}
+
+/*
+ * Handle every completion the kernel has posted, waiting for at least
+ * 'min_complete' of them first
+ */
+void sbf_io_uring_reap(sbf_IOQueue *queue, unsigned min_complete) {
+    if (min_complete > 0) {
+        while (sbf_io_uring_enter(queue->ring_fd, 0, min_complete, IORING_ENTER_GETEVENTS) < 0 &&
+               errno == EINTR) {
+        }
+    }
+    unsigned head = *queue->cq_head;
+    while (head != __atomic_load_n(queue->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &queue->cqes[head & *queue->cq_mask];
+        sbf_IORequest *request = (sbf_IORequest *)(uintptr_t)cqe->user_data;
+        const int res = cqe->res;
+        __atomic_store_n(queue->cq_head, ++head, __ATOMIC_RELEASE);
+        queue->in_flight--;
+        if (res == -EINTR || res == -EAGAIN) {
+            if (sbf_io_uring_submit(queue, request) != 0)
+                sbf_io_finish(request, SBF_IO_FAILED);
+        } else if (res <= 0) {
+            // a read of 0 bytes means the file is shorter than the request
+            sbf_io_finish(request, SBF_IO_FAILED);
+        } else if ((request->done += (uint64_t)res) < request->size) {
+            if (sbf_io_uring_submit(queue, request) != 0)
+                sbf_io_finish(request, SBF_IO_FAILED);
+        } else {
+            sbf_io_finish(request, SBF_IO_COMPLETE);
+        }
+    }
+}
+
+void sbf_io_uring_destroy(sbf_IOQueue *queue) {
+    while (queue->in_flight > 0)
+        sbf_io_uring_reap(queue, 1);
+    munmap(queue->sqes, queue->sqes_size);
+    if (queue->cq_ring_size > 0)
+        munmap(queue->cq_ring, queue->cq_ring_size);
+    munmap(queue->sq_ring, queue->sq_ring_size);
+    close(queue->ring_fd);
+}
+#endif
+
+void *sbf_io_worker(void *arg) {
+    sbf_IOQueue *queue = (sbf_IOQueue *)arg;
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        while (queue->head == NULL && !queue->stopping)
+            pthread_cond_wait(&queue->work, &queue->lock);
+        // anything queued is finished before stopping
+        sbf_IORequest *request = queue->head;
+        if (request == NULL)
+            break;
+        queue->head = request->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        int64_t n = sbf_transfer_all(request->fd, request->data, request->size,
+                                     request->offset, request->write);
+        request->done = (n > 0) ? (uint64_t)n : 0;
+        sbf_io_finish(request, (n == (int64_t)request->size) ? SBF_IO_COMPLETE : SBF_IO_FAILED);
+
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_broadcast(&queue->done);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+/*
+ * Set up 'queue' with the given backend (SBF_IO_AUTO for io_uring where
+ * available), keeping up to 'depth' requests in flight with io_uring or
+ * using 'n_threads' threads (SBF_IO_THREADS_DEFAULT if < 1) otherwise.
+ * Returns 0, or -1 on failure.
+ */
+int sbf_io_queue_init(sbf_IOQueue *queue, int backend, unsigned depth, int n_threads) {
+    memset(queue, 0, sizeof(*queue));
+    if (depth == 0)
+        depth = SBF_IO_QUEUE_DEPTH;
+#ifdef SBF_IO_URING
+    if (backend != SBF_IO_THREADS && sbf_io_uring_init(queue, depth) == 0) {
+        queue->backend = SBF_IO_URING_BACKEND;
+        return 0;
+    }
+#endif
+    if (backend == SBF_IO_URING_BACKEND)
+        return -1;
+
+    queue->backend = SBF_IO_THREADS;
+    if (n_threads < 1)
+        n_threads = SBF_IO_THREADS_DEFAULT;
+    queue->threads = (pthread_t *)malloc(n_threads * sizeof(pthread_t));
+    if (queue->threads == NULL)
+        return -1;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work, NULL);
+    pthread_cond_init(&queue->done, NULL);
+    for (; queue->n_threads < n_threads; queue->n_threads++) {
+        if (pthread_create(&queue->threads[queue->n_threads], NULL, sbf_io_worker, queue) != 0)
+            break;
+    }
+    return (queue->n_threads > 0) ? 0 : -1;
+}
+
+/*
+ * Start 'request', set up by sbf_io_prepare. Returns 0, or -1 if it
+ * could not be started, in which case it is marked SBF_IO_FAILED.
+ */
+int sbf_io_queue_submit(sbf_IOQueue *queue, sbf_IORequest *request) {
+    if (request->size == 0) {
+        sbf_io_finish(request, SBF_IO_COMPLETE);
+        return 0;
+    }
+#ifdef SBF_IO_URING
+    if (queue->backend == SBF_IO_URING_BACKEND) {
+        // don't let completions overflow the completion queue
+        while (queue->in_flight >= queue->cq_entries)
+            sbf_io_uring_reap(queue, 1);
+        if (sbf_io_uring_submit(queue, request) != 0) {
+            sbf_io_finish(request, SBF_IO_FAILED);
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    request->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail != NULL)
+        queue->tail->next = request;
+    else
+        queue->head = request;
+    queue->tail = request;
+    pthread_cond_signal(&queue->work);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/* State of 'request', without waiting for it */
+int sbf_io_queue_poll(sbf_IOQueue *queue, sbf_IORequest *request) {
+#ifdef SBF_IO_URING
+    if (queue->backend == SBF_IO_URING_BACKEND && sbf_io_state(request) == SBF_IO_PENDING)
+        sbf_io_uring_reap(queue, 0);
+#else
+    (void)queue;
+#endif
+    return sbf_io_state(request);
+}
+
+/*
+ * Wait for 'request' to complete, returning its final state. Finished
+ * requests may be waited on even after their queue is destroyed.
+ */
+int sbf_io_queue_wait(sbf_IOQueue *queue, sbf_IORequest *request) {
+    if (sbf_io_state(request) != SBF_IO_PENDING)
+        return sbf_io_state(request);
+#ifdef SBF_IO_URING
+    if (queue->backend == SBF_IO_URING_BACKEND) {
+        sbf_io_uring_reap(queue, 0);
+        while (sbf_io_state(request) == SBF_IO_PENDING && queue->in_flight > 0)
+            sbf_io_uring_reap(queue, 1);
+        return sbf_io_state(request);
+    }
+#endif
+    pthread_mutex_lock(&queue->lock);
+    while (sbf_io_state(request) == SBF_IO_PENDING)
+        pthread_cond_wait(&queue->done, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+    return sbf_io_state(request);
+}
+
+/*
+ * Wait for every request submitted to 'queue', then release it.
+ * Does nothing if it has already been released.
+ */
+void sbf_io_queue_destroy(sbf_IOQueue *queue) {
+#ifdef SBF_IO_URING
+    if (queue->backend == SBF_IO_URING_BACKEND) {
+        sbf_io_uring_destroy(queue);
+        queue->backend = SBF_IO_AUTO;
+        return;
+    }
+#endif
+    if (queue->backend != SBF_IO_THREADS)
+        return;
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->work);
+    pthread_mutex_unlock(&queue->lock);
+    for (int i = 0; i < queue->n_threads; i++)
+        pthread_join(queue->threads[i], NULL);
+    free(queue->threads);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->work);
+    pthread_cond_destroy(&queue->done);
+    queue->backend = SBF_IO_AUTO;
+}
+
+#endif
@@ -0,0 +1,155 @@
+#pragma once
+/*
+ * sbf_byteswap.h
+ *
+ * In-place byte swapping of dataset blobs, shared by sbf.h and sbf.hpp.
+ *
+ * Datasets are written in the byte order of the machine that wrote
+ * them, recorded by the big endian bit of their flags; readers on a
+ * machine of the other byte order reverse the bytes of every word in
+ * the blob after reading it. Complex numbers are swapped as their two
+ * components, so the only word widths needed are 2, 4 and 8 bytes.
+ *
+ * Everything else, the integers of the headers, chunk indexes and
+ * trailers, is little endian on disk whatever the machine, converted
+ * with sbf_le32, sbf_le64 and sbf_le_words as it is packed and parsed.
+ *
+ * With AVX2 or SSSE3 each vector is swapped with a single byte
+ * shuffle; plain SSE2 swaps the bytes of 16 bit lanes with shifts and
+ * then reorders the lanes, which is still far faster than a byte loop.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define SBF_HOST_BIG_ENDIAN 1
+#else
+#define SBF_HOST_BIG_ENDIAN 0
+#endif
+
+#if defined(__AVX2__)
+#define SBF_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#define SBF_SIMD_SSSE3 1
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define SBF_SIMD_SSE2_BYTESWAP 1
+#include <emmintrin.h>
+#endif
+
+/*
+ * Reverse the bytes of each 'width' byte word in the first 'n' bytes
+ * of 'data', one byte at a time
+ */
+void sbf_byteswap_scalar(uint8_t *data, size_t n, size_t width) {
+    for (size_t i = 0; i + width <= n; i += width) {
+        for (size_t lo = i, hi = i + width - 1; lo < hi; lo++, hi--) {
+            uint8_t t = data[lo];
+            data[lo] = data[hi];
+            data[hi] = t;
+        }
+    }
+}
+
+#if defined(SBF_SIMD_AVX2) || defined(SBF_SIMD_SSSE3)
+/*
+ * Shuffle control reversing each 'width' byte word of a 16 byte vector
+ */
+__m128i sbf_byteswap_mask(size_t width) {
+    uint8_t mask[16];
+    for (size_t j = 0; j < 16; j++)
+        mask[j] = (uint8_t)((j / width) * width + (width - 1 - j % width));
+    return _mm_loadu_si128((const __m128i *)mask);
+}
+#endif
+
+#ifdef SBF_SIMD_SSE2_BYTESWAP
+/*
+ * Reverse each 'width' (2, 4 or 8) byte word of a vector: swap the
+ * bytes of every 16 bit lane, then reverse the order of the lanes
+ * within each word.
+ */
+__m128i sbf_byteswap_sse2(__m128i v, size_t width) {
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    if (width == 4) {
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    } else if (width == 8) {
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+    return v;
+}
+#endif
+
+/*
+ * Reverse the bytes of each 'width' byte word in the first 'n' bytes
+ * of 'data' in place. 'n' should be a multiple of 'width'; widths of
+ * 0 or 1 leave the data untouched.
+ */
+void sbf_byteswap(void *data, size_t n, size_t width) {
+    uint8_t *bytes = (uint8_t *)data;
+    size_t i = 0;
+    if (width < 2)
+        return;
+    if (width == 2 || width == 4 || width == 8) {
+#if defined(SBF_SIMD_AVX2) || defined(SBF_SIMD_SSSE3)
+        const __m128i mask = sbf_byteswap_mask(width);
+#endif
+#ifdef SBF_SIMD_AVX2
+        const __m256i mask256 = _mm256_broadcastsi128_si256(mask);
+        for (; i + 32 <= n; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+            _mm256_storeu_si256((__m256i *)(bytes + i), _mm256_shuffle_epi8(v, mask256));
+        }
+#endif
+#if defined(SBF_SIMD_AVX2) || defined(SBF_SIMD_SSSE3)
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+            _mm_storeu_si128((__m128i *)(bytes + i), _mm_shuffle_epi8(v, mask));
+        }
+#elif defined(SBF_SIMD_SSE2_BYTESWAP)
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+            _mm_storeu_si128((__m128i *)(bytes + i), sbf_byteswap_sse2(v, width));
+        }
+#endif
+    }
+    sbf_byteswap_scalar(bytes + i, n - i, width);
+}
+
+/*
+ * Convert 'value' between host and little endian byte order, which
+ * are the same conversion either way
+ */
+uint32_t sbf_le32(uint32_t value) {
+#if SBF_HOST_BIG_ENDIAN
+    return ((value & 0xffu) << 24) | ((value & 0xff00u) << 8) |
+           ((value >> 8) & 0xff00u) | (value >> 24);
+#else
+    return value;
+#endif
+}
+
+uint64_t sbf_le64(uint64_t value) {
+#if SBF_HOST_BIG_ENDIAN
+    return ((uint64_t)sbf_le32((uint32_t)value) << 32) | sbf_le32((uint32_t)(value >> 32));
+#else
+    return value;
+#endif
+}
+
+/*
+ * Convert the 'n' bytes of 'width' byte words at 'data' between host
+ * and little endian byte order in place
+ */
+void sbf_le_words(void *data, size_t n, size_t width) {
+#if SBF_HOST_BIG_ENDIAN
+    sbf_byteswap(data, n, width);
+#else
+    (void)data;
+    (void)n;
+    (void)width;
+#endif
+}
@@ -0,0 +1,100 @@
+#pragma once
+/*
+ * sbf_checkpoint.h
+ *
+ * File level helpers for checkpoint writers, shared by sbf.h and
+ * sbf.hpp. A checkpoint writer lays out a set of datasets once, then
+ * writes files with the same names and shapes over and over (e.g.
+ * every N timesteps), each as a single gathered write.
+ *
+ * To keep one complete checkpoint under a fixed name, the next one is
+ * written to a spare file which is then atomically exchanged with it.
+ * Readers see either the old or the new checkpoint, never a mix, and
+ * the pair of files is reused so nothing is reallocated on disk.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sbf_integrity.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SBF_CHECKPOINT_POSIX 1
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
+#if defined(SYS_renameat2)
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#define SBF_RENAME_EXCHANGE 1
+#endif
+
+#ifdef SBF_CHECKPOINT_POSIX
+/*
+ * Write the ranges in 'iov' one after the other to 'fd', starting at
+ * 'offset', with as few pwritev calls as IOV_MAX allows. 'iov' is
+ * consumed as it is written. Returns 0 on success, -1 on failure.
+ */
+int sbf_write_gather(int fd, struct iovec *iov, int n_iov, uint64_t offset) {
+    while (n_iov > 0) {
+        ssize_t n = pwritev(fd, iov, (n_iov < IOV_MAX) ? n_iov : IOV_MAX, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        offset += (uint64_t)n;
+        // skip what was written, which may end part way through a range
+        size_t left = (size_t)n;
+        while (n_iov > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if (n_iov > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Atomically make the file 'spare' visible as 'filename'. Where the
+ * system can exchange two names, 'spare' is left holding the previous
+ * 'filename' (if there was one) to be overwritten next time; otherwise
+ * 'spare' is renamed over it. As in sbf_commit_file, 'spare' is flushed
+ * to disk before the names change and their directory after, so after
+ * a crash 'filename' is one complete checkpoint or the other.
+ * Returns 0 on success, -1 on failure.
+ */
+int sbf_replace_file(const char *spare, const char *filename) {
+#ifdef SBF_INTEGRITY_POSIX
+    if (sbf_sync_path(spare, 0) != 0)
+        return -1;
+#endif
+#ifdef SBF_RENAME_EXCHANGE
+    if (syscall(SYS_renameat2, AT_FDCWD, spare, AT_FDCWD, filename, RENAME_EXCHANGE) == 0)
+        return sbf_sync_path(filename, 1);
+    // ENOENT: there is no previous checkpoint, EINVAL/ENOSYS: can't exchange here
+    if (errno != ENOENT && errno != EINVAL && errno != ENOSYS)
+        return -1;
+#endif
+    if (sbf_rename_over(spare, filename) != 0)
+        return -1;
+#ifdef SBF_INTEGRITY_POSIX
+    return sbf_sync_path(filename, 1);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,392 @@
+#pragma once
+/*
+ * sbf_codec.h
+ *
+ * Self-contained codecs used for compressed SBF datasets, shared
+ * by sbf.h and sbf.hpp so that no external dependencies are needed:
+ * - an XOR-delta filter, which replaces each element with its XOR
+ *   against the previous element (zeroing the bits they share)
+ * - a byte-shuffle filter, which groups the n-th byte of every element
+ *   together (making smooth floating point data far more compressible)
+ * - a small LZ77 compressor writing the LZ4 block format.
+ *
+ * Each chunk passes through the filter pipeline (delta, then shuffle)
+ * and then the codec; decoding runs the pipeline in reverse. With
+ * SBF_CODEC_NONE the filters alone are applied, leaving the chunk
+ * the same size but far cheaper for e.g. gzip to compress later.
+ *
+ * A compressed dataset is stored as a chunk index followed by the chunks:
+ *
+ * +-----------------------+
+ * | sbf_ChunkIndexHeader  | codec, filters, chunk size, number of chunks
+ * +-----------------------+
+ * | sbf_size[n_chunks+1]  | offsets of each chunk, relative to the end
+ * |                       | of this table (the last is the total size)
+ * +-----------------------+
+ * |   encoded chunks      | each decodes to chunk_size bytes (the last
+ * |         ...           | may be smaller), stored raw if it would not
+ * +-----------------------+ compress, i.e. when stored size == decoded size
+ *
+ * The index and offsets are little endian, see sbf_chunk_index_le.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sbf_byteswap.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SBF_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define SBF_CODEC_NONE 0
+#define SBF_CODEC_LZ 1
+
+// Filter bits, applied before compression and undone after decompression
+#define SBF_FILTER_SHUFFLE 0x01
+#define SBF_FILTER_DELTA 0x02
+
+// Default number of uncompressed bytes in each chunk of a compressed dataset
+#ifndef SBF_COMPRESSION_CHUNK_SIZE
+#define SBF_COMPRESSION_CHUNK_SIZE (1024 * 1024)
+#endif
+
+#define SBF_LZ_HASH_BITS 14
+#define SBF_LZ_MIN_MATCH 4
+#define SBF_LZ_MAX_OFFSET 65535
+// The last match must start at least this many bytes before the end,
+// and the last literals are at least SBF_LZ_LAST_LITERALS long
+#define SBF_LZ_MF_LIMIT 12
+#define SBF_LZ_LAST_LITERALS 5
+
+typedef struct {
+    uint8_t codec;       // SBF_CODEC_*
+    uint8_t filters;     // SBF_FILTER_* bits
+    uint8_t reserved[6];
+    uint64_t chunk_size; // decoded bytes per chunk
+    uint64_t n_chunks;
+} sbf_ChunkIndexHeader;
+
+/*
+ * Convert 'index' and its 'n_offsets' chunk 'offsets' between host and
+ * little endian byte order, the order they are stored in
+ */
+void sbf_chunk_index_le(sbf_ChunkIndexHeader *index, uint64_t *offsets, uint64_t n_offsets) {
+    index->chunk_size = sbf_le64(index->chunk_size);
+    index->n_chunks = sbf_le64(index->n_chunks);
+    if (offsets != NULL)
+        sbf_le_words(offsets, n_offsets * sizeof(uint64_t), sizeof(uint64_t));
+}
+
+#ifdef SBF_SIMD_SSE2
+/*
+ * Interleave the bytes of 'elem' vectors (elem a power of two <= 16)
+ * 'rounds' times. Viewing the byte position in v as (vector, byte)
+ * bits, each round rotates those bits left by one, so 4 rounds
+ * transpose 16 elements into byte planes and log2(elem) undo it.
+ */
+void sbf_interleave_sse2(__m128i *v, size_t elem, int rounds) {
+    __m128i t[16];
+    const size_t half = elem / 2;
+    for (int r = 0; r < rounds; r++) {
+        for (size_t q = 0; q < half; q++) {
+            t[2 * q] = _mm_unpacklo_epi8(v[q], v[half + q]);
+            t[2 * q + 1] = _mm_unpackhi_epi8(v[q], v[half + q]);
+        }
+        memcpy(v, t, elem * sizeof(__m128i));
+    }
+}
+
+int sbf_log2_elem(size_t elem) {
+    switch (elem) {
+    case 2: return 1;
+    case 4: return 2;
+    case 8: return 3;
+    case 16: return 4;
+    default: return -1;
+    }
+}
+#endif
+
+/*
+ * Byte-shuffle 'n' bytes of elements 'elem' bytes wide from 'src' to 'dst':
+ * dst holds byte 0 of every element, then byte 1 of every element etc.
+ * Any trailing partial element is copied as-is.
+ */
+void sbf_shuffle(const uint8_t *src, uint8_t *dst, size_t n, size_t elem) {
+    size_t count = n / elem;
+    size_t i = 0;
+#ifdef SBF_SIMD_SSE2
+    if (sbf_log2_elem(elem) > 0) {
+        __m128i v[16];
+        for (; i + 16 <= count; i += 16) {
+            for (size_t k = 0; k < elem; k++)
+                v[k] = _mm_loadu_si128((const __m128i *)(src + i * elem + 16 * k));
+            sbf_interleave_sse2(v, elem, 4);
+            for (size_t b = 0; b < elem; b++)
+                _mm_storeu_si128((__m128i *)(dst + b * count + i), v[b]);
+        }
+    }
+#endif
+    for (size_t b = 0; b < elem; b++) {
+        for (size_t j = i; j < count; j++) {
+            dst[b * count + j] = src[j * elem + b];
+        }
+    }
+    memcpy(dst + count * elem, src + count * elem, n - count * elem);
+}
+
+/*
+ * Inverse of sbf_shuffle
+ */
+void sbf_unshuffle(const uint8_t *src, uint8_t *dst, size_t n, size_t elem) {
+    size_t count = n / elem;
+    size_t i = 0;
+#ifdef SBF_SIMD_SSE2
+    int rounds = sbf_log2_elem(elem);
+    if (rounds > 0) {
+        __m128i v[16];
+        for (; i + 16 <= count; i += 16) {
+            for (size_t b = 0; b < elem; b++)
+                v[b] = _mm_loadu_si128((const __m128i *)(src + b * count + i));
+            sbf_interleave_sse2(v, elem, rounds);
+            for (size_t k = 0; k < elem; k++)
+                _mm_storeu_si128((__m128i *)(dst + i * elem + 16 * k), v[k]);
+        }
+    }
+#endif
+    for (size_t b = 0; b < elem; b++) {
+        for (size_t j = i; j < count; j++) {
+            dst[j * elem + b] = src[b * count + j];
+        }
+    }
+    memcpy(dst + count * elem, src + count * elem, n - count * elem);
+}
+
+/*
+ * XOR-delta 'n' bytes of elements 'elem' bytes wide from 'src' to 'dst':
+ * the first element is kept and every other becomes its XOR with the
+ * element before it. Any trailing partial element is copied as-is.
+ */
+void sbf_delta_encode(const uint8_t *src, uint8_t *dst, size_t n, size_t elem) {
+    size_t whole = (n / elem) * elem;
+    memcpy(dst, src, whole < elem ? whole : elem);
+    for (size_t i = elem; i < whole; i++) {
+        dst[i] = src[i] ^ src[i - elem];
+    }
+    memcpy(dst + whole, src + whole, n - whole);
+}
+
+/*
+ * Inverse of sbf_delta_encode, 'src' and 'dst' may be the same buffer
+ */
+void sbf_delta_decode(const uint8_t *src, uint8_t *dst, size_t n, size_t elem) {
+    size_t whole = (n / elem) * elem;
+    memmove(dst, src, whole < elem ? whole : elem);
+    for (size_t i = elem; i < whole; i++) {
+        dst[i] = src[i] ^ dst[i - elem];
+    }
+    memmove(dst + whole, src + whole, n - whole);
+}
+
+/*
+ * Worst case size of compressing 'n' bytes with sbf_lz_compress
+ */
+size_t sbf_lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+uint32_t sbf_lz_read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t sbf_lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - SBF_LZ_HASH_BITS);
+}
+
+uint8_t *sbf_lz_write_length(uint8_t *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/*
+ * Compress 'n' bytes from 'src' into 'dst' (LZ4 block format).
+ *
+ * Returns the compressed size, or 0 if it would not fit in 'capacity'.
+ */
+size_t sbf_lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity) {
+    uint32_t table[1 << SBF_LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *const end = src + n;
+    uint8_t *op = dst;
+    uint8_t *const op_end = dst + capacity;
+
+    if (n > SBF_LZ_MF_LIMIT) {
+        const uint8_t *const match_limit = end - SBF_LZ_MF_LIMIT;
+        while (ip < match_limit) {
+            uint32_t sequence = sbf_lz_read32(ip);
+            uint32_t h = sbf_lz_hash(sequence);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || (size_t)(ip - ref) > SBF_LZ_MAX_OFFSET ||
+                sbf_lz_read32(ref) != sequence) {
+                // skip faster through data that doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            const uint8_t *mp = ip + SBF_LZ_MIN_MATCH, *rp = ref + SBF_LZ_MIN_MATCH;
+            while (mp < end - SBF_LZ_LAST_LITERALS && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            size_t literals = (size_t)(ip - anchor);
+            size_t match = (size_t)(mp - ip) - SBF_LZ_MIN_MATCH;
+            if ((size_t)(op_end - op) < 1 + literals + literals / 255 + 3 + match / 255 + 1)
+                return 0;
+            uint8_t *token = op++;
+            *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+            if (literals >= 15)
+                op = sbf_lz_write_length(op, literals - 15);
+            memcpy(op, anchor, literals);
+            op += literals;
+            size_t offset = (size_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+            *token |= (uint8_t)(match >= 15 ? 15 : match);
+            if (match >= 15)
+                op = sbf_lz_write_length(op, match - 15);
+            ip = anchor = mp;
+        }
+    }
+
+    size_t literals = (size_t)(end - anchor);
+    if ((size_t)(op_end - op) < 1 + literals + literals / 255 + 1)
+        return 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15)
+        op = sbf_lz_write_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    return (size_t)(op - dst);
+}
+
+/*
+ * Decompress 'n' bytes of LZ4 block format data from 'src' into 'dst',
+ * which must decode to exactly 'dst_size' bytes.
+ *
+ * Returns 0 on success, -1 if the input is malformed.
+ */
+int sbf_lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t dst_size) {
+    const uint8_t *ip = src;
+    const uint8_t *const ip_end = src + n;
+    uint8_t *op = dst;
+    uint8_t *const op_end = dst + dst_size;
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end) return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op))
+            return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == ip_end)
+            break; // the last sequence has no match
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        size_t match = token & 15;
+        if (match == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end) return -1;
+                b = *ip++;
+                match += b;
+            } while (b == 255);
+        }
+        match += SBF_LZ_MIN_MATCH;
+        if (match > (size_t)(op_end - op)) return -1;
+        const uint8_t *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            // overlapping copy, i.e. a repeating pattern
+            for (size_t i = 0; i < match; i++) *op++ = *ref++;
+        }
+    }
+    return (op == op_end) ? 0 : -1;
+}
+
+/*
+ * Encode a chunk of 'n' bytes of elements 'elem' bytes wide from 'src'
+ * into 'dst', using 'scratch' for filtering (both at least n bytes).
+ *
+ * Returns the stored size; a stored size of n means no codec was applied.
+ */
+size_t sbf_encode_chunk(uint8_t codec, uint8_t filters, size_t elem,
+                        const uint8_t *src, size_t n, uint8_t *dst, uint8_t *scratch) {
+    const uint8_t *input = src;
+    if ((filters & SBF_FILTER_DELTA) && (filters & SBF_FILTER_SHUFFLE)) {
+        sbf_delta_encode(src, dst, n, elem);
+        sbf_shuffle(dst, scratch, n, elem);
+        input = scratch;
+    } else if (filters & SBF_FILTER_DELTA) {
+        sbf_delta_encode(src, scratch, n, elem);
+        input = scratch;
+    } else if (filters & SBF_FILTER_SHUFFLE) {
+        sbf_shuffle(src, scratch, n, elem);
+        input = scratch;
+    }
+    size_t stored = 0;
+    if (codec == SBF_CODEC_LZ)
+        stored = sbf_lz_compress(input, n, dst, n);
+    if (stored == 0 || stored >= n) {
+        memcpy(dst, input, n);
+        stored = n;
+    }
+    return stored;
+}
+
+/*
+ * Decode a chunk of 'stored' bytes from 'src' into the 'n' bytes of 'dst',
+ * using 'scratch' (at least n bytes) for filtering.
+ *
+ * Returns 0 on success, -1 if the chunk is malformed.
+ */
+int sbf_decode_chunk(uint8_t codec, uint8_t filters, size_t elem,
+                     const uint8_t *src, size_t stored, uint8_t *dst, size_t n,
+                     uint8_t *scratch) {
+    const uint8_t filter_bits = SBF_FILTER_SHUFFLE | SBF_FILTER_DELTA;
+    uint8_t *output = (filters & filter_bits) ? scratch : dst;
+    if (stored == n) {
+        memcpy(output, src, n);
+    } else if (codec != SBF_CODEC_LZ || sbf_lz_decompress(src, stored, output, n) != 0) {
+        return -1;
+    }
+    if (filters & SBF_FILTER_SHUFFLE) {
+        sbf_unshuffle(scratch, dst, n, elem);
+        output = dst;
+    }
+    if (filters & SBF_FILTER_DELTA)
+        sbf_delta_decode(output, dst, n, elem);
+    return 0;
+}
@@ -0,0 +1,156 @@
+#pragma once
+/*
+ * sbf_direct.h
+ *
+ * Aligned layout and uncached (O_DIRECT) I/O, shared by sbf.h and sbf.hpp.
+ *
+ * From version 0.3.2 the file header records an alignment, and every
+ * blob (and so the end of the headers) is padded to start at a multiple
+ * of it. With SBF_DIRECT_ALIGNMENT the blobs line up with the blocks of
+ * the device, so large datasets can be moved through a descriptor
+ * opened with O_DIRECT, bypassing the page cache entirely.
+ *
+ * O_DIRECT transfers need the file offset, length and memory to be
+ * aligned. Buffers from sbf_aligned_alloc are transferred in place,
+ * others through an aligned bounce buffer, and the last partial block
+ * of a transfer is read as a whole block, or written through the
+ * normal (cached) descriptor so that nothing after it is overwritten.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(O_DIRECT)
+#define SBF_O_DIRECT 1
+#endif
+#endif
+
+// alignment of the aligned layout, and of buffers for O_DIRECT
+#define SBF_DIRECT_ALIGNMENT 4096
+// largest alignment a file may record, anything more is corrupt
+#define SBF_MAX_ALIGNMENT (1024 * 1024)
+// size of the bounce buffer used for unaligned memory
+#define SBF_DIRECT_BOUNCE_SIZE (4 * 1024 * 1024)
+
+/*
+ * Round 'size' up to a multiple of 'alignment' (0 or 1 for none)
+ */
+uint64_t sbf_align_up(uint64_t size, uint64_t alignment) {
+    if (alignment <= 1)
+        return size;
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Is 'alignment' a power of two no larger than SBF_MAX_ALIGNMENT?
+ */
+int sbf_valid_alignment(uint64_t alignment) {
+    return alignment >= 1 && alignment <= SBF_MAX_ALIGNMENT &&
+           (alignment & (alignment - 1)) == 0;
+}
+
+/*
+ * Allocate 'size' bytes aligned to SBF_DIRECT_ALIGNMENT, to be
+ * released with sbf_aligned_free. Returns NULL on failure.
+ */
+void *sbf_aligned_alloc(size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, SBF_DIRECT_ALIGNMENT, size ? size : 1) != 0)
+        return NULL;
+    return ptr;
+#else
+    return malloc(size ? size : 1);
+#endif
+}
+
+void sbf_aligned_free(void *ptr) {
+    free(ptr);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/*
+ * pread/pwrite 'size' bytes at 'offset', retrying short transfers.
+ * Returns the number of bytes transferred, which is less than 'size'
+ * only if a read reached the end of the file, or -1 on failure.
+ */
+int64_t sbf_transfer_all(int fd, uint8_t *data, uint64_t size, uint64_t offset, int write) {
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t n = write ? pwrite(fd, data + done, size - done, (off_t)(offset + done))
+                          : pread(fd, data + done, size - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += (uint64_t)n;
+    }
+    return (int64_t)done;
+}
+#endif
+
+#ifdef SBF_O_DIRECT
+/*
+ * Read or write 'size' bytes of 'data' at 'offset' of a file opened
+ * both normally ('fd') and with O_DIRECT ('direct_fd'), bypassing the
+ * page cache for all but the last partial block of a write.
+ * 'offset' must be a multiple of SBF_DIRECT_ALIGNMENT.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int sbf_direct_transfer(int fd, int direct_fd, void *data, uint64_t size, uint64_t offset,
+                        int write) {
+    const uint64_t block = SBF_DIRECT_ALIGNMENT;
+    const uint64_t whole = size - size % block;
+    uint8_t *bytes = (uint8_t *)data;
+    uint64_t done = 0;
+    if ((uintptr_t)bytes % block == 0) {
+        if (sbf_transfer_all(direct_fd, bytes, whole, offset, write) != (int64_t)whole)
+            return -1;
+        done = whole;
+    }
+    if (done == size)
+        return 0;
+
+    uint64_t bounce_size = sbf_align_up(size - done, block);
+    if (bounce_size > SBF_DIRECT_BOUNCE_SIZE)
+        bounce_size = SBF_DIRECT_BOUNCE_SIZE;
+    uint8_t *bounce = (uint8_t *)sbf_aligned_alloc(bounce_size);
+    if (bounce == NULL)
+        return -1;
+    int res = 0;
+    while (res == 0 && done < whole) {
+        uint64_t n = whole - done;
+        if (n > bounce_size)
+            n = bounce_size;
+        if (write)
+            memcpy(bounce, bytes + done, n);
+        if (sbf_transfer_all(direct_fd, bounce, n, offset + done, write) != (int64_t)n)
+            res = -1;
+        else if (!write)
+            memcpy(bytes + done, bounce, n);
+        done += n;
+    }
+    // the last partial block
+    if (res == 0 && done < size) {
+        const uint64_t n = size - done;
+        if (write) {
+            if (sbf_transfer_all(fd, bytes + done, n, offset + done, 1) != (int64_t)n)
+                res = -1;
+        } else if (sbf_transfer_all(direct_fd, bounce, block, offset + done, 0) < (int64_t)n) {
+            res = -1;
+        } else {
+            memcpy(bytes + done, bounce, n);
+        }
+    }
+    sbf_aligned_free(bounce);
+    return res;
+}
+#endif
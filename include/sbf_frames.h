@@ -0,0 +1,91 @@
+#pragma once
+/*
+ * sbf_frames.h
+ *
+ * Frame index of multi-frame files, shared by sbf.h and sbf.hpp.
+ *
+ * A multi-frame file holds many records ("frames") of the same
+ * datasets in one file, e.g. one per timestep. The headers describe a
+ * single frame, and the frames follow them one after the other, each
+ * laid out exactly like the first (so readers unaware of frames see
+ * frame 0). The file ends with a footer indexing them:
+ *
+ * +--------------------------+
+ * | uint64_t offsets[n]      | of each frame in the file
+ * +--------------------------+
+ * | uint64_t n_frames        |
+ * +--------------------------+
+ * | char magic[8]            | SBF_FRAME_MAGIC
+ * +--------------------------+
+ *
+ * Frames only hold uncompressed datasets, so every frame is the same
+ * size and frame k can be read (or mapped) directly. The footer is
+ * rewritten after the last frame whenever frames have been appended.
+ * The offsets and n_frames are little endian, see sbf_frame_index_le.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sbf_byteswap.h"
+
+#define SBF_FRAME_MAGIC "SBFFRAME"
+
+typedef struct {
+    uint64_t n_frames;
+    char magic[8];
+} sbf_FrameTrailer;
+
+/*
+ * Trailer ending the footer of a file with 'n_frames' frames
+ */
+sbf_FrameTrailer sbf_frame_trailer(uint64_t n_frames) {
+    sbf_FrameTrailer trailer;
+    trailer.n_frames = n_frames;
+    memcpy(trailer.magic, SBF_FRAME_MAGIC, sizeof(trailer.magic));
+    return trailer;
+}
+
+/*
+ * Convert 'trailer' and the 'n_frames' frame 'offsets' between host and
+ * little endian byte order, the order they are stored in
+ */
+void sbf_frame_index_le(sbf_FrameTrailer *trailer, uint64_t *offsets, uint64_t n_frames) {
+    if (trailer != NULL)
+        trailer->n_frames = sbf_le64(trailer->n_frames);
+    if (offsets != NULL)
+        sbf_le_words(offsets, n_frames * sizeof(uint64_t), sizeof(uint64_t));
+}
+
+/*
+ * If 'trailer', the last bytes of a file of 'file_size' bytes, ends a
+ * frame index, return the offset of the index, otherwise 0. Frames are
+ * 'frame_size' bytes from the first blob at 'data_start'.
+ */
+uint64_t sbf_frame_index_start(const sbf_FrameTrailer *trailer, uint64_t file_size,
+                               uint64_t data_start, uint64_t frame_size) {
+    if (frame_size == 0 || memcmp(trailer->magic, SBF_FRAME_MAGIC, sizeof(trailer->magic)) != 0)
+        return 0;
+    const uint64_t n = trailer->n_frames;
+    if (file_size < data_start + sizeof(*trailer) || n == 0 ||
+        n > (file_size - data_start - sizeof(*trailer)) / (frame_size + sizeof(uint64_t)))
+        return 0;
+    return file_size - sizeof(*trailer) - n * sizeof(uint64_t);
+}
+
+/*
+ * Do 'offsets' locate 'n_frames' frames of 'frame_size' bytes, aligned
+ * to 'alignment', from 'data_start' to no further than 'index_start'?
+ */
+int sbf_frame_index_valid(const uint64_t *offsets, uint64_t n_frames, uint64_t data_start,
+                          uint64_t frame_size, uint64_t index_start, uint64_t alignment) {
+    if (n_frames == 0 || offsets[0] != data_start)
+        return 0;
+    for (uint64_t frame = 0; frame < n_frames; frame++) {
+        if (offsets[frame] % alignment != 0 || offsets[frame] > index_start ||
+            index_start - offsets[frame] < frame_size)
+            return 0;
+        if (frame > 0 && offsets[frame] < offsets[frame - 1] + frame_size)
+            return 0;
+    }
+    return 1;
+}
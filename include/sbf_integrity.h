@@ -0,0 +1,341 @@
+#pragma once
+/*
+ * sbf_integrity.h
+ *
+ * Checksums and crash consistent commits, shared by sbf.h and sbf.hpp.
+ *
+ * Headers are written before data, so a writer killed part way through
+ * leaves a file whose headers look fine but whose data is missing or
+ * stale. Two things guard against using such a file:
+ *
+ * Atomic commits: the file is written as 'filename' SBF_TEMP_SUFFIX,
+ * which is flushed to disk (fsync) and only then renamed over
+ * 'filename', with the directory flushed after. Readers of 'filename'
+ * see the previous file or the complete new one, never a partial one.
+ *
+ * Checksums: a trailer after the last blob holds the CRC32C of each
+ * blob as stored (compressed, and in the writer's byte order), and of
+ * the headers, so that corruption can be detected when a dataset is
+ * read without decoding anything:
+ *
+ * +------------------------------+
+ * | uint32_t crcs[n_datasets]    | of each blob, in order
+ * +------------------------------+
+ * | uint32_t headers_crc         | of everything before the first blob
+ * | uint32_t table_crc           | of crcs[]
+ * | uint64_t n_datasets          |
+ * | char magic[8]                | SBF_CHECKSUM_MAGIC
+ * +------------------------------+
+ *
+ * The table and trailer are little endian, see sbf_checksums_le, and
+ * table_crc is the checksum of the table as stored.
+ *
+ * Readers unaware of the trailer ignore it. CRC32C is computed with the
+ * SSE4.2 crc32 instruction where the CPU has it (checked at run time
+ * unless the compiler targets it anyway), the ARMv8 CRC instructions
+ * where enabled, and a table otherwise.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sbf_byteswap.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SBF_INTEGRITY_POSIX 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define SBF_INTEGRITY_WINDOWS 1
+#include <windows.h>
+#endif
+
+#if defined(__SSE4_2__)
+#define SBF_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+// compiled for SSE4.2 regardless, and only called if the CPU has it
+#define SBF_CRC32C_SSE42 1
+#define SBF_CRC32C_DISPATCH 1
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define SBF_CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+#define SBF_CHECKSUM_MAGIC "SBFCRC32"
+#define SBF_TEMP_SUFFIX ".tmp"
+
+typedef struct {
+    uint32_t headers_crc;
+    uint32_t table_crc;
+    uint64_t n_datasets;
+    char magic[8];
+} sbf_ChecksumTrailer;
+
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) of every byte value
+static const uint32_t sbf_crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+uint32_t sbf_crc32c_scalar(uint32_t crc, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        crc = sbf_crc32c_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef SBF_CRC32C_SSE42
+#ifdef SBF_CRC32C_DISPATCH
+__attribute__((target("sse4.2")))
+#endif
+uint32_t sbf_crc32c_sse42(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size > 0 && ((uintptr_t)data & 7) != 0; size--)
+        crc = _mm_crc32_u8(crc, *data++);
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; size >= 4; size -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; size > 0; size--)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+#ifdef SBF_CRC32C_ARM
+uint32_t sbf_crc32c_arm(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; size--)
+        crc = __crc32cb(crc, *data++);
+    return crc;
+}
+#endif
+
+/*
+ * CRC32C of 'size' bytes of 'data', continuing from the CRC32C 'crc' of
+ * the bytes before them (0 to start), so that
+ * sbf_crc32c(sbf_crc32c(0, a, n), b, m) is the CRC32C of a followed by b.
+ */
+uint32_t sbf_crc32c(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    crc = ~crc;
+#if defined(SBF_CRC32C_SSE42) && defined(SBF_CRC32C_DISPATCH)
+    if (__builtin_cpu_supports("sse4.2"))
+        return ~sbf_crc32c_sse42(crc, bytes, size);
+    return ~sbf_crc32c_scalar(crc, bytes, size);
+#elif defined(SBF_CRC32C_SSE42)
+    return ~sbf_crc32c_sse42(crc, bytes, size);
+#elif defined(SBF_CRC32C_ARM)
+    return ~sbf_crc32c_arm(crc, bytes, size);
+#else
+    return ~sbf_crc32c_scalar(crc, bytes, size);
+#endif
+}
+
+/*
+ * Product of 'a' and 'b', polynomials of the reflected CRC32C, modulo
+ * its polynomial
+ */
+uint32_t sbf_crc32c_multiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = (uint32_t)1 << 31; bit != 0; bit >>= 1) {
+        if (a & bit)
+            product ^= b;
+        b = (b & 1) ? (b >> 1) ^ 0x82f63b78 : b >> 1;
+    }
+    return product;
+}
+
+/*
+ * CRC32C of a followed by b, from the CRC32C 'crc_a' of a, and 'crc_b'
+ * of the 'size_b' bytes of b, so that parts written out of order can
+ * be checksummed without reading them back. Takes O(log(size_b)).
+ */
+uint32_t sbf_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t size_b) {
+    // multiply crc_a by x^(8 size_b), squaring x^8 up bit by bit of size_b
+    uint32_t power = (uint32_t)1 << 23;
+    for (; size_b != 0; size_b >>= 1) {
+        if (size_b & 1)
+            crc_a = sbf_crc32c_multiply(power, crc_a);
+        power = sbf_crc32c_multiply(power, power);
+    }
+    return crc_a ^ crc_b;
+}
+
+/*
+ * Trailer following the checksums 'crcs' of 'n_datasets' blobs, as
+ * stored (little endian), in a file whose headers have the checksum
+ * 'headers_crc'. The trailer itself is in host byte order.
+ */
+sbf_ChecksumTrailer sbf_checksum_trailer(uint32_t headers_crc, const uint32_t *crcs,
+                                         uint64_t n_datasets) {
+    sbf_ChecksumTrailer trailer;
+    trailer.headers_crc = headers_crc;
+    trailer.table_crc = sbf_crc32c(0, crcs, n_datasets * sizeof(uint32_t));
+    trailer.n_datasets = n_datasets;
+    memcpy(trailer.magic, SBF_CHECKSUM_MAGIC, sizeof(trailer.magic));
+    return trailer;
+}
+
+/*
+ * Convert 'trailer' and the 'n_datasets' checksums 'crcs' between host
+ * and little endian byte order, the order they are stored in
+ */
+void sbf_checksums_le(sbf_ChecksumTrailer *trailer, uint32_t *crcs, uint64_t n_datasets) {
+    if (trailer != NULL) {
+        trailer->headers_crc = sbf_le32(trailer->headers_crc);
+        trailer->table_crc = sbf_le32(trailer->table_crc);
+        trailer->n_datasets = sbf_le64(trailer->n_datasets);
+    }
+    if (crcs != NULL)
+        sbf_le_words(crcs, n_datasets * sizeof(uint32_t), sizeof(uint32_t));
+}
+
+/*
+ * If 'trailer', the last bytes of a file of 'file_size' bytes, ends the
+ * checksums of its 'n_datasets' blobs, the last of which ends at
+ * 'data_end', return the offset of the checksums, otherwise 0.
+ */
+uint64_t sbf_checksum_table_start(const sbf_ChecksumTrailer *trailer, uint64_t file_size,
+                                  uint64_t data_end, uint64_t n_datasets) {
+    if (memcmp(trailer->magic, SBF_CHECKSUM_MAGIC, sizeof(trailer->magic)) != 0 ||
+        trailer->n_datasets != n_datasets || n_datasets > UINT32_MAX)
+        return 0;
+    const uint64_t size = n_datasets * sizeof(uint32_t) + sizeof(*trailer);
+    if (file_size < data_end || file_size - data_end < size)
+        return 0;
+    return file_size - size;
+}
+
+/*
+ * Name of the temporary file 'filename' is written as before it is
+ * committed, which the caller must free. Returns NULL on failure.
+ */
+char *sbf_temp_filename(const char *filename) {
+    const size_t length = strlen(filename);
+    char *temp = (char *)malloc(length + sizeof(SBF_TEMP_SUFFIX));
+    if (temp == NULL)
+        return NULL;
+    memcpy(temp, filename, length);
+    memcpy(temp + length, SBF_TEMP_SUFFIX, sizeof(SBF_TEMP_SUFFIX));
+    return temp;
+}
+
+#ifdef SBF_INTEGRITY_POSIX
+/*
+ * Flush 'path' (a file, or with 'directory' the directory holding it)
+ * to disk. Returns 0 on success, -1 on failure.
+ */
+int sbf_sync_path(const char *path, int directory) {
+    char *dir = NULL;
+    if (directory) {
+        const char *slash = strrchr(path, '/');
+        const size_t length = (slash == NULL) ? 0 : (slash == path) ? 1 : (size_t)(slash - path);
+        if (length == 0) {
+            path = ".";
+        } else {
+            if ((dir = (char *)malloc(length + 1)) == NULL)
+                return -1;
+            memcpy(dir, path, length);
+            dir[length] = '\0';
+            path = dir;
+        }
+    }
+    int fd = open(path, directory ? O_RDONLY : O_WRONLY);
+    free(dir);
+    if (fd < 0)
+        return -1;
+    int res = fsync(fd);
+    // some file systems can't flush directories, and don't need to
+    if (res != 0 && directory && (errno == EINVAL || errno == EBADF))
+        res = 0;
+    close(fd);
+    return res == 0 ? 0 : -1;
+}
+#endif
+
+/*
+ * Rename 'from' to 'to' in one step, replacing any file 'to'.
+ * Returns 0 on success, -1 on failure, leaving 'to' untouched.
+ */
+int sbf_rename_over(const char *from, const char *to) {
+#ifdef SBF_INTEGRITY_WINDOWS
+    // rename won't replace an existing file here
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+#else
+    return rename(from, to) == 0 ? 0 : -1;
+#endif
+}
+
+/*
+ * Commit 'temp', a complete file, as 'filename': flush it to disk,
+ * rename it over 'filename' and flush the directory so the rename is
+ * durable too. Returns 0 on success, -1 on failure, in which case
+ * 'filename' is untouched (or, at worst, already the new file).
+ */
+int sbf_commit_file(const char *temp, const char *filename) {
+#ifdef SBF_INTEGRITY_POSIX
+    if (sbf_sync_path(temp, 0) != 0 || sbf_rename_over(temp, filename) != 0)
+        return -1;
+    return sbf_sync_path(filename, 1);
+#else
+    return sbf_rename_over(temp, filename);
+#endif
+}
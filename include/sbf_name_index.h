@@ -0,0 +1,129 @@
+#pragma once
+/*
+ * sbf_name_index.h
+ *
+ * Open addressed hash table of dataset names, shared by sbf.h and
+ * sbf.hpp. From version 0.3.1 the table is also stored in the file,
+ * directly after the data headers, so readers can look datasets up
+ * by name without hashing (or copying) every name in the file:
+ *
+ * +-----------------------+
+ * | uint64_t n_slots      | a power of two, at least twice n_datasets
+ * +-----------------------+
+ * | sbf_NameSlot[n_slots] | FNV-1a hash of the name, and the index + 1
+ * |                       | of the dataset (0 for an empty slot)
+ * +-----------------------+
+ *
+ * Collisions are resolved by linear probing; where names are
+ * duplicated, the first dataset with that name is found. Like every
+ * header integer, n_slots and the slots are stored little endian.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SBF_NAME_INDEX_MIN_SLOTS 8
+
+typedef struct {
+    uint32_t hash;
+    uint32_t index; // dataset index + 1, 0 if the slot is empty
+} sbf_NameSlot;
+
+/*
+ * FNV-1a hash of 'name', which is at most 'length' characters
+ * long or terminated by a NUL.
+ */
+uint32_t sbf_name_hash(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length && name[i] != '\0'; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Number of slots needed to index 'n' names, keeping the table at
+ * most half full
+ */
+uint64_t sbf_name_index_slots(uint64_t n) {
+    uint64_t n_slots = SBF_NAME_INDEX_MIN_SLOTS;
+    while (n_slots < 2 * n)
+        n_slots *= 2;
+    return n_slots;
+}
+
+/*
+ * Insert dataset 'index' with name 'hash' into a table with room for it
+ */
+void sbf_name_index_insert(sbf_NameSlot *slots, uint64_t n_slots, uint32_t hash,
+                           uint32_t index) {
+    uint64_t slot = hash & (n_slots - 1);
+    while (slots[slot].index != 0)
+        slot = (slot + 1) & (n_slots - 1);
+    slots[slot].hash = hash;
+    slots[slot].index = index + 1;
+}
+
+/*
+ * Rehash the 'n_old' slots of 'old' into 'slots', which has 'n_slots'
+ * empty slots. Entries are moved in index order so that duplicated
+ * names are still found first to last.
+ */
+int sbf_name_index_rehash(const sbf_NameSlot *old, uint64_t n_old, sbf_NameSlot *slots,
+                          uint64_t n_slots, uint64_t n_names) {
+    sbf_NameSlot *by_index = (sbf_NameSlot *)calloc(n_names ? n_names : 1, sizeof(*by_index));
+    if (by_index == NULL)
+        return -1;
+    for (uint64_t i = 0; i < n_old; i++) {
+        if (old[i].index != 0 && old[i].index <= n_names)
+            by_index[old[i].index - 1] = old[i];
+    }
+    for (uint64_t i = 0; i < n_names; i++) {
+        if (by_index[i].index != 0)
+            sbf_name_index_insert(slots, n_slots, by_index[i].hash, (uint32_t)i);
+    }
+    free(by_index);
+    return 0;
+}
+
+/*
+ * Is a table read from a file usable to index 'n_names' names?
+ */
+int sbf_name_index_valid(const sbf_NameSlot *slots, uint64_t n_slots, uint64_t n_names) {
+    if (n_slots == 0)
+        return n_names == 0;
+    if ((n_slots & (n_slots - 1)) != 0 || n_slots <= n_names)
+        return 0;
+    for (uint64_t i = 0; i < n_slots; i++) {
+        if (slots[i].index > n_names)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Index of the dataset called 'name' (at most 'length' characters),
+ * or -1 if there is none. 'name_of(context, index)' returns the
+ * name of the dataset at 'index', and is only called for datasets
+ * whose hash matches.
+ */
+int64_t sbf_name_index_find(const sbf_NameSlot *slots, uint64_t n_slots,
+                            const char *name, size_t length,
+                            const char *(*name_of)(const void *, uint32_t),
+                            const void *context) {
+    if (n_slots == 0)
+        return -1;
+    const uint32_t hash = sbf_name_hash(name, length);
+    uint64_t slot = hash & (n_slots - 1);
+    for (uint64_t probes = 0; probes < n_slots && slots[slot].index != 0; probes++) {
+        if (slots[slot].hash == hash) {
+            uint32_t index = slots[slot].index - 1;
+            if (strncmp(name_of(context, index), name, length) == 0)
+                return index;
+        }
+        slot = (slot + 1) & (n_slots - 1);
+    }
+    return -1;
+}
@@ -2,21 +2,49 @@
 """
 from collections import OrderedDict
 from enum import IntEnum
+import mmap
+import os
 import struct
+import sys
 import numpy as np
 
 __author__ = "Peter Spackman <peterspackman@fastmail.com>"
-__version__ = "0.2.0"
-SBF_FILEHEADER_FMT = "=3s3sb"
+__version__ = "0.3.2"
+SBF_VERSION_STRING = b'032'
+# every integer of the headers is little endian, whatever the machine
+SBF_FILEHEADER_FMT = "<3s3sQQ"
 SBF_FILEHEADER_SIZE = struct.calcsize(SBF_FILEHEADER_FMT)
+# before 0.3.0 the number of datasets was a single byte
+SBF_WIDE_COUNT_VERSION_STRING = b'030'
+# from 0.3.1 an index of dataset names follows the data headers
+SBF_NAME_INDEX_VERSION_STRING = b'031'
+# from 0.3.2 the file header ends with the alignment of the blobs
+SBF_ALIGNMENT_VERSION_STRING = b'032'
+SBF_NAME_INDEX_MIN_SLOTS = 8
+SBF_NAME_LENGTH = 62
+SBF_TOKEN_VERSION_SIZE = 6
 # this is everything except the last part of the dataheader
 # which is the shape array
-SBF_DATAHEADER_FMT = "=62sbb"
+SBF_DATAHEADER_FMT = "<62sBb"
 SBF_DATAHEADER_SIZE = struct.calcsize(SBF_DATAHEADER_FMT)
+SBF_SHAPE_SIZE = 8 * 8
+# bytes read at once when reading headers, enough for ~500 datasets
+SBF_HEADER_READ_SIZE = 64 * 1024
 _UNPACK_FILEHEADER = struct.Struct(SBF_FILEHEADER_FMT).unpack_from
+_UNPACK_UNALIGNED_FILEHEADER = struct.Struct("<3s3sQ").unpack_from
+_UNPACK_LEGACY_FILEHEADER = struct.Struct("<3s3sB").unpack_from
 _UNPACK_DATAHEADER = struct.Struct(SBF_DATAHEADER_FMT).unpack_from
 _PACK_FILEHEADER = struct.Struct(SBF_FILEHEADER_FMT).pack
 _PACK_DATAHEADER = struct.Struct(SBF_DATAHEADER_FMT).pack
+# chunk index at the start of compressed datasets, see sbf_codec.h
+SBF_CHUNK_INDEX_FMT = "<BB6xQQ"
+SBF_CHUNK_INDEX_SIZE = struct.calcsize(SBF_CHUNK_INDEX_FMT)
+_UNPACK_CHUNK_INDEX = struct.Struct(SBF_CHUNK_INDEX_FMT).unpack_from
+SBF_CODEC_LZ = 1
+SBF_FILTER_SHUFFLE = 0x01
+SBF_FILTER_DELTA = 0x02
+# most buffers gathered into one writev, as in sbf_checkpoint.h
+SBF_IOV_MAX = 1024
 
 _OUTPUT_FORMAT_STRING = """dataset:\t'{self.name}'
 dtype:\t\t{self.datatype.name}
@@ -29,11 +57,21 @@ endianness:\t{endianness}{data_sep}{data}{data_sep}
 """
 
 
-def read_file(filepath):
-    """Helper method to read an SBF file from a given filepath
+def align_up(size, alignment):
+    """Round size up to a multiple of alignment
+
+    >>> align_up(4097, 4096), align_up(10, 1)
+    (8192, 10)
+    """
+    return -(-size // alignment) * alignment
+
+
+def read_file(filepath, headers_only=False):
+    """Helper method to read an SBF file from a given filepath,
+    see File.read
     """
     sbf_file = File(filepath)
-    sbf_file.read()
+    sbf_file.read(headers_only=headers_only)
     return sbf_file
 
 
@@ -44,11 +82,207 @@ def bytes2str(bytes_arr):
     return (bytes_arr.split(b'\0')[0]).decode('utf-8')
 
 
+def as_array(data):
+    """Helper method to convert array-like data to a numpy array without
+    copying it, and strings to arrays of characters
+
+    >>> as_array('abc')
+    array([b'a', b'b', b'c'], dtype='|S1')
+    """
+    if isinstance(data, str):
+        data = data.encode('utf-8')
+    if isinstance(data, bytes):
+        return np.frombuffer(data, dtype='S1')
+    return np.asarray(data)
+
+
+def write_buffers(buf, buffers):
+    """Write each of `buffers` one after the other to `buf`, an
+    unbuffered file, gathering them into as few writes as possible
+    where the system has writev
+
+    >>> import io
+    >>> out = io.BytesIO()
+    >>> write_buffers(out, [b'ab', np.arange(2, dtype=np.uint8)])
+    >>> out.getvalue()
+    b'ab\\x00\\x01'
+    """
+    pending = [memoryview(b).cast('B') for b in buffers if len(b)]
+    try:
+        fd = buf.fileno() if hasattr(os, 'writev') else None
+    except (AttributeError, OSError):
+        fd = None
+    first = 0
+    while first < len(pending):
+        if fd is not None:
+            written = os.writev(fd, pending[first:first + SBF_IOV_MAX])
+        else:
+            written = buf.write(pending[first])
+        if not written:
+            raise OSError('Failed to write file')
+        # skip what was written, which may end part way through a buffer
+        while first < len(pending) and written >= len(pending[first]):
+            written -= len(pending[first])
+            first += 1
+        if written:
+            pending[first] = pending[first][written:]
+
+
+def name_hash(name):
+    """FNV-1a hash of an encoded dataset name, as in sbf_name_index.h
+
+    >>> hex(name_hash(b'a'))
+    '0xe40c292c'
+    """
+    value = 2166136261
+    for char in name[:SBF_NAME_LENGTH].split(b'\0', 1)[0]:
+        value = ((value ^ char) * 16777619) & 0xffffffff
+    return value
+
+
+def name_index(names):
+    """Serialize an open addressed index of encoded dataset names
+
+    >>> len(name_index([b'a', b'b']))
+    72
+    """
+    n_slots = SBF_NAME_INDEX_MIN_SLOTS
+    while n_slots < 2 * len(names):
+        n_slots *= 2
+    slots = np.zeros((n_slots, 2), dtype='<u4')
+    for i, name in enumerate(names):
+        value = name_hash(name)
+        slot = value & (n_slots - 1)
+        while slots[slot, 1]:
+            slot = (slot + 1) & (n_slots - 1)
+        slots[slot] = (value, i + 1)
+    return struct.pack("<Q", n_slots) + slots.tobytes()
+
+
 class InvalidDatasetError(Exception):
     """Simple name wrapper for SBF dataset errors"""
     pass
 
 
+def _read_length(src, pos, length):
+    """Read an LZ4 style extended length starting at src[pos]"""
+    while True:
+        extra = src[pos]
+        pos += 1
+        length += extra
+        if extra != 255:
+            return length, pos
+
+
+def lz_decompress(src, size):
+    """Decompress a chunk in the LZ4 block format written by sbf_codec.h
+
+    >>> lz_decompress(b'\\x10a\\x01\\x00', 5)
+    b'aaaaa'
+    """
+    dst = bytearray()
+    pos = 0
+    while pos < len(src):
+        token = src[pos]
+        pos += 1
+        literals = token >> 4
+        if literals == 15:
+            literals, pos = _read_length(src, pos, literals)
+        dst += src[pos:pos + literals]
+        pos += literals
+        if pos >= len(src):
+            break
+        offset = src[pos] | (src[pos + 1] << 8)
+        pos += 2
+        match = token & 15
+        if match == 15:
+            match, pos = _read_length(src, pos, match)
+        match += 4
+        start = len(dst) - offset
+        if offset == 0 or start < 0:
+            raise InvalidDatasetError('Corrupt compressed chunk')
+        if offset >= match:
+            dst += dst[start:start + match]
+        else:
+            for i in range(match):
+                dst.append(dst[start + i])
+    if len(dst) != size:
+        raise InvalidDatasetError('Corrupt compressed chunk')
+    return bytes(dst)
+
+
+def unshuffle(data, itemsize):
+    """Undo the byte-shuffle filter applied to a chunk by sbf_codec.h
+
+    >>> unshuffle(b'acbd', 2)
+    b'abcd'
+    """
+    count = len(data) // itemsize
+    arr = np.frombuffer(data, dtype=np.uint8)
+    body = arr[:count * itemsize].reshape(itemsize, count).T.ravel()
+    return body.tobytes() + bytes(arr[count * itemsize:])
+
+
+def delta_decode(data, itemsize):
+    """Undo the XOR-delta filter applied to a chunk by sbf_codec.h
+
+    >>> delta_decode(b'ab\\x00\\x00\\x03\\x01c', 2)
+    b'ababbcc'
+    """
+    count = len(data) // itemsize
+    arr = np.frombuffer(data, dtype=np.uint8)
+    body = np.bitwise_xor.accumulate(
+        arr[:count * itemsize].reshape(count, itemsize), axis=0)
+    return body.tobytes() + bytes(arr[count * itemsize:])
+
+
+def read_chunk_index(blob):
+    """Read the chunk index at the start of a compressed dataset blob,
+    returning the index header and the chunk offsets"""
+    if len(blob) < SBF_CHUNK_INDEX_SIZE:
+        raise InvalidDatasetError('Compressed dataset extends past the end of the file')
+    header = _UNPACK_CHUNK_INDEX(blob)
+    n_chunks = header[3]
+    if n_chunks >= (len(blob) - SBF_CHUNK_INDEX_SIZE) // 8:
+        raise InvalidDatasetError('Compressed dataset extends past the end of the file')
+    offsets = np.frombuffer(blob, dtype='<u8', count=n_chunks + 1,
+                            offset=SBF_CHUNK_INDEX_SIZE)
+    return header, offsets
+
+
+def compressed_size(blob):
+    """Number of bytes a compressed dataset occupies at the start of blob
+
+    >>> compressed_size(struct.pack(SBF_CHUNK_INDEX_FMT + "QQ", 1, 0, 64, 1, 0, 5))
+    45
+    """
+    _, offsets = read_chunk_index(blob)
+    return SBF_CHUNK_INDEX_SIZE + 8 * len(offsets) + int(offsets[-1])
+
+
+def read_compressed(blob, num_bytes, itemsize):
+    """Decompress a compressed dataset from the start of blob, a
+    buffer such as a memoryview of the mapped file"""
+    (codec, filters, chunk_size, n_chunks), offsets = read_chunk_index(blob)
+    start = SBF_CHUNK_INDEX_SIZE + 8 * (n_chunks + 1)
+    if start + int(offsets[-1]) > len(blob):
+        raise InvalidDatasetError('Compressed dataset extends past the end of the file')
+    chunks = []
+    for i in range(n_chunks):
+        stored = bytes(blob[start + int(offsets[i]):start + int(offsets[i + 1])])
+        size = min(chunk_size, num_bytes - i * chunk_size)
+        if len(stored) != size:
+            if codec != SBF_CODEC_LZ:
+                raise InvalidDatasetError('Unknown codec {}'.format(codec))
+            stored = lz_decompress(stored, size)
+        if filters & SBF_FILTER_SHUFFLE:
+            stored = unshuffle(stored, itemsize)
+        if filters & SBF_FILTER_DELTA:
+            stored = delta_decode(stored, itemsize)
+        chunks.append(stored)
+    return b''.join(chunks)
+
+
 class SBFType(IntEnum):
     """ Integer storage value of different SBF types.
     
@@ -78,11 +312,13 @@ class SBFType(IntEnum):
 
     @staticmethod
     def from_numpy_type(numpy_type):
-        """Get the relevant SBF type for a given numpy type
+        """Get the relevant SBF type for a given numpy type, in either byte order
         >>> SBFType.from_numpy_type(np.dtype('float32'))
         <SBFType.sbf_float: 3>
+        >>> SBFType.from_numpy_type(np.dtype('>i4'))
+        <SBFType.sbf_integer: 1>
         """
-        return _NUMPY_SBF_TYPE_MAP[numpy_type]
+        return _NUMPY_SBF_TYPE_MAP[np.dtype(numpy_type).newbyteorder('=')]
 
 
 _SBF_NUMPY_TYPE_MAP = {
@@ -105,6 +341,7 @@ class Flags:
 
     Keyword arguments
     binary -- integer/binary value of the flags (default 0b0000000)
+    endianness -- byte order of the data (default that of this machine)
 
     >>> f = Flags(column_major=True, dimensions=3)
     >>> f
@@ -114,11 +351,12 @@ class Flags:
     dimension_bits = 0b00001111
     big_endian_bit = 0b10000000
     custom_datatype_bit = 0b00100000
+    compressed_bit = 0b00010000
 
     def __init__(self,
                  column_major=False,
                  dimensions=0,
-                 endianness='little',
+                 endianness=sys.byteorder,
                  custom_datatype=False):
 
         self.binary = 0
@@ -174,7 +412,7 @@ class Flags:
     def endianness(self):
         """Is the binary data in this dataset big or little endian?
 
-        >>> f = Flags(dimensions=7)
+        >>> f = Flags(dimensions=7, endianness='little')
         >>> f.endianness
         'little'
         """
@@ -182,7 +420,7 @@ class Flags:
 
     def set_endianness(self, value):
         """Set whether the dataset is stored as big or little endian.
-        Note: endianness is unimplemented as yet in SBF in general.
+        Readers swap data of the other byte order to their own.
 
         >>> f = Flags(dimensions=7, endianness='big')
         >>> f.set_endianness('little')
@@ -219,6 +457,15 @@ class Flags:
             self.clear_bits(Flags.custom_datatype_bit)
 
 
+    @property
+    def compressed(self):
+        """Is the dataset stored compressed?
+        >>> f = Flags.from_bits(Flags.compressed_bit)
+        >>> f.compressed
+        True
+        """
+        return bool(self.binary & Flags.compressed_bit)
+
     def set_bits(self, mask):
         """Helper method to set bits based on a mask
         >>> f = Flags()
@@ -243,6 +490,26 @@ class Flags:
             d=self.dimensions,
             c=self.column_major)
 
+    @staticmethod
+    def for_array(data):
+        """Flags describing how the numpy array `data` is laid out in
+        memory: Fortran ordered arrays are column major
+
+        >>> Flags.for_array(np.zeros((2, 3), order='F'))
+        Flags(dim=2, col=True)
+        >>> Flags.for_array(np.zeros(3, dtype='>f8')).endianness
+        'big'
+        """
+        byteorder = data.dtype.byteorder
+        if byteorder == '>':
+            endianness = 'big'
+        elif byteorder == '<':
+            endianness = 'little'
+        else:
+            endianness = sys.byteorder
+        return Flags(column_major=not data.flags.c_contiguous,
+                     dimensions=data.ndim, endianness=endianness)
+
     @staticmethod
     def from_bits(bits):
         """Construct a Flags instance from a bitmask
@@ -275,15 +542,24 @@ class Dataset:
     >>> Dataset('example_integer_dataset', [1,2,3,4])
     Dataset('example_integer_dataset', sbf_long, [4])
 
-    Alternately, they may be specified by the numpy array
+    Alternately, they may be specified by the numpy array,
+    which is not copied
     >>> Dataset('example_float_dataset', np.array([1,2.5,3,4], dtype=np.float32))
     Dataset('example_float_dataset', sbf_float, [4])
 
+    Strings are stored as arrays of characters
+    >>> Dataset('example_string_dataset', 'hello')
+    Dataset('example_string_dataset', sbf_char, [5])
+
     """
     def __init__(self, name, data, flags=None, dtype=None, shape=None):
-        data = np.array(data)
+        if data is not None:
+            data = as_array(data)
         self._data = data
         self._name = name
+        # where the data is in a mapped file, until it is first used
+        self._mapping = None
+        self._offset = 0
 
         if dtype is not None:
             self._dtype = dtype
@@ -295,12 +571,16 @@ class Dataset:
         else:
             self._shape = np.array(data.shape)
 
-        self._flags = Flags(dimensions=self._shape.size)
         if flags:
             self._flags = flags
+        elif data is not None:
+            self._flags = Flags.for_array(data)
+        else:
+            self._flags = Flags(dimensions=self._shape.size)
 
     def set_data(self, data, flags=None):
-        """Assign the data stored in this dataset to be the array-like `data`.
+        """Assign the data stored in this dataset to be the array-like `data`,
+        without copying it.
 
         >>> dset = Dataset('example', [1,2,3,4])
         >>> dset
@@ -309,13 +589,12 @@ class Dataset:
         >>> dset
         Dataset('example', sbf_double, [2 1])
         """
-        data = np.array(data)
+        data = as_array(data)
         self._data = data
+        self._mapping = None
         self._dtype = SBFType.from_numpy_type(data.dtype)
         self._shape = np.array(data.shape)
-        self._flags = Flags(dimensions=self._shape.size)
-        if flags:
-            self._flags = flags
+        self._flags = flags if flags else Flags.for_array(data)
 
     def set_name(self, name):
         """Set the name of this dataset.
@@ -348,25 +627,72 @@ class Dataset:
                        dtype=dtype, shape=shape[np.nonzero(shape)])
         return dset
 
-    def read_data(self, buf):
-        """Read the raw data from a given buffer"""
-        num_bytes = np.product(self._shape)
-        if self.datatype == SBFType.sbf_char and self.dimensions == 1:
-            data = buf.read(num_bytes)
-            self._data = bytes2str(struct.unpack('={}s'.format(num_bytes), data)[0])
-        else:
-            self._data = np.fromfile(buf, dtype=self.datatype.as_numpy(),
-                                     count=num_bytes)
-            kwargs = {}
-            if self.flags.column_major:
-                kwargs['order'] = 'F'
-            self._data = self._data.reshape(self._shape, **kwargs)
-
-    def _write_header(self, buf):
-        pass
+    def file_dtype(self):
+        """numpy dtype of the data as stored in the file, i.e.
+        in the byte order given by the flags
 
-    def _write_datablock(self, buf):
-        np.save(buf, self.data)
+        >>> header_struct = (b"big", Flags.big_endian_bit | 1, 4)
+        >>> shape = np.array([2, 0, 0, 0, 0, 0, 0, 0])
+        >>> Dataset.from_header(header_struct, shape).file_dtype().str
+        '>f8'
+        """
+        order = '>' if self.flags.endianness == 'big' else '<'
+        return self.datatype.as_numpy().newbyteorder(order)
+
+    def stored_size(self, mapping, offset):
+        """Number of bytes the blob of this dataset, starting at
+        `offset` in `mapping`, occupies in the file"""
+        if self.flags.compressed:
+            return compressed_size(memoryview(mapping)[offset:])
+        return int(np.prod(self._shape)) * self.datatype.as_numpy().itemsize
+
+    def map_data(self, mapping, offset):
+        """Use the blob starting at `offset` in `mapping`, a read only
+        mmap of the whole file, as the data of this dataset. Nothing is
+        read until the data is first used."""
+        self._data = None
+        self._mapping = mapping
+        self._offset = offset
+
+    def read_data(self, mapping, offset):
+        """Return the data of the blob starting at `offset` in `mapping`.
+
+        Uncompressed datasets are returned as read only views of the
+        mapping, in the byte order of the file (numpy swaps as it goes),
+        so only the pages used are ever read. Column major datasets are
+        viewed with Fortran strides rather than copied. Compressed
+        datasets are decompressed into a new array."""
+        count = int(np.prod(self._shape))
+        file_dtype = self.file_dtype()
+        order = 'F' if self.flags.column_major else 'C'
+        shape = tuple(int(x) for x in self._shape)
+        if self.flags.compressed:
+            itemsize = file_dtype.itemsize
+            raw = read_compressed(memoryview(mapping)[offset:], count * itemsize, itemsize)
+            data = np.frombuffer(raw, dtype=file_dtype)
+            data = data.astype(self.datatype.as_numpy(), copy=False)
+            return data.reshape(shape, order=order)
+        if offset + count * file_dtype.itemsize > len(mapping):
+            raise InvalidDatasetError(
+                "Dataset '{}' extends past the end of the file".format(self.name))
+        if self.is_string():
+            return bytes2str(mapping[offset:offset + count])
+        return np.ndarray(shape, dtype=file_dtype, buffer=mapping,
+                          offset=offset, order=order)
+
+    def blob(self):
+        """The flags and the bytes of this dataset as written to a file.
+        C and Fortran ordered arrays are written as they are, without a
+        copy, the latter as column major, and in their own byte order.
+
+        >>> flags, data = Dataset('x', np.arange(6, dtype=np.uint8).reshape(2, 3).T).blob()
+        >>> flags, data
+        (Flags(dim=2, col=True), array([0, 1, 2, 3, 4, 5], dtype=uint8))
+        """
+        data = as_array(self.data)
+        if not (data.flags.c_contiguous or data.flags.f_contiguous):
+            data = np.ascontiguousarray(data)
+        return Flags.for_array(data), data.ravel(order='K').view(np.uint8)
 
     @property
     def name(self):
@@ -375,7 +701,10 @@ class Dataset:
 
     @property
     def data(self):
-        """The data contained in this dataset"""
+        """The data contained in this dataset, read from the
+        mapped file when first used"""
+        if self._data is None and self._mapping is not None:
+            self._data = self.read_data(self._mapping, self._offset)
         return self._data
 
     @property
@@ -395,7 +724,7 @@ class Dataset:
 
     def sbf_shape(self):
         """Return the shape of this dataset in SBF format"""
-        arr = np.zeros(8, dtype=np.uint64)
+        arr = np.zeros(8, dtype='<u8')
         arr[:self.dimensions] = self._shape[:]
         return arr
 
@@ -420,7 +749,7 @@ class Dataset:
             self=self,
             datatype_width=np.dtype(self.datatype.as_numpy()).itemsize * 8,
             storage="column major" if self.flags.column_major else "row major",
-            endianness="little endian",
+            endianness=self.flags.endianness + " endian",
             data_sep=sep, data=data)
         print(output)
 
@@ -431,60 +760,97 @@ class File:
         self._path = path
         self._datasets = OrderedDict()
         self._n_datasets = 0
-
-    def read(self):
-        """Read the data contained in this file"""
+        self._alignment = 1
+        self._data_start = 0
+
+    def read(self, headers_only=False):
+        """Read the headers of this file and map its data, which is
+        only read as each dataset's data is used, or if `headers_only`
+        just the name, type and shape of each dataset, leaving its
+        data as None"""
         with open(self._path, "rb") as buf:
             self._read_headers(buf)
-            self._read_data(buf)
+            if not headers_only:
+                self._map_data(buf)
 
     def write(self):
-        """Write the data contained in this file to the specified path"""
-        with open(self._path, 'wb') as buf:
-            self._write_headers(buf)
-            self._write_data(buf)
+        """Write the data contained in this file to the specified path,
+        the headers as a single buffer followed by the data of each
+        dataset straight from its array"""
+        blobs = [dataset.blob() for dataset in self._datasets.values()]
+        headers = self._pack_headers([flags for flags, _ in blobs])
+        with open(self._path, 'wb', buffering=0) as buf:
+            write_buffers(buf, [headers] + [data for _, data in blobs])
 
     def _read_headers(self, buf):
-        file_header_raw = buf.read(SBF_FILEHEADER_SIZE)
-        assert file_header_raw
-        file_header = _UNPACK_FILEHEADER(file_header_raw)
+        """Read the headers into memory, usually with a single read,
+        and parse them from there"""
+        raw = buf.read(SBF_HEADER_READ_SIZE)
+
+        def have(size):
+            nonlocal raw
+            if len(raw) < size:
+                raw += buf.read(size - len(raw))
+            assert len(raw) >= size
+
+        have(SBF_TOKEN_VERSION_SIZE)
+        version = bytes(raw[3:SBF_TOKEN_VERSION_SIZE])
+        if version >= SBF_ALIGNMENT_VERSION_STRING:
+            have(SBF_FILEHEADER_SIZE)
+            file_header = _UNPACK_FILEHEADER(raw)
+            offset = SBF_FILEHEADER_SIZE
+        elif version >= SBF_WIDE_COUNT_VERSION_STRING:
+            have(SBF_FILEHEADER_SIZE - 8)
+            file_header = _UNPACK_UNALIGNED_FILEHEADER(raw)
+            offset = SBF_FILEHEADER_SIZE - 8
+        else:
+            have(SBF_TOKEN_VERSION_SIZE + 1)
+            file_header = _UNPACK_LEGACY_FILEHEADER(raw)
+            offset = SBF_TOKEN_VERSION_SIZE + 1
         self._n_datasets = file_header[2]
+        self._alignment = file_header[3] if len(file_header) > 3 else 1
+        assert self._alignment >= 1, "invalid alignment"
+        header_size = SBF_DATAHEADER_SIZE + SBF_SHAPE_SIZE
+        have(offset + self._n_datasets * header_size)
         for _ in range(self._n_datasets):
-            data_header_raw = buf.read(SBF_DATAHEADER_SIZE)
-            assert data_header_raw
-            data_header = _UNPACK_DATAHEADER(data_header_raw)
-            shape = np.fromfile(buf, dtype=np.uint64, count=8)
+            data_header = _UNPACK_DATAHEADER(raw, offset)
+            shape = np.frombuffer(raw, dtype='<u8', count=8,
+                                  offset=offset + SBF_DATAHEADER_SIZE)
             dataset = Dataset.from_header(data_header, shape)
             self._datasets[dataset.name] = dataset
-
-    def _write_headers(self, buf):
-        file_header = _PACK_FILEHEADER(b'SBF', b'020', self._n_datasets)
-        buf.write(file_header)
-        for dataset in self._datasets.values():
-            flags = dataset.flags
-            # if we're writing a file, unset the column major bit as
-            # numpy arrays are stored row major
-            if flags.column_major:
-                flags.set_column_major(False)
-            data_header = _PACK_DATAHEADER(
+            offset += header_size
+        if version >= SBF_NAME_INDEX_VERSION_STRING:
+            # names are looked up through the dict, so skip the index
+            have(offset + 8)
+            n_slots, = struct.unpack_from("<Q", raw, offset)
+            offset += 8 + 8 * n_slots
+        self._data_start = align_up(offset, self._alignment)
+
+    def _pack_headers(self, flags):
+        """Pack the headers, with the given flags for each dataset,
+        into one buffer"""
+        # blobs are written packed
+        parts = [_PACK_FILEHEADER(b'SBF', SBF_VERSION_STRING, self._n_datasets, 1)]
+        for dataset, dataset_flags in zip(self._datasets.values(), flags):
+            parts.append(_PACK_DATAHEADER(
                 dataset.name.encode('utf-8'),
-                flags.binary,
-                int(dataset.datatype))
-            buf.write(data_header)
-            dataset.sbf_shape().tofile(buf)
-
-    def _read_data(self, buf):
-        for dataset in self._datasets.values():
-            dataset.read_data(buf)
-
-    def _write_data(self, buf):
+                dataset_flags.binary,
+                int(dataset.datatype)))
+            parts.append(dataset.sbf_shape().tobytes())
+        parts.append(name_index(
+            [d.name.encode('utf-8') for d in self._datasets.values()]))
+        return b''.join(parts)
+
+    def _map_data(self, buf):
+        """Map the whole file read only, and find the blob of each
+        dataset from the headers. The mapping stays open while any
+        dataset (or view of its data) uses it."""
+        mapping = mmap.mmap(buf.fileno(), 0, access=mmap.ACCESS_READ)
+        offset = self._data_start
         for dataset in self._datasets.values():
-            if dataset.is_string():
-                np.fromstring(dataset.data,
-                              dtype=np.uint8,
-                              count=dataset.shape[0]).tofile(buf)
-            else:
-                dataset.data.tofile(buf)
+            offset = align_up(offset, self._alignment)
+            dataset.map_data(mapping, offset)
+            offset += dataset.stored_size(mapping, offset)
 
     def __getitem__(self, key):
         return self._datasets[key]
@@ -522,7 +888,7 @@ def main():
     for path in args.paths:
         print(path)
         sbf_file = File(path)
-        sbf_file.read()
+        sbf_file.read(headers_only=not args.print_datasets)
         for dset in sbf_file.datasets():
             dset.pretty_print(show_data=args.print_datasets)
 
@@ -14,7 +14,7 @@ sbf_classifiers = [
 
 
 setup(name='sbf',
-      version='0.2.0',
+      version='0.3.2',
       py_modules=['sbf'],
       url='http://github.com/peterspackman/sbf',
       author='Peter Spackman',
@@ -9,7 +9,16 @@
 #include <ctype.h>
 #include <math.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "sbf.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#define SBFTOOL_SSE2 1
+#include <emmintrin.h>
+#endif
 #define SBFTOOL_VERSION "0.3.0"
 
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
@@ -47,19 +56,56 @@ enum log_level GLOBAL_LOG_LEVEL = info;
             exit(EXIT_FAILURE);              \
     } while (0)
 
-float eps = 1e-5;
+/*
+ * Floating point values (and the components of complex values) are the
+ * same if they are identical, both NaN, or within any of these
+ */
+typedef struct {
+    double absolute;
+    double relative; // of the larger magnitude
+    uint64_t ulps;   // units in the last place
+} tolerances;
+
+tolerances tol = {1e-5, 0.0, 0};
+
+// sidecar manifest of the checksums of a file, see verify_file
+#define MANIFEST_SUFFIX ".crc32c"
+// datasets are printed and exported in pieces of this size, see dataset_reader
+#define PRINT_CHUNK_SIZE ((sbf_size)4 * 1024 * 1024)
+// text is formatted into a buffer of this size before being written out
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+// most characters a single element is formatted to, see format_element
+#define MAX_ELEMENT_TEXT 128
+// datasets are compared in chunks of this size, see diff_pairs
+#define DIFF_CHUNK_SIZE ((sbf_size)4 * 1024 * 1024)
+// blobs are checksummed in pieces of this size, spread across threads
+#define VERIFY_PIECE_SIZE ((sbf_size)64 * 1024 * 1024)
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
 
 void usage(const char * progname) {
     fprintf(stdout,
     "sbftool %s (SBF v%s)\n"
     "Usage:\n"
     "\tsbftool [-dhvp] filename\n"
-    "\tsbftool [-cm] filename1 filename2\n"
+    "\tsbftool [-cm] [-e abs] [-r rel] [-u ulps] [-j threads] filename1 filename2\n"
+    "\tsbftool -V [-W] [-j threads] filename(s)\n"
+    "\tsbftool -x csv|npy -d dataset [-o output] filename\n"
     "Options:\n"
         "\t-d\tspecify a dataset.\n"
         "\t-p\tprint out contents of dataset(s).\n"
+        "\t-x\tExport a dataset as CSV (a line per row) or as a NumPy .npy file.\n"
+        "\t-o\tWith -x, write to this file rather than standard output.\n"
         "\t-c\tCompare contents of two sbf files (like diff).\n"
         "\t-m\tOnly compare dataset metadata of the two sbf files.\n"
+        "\t-e\tAbsolute tolerance comparing floating point values (default 1e-5).\n"
+        "\t-r\tRelative tolerance comparing floating point values (default 0).\n"
+        "\t-u\tTolerance in units in the last place comparing floating point values (default 0).\n"
+        "\t\tValues within any tolerance, or both NaN, are the same.\n"
+        "\t-V\tVerify the layout and checksums of file(s), against the checksums\n"
+        "\t\tending them and/or a manifest 'filename"MANIFEST_SUFFIX"' if present.\n"
+        "\t-W\tWith -V, (re)write the manifest of each file instead of checking it.\n"
+        "\t-j\tNumber of threads to compare or verify with (default: one per CPU).\n"
         "\t-v\tIncrease verbosity (up to three times).\n\n"
         "\t-h\tPrint this help message.\n\n"
     "By default sbftool simply prints out info about datasets in the file(s) provided.\n",
@@ -68,15 +114,11 @@ void usage(const char * progname) {
     exit(EXIT_SUCCESS);
 }
 
-int_fast8_t get_dataset(const char * name, const sbf_File * file) {
-    int_fast8_t found = -1;
-    for(sbf_byte i = 0; i < file->n_datasets; i++) {
-        if(strncmp(name, file->datasets[i].name, SBF_NAME_LENGTH) == 0) {
-            found = i;
-            log(debug, "Found matching dataset '%s' in '%s'\n", file->datasets[i].name,
-                    file->filename);
-        }
-    }
+int_fast32_t get_dataset(const char * name, const sbf_File * file) {
+    int_fast32_t found = sbf_dataset_index(file, name);
+    if(found != -1)
+        log(debug, "Found matching dataset '%s' in '%s'\n", file->datasets[found].name,
+            file->filename);
     return found;
 }
 
@@ -87,149 +129,1108 @@ bool shape_equal(sbf_size shape1[SBF_MAX_DIM], sbf_size shape2[SBF_MAX_DIM]) {
     return true;
 }
 
-void increment_index(const sbf_size shape[SBF_MAX_DIM],
-                     sbf_size idx[SBF_MAX_DIM], const sbf_byte dims) {
-    for(int dim = dims -1; dim > -1; dim--) {
-        idx[dim]++;
-        if(idx[dim] == shape[dim]) idx[dim] = 0;
-        else break;
+const char * sbf_datatype_name(sbf_byte data_type) {
+    switch(data_type) {
+        case SBF_DOUBLE: return "sbf_double";
+        case SBF_INT: return "sbf_integer";
+        case SBF_LONG: return "sbf_long_integer";
+        case SBF_FLOAT: return "sbf_float";
+        case SBF_CFLOAT: return "sbf_complex_float";
+        case SBF_CDOUBLE: return "sbf_complex_double";
+        case SBF_CHAR: return "sbf_character";
+        default: return "sbf_byte";
     }
 }
 
-bool all_zero(sbf_size idx[SBF_MAX_DIM]) {
-    for(int dim = 0; dim < SBF_MAX_DIM; dim++) 
-        if(idx[dim] != 0) return 0;
-    return 1;
+/*
+ * Text is formatted into a buffer of OUTPUT_BUFFER_SIZE bytes, written
+ * out whenever it fills, rather than element by element through stdio
+ */
+typedef struct {
+    FILE *fp;
+    char *data;
+    size_t length;
+    bool failed;
+} text_output;
+
+bool output_open(text_output *out, FILE *fp) {
+    out->fp = fp;
+    out->data = malloc(OUTPUT_BUFFER_SIZE);
+    out->length = 0;
+    out->failed = (out->data == NULL);
+    return !out->failed;
+}
+
+void output_flush(text_output *out) {
+    if(out->length > 0 && fwrite(out->data, 1, out->length, out->fp) != out->length)
+        out->failed = true;
+    out->length = 0;
 }
 
-ptrdiff_t offset_of(sbf_size block_size, bool column_major, sbf_byte dims,
-                    const sbf_size shape[SBF_MAX_DIM], sbf_size idx[SBF_MAX_DIM]) {
-    ptrdiff_t offset = 0;
+/*
+ * Space for at least 'n' (no more than OUTPUT_BUFFER_SIZE) more bytes,
+ * to be claimed by adding to 'length'
+ */
+char *output_reserve(text_output *out, size_t n) {
+    if(out->length + n > OUTPUT_BUFFER_SIZE) output_flush(out);
+    return out->data + out->length;
+}
 
-    if(column_major) {
-        for(int_fast8_t i = 0; i < dims; i++) {
-            sbf_size product = 1;
-            for(int j = 0; j < i; j++) {
-                product = product * shape[j];
-            }
-            offset = offset + product * idx[i];
-        }
+void output_text(text_output *out, const char *text, size_t n) {
+    memcpy(output_reserve(out, n), text, n);
+    out->length += n;
+}
+
+bool output_close(text_output *out) {
+    if(out->data != NULL) output_flush(out);
+    free(out->data);
+    out->data = NULL;
+    return !out->failed;
+}
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/*
+ * Format 'value' in decimal at 'out', two digits at a time.
+ * Returns the number of characters written (at most 20).
+ */
+size_t format_uint(char *out, uint64_t value) {
+    char digits[20];
+    char *end = digits + sizeof(digits), *p = end;
+    while(value >= 100) {
+        const unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if(value >= 10) {
+        *--p = DIGIT_PAIRS[value * 2 + 1];
+        *--p = DIGIT_PAIRS[value * 2];
     }
     else {
-        for(int_fast8_t i = 0; i < dims; i++) {
-            sbf_size product = 1;
-            for(int j = i + 1; j < dims; j++) {
-                product = product * shape[j];
-            }
-            offset = offset + product * idx[i];
-        }
+        *--p = (char)('0' + value);
+    }
+    memcpy(out, p, end - p);
+    return end - p;
+}
+
+size_t format_int(char *out, int64_t value) {
+    if(value >= 0) return format_uint(out, (uint64_t)value);
+    *out = '-';
+    return 1 + format_uint(out + 1, 0 - (uint64_t)value);
+}
 
+/*
+ * 'x' multiplied by 10^k and rounded to an integer: to the nearest, or
+ * with a tie to the even one as printf does. The product is exact but
+ * for one rounding when |k| <= 22, whose error is found with fma if the
+ * product is close enough to half way to matter.
+ */
+uint64_t scale_and_round(double x, int k) {
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const bool exact = (k >= -22 && k <= 22);
+    double p;
+    if(exact) {
+        p = (k >= 0) ? x * powers[k] : x / powers[-k];
+    }
+    else {
+        // subnormal numbers need more than the largest power of ten
+        if(k > 300) {
+            x *= 1e300;
+            k -= 300;
+        }
+        p = (k >= 0) ? x * pow(10.0, k) : x / pow(10.0, -k);
+    }
+    double whole = floor(p), fraction = p - whole;
+    if(exact && fabs(fraction - 0.5) <= p * 2.3e-16) {
+        fraction += (k >= 0) ? fma(x, powers[k], -p) : fma(-p, powers[-k], x) / powers[-k];
     }
-    return offset * block_size;
+    if(fraction > 0.5 || (fraction == 0.5 && fmod(whole, 2.0) != 0.0)) whole += 1.0;
+    return (uint64_t)whole;
 }
 
-const char * sbf_datatype_name(sbf_byte data_type) {
-    switch(data_type) {
-        case SBF_DOUBLE: return "sbf_double";
-        case SBF_INT: return "sbf_integer";
-        case SBF_LONG: return "sbf_long_integer";
-        case SBF_FLOAT: return "sbf_float";
-        case SBF_CFLOAT: return "sbf_complex_float";
-        case SBF_CDOUBLE: return "sbf_complex_double";
-        case SBF_CHAR: return "sbf_character";
-        default: return "sbf_byte";
+/*
+ * Format 'x' rounded to 'digits' (at most 15) significant digits at
+ * 'out', as printf's %.<digits>g does, without going through printf:
+ * the digits are found by scaling 'x' to an integer. Only numbers too
+ * large or small for exact powers of ten may round differently, and 9
+ * digits still always read back as the same float.
+ *
+ * Returns the number of characters written (at most 32).
+ */
+size_t format_significant(char *out, double x, int digits) {
+    static const uint64_t limits[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+        10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+        100000000000000ULL, 1000000000000000ULL};
+    char *p = out;
+    if(isnan(x)) {
+        memcpy(p, "nan", 3);
+        return 3;
+    }
+    if(signbit(x)) {
+        *p++ = '-';
+        x = -x;
+    }
+    if(isinf(x)) {
+        memcpy(p, "inf", 3);
+        return p + 3 - out;
+    }
+    if(x == 0) {
+        *p++ = '0';
+        return p - out;
+    }
+
+    // estimate the decimal exponent from the binary one, which is at most one too low
+    int binary_exponent;
+    frexp(x, &binary_exponent);
+    int exponent = (int)floor((binary_exponent - 1) * 0.30102999566398120);
+    const uint64_t limit = limits[digits];
+    uint64_t m = scale_and_round(x, digits - 1 - exponent);
+    if(m >= limit) {
+        exponent++;
+        m = scale_and_round(x, digits - 1 - exponent);
     }
+    // rounding up to the next power of ten
+    if(m >= limit) {
+        m /= 10;
+        exponent++;
+    }
+    char d[20];
+    format_uint(d, m);
+    int n = digits;
+    while(n > 1 && d[n - 1] == '0') n--;
+
+    if(exponent < -4 || exponent >= digits) {
+        *p++ = d[0];
+        if(n > 1) {
+            *p++ = '.';
+            memcpy(p, d + 1, n - 1);
+            p += n - 1;
+        }
+        *p++ = 'e';
+        *p++ = (exponent < 0) ? '-' : '+';
+        if(abs(exponent) < 10) *p++ = '0';
+        p += format_uint(p, (uint64_t)abs(exponent));
+    }
+    else if(exponent >= 0) {
+        const int whole = exponent + 1;
+        memcpy(p, d, whole);
+        p += whole;
+        if(n > whole) {
+            *p++ = '.';
+            memcpy(p, d + whole, n - whole);
+            p += n - whole;
+        }
+    }
+    else {
+        *p++ = '0';
+        *p++ = '.';
+        for(int i = 0; i < -exponent - 1; i++) *p++ = '0';
+        memcpy(p, d, n);
+        p += n;
+    }
+    return p - out;
 }
 
-const char * format_string(sbf_byte data_type) {
-    switch(data_type) {
-        case SBF_DOUBLE: return "%s% 7.5g%s";
-        case SBF_INT: return "%s% 7"PRIi32"%s";
-        case SBF_LONG: return "%s% 7"PRIi64"%s";
-        case SBF_FLOAT: return "%s% 7.5g%s";
-        case SBF_CFLOAT: return "%s%3.1g%+3.1gi";
-        case SBF_CDOUBLE: return "%s%3.1g%+3.1gi";
-        case SBF_CHAR: return "%s%c%s";
-        default: return "%s%0x %s";
-    }
-}
-
-void pretty_print_block(void *data, const char *fmt_string, sbf_data_type dtype) {
-    ptrdiff_t offset = 0;
-    const char * suffix = "";
-    const char * prefix = "";
-    if(dtype == SBF_BYTE) 
-        suffix="";
-    switch(dtype) {
-        case(SBF_INT):
-            fprintf(stdout, fmt_string, "", *(int32_t *)(data), suffix);
+/*
+ * Right align the 'n' characters of 'text' in 'width' columns at 'out',
+ * with a space in place of the sign of positive numbers (as printf's
+ * "% <width>" flags). Returns the number of characters written.
+ */
+size_t format_aligned(char *out, const char *text, size_t n, size_t width) {
+    const size_t sign = (n > 0 && text[0] != '-') ? 1 : 0;
+    const size_t pad = (width > n + sign) ? width - n - sign : 0;
+    memset(out, ' ', pad + sign);
+    memcpy(out + pad + sign, text, n);
+    return pad + sign + n;
+}
+
+/*
+ * Format a floating point number at 'out', to 'digits' significant
+ * digits, or for doubles with 'digits' 0, exactly
+ */
+size_t format_real(char *out, double x, int digits) {
+    if(digits > 0) return format_significant(out, x, digits);
+    // 17 digits are more than format_significant can give
+    return (size_t)snprintf(out, MAX_ELEMENT_TEXT / 2, "%.17g", x);
+}
+
+/*
+ * Format the element at 'data' of a dataset like 'dset' (already in
+ * this machine's byte order) at 'out', for people to read, or for CSV
+ * at full precision (floats to 9 digits, doubles to 17, enough to read
+ * back the same value). Characters are formatted by write_elements.
+ *
+ * Returns the number of characters written, at most MAX_ELEMENT_TEXT.
+ */
+size_t format_element(char *out, const sbf_DataHeader dset, const sbf_byte *data, bool csv) {
+    char text[MAX_ELEMENT_TEXT];
+    size_t n = 0;
+    switch(dset.data_type) {
+        case(SBF_INT): {
+            int32_t value;
+            memcpy(&value, data, sizeof(value));
+            n = format_int(text, value);
             break;
-        case(SBF_LONG):
-            fprintf(stdout, fmt_string, "", *(int64_t *)(data), suffix);
+        }
+        case(SBF_LONG): {
+            int64_t value;
+            memcpy(&value, data, sizeof(value));
+            n = format_int(text, value);
             break;
-        case(SBF_DOUBLE):
-            fprintf(stdout, fmt_string, "", *(double *)(data), suffix);
+        }
+        case(SBF_DOUBLE): {
+            double value;
+            memcpy(&value, data, sizeof(value));
+            n = format_real(text, value, csv ? 0 : 5);
             break;
-        case(SBF_FLOAT):
-            fprintf(stdout, fmt_string, "", *(float *)(data), suffix);
+        }
+        case(SBF_FLOAT): {
+            float value;
+            memcpy(&value, data, sizeof(value));
+            n = format_real(text, value, csv ? 9 : 5);
             break;
+        }
         case(SBF_CFLOAT):
-            fprintf(stdout, fmt_string, "", *(float *)(data), 
-                                            *(float *)(data + sizeof(float)), 
-                                            suffix);
+        case(SBF_CDOUBLE): {
+            double re, im;
+            if(dset.data_type == SBF_CFLOAT) {
+                float parts[2];
+                memcpy(parts, data, sizeof(parts));
+                re = parts[0];
+                im = parts[1];
+            }
+            else {
+                memcpy(&re, data, sizeof(re));
+                memcpy(&im, data + sizeof(re), sizeof(im));
+            }
+            const int digits = csv ? (dset.data_type == SBF_CFLOAT ? 9 : 0) : 5;
+            n = format_real(text, re, digits);
+            if(!signbit(im) || isnan(im)) text[n++] = '+';
+            n += format_real(text + n, im, digits);
+            text[n++] = csv ? 'j' : 'i';
             break;
+        }
+        case(SBF_CHAR):
+            out[0] = (char)data[0];
+            return 1;
+        default: {
+            // bytes, in hex for people to read
+            if(csv) return format_uint(out, data[0]);
+            static const char hex[] = "0123456789abcdef";
+            if(data[0] >= 16) text[n++] = hex[data[0] >> 4];
+            text[n++] = hex[data[0] & 0xF];
+            memcpy(out, text, n);
+            return n;
+        }
+    }
+    if(csv || dset.data_type == SBF_CFLOAT || dset.data_type == SBF_CDOUBLE) {
+        memcpy(out, text, n);
+        return n;
+    }
+    return format_aligned(out, text, n, 7);
+}
+
+/*
+ * Map the bits of a floating point number to an unsigned integer of
+ * the same order, so that the difference of two is their distance in
+ * units in the last place
+ */
+uint64_t ordered_bits_double(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u >> 63) ? ~u : u | ((uint64_t)1 << 63);
+}
+
+uint32_t ordered_bits_float(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u >> 31) ? ~u : u | ((uint32_t)1 << 31);
+}
+
+bool doubles_equal(double a, double b) {
+    if(a == b || (isnan(a) && isnan(b))) return true;
+    if(isnan(a) || isnan(b)) return false;
+    const double d = fabs(a - b);
+    if(d <= tol.absolute || (isfinite(d) && d <= tol.relative * fmax(fabs(a), fabs(b))))
+        return true;
+    const uint64_t ka = ordered_bits_double(a), kb = ordered_bits_double(b);
+    return (ka > kb ? ka - kb : kb - ka) <= tol.ulps;
+}
+
+/*
+ * As doubles_equal, in single precision throughout
+ */
+bool floats_equal(float a, float b) {
+    if(a == b || (isnan(a) && isnan(b))) return true;
+    if(isnan(a) || isnan(b)) return false;
+    const float d = fabsf(a - b);
+    if(d <= (float)tol.absolute || (isfinite(d) && d <= (float)tol.relative * fmaxf(fabsf(a), fabsf(b))))
+        return true;
+    const uint32_t ka = ordered_bits_float(a), kb = ordered_bits_float(b);
+    return (uint64_t)(ka > kb ? ka - kb : kb - ka) <= tol.ulps;
+}
+
+/*
+ * Number of elements of 'components' values (2 for complex numbers)
+ * which differ among the first 'n' values of 'a' and 'b', one by one
+ */
+sbf_size count_diffs_double_scalar(const double *a, const double *b, sbf_size n,
+                                   sbf_size components) {
+    sbf_size diffs = 0;
+    for(sbf_size i = 0; i < n; i += components) {
+        bool equal = true;
+        for(sbf_size c = 0; c < components; c++)
+            equal = equal && doubles_equal(a[i + c], b[i + c]);
+        diffs += !equal;
+    }
+    return diffs;
+}
+
+sbf_size count_diffs_float_scalar(const float *a, const float *b, sbf_size n,
+                                  sbf_size components) {
+    sbf_size diffs = 0;
+    for(sbf_size i = 0; i < n; i += components) {
+        bool equal = true;
+        for(sbf_size c = 0; c < components; c++)
+            equal = equal && floats_equal(a[i + c], b[i + c]);
+        diffs += !equal;
+    }
+    return diffs;
+}
+
+/*
+ * As count_diffs_double_scalar, but blocks of values are first checked
+ * with SSE2: those all identical, both NaN, or within the absolute or
+ * relative tolerance are accepted at once, and only blocks holding a
+ * difference (which may still be within 'ulps') are checked one by one.
+ */
+sbf_size count_diffs_double(const double *a, const double *b, sbf_size n, sbf_size components) {
+    sbf_size diffs = 0, i = 0;
+#ifdef SBFTOOL_SSE2
+    const __m128d sign = _mm_set1_pd(-0.0), inf = _mm_set1_pd(INFINITY);
+    const __m128d absolute = _mm_set1_pd(tol.absolute), relative = _mm_set1_pd(tol.relative);
+    for(; i + 4 <= n; i += 4) {
+        int accepted = 0;
+        for(int half = 0; half < 2; half++) {
+            const __m128d x = _mm_loadu_pd(a + i + 2 * half), y = _mm_loadu_pd(b + i + 2 * half);
+            const __m128d d = _mm_andnot_pd(sign, _mm_sub_pd(x, y));
+            const __m128d m = _mm_max_pd(_mm_andnot_pd(sign, x), _mm_andnot_pd(sign, y));
+            __m128d ok = _mm_or_pd(_mm_cmpeq_pd(x, y),
+                                   _mm_and_pd(_mm_cmpunord_pd(x, x), _mm_cmpunord_pd(y, y)));
+            ok = _mm_or_pd(ok, _mm_cmple_pd(d, absolute));
+            ok = _mm_or_pd(ok, _mm_and_pd(_mm_cmplt_pd(d, inf),
+                                          _mm_cmple_pd(d, _mm_mul_pd(relative, m))));
+            accepted |= _mm_movemask_pd(ok) << (2 * half);
+        }
+        if(accepted != 0xF)
+            diffs += count_diffs_double_scalar(a + i, b + i, 4, components);
+    }
+#endif
+    return diffs + count_diffs_double_scalar(a + i, b + i, n - i, components);
+}
+
+sbf_size count_diffs_float(const float *a, const float *b, sbf_size n, sbf_size components) {
+    sbf_size diffs = 0, i = 0;
+#ifdef SBFTOOL_SSE2
+    const __m128 sign = _mm_set1_ps(-0.0f), inf = _mm_set1_ps(INFINITY);
+    const __m128 absolute = _mm_set1_ps((float)tol.absolute);
+    const __m128 relative = _mm_set1_ps((float)tol.relative);
+    for(; i + 8 <= n; i += 8) {
+        int accepted = 0;
+        for(int half = 0; half < 2; half++) {
+            const __m128 x = _mm_loadu_ps(a + i + 4 * half), y = _mm_loadu_ps(b + i + 4 * half);
+            const __m128 d = _mm_andnot_ps(sign, _mm_sub_ps(x, y));
+            const __m128 m = _mm_max_ps(_mm_andnot_ps(sign, x), _mm_andnot_ps(sign, y));
+            __m128 ok = _mm_or_ps(_mm_cmpeq_ps(x, y),
+                                  _mm_and_ps(_mm_cmpunord_ps(x, x), _mm_cmpunord_ps(y, y)));
+            ok = _mm_or_ps(ok, _mm_cmple_ps(d, absolute));
+            ok = _mm_or_ps(ok, _mm_and_ps(_mm_cmplt_ps(d, inf),
+                                          _mm_cmple_ps(d, _mm_mul_ps(relative, m))));
+            accepted |= _mm_movemask_ps(ok) << (4 * half);
+        }
+        if(accepted != 0xFF)
+            diffs += count_diffs_float_scalar(a + i, b + i, 8, components);
+    }
+#endif
+    return diffs + count_diffs_float_scalar(a + i, b + i, n - i, components);
+}
+
+/*
+ * Number of the 'width' byte elements which differ among the first 'n'
+ * bytes of 'a' and 'b', compared exactly: 16 bytes at a time with SSE2,
+ * and element by element only within blocks holding a difference.
+ */
+sbf_size count_diffs_exact(const sbf_byte *a, const sbf_byte *b, sbf_size n, sbf_size width) {
+    sbf_size diffs = 0, i = 0;
+#ifdef SBFTOOL_SSE2
+    for(; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF) continue;
+        for(sbf_size k = i; k < i + 16; k += width)
+            diffs += memcmp(a + k, b + k, width) != 0;
+    }
+#endif
+    for(; i < n; i += width)
+        diffs += memcmp(a + i, b + i, width) != 0;
+    return diffs;
+}
+
+/*
+ * Number of the first 'count' elements of 'a' and 'b', both the data
+ * of datasets like 'dset' in this machine's byte order, which differ
+ */
+sbf_size count_diffs(const sbf_DataHeader dset, const sbf_byte *a, const sbf_byte *b,
+                     sbf_size count) {
+    switch(dset.data_type) {
+        case(SBF_DOUBLE):
+            return count_diffs_double((const double *)a, (const double *)b, count, 1);
         case(SBF_CDOUBLE):
-            fprintf(stdout, fmt_string, "", *(double *)(data), 
-                                            *(double *)(data + sizeof(double)), 
-                                            suffix);
-            break;
+            return count_diffs_double((const double *)a, (const double *)b, 2 * count, 2);
+        case(SBF_FLOAT):
+            return count_diffs_float((const float *)a, (const float *)b, count, 1);
+        case(SBF_CFLOAT):
+            return count_diffs_float((const float *)a, (const float *)b, 2 * count, 2);
         default:
-            fprintf(stdout, fmt_string, "",*(char *)(data), suffix);
-            break;
+            return count_diffs_exact(a, b, count * sbf_datatype_size(dset), sbf_datatype_size(dset));
     }
 }
 
-void pretty_print_nd(const sbf_DataHeader dset, void *data, const char *fmt_string) {
-    sbf_size idx[SBF_MAX_DIM] = {0};
-    sbf_byte dims = SBF_GET_DIMENSIONS(dset);
-    sbf_size rows = dset.shape[dims - 2];
-    sbf_size cols = dset.shape[dims - 1];
-    bool column_major = SBF_CHECK_COLUMN_MAJOR_FLAG(dset);
-    bool print_columns = (dims == 1) && (dset.data_type != SBF_CHAR);
-    sbf_size n = 0;
-    do {
-        if(n % (rows * cols) == 0) {
-            for(int i = 0; i < dims - 2; i++) printf("%"PRIu64",", idx[i]);
-            if(dims > 2) fprintf(stdout, ":,:\n");
+/*
+ * Strides (in elements) of each dimension of 'dset' in its storage order
+ */
+void element_strides(const sbf_DataHeader dset, sbf_size strides[SBF_MAX_DIM]) {
+    const sbf_byte dims = SBF_GET_DIMENSIONS(dset);
+    const bool column_major = SBF_CHECK_COLUMN_MAJOR_FLAG(dset);
+    sbf_size stride = 1;
+    for(sbf_byte i = 0; i < dims; i++) {
+        const int dim = column_major ? i : dims - 1 - i;
+        strides[dim] = stride;
+        stride *= dset.shape[dim];
+    }
+}
+
+/*
+ * Index of element 'n' of 'dset', counting in its storage order
+ */
+void element_index(const sbf_DataHeader dset, sbf_size n, sbf_size idx[SBF_MAX_DIM]) {
+    const sbf_byte dims = SBF_GET_DIMENSIONS(dset);
+    const bool column_major = SBF_CHECK_COLUMN_MAJOR_FLAG(dset);
+    memset(idx, 0, SBF_MAX_DIM * sizeof(sbf_size));
+    for(sbf_byte i = 0; i < dims && dset.shape[0] != 0; i++) {
+        const int dim = column_major ? i : dims - 1 - i;
+        if(dset.shape[dim] == 0) break;
+        idx[dim] = n % dset.shape[dim];
+        n /= dset.shape[dim];
+    }
+}
+
+/*
+ * Copy 'count' elements of 'data2', the data of 'dset2', to 'out' in
+ * the storage order of 'dset1': the same shape, but in the other order.
+ * Starts from element 'first' of 'dset1'.
+ */
+void gather_elements(const sbf_DataHeader dset1, const sbf_DataHeader dset2,
+                     const sbf_byte *data2, sbf_size first, sbf_size count, sbf_byte *out) {
+    const sbf_byte dims = SBF_GET_DIMENSIONS(dset1);
+    const bool column_major = SBF_CHECK_COLUMN_MAJOR_FLAG(dset1);
+    const sbf_size size = sbf_datatype_size(dset1);
+    sbf_size idx[SBF_MAX_DIM], strides[SBF_MAX_DIM], offset = 0;
+    element_index(dset1, first, idx);
+    element_strides(dset2, strides);
+    for(sbf_byte dim = 0; dim < dims; dim++) offset += idx[dim] * strides[dim];
+
+    for(sbf_size n = 0; n < count; n++) {
+        memcpy(out + n * size, data2 + offset * size, size);
+        // step to the next element of dset1, carrying into slower dimensions
+        for(sbf_byte i = 0; i < dims; i++) {
+            const int dim = column_major ? i : dims - 1 - i;
+            offset += strides[dim];
+            if(++idx[dim] < dset1.shape[dim]) break;
+            offset -= idx[dim] * strides[dim];
+            idx[dim] = 0;
         }
-        ptrdiff_t offset = offset_of(sbf_datatype_size(dset),
-                                     column_major, dims, dset.shape, idx);
-        pretty_print_block(data + offset, fmt_string, dset.data_type);
-        n++;
-        if(((n % rows == 0)) || print_columns) {
-            fprintf(stdout, "\n");
+    }
+}
+
+/*
+ * A dataset found in both files being compared, with the same data
+ * type and shape
+ */
+typedef struct {
+    sbf_size index1, index2; // in each file
+    sbf_DataHeader dset1, dset2;
+    sbf_size count;          // of elements
+    bool streamed;           // read in chunks, otherwise in whole
+    sbf_size diffs;
+} diff_pair;
+
+/*
+ * Chunk of DIFF_CHUNK_SIZE bytes of a streamed pair of datasets, or the
+ * whole of any other pair
+ */
+typedef struct {
+    sbf_size pair;
+    sbf_size chunk;
+} diff_task;
+
+/*
+ * Tasks shared by the threads comparing two files, each taking the next
+ * under 'lock' as in sbf_parallel_io
+ */
+typedef struct {
+    const sbf_File *file1, *file2;
+    diff_pair *pairs;
+    diff_task *tasks;
+    sbf_size n_tasks, next_task;
+    pthread_mutex_t lock;
+} diff_job;
+
+// differences are printed by many threads
+pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Compare 'count' elements of 'a' and 'b' from element 'first' of
+ * 'pair', printing each difference when verbose
+ */
+sbf_size compare_elements(const diff_pair *pair, const sbf_byte *a, const sbf_byte *b,
+                          sbf_size first, sbf_size count) {
+    const sbf_size diffs = count_diffs(pair->dset1, a, b, count);
+    if(diffs == 0 || GLOBAL_LOG_LEVEL < verbose_info) return diffs;
+
+    const sbf_size size = sbf_datatype_size(pair->dset1);
+    const sbf_byte dims = SBF_GET_DIMENSIONS(pair->dset1);
+    for(sbf_size k = 0; k < count; k++) {
+        if(count_diffs(pair->dset1, a + k * size, b + k * size, 1) == 0) continue;
+        sbf_size idx[SBF_MAX_DIM];
+        char text1[MAX_ELEMENT_TEXT], text2[MAX_ELEMENT_TEXT];
+        const int n1 = (int)format_element(text1, pair->dset1, a + k * size, false);
+        const int n2 = (int)format_element(text2, pair->dset2, b + k * size, false);
+        element_index(pair->dset1, first + k, idx);
+        pthread_mutex_lock(&print_lock);
+        log(verbose_info, "D '%s' @(", pair->dset1.name);
+        for(sbf_byte dim = 0; dim < dims; dim++) log(verbose_info, "%s%"PRIu64, (dim ==0)? "":",", idx[dim]);
+        fprintf(stdout, "):%.*s < >%.*s\n", n1, text1, n2, text2);
+        pthread_mutex_unlock(&print_lock);
+    }
+    return diffs;
+}
+
+/*
+ * Compare chunk 'chunk' of a streamed 'pair', read from each file into
+ * 'data1' and 'data2' (of DIFF_CHUNK_SIZE bytes)
+ */
+sbf_size diff_chunk(const diff_job *job, const diff_pair *pair, sbf_size chunk,
+                    sbf_byte *data1, sbf_byte *data2) {
+    const sbf_size size = sbf_datatype_size(pair->dset1);
+    const sbf_size per_chunk = DIFF_CHUNK_SIZE / size;
+    const sbf_size first = chunk * per_chunk;
+    const sbf_size count = (pair->count - first < per_chunk) ? pair->count - first : per_chunk;
+    if(sbf_pread(job->file1, data1, count * size,
+                 sbf_data_offset(job->file1, pair->index1) + first * size) != SBF_RESULT_SUCCESS ||
+       sbf_pread(job->file2, data2, count * size,
+                 sbf_data_offset(job->file2, pair->index2) + first * size) != SBF_RESULT_SUCCESS) {
+        log(error, "Problem reading dataset '%s': %s\n", pair->dset1.name, strerror(errno));
+        return 1;
+    }
+    sbf_to_host_order(pair->dset1, data1, count * size);
+    sbf_to_host_order(pair->dset2, data2, count * size);
+    return compare_elements(pair, data1, data2, first, count);
+}
+
+/*
+ * Compare the whole of 'pair', compressed or stored in different orders,
+ * reading both into 'arena' along with a chunk to reorder the latter
+ */
+sbf_size diff_whole(const diff_job *job, const diff_pair *pair, sbf_Arena *arena) {
+    const sbf_size size = sbf_datatype_size(pair->dset1);
+    const sbf_size per_chunk = DIFF_CHUNK_SIZE / size;
+    const bool reorder = SBF_CHECK_COLUMN_MAJOR_FLAG(pair->dset1) != SBF_CHECK_COLUMN_MAJOR_FLAG(pair->dset2);
+    sbf_byte *data1 = NULL, *data2 = NULL, *gathered = NULL;
+    if(sbf_arena_reserve(arena, 2 * sbf_arena_padded(pair->count * size) + DIFF_CHUNK_SIZE) == 0) {
+        data1 = sbf_arena_alloc(arena, pair->count * size);
+        data2 = sbf_arena_alloc(arena, pair->count * size);
+        gathered = sbf_arena_alloc(arena, DIFF_CHUNK_SIZE);
+    }
+    sbf_size diffs = 1;
+    if(data1 == NULL || data2 == NULL || gathered == NULL) {
+        log(error, "Problem reading dataset '%s': %s\n", pair->dset1.name, "failure allocating memory");
+    }
+    else if(sbf_read_dataset_at(job->file1, pair->index1, data1) != SBF_RESULT_SUCCESS ||
+            sbf_read_dataset_at(job->file2, pair->index2, data2) != SBF_RESULT_SUCCESS) {
+        log(error, "Problem reading dataset '%s': %s\n", pair->dset1.name, strerror(errno));
+    }
+    else {
+        diffs = 0;
+        for(sbf_size first = 0; first < pair->count; first += per_chunk) {
+            const sbf_size count = (pair->count - first < per_chunk) ? pair->count - first : per_chunk;
+            const sbf_byte *b = data2 + first * size;
+            if(reorder) {
+                gather_elements(pair->dset1, pair->dset2, data2, first, count, gathered);
+                b = gathered;
+            }
+            diffs += compare_elements(pair, data1 + first * size, b, first, count);
         }
-        increment_index(dset.shape, idx, dims);
-    } while(!all_zero(idx));
-    fprintf(stdout, "\n");
+    }
+    return diffs;
 }
 
+void *diff_worker(void *arg) {
+    diff_job *job = (diff_job *)arg;
+    // buffers for each task, only reallocated when one needs more than those before
+    sbf_Arena arena = sbf_new_arena;
+    for(;;) {
+        pthread_mutex_lock(&job->lock);
+        const sbf_size t = job->next_task++;
+        pthread_mutex_unlock(&job->lock);
+        if(t >= job->n_tasks) break;
+        diff_pair *pair = &job->pairs[job->tasks[t].pair];
+        sbf_size diffs = 1;
+        if(!pair->streamed)
+            diffs = diff_whole(job, pair, &arena);
+        else if(sbf_arena_reserve(&arena, 2 * DIFF_CHUNK_SIZE) != 0)
+            log(error, "Problem reading dataset '%s': %s\n", pair->dset1.name, "failure allocating memory");
+        else
+            diffs = diff_chunk(job, pair, job->tasks[t].chunk, sbf_arena_alloc(&arena, DIFF_CHUNK_SIZE),
+                               sbf_arena_alloc(&arena, DIFF_CHUNK_SIZE));
+        pthread_mutex_lock(&job->lock);
+        pair->diffs += diffs;
+        pthread_mutex_unlock(&job->lock);
+    }
+    sbf_arena_free(&arena);
+    return NULL;
+}
 
-void pretty_print_data(const sbf_DataHeader dset, void * data, const char *fmt_string) {
-    sbf_byte dims = SBF_GET_DIMENSIONS(dset);
-    if(dims == 0) {
-        pretty_print_block(data, fmt_string, dset.data_type);
-        fprintf(stdout, "\n");
+/*
+ * Compare the data of the 'n_pairs' 'pairs' of datasets in 'file1'
+ * and 'file2' with up to 'n_threads' threads (including this one).
+ * Pairs stored the same way and not compressed are streamed from both
+ * files in chunks spread across the threads; others are read in whole.
+ */
+void diff_pairs(const sbf_File *file1, const sbf_File *file2, diff_pair *pairs,
+                sbf_size n_pairs, int n_threads) {
+    diff_job job;
+    job.file1 = file1;
+    job.file2 = file2;
+    job.pairs = pairs;
+    job.n_tasks = 0;
+    job.next_task = 0;
+    for(sbf_size p = 0; p < n_pairs; p++) {
+        const sbf_size per_chunk = DIFF_CHUNK_SIZE / sbf_datatype_size(pairs[p].dset1);
+        job.n_tasks += pairs[p].streamed ? (pairs[p].count + per_chunk - 1) / per_chunk : 1;
+    }
+    job.tasks = malloc((job.n_tasks + 1) * sizeof(diff_task));
+    if(n_threads < 1) n_threads = 1;
+    if((sbf_size)n_threads > job.n_tasks) n_threads = job.n_tasks > 0 ? (int)job.n_tasks : 1;
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    if(job.tasks == NULL || threads == NULL) {
+        log(error, "Problem comparing %s and %s: %s\n", file1->filename, file2->filename,
+            "failure allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    sbf_size t = 0;
+    for(sbf_size p = 0; p < n_pairs; p++) {
+        const sbf_size per_chunk = DIFF_CHUNK_SIZE / sbf_datatype_size(pairs[p].dset1);
+        const sbf_size n_chunks = pairs[p].streamed ? (pairs[p].count + per_chunk - 1) / per_chunk : 1;
+        for(sbf_size chunk = 0; chunk < n_chunks; chunk++, t++) {
+            job.tasks[t].pair = p;
+            job.tasks[t].chunk = chunk;
+        }
+    }
+    pthread_mutex_init(&job.lock, NULL);
+
+    int started = 0;
+    for(int i = 1; i < n_threads; i++) {
+        if(pthread_create(&threads[started], NULL, diff_worker, &job) != 0) break;
+        started++;
+    }
+    diff_worker(&job);
+    for(int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+    free(job.tasks);
+    free(threads);
+}
+
+/*
+ * Compare the datasets of 'file1' and 'file2', matched by name: first
+ * their metadata, then unless 'metadata_only' their data (see
+ * diff_pairs). Returns the number of differences found.
+ */
+sbf_size diff_files(sbf_File * file1, sbf_File * file2, bool metadata_only, int n_threads) {
+    sbf_size n1 = file1->n_datasets; sbf_size n2 = file2->n_datasets;
+    if(n2 > n1) {
+        sbf_File * tmp; sbf_size n_tmp;
+        tmp = file1; file1 = file2; file2 = tmp;
+        n_tmp = n1; n1 = n2; n2 = n_tmp;
+    }
+    sbf_size file_diffs = 0;
+    bool deep_check = !metadata_only;
+    if(n1 != n2) {
+        log(verbose_info, "Different number of datasets: %"PRIu64", %"PRIu64"\n", n1, n2);
+        ++file_diffs;
+    }
+
+    // metadata differences of each dataset in file1, or -1 if not in file2
+    int64_t *dset_diffs = malloc((n1 + 1) * sizeof(int64_t));
+    diff_pair *pairs = malloc((n1 + 1) * sizeof(diff_pair));
+    sbf_size n_pairs = 0;
+    if(dset_diffs == NULL || pairs == NULL) {
+        log(error, "Problem comparing %s and %s: %s\n", file1->filename, file2->filename,
+            "failure allocating memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for(sbf_size i = 0; i < n1;  i++) {
+        log(debug, "Checking dataset %"PRIu64" in %s\n", i, file1->filename);
+        sbf_DataHeader dset1 = file1->datasets[i];
+        int64_t diffs = 0;
+        int dset_found = get_dataset(dset1.name, file2);
+        if(dset_found == -1) {
+            log(verbose_info, "No matching dataset found for '%s' in %s\n",
+                dset1.name, file2->filename);
+            dset_diffs[i] = -1;
+            file_diffs++;
+            continue;
+        }
+        sbf_DataHeader dset2 = file2->datasets[dset_found];
+        bool dims_equal = (SBF_GET_DIMENSIONS(dset1) == SBF_GET_DIMENSIONS(dset2));
+        bool dtypes_equal = (dset1.data_type == dset2.data_type);
+        bool shapes_equal = shape_equal(dset1.shape, dset2.shape);
+
+        if(!dims_equal) {
+            log(verbose_info, "D '%s' incompatible dimensions: %d < > %d\n",
+                dset1.name, SBF_GET_DIMENSIONS(dset1), SBF_GET_DIMENSIONS(dset2));
+            diffs++;
+        }
+        if(!dtypes_equal) {
+            log(verbose_info, "D '%s' incompatible data types: %s < > %s\n",
+                dset1.name, sbf_datatype_name(dset1.data_type), sbf_datatype_name(dset2.data_type));
+            diffs++;
+        }
+        if(!shapes_equal) {
+            log(verbose_info, "D '%s' incompatible shapes: ", dset1.name);
+            for(int_fast8_t i = 0; i < SBF_GET_DIMENSIONS(dset1); i++) log(verbose_info, "[%"PRIu64"]", dset1.shape[i]);
+            log(verbose_info, " %s ", "< >");
+            for(int_fast8_t i = 0; i < SBF_GET_DIMENSIONS(dset2); i++) log(verbose_info, "[%"PRIu64"]", dset2.shape[i]);
+            log(verbose_info, "%s\n", "");
+            diffs++;
+        }
+        if(deep_check && dims_equal && shapes_equal && dtypes_equal) {
+            diff_pair *pair = &pairs[n_pairs++];
+            pair->index1 = i;
+            pair->index2 = dset_found;
+            pair->dset1 = dset1;
+            pair->dset2 = dset2;
+            pair->count = sbf_num_blocks(dset1);
+            // data stored in the same order can be compared as it is read
+            pair->streamed = !SBF_CHECK_COMPRESSED_FLAG(dset1) && !SBF_CHECK_COMPRESSED_FLAG(dset2) &&
+                             (SBF_GET_DIMENSIONS(dset1) <= 1 ||
+                              SBF_CHECK_COLUMN_MAJOR_FLAG(dset1) == SBF_CHECK_COLUMN_MAJOR_FLAG(dset2));
+            pair->diffs = 0;
+        }
+        dset_diffs[i] = diffs;
+    }
+
+    diff_pairs(file1, file2, pairs, n_pairs, n_threads);
+    for(sbf_size p = 0; p < n_pairs; p++) dset_diffs[pairs[p].index1] += pairs[p].diffs;
+    for(sbf_size i = 0; i < n1; i++) {
+        if(dset_diffs[i] < 0) continue;
+        log(verbose_info, "%"PRIi64" differences in dataset '%s'\n", dset_diffs[i], file1->datasets[i].name);
+        file_diffs = file_diffs + dset_diffs[i];
+    }
+    free(dset_diffs);
+    free(pairs);
+    return file_diffs;
+}
+
+/*
+ * Reads the data of a dataset in pieces of at most PRINT_CHUNK_SIZE
+ * bytes (or a chunk of a compressed dataset), in this machine's byte
+ * order. Pieces follow one another in row major order (the last index
+ * varying fastest) unless 'storage_order' is set.
+ *
+ * Data stored column major is read a slab at a time: the fewest leading
+ * indices which leave no more than a piece, read with sbf_read_hyperslab
+ * and put in row major order with gather_elements. Compressed column
+ * major data can't be read in part, so it is read in whole.
+ */
+typedef struct {
+    const sbf_File *file;
+    sbf_size index;
+    sbf_DataHeader dset;
+    sbf_DataHeader row_major;  // 'dset' as if stored in row major order
+    sbf_size size, count;      // of each element, and number of elements
+    sbf_size per_piece;        // elements
+    sbf_size next;             // first element of the next piece
+    bool reorder;              // from column major to row major order
+    int slab_dim;              // the dimension slabs are cut across
+    sbf_size slab_inner;       // elements in each index of 'slab_dim'
+    sbf_byte *piece, *stored;  // returned, and as stored before reordering
+    sbf_byte *whole;           // all of a compressed column major dataset
+    sbf_ChunkIndexHeader chunks;
+    sbf_size *chunk_offsets;   // of a compressed dataset, see sbf_read_chunk_index
+    sbf_byte *encoded;         // a chunk as stored, and space to decode it
+} dataset_reader;
+
+// the buffers of each reader, kept from one dataset (and file) to the next
+sbf_Arena reader_arena = {NULL, 0, 0, 0};
+
+void reader_close(dataset_reader *r) {
+    free(r->chunk_offsets);
+    r->piece = r->stored = r->whole = r->encoded = NULL;
+    r->chunk_offsets = NULL;
+}
+
+sbf_result reader_open(dataset_reader *r, const sbf_File *file, sbf_size index,
+                       bool storage_order) {
+    memset(r, 0, sizeof(*r));
+    r->file = file;
+    r->index = index;
+    r->dset = file->datasets[index];
+    r->row_major = r->dset;
+    r->row_major.flags &= ~SBF_COLUMN_MAJOR;
+    r->size = sbf_datatype_size(r->dset);
+    r->count = sbf_num_blocks(r->dset);
+    r->per_piece = PRINT_CHUNK_SIZE / r->size;
+    const int dims = SBF_GET_DIMENSIONS(r->dset);
+    r->reorder = !storage_order && dims > 1 && SBF_CHECK_COLUMN_MAJOR_FLAG(r->dset);
+    const bool compressed = SBF_CHECK_COMPRESSED_FLAG(r->dset);
+
+    sbf_size piece_size = PRINT_CHUNK_SIZE;
+    bool whole = false, encoded = false, stored = false;
+    if(compressed) {
+        sbf_result res = sbf_read_chunk_index(file, sbf_data_offset(file, index), &r->chunks,
+                                              &r->chunk_offsets);
+        if(res != SBF_RESULT_SUCCESS) return res;
+        if(r->reorder) {
+            whole = true;
+        }
+        else {
+            piece_size = r->chunks.chunk_size;
+            r->per_piece = piece_size / r->size;
+            encoded = true;
+        }
+    }
+    else if(r->reorder) {
+        r->slab_dim = dims - 1;
+        r->slab_inner = 1;
+        while(r->slab_dim > 0 && r->slab_inner * r->dset.shape[r->slab_dim] <= r->per_piece) {
+            r->slab_inner *= r->dset.shape[r->slab_dim];
+            r->slab_dim--;
+        }
+        stored = true;
+    }
+
+    // the buffers are taken from the arena together
+    sbf_size total = sbf_arena_padded(piece_size);
+    if(whole) total += sbf_arena_padded(r->count * r->size);
+    if(encoded) total += sbf_arena_padded(2 * piece_size);
+    if(stored) total += sbf_arena_padded(piece_size);
+    if(sbf_arena_reserve(&reader_arena, total) != 0) return SBF_RESULT_NULL_FAILURE;
+    r->piece = sbf_arena_alloc(&reader_arena, piece_size);
+    if(encoded) r->encoded = sbf_arena_alloc(&reader_arena, 2 * piece_size);
+    if(stored) r->stored = sbf_arena_alloc(&reader_arena, piece_size);
+    if(whole) {
+        r->whole = sbf_arena_alloc(&reader_arena, r->count * r->size);
+        return sbf_read_dataset_at(file, index, r->whole);
+    }
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Read the next piece of the dataset, of '*n' elements (0 at the end)
+ * from element 'r->next' into '*data'
+ */
+sbf_result reader_next(dataset_reader *r, const sbf_byte **data, sbf_size *n) {
+    const sbf_size first = r->next;
+    *data = r->piece;
+    *n = 0;
+    if(first >= r->count) return SBF_RESULT_SUCCESS;
+    sbf_size count = (r->count - first < r->per_piece) ? r->count - first : r->per_piece;
+
+    if(r->whole != NULL) {
+        gather_elements(r->row_major, r->dset, r->whole, first, count, r->piece);
+    }
+    else if(r->chunk_offsets != NULL) {
+        // a piece is a chunk, all of which but the last are full
+        const sbf_size chunk = first * r->size / r->chunks.chunk_size;
+        const sbf_size stored = r->chunk_offsets[chunk + 1] - r->chunk_offsets[chunk];
+        const sbf_size table = sizeof(r->chunks) + (r->chunks.n_chunks + 1) * sizeof(sbf_size);
+        if(chunk >= r->chunks.n_chunks || r->chunk_offsets[chunk + 1] < r->chunk_offsets[chunk] ||
+           stored > count * r->size)
+            return SBF_RESULT_READ_FAILURE;
+        sbf_result res = sbf_pread(r->file, r->encoded, stored,
+                                   sbf_data_offset(r->file, r->index) + table + r->chunk_offsets[chunk]);
+        if(res != SBF_RESULT_SUCCESS) return res;
+        if(sbf_decode_chunk(r->chunks.codec, r->chunks.filters, r->size, r->encoded, stored,
+                            r->piece, count * r->size, r->encoded + r->chunks.chunk_size) != 0)
+            return SBF_RESULT_READ_FAILURE;
+        sbf_to_host_order(r->dset, r->piece, count * r->size);
+    }
+    else if(r->reorder) {
+        // the slab from element 'first', across the rest of 'slab_dim' or as much as fits
+        sbf_size idx[SBF_MAX_DIM], start[SBF_MAX_DIM] = {0}, counts[SBF_MAX_DIM] = {0};
+        element_index(r->row_major, first, idx);
+        const int dims = SBF_GET_DIMENSIONS(r->dset);
+        for(int dim = 0; dim < dims; dim++) {
+            start[dim] = (dim <= r->slab_dim) ? idx[dim] : 0;
+            counts[dim] = (dim < r->slab_dim) ? 1 : r->dset.shape[dim];
+        }
+        sbf_size rows = r->per_piece / r->slab_inner;
+        if(rows > r->dset.shape[r->slab_dim] - idx[r->slab_dim])
+            rows = r->dset.shape[r->slab_dim] - idx[r->slab_dim];
+        counts[r->slab_dim] = rows;
+        count = rows * r->slab_inner;
+        sbf_result res = sbf_read_hyperslab(r->file, r->index, start, counts, NULL, r->stored);
+        if(res != SBF_RESULT_SUCCESS) return res;
+        sbf_DataHeader slab = r->dset, slab_row_major = r->row_major;
+        memcpy(slab.shape, counts, sizeof(counts));
+        memcpy(slab_row_major.shape, counts, sizeof(counts));
+        gather_elements(slab_row_major, slab, r->stored, 0, count, r->piece);
     }
     else {
-        pretty_print_nd(dset, data, fmt_string);
+        sbf_result res = sbf_pread(r->file, r->piece, count * r->size,
+                                   sbf_data_offset(r->file, r->index) + first * r->size);
+        if(res != SBF_RESULT_SUCCESS) return res;
+        sbf_to_host_order(r->dset, r->piece, count * r->size);
+    }
+    r->next += count;
+    *n = count;
+    return SBF_RESULT_SUCCESS;
+}
+
+/*
+ * Write 'count' elements of 'data' as text, from element 'first' of
+ * 'dset' in row major order. For 'csv' each row (along the last
+ * dimension) is a line of comma separated values; otherwise elements
+ * are aligned and separated by spaces, a 1 dimensional dataset is
+ * written one element per line, and each 2 dimensional slice of one
+ * with more dimensions follows a line giving its leading indices. Rows
+ * of characters are written as strings, quoted for CSV.
+ */
+void write_elements(text_output *out, const sbf_DataHeader dset, const sbf_byte *data,
+                    sbf_size first, sbf_size count, bool csv) {
+    const int dims = SBF_GET_DIMENSIONS(dset);
+    const bool characters = (dset.data_type == SBF_CHAR);
+    const sbf_size size = sbf_datatype_size(dset);
+    const sbf_size row = (dims == 0 || (dims == 1 && !characters)) ? 1 : dset.shape[dims - 1];
+    const sbf_size slice = (dims > 2 && !csv) ? dset.shape[dims - 2] * row : 0;
+    for(sbf_size i = 0; i < count; i++) {
+        const sbf_size n = first + i;
+        const sbf_size column = n % row;
+        if(slice && n % slice == 0) {
+            sbf_DataHeader row_major = dset;
+            row_major.flags &= ~SBF_COLUMN_MAJOR;
+            sbf_size idx[SBF_MAX_DIM];
+            element_index(row_major, n, idx);
+            if(n > 0) output_text(out, "\n", 1);
+            for(int dim = 0; dim < dims - 2; dim++) {
+                char *p = output_reserve(out, 24);
+                out->length += format_uint(p, idx[dim]);
+                output_text(out, ",", 1);
+            }
+            output_text(out, ":,:\n", 4);
+        }
+        if(characters) {
+            if(csv && column == 0) output_text(out, "\"", 1);
+            const char c = (char)data[i];
+            // quotes in a quoted CSV field are doubled
+            if(csv && c == '"') output_text(out, "\"", 1);
+            output_text(out, &c, 1);
+            if(csv && column == row - 1) output_text(out, "\"", 1);
+        }
+        else {
+            if(column > 0) output_text(out, csv ? "," : " ", 1);
+            char *p = output_reserve(out, MAX_ELEMENT_TEXT);
+            out->length += format_element(p, dset, data + i * size, csv);
+        }
+        if(column == row - 1) output_text(out, "\n", 1);
+    }
+}
+
+/*
+ * Write dataset 'index' of 'file' as text to 'out' (see write_elements),
+ * reading it a piece at a time
+ */
+bool export_text(text_output *out, const sbf_File *file, sbf_size index, bool csv) {
+    dataset_reader reader;
+    sbf_result res = reader_open(&reader, file, index, false);
+    const sbf_byte *data;
+    sbf_size n = 0;
+    while(res == SBF_RESULT_SUCCESS && (res = reader_next(&reader, &data, &n)) == SBF_RESULT_SUCCESS && n > 0)
+        write_elements(out, reader.dset, data, reader.next - n, n, csv);
+    reader_close(&reader);
+    if(res != SBF_RESULT_SUCCESS) {
+        output_flush(out);
+        log(error, "Problem reading dataset '%s' in %s: %s\n", file->datasets[index].name, file->filename,
+            (res == SBF_RESULT_NULL_FAILURE) ? "failure allocating memory" : strerror(errno));
+    }
+    return res == SBF_RESULT_SUCCESS;
+}
+
+/*
+ * NumPy type string of the data of 'dset' in this machine's byte order
+ */
+const char *npy_descr(const sbf_DataHeader dset) {
+    static const char *little[] = {"|u1", "<i4", "<i8", "<f4", "<f8", "<c8", "<c16", "|S1"};
+    static const char *big[] = {"|u1", ">i4", ">i8", ">f4", ">f8", ">c8", ">c16", "|S1"};
+    const sbf_byte type = (dset.data_type <= SBF_CHAR) ? dset.data_type : SBF_BYTE;
+    return SBF_HOST_BIG_ENDIAN ? big[type] : little[type];
+}
+
+/*
+ * Write dataset 'index' of 'file' to 'fp' as a NumPy .npy file (format
+ * version 1.0), whose data is copied a piece at a time as stored, row
+ * or column major ('fortran_order')
+ */
+bool export_npy(FILE *fp, const sbf_File *file, sbf_size index) {
+    const sbf_DataHeader dset = file->datasets[index];
+    const int dims = SBF_GET_DIMENSIONS(dset);
+    char header[128 + SBF_MAX_DIM * 24];
+    int length = snprintf(header, sizeof(header), "{'descr': '%s', 'fortran_order': %s, 'shape': (",
+                          npy_descr(dset), (dims > 1 && SBF_CHECK_COLUMN_MAJOR_FLAG(dset)) ? "True" : "False");
+    for(int dim = 0; dim < dims; dim++) {
+        length += format_uint(header + length, dset.shape[dim]);
+        header[length++] = ',';
+        if(dim < dims - 1) header[length++] = ' ';
     }
+    if(dims > 1) length--;
+    length += sprintf(header + length, "), }");
+    // the magic, version and length take 10 bytes, and the data starts at a multiple of 64
+    while((10 + length + 1) % 64 != 0) header[length++] = ' ';
+    header[length++] = '\n';
+    const unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                                        (unsigned char)(length & 0xFF), (unsigned char)(length >> 8)};
+    bool ok = fwrite(preamble, 1, sizeof(preamble), fp) == sizeof(preamble) &&
+              fwrite(header, 1, length, fp) == (size_t)length;
+
+    dataset_reader reader;
+    sbf_result res = reader_open(&reader, file, index, true);
+    const sbf_byte *data;
+    sbf_size n = 0;
+    while(ok && res == SBF_RESULT_SUCCESS && (res = reader_next(&reader, &data, &n)) == SBF_RESULT_SUCCESS && n > 0)
+        ok = fwrite(data, reader.size, n, fp) == n;
+    reader_close(&reader);
+    if(res != SBF_RESULT_SUCCESS)
+        log(error, "Problem reading dataset '%s' in %s: %s\n", dset.name, file->filename,
+            (res == SBF_RESULT_NULL_FAILURE) ? "failure allocating memory" : strerror(errno));
+    else if(!ok)
+        log(error, "Problem writing dataset '%s': %s\n", dset.name, strerror(errno));
+    return ok && res == SBF_RESULT_SUCCESS;
 }
 
-void dump_file_as_utf8(sbf_File * file, bool dump_all_data) {
-    for(int_fast8_t i = 0; i < file->n_datasets; i++) {
+void dump_file_as_utf8(sbf_File * file, bool dump_all_data, const char * dataset_name) {
+    for(sbf_size i = 0; i < file->n_datasets; i++) {
 
         sbf_DataHeader dset = file->datasets[i];
+        if(dataset_name && strncmp(dataset_name, dset.name, SBF_NAME_LENGTH) != 0) continue;
         fprintf(stdout, "dataset:\t'%s'\n", dset.name);
         fprintf(stdout, "dtype:\t\t%s\n", sbf_datatype_name(dset.data_type));
         fprintf(stdout, "dtype size:\t%"PRIu64" bit\n", sbf_datatype_size(dset)*8);
@@ -246,185 +1247,443 @@ void dump_file_as_utf8(sbf_File * file, bool dump_all_data) {
         fprintf(stdout, "storage:\t%s major\n", column_major ? "column": "row");
         bool endianness = SBF_CHECK_BIG_ENDIAN_FLAG(dset);
         fprintf(stdout, "endianness:\t%s endian\n", endianness ? "big": "little");
+        if(SBF_CHECK_COMPRESSED_FLAG(dset)) fprintf(stdout, "compressed:\tyes\n");
 
         if(dump_all_data) {
-            sbf_size data_size = sbf_datatype_size(dset) * sbf_num_blocks(dset);
-            sbf_byte data[data_size];
-            sbf_result res = sbf_read_dataset(file, dset, data);
-            if(res != SBF_RESULT_SUCCESS) {
-                log(error, "Problem reading dataset %s: %s\n", dset.name, strerror(errno));
-            }
-            else {
-                fprintf(stdout, "\n--- contents ---\n");
-                pretty_print_data(dset, (void *) data, format_string(dset.data_type));
-                fprintf(stdout, "----------------\n");
-            }
+            text_output out;
+            fprintf(stdout, "\n--- contents ---\n");
+            if(!output_open(&out, stdout))
+                log(error, "Problem printing dataset %s: %s\n", dset.name, "failure allocating memory");
+            else
+                export_text(&out, file, i, false);
+            output_close(&out);
+            fprintf(stdout, "----------------\n");
         }
         fprintf(stdout, "\n");
     }
 }
 
-bool compare_blocks(void * a, void * b, sbf_data_type dtype) {
-    switch(dtype) {
-        case(SBF_INT):
-            return *(int *)(a) == *(int *)(b);
-        case(SBF_LONG):
-            return *(long *)(a) == *(long *)(b);
-        case(SBF_DOUBLE):
-            return (fabs(*(double *)(a) - *(double *)(b)) < eps);
-        case(SBF_FLOAT):
-            return (fabs(*(float *)(a) - *(float *)(b)) < eps);
-        case(SBF_CFLOAT):
-            return (*(float *)(a) == *(float *)(b)) &&
-                   (*(float *)(a+sizeof(float)) == *(float *)(b+sizeof(float))); 
-        case(SBF_CDOUBLE):
-            return (*(double *)(a) == *(double *)(b)) &&
-                   (*(double *)(a+sizeof(double)) == *(double *)(b+sizeof(double))); 
-        default:
-            return *(char *)(a) == *(char *)(b);
+/*
+ * A range of bytes of a mapped file and its CRC32C: the headers, the
+ * blob of a dataset, or everything after the last blob (the tail).
+ */
+typedef struct {
+    sbf_size offset;
+    sbf_size size;
+    uint32_t crc;
+} byte_range;
+
+/*
+ * Ranges being checksummed by several threads, each taking the next
+ * piece of VERIFY_PIECE_SIZE bytes under 'lock'.
+ */
+typedef struct {
+    const sbf_byte *map;
+    byte_range *ranges;
+    sbf_size n_ranges;
+    sbf_size *first_piece; // of each range, and the total
+    uint32_t *piece_crcs;
+    sbf_size next_piece;
+    pthread_mutex_t lock;
+} checksum_job;
+
+void *checksum_worker(void *arg) {
+    checksum_job *job = (checksum_job *)arg;
+    const sbf_size n_pieces = job->first_piece[job->n_ranges];
+    sbf_size range = 0;
+    for(;;) {
+        pthread_mutex_lock(&job->lock);
+        const sbf_size piece = job->next_piece++;
+        pthread_mutex_unlock(&job->lock);
+        if(piece >= n_pieces) break;
+        // pieces are taken in order, so the range only moves forward
+        while(job->first_piece[range + 1] <= piece) range++;
+        const byte_range *r = &job->ranges[range];
+        const sbf_size start = (piece - job->first_piece[range]) * VERIFY_PIECE_SIZE;
+        const sbf_size left = r->size - start;
+        job->piece_crcs[piece] = sbf_crc32c(0, job->map + r->offset + start,
+                                            left < VERIFY_PIECE_SIZE ? left : VERIFY_PIECE_SIZE);
+    }
+    return NULL;
+}
+
+/*
+ * Set the CRC32C of each of the 'n_ranges' 'ranges' of 'map', using up
+ * to 'n_threads' threads (including this one), then combine the
+ * checksums of the pieces of each range in order.
+ */
+bool checksum_ranges(const sbf_byte *map, byte_range *ranges, sbf_size n_ranges, int n_threads) {
+    checksum_job job;
+    job.map = map;
+    job.ranges = ranges;
+    job.n_ranges = n_ranges;
+    job.next_piece = 0;
+    job.first_piece = malloc((n_ranges + 1) * sizeof(sbf_size));
+    if(job.first_piece == NULL) return false;
+    job.first_piece[0] = 0;
+    for(sbf_size i = 0; i < n_ranges; i++)
+        job.first_piece[i + 1] = job.first_piece[i] +
+            (ranges[i].size + VERIFY_PIECE_SIZE - 1) / VERIFY_PIECE_SIZE;
+    const sbf_size n_pieces = job.first_piece[n_ranges];
+    job.piece_crcs = malloc((n_pieces + 1) * sizeof(uint32_t));
+    if(n_threads < 1) n_threads = 1;
+    if((sbf_size)n_threads > n_pieces) n_threads = n_pieces > 0 ? (int)n_pieces : 1;
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    if(job.piece_crcs == NULL || threads == NULL) {
+        free(job.first_piece);
+        free(job.piece_crcs);
+        free(threads);
+        return false;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+
+    int started = 0;
+    for(int t = 1; t < n_threads; t++) {
+        if(pthread_create(&threads[started], NULL, checksum_worker, &job) != 0) break;
+        started++;
+    }
+    checksum_worker(&job);
+    for(int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    pthread_mutex_destroy(&job.lock);
+
+    for(sbf_size i = 0; i < n_ranges; i++) {
+        uint32_t crc = 0;
+        sbf_size left = ranges[i].size;
+        for(sbf_size piece = job.first_piece[i]; piece < job.first_piece[i + 1]; piece++) {
+            const sbf_size size = left < VERIFY_PIECE_SIZE ? left : VERIFY_PIECE_SIZE;
+            crc = sbf_crc32c_combine(crc, job.piece_crcs[piece], size);
+            left -= size;
+        }
+        ranges[i].crc = crc;
     }
+    free(job.first_piece);
+    free(job.piece_crcs);
+    free(threads);
+    return true;
+}
 
+/*
+ * Size of the blob of the uncompressed dataset 'dset', as declared by
+ * its shape and data type, if it is no more than 'limit' bytes.
+ */
+bool declared_size(const sbf_DataHeader dset, sbf_size limit, sbf_size *size) {
+    sbf_size bytes = sbf_datatype_size(dset);
+    for(int dim = 0; dim < SBF_MAX_DIM; dim++) {
+        if(dim > 0 && dset.shape[dim] == 0) break;
+        if(dset.shape[dim] != 0 && bytes > limit / dset.shape[dim]) return false;
+        bytes *= dset.shape[dim];
+    }
+    *size = bytes;
+    return true;
 }
 
-sbf_size diff_datablocks(const sbf_DataHeader dset1, void * data1,
-                         const sbf_DataHeader dset2, void * data2) {
-    sbf_size bytes = sbf_num_blocks(dset1) * sbf_datatype_size(dset1); 
-    bool raw = false;
-    if(raw) return memcmp(data1, data2, bytes);
-    sbf_size diffs = 0;
-    bool cmaj1 = SBF_CHECK_COLUMN_MAJOR_FLAG(dset1);
-    bool cmaj2 = SBF_CHECK_COLUMN_MAJOR_FLAG(dset2);
-
-    sbf_size idx[SBF_MAX_DIM] = {0};
-    sbf_byte dims = SBF_GET_DIMENSIONS(dset1);
-    const char * fmt_string = format_string(dset1.data_type);
-
-    do {
-        ptrdiff_t offset1 = offset_of(sbf_datatype_size(dset1), cmaj1, dims, dset1.shape, idx);
-        ptrdiff_t offset2 = offset_of(sbf_datatype_size(dset2), cmaj2, dims, dset1.shape, idx);
-        if(!compare_blocks(data1 + offset1, data2 + offset2, dset1.data_type)) {
-
-            if(GLOBAL_LOG_LEVEL >= verbose_info) {
-                log(verbose_info, "D '%s' @(",dset1.name);
-                for(sbf_byte dim = 0; dim < dims; dim++) log(verbose_info, "%s%"PRIu64, (dim ==0)? "":",", idx[dim]);
-                fprintf(stdout, "):");
-                pretty_print_block(data1 + offset1, fmt_string, dset1.data_type);
-                fprintf(stdout, " < >");
-                pretty_print_block(data2 + offset2, fmt_string, dset2.data_type);
-                fprintf(stdout, "\n");
-            }
-            diffs++;
+/*
+ * Size of the blob of the compressed dataset 'dset' at the start of
+ * 'blob', whose chunk index must describe chunks which decode to its
+ * declared shape and all lie within the 'limit' bytes of 'blob'.
+ */
+bool compressed_size(const sbf_DataHeader dset, const sbf_byte *blob, sbf_size limit,
+                     sbf_size *size) {
+    sbf_ChunkIndexHeader index;
+    sbf_size decoded = 0;
+    if(limit < sizeof(index)) return false;
+    memcpy(&index, blob, sizeof(index));
+    sbf_chunk_index_le(&index, NULL, 0);
+    const sbf_size table = (limit - sizeof(index)) / sizeof(sbf_size);
+    if(index.chunk_size == 0 || index.n_chunks >= table) return false;
+    if(!declared_size(dset, index.chunk_size * index.n_chunks, &decoded) ||
+       index.n_chunks != (decoded + index.chunk_size - 1) / index.chunk_size)
+        return false;
+
+    const sbf_size chunks_start = sizeof(index) + (index.n_chunks + 1) * sizeof(sbf_size);
+    sbf_size previous = 0;
+    for(sbf_size chunk = 0; chunk <= index.n_chunks; chunk++) {
+        sbf_size offset;
+        memcpy(&offset, blob + sizeof(index) + chunk * sizeof(sbf_size), sizeof(offset));
+        offset = sbf_le64(offset);
+        if((chunk == 0 && offset != 0) || offset < previous ||
+           offset > limit - chunks_start)
+            return false;
+        previous = offset;
+    }
+    *size = chunks_start + previous;
+    return true;
+}
+
+/*
+ * Locate the headers, the blob of each dataset and the tail of 'file',
+ * mapped at 'map' and 'length' bytes long, filling the n_datasets + 2
+ * 'ranges'. The shapes in the headers, and the chunk indexes of
+ * compressed datasets, must agree with the length of the file.
+ */
+bool check_layout(const sbf_File *file, const sbf_byte *map, sbf_size length,
+                  byte_range *ranges) {
+    const sbf_size data_start = sbf_data_start(file);
+    sbf_size offset = data_start, data_end = sbf_headers_size(file);
+    ranges[0].offset = 0;
+    ranges[0].size = data_end;
+    for(sbf_size i = 0; i < file->n_datasets; i++) {
+        const sbf_DataHeader dset = file->datasets[i];
+        sbf_size size = 0;
+        const sbf_size limit = length > offset ? length - offset : 0;
+        bool fits = SBF_CHECK_COMPRESSED_FLAG(dset)
+                        ? compressed_size(dset, map + offset, limit, &size)
+                        : declared_size(dset, limit, &size);
+        if(!fits) {
+            log(error, "D '%s' in %s doesn't fit in the file (%"PRIu64" bytes left at %"PRIu64")%s\n",
+                dset.name, file->filename, limit, offset,
+                SBF_CHECK_COMPRESSED_FLAG(dset) ? ", or has a corrupt chunk index" : "");
+            return false;
         }
-        increment_index(dset1.shape, idx, dims);
-    } while(!all_zero(idx));
-    return diffs;
+        log(very_verbose_info, "D '%s' is %"PRIu64" bytes at %"PRIu64"\n", dset.name, size, offset);
+        ranges[i + 1].offset = offset;
+        ranges[i + 1].size = size;
+        data_end = offset + size;
+        offset = data_start + sbf_align_up(offset - data_start + size, file->alignment);
+    }
+    ranges[file->n_datasets + 1].offset = data_end;
+    ranges[file->n_datasets + 1].size = length - data_end;
+    return true;
 }
 
-sbf_result load_datasets(sbf_File *file) {
-    //TODO error check
-    for(int_fast8_t i = 0; i < file->n_datasets; i++) {
-        sbf_DataHeader dset = file->datasets[i];
-        file->dataset_pointers[i] = calloc(sbf_datatype_size(dset), sbf_num_blocks(dset));
-        sbf_result res = sbf_read_dataset(file, dset, file->dataset_pointers[i]);
-        if(res != SBF_RESULT_SUCCESS) {
-            log(error, "Problem reading dataset '%s' in %s: %s\n", 
-                dset.name, file->filename,
-                (res == SBF_RESULT_NULL_FAILURE) ? "failure allocating memory" : strerror(errno));
-            return res;
+/*
+ * Compare the checksums of 'ranges' with those ending 'file', if it
+ * has them. Returns the number of mismatches.
+ */
+sbf_size check_trailer(const sbf_File *file, const sbf_byte *map, sbf_size length,
+                       const byte_range *ranges, bool *found) {
+    const sbf_size n = file->n_datasets;
+    const sbf_size data_end = ranges[n + 1].offset;
+    sbf_ChecksumTrailer trailer;
+    *found = false;
+    if(length < data_end + sizeof(trailer)) return 0;
+    memcpy(&trailer, map + length - sizeof(trailer), sizeof(trailer));
+    sbf_checksums_le(&trailer, NULL, 0);
+    const sbf_size table_start = sbf_checksum_table_start(&trailer, length, data_end, n);
+    if(table_start == 0) return 0;
+    *found = true;
+    if(sbf_crc32c(0, map + table_start, n * sizeof(uint32_t)) != trailer.table_crc) {
+        log(error, "File %s has corrupt checksums\n", file->filename);
+        return 1;
+    }
+
+    sbf_size problems = 0;
+    if(ranges[0].crc != trailer.headers_crc) {
+        log(error, "Headers of %s fail their checksum: %08"PRIx32", expected %08"PRIx32"\n",
+            file->filename, ranges[0].crc, trailer.headers_crc);
+        problems++;
+    }
+    for(sbf_size i = 0; i < n; i++) {
+        uint32_t expected;
+        memcpy(&expected, map + table_start + i * sizeof(uint32_t), sizeof(expected));
+        expected = sbf_le32(expected);
+        if(ranges[i + 1].crc != expected) {
+            log(error, "D '%s' in %s fails its checksum: %08"PRIx32", expected %08"PRIx32"\n",
+                file->datasets[i].name, file->filename, ranges[i + 1].crc, expected);
+            problems++;
         }
     }
-    return SBF_RESULT_SUCCESS;
+    return problems;
 }
 
-sbf_result cleanup_datasets(sbf_File *file) {
-    for(int_fast8_t i = 0; i < file->n_datasets; i++) {
-        free(file->dataset_pointers[i]);
+/*
+ * Write the manifest of 'file' to 'manifest': a line for the headers,
+ * each dataset and the tail, holding its checksum and size, e.g.
+ *
+ *     headers 1c2d3e4f 4264
+ *     dataset 9a8b7c6d 8000 positions
+ *     tail 00000000 0
+ *
+ * The manifest is written aside and then renamed over any previous one.
+ */
+bool write_manifest(const sbf_File *file, const byte_range *ranges, const char *manifest) {
+    char *temp = sbf_temp_filename(manifest);
+    if(temp == NULL) return false;
+    FILE *fp = fopen(temp, "w");
+    bool ok = fp != NULL;
+    if(ok) {
+        const sbf_size n = file->n_datasets;
+        fprintf(fp, "headers %08"PRIx32" %"PRIu64"\n", ranges[0].crc, ranges[0].size);
+        for(sbf_size i = 0; i < n; i++)
+            fprintf(fp, "dataset %08"PRIx32" %"PRIu64" %.*s\n", ranges[i + 1].crc,
+                    ranges[i + 1].size, SBF_NAME_LENGTH, file->datasets[i].name);
+        fprintf(fp, "tail %08"PRIx32" %"PRIu64"\n", ranges[n + 1].crc, ranges[n + 1].size);
+        ok = !ferror(fp);
+        ok = (fclose(fp) == 0) && ok;
     }
-    return SBF_RESULT_SUCCESS;
+    ok = ok && sbf_commit_file(temp, manifest) == 0;
+    if(!ok) {
+        log(error, "Problem writing %s: %s\n", manifest, strerror(errno));
+        remove(temp);
+    }
+    free(temp);
+    return ok;
 }
 
-sbf_size diff_files(sbf_File * file1, sbf_File * file2) {
-    sbf_byte n1 = file1->n_datasets; sbf_byte n2 = file2->n_datasets;
-    if(n2 > n1) {
-        sbf_File * tmp; sbf_byte n_tmp;
-        tmp = file1; file1 = file2; file2 = tmp;
-        n_tmp = n2; n1 = n2; n2 = n_tmp;
+/*
+ * Compare the checksums of 'ranges' with the manifest 'fp' of 'file'.
+ * Returns the number of mismatches.
+ */
+sbf_size check_manifest(const sbf_File *file, const byte_range *ranges, FILE *fp,
+                        const char *manifest) {
+    const sbf_size n = file->n_datasets;
+    sbf_size problems = 0, entry = 0;
+    char line[SBF_NAME_LENGTH + 64];
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        char kind[8], name[SBF_NAME_LENGTH + 1] = "";
+        uint32_t crc;
+        sbf_size size;
+        int fields = sscanf(line, "%7s %"SCNx32" %"SCNu64" %"STRINGIFY(SBF_NAME_LENGTH)"[^\n]",
+                            kind, &crc, &size, name);
+        const char *expected_kind = (entry == 0) ? "headers" : (entry <= n) ? "dataset" : "tail";
+        if(fields < 3 || entry > n + 1 || strcmp(kind, expected_kind) != 0 ||
+           (entry > 0 && entry <= n &&
+            strncmp(name, file->datasets[entry - 1].name, SBF_NAME_LENGTH) != 0)) {
+            log(error, "%s doesn't match the layout of %s at line %"PRIu64"\n",
+                manifest, file->filename, entry + 1);
+            return problems + 1;
+        }
+        const byte_range *r = &ranges[entry];
+        if(r->crc != crc || r->size != size) {
+            log(error, "%s%s%s of %s fail%s the manifest: %08"PRIx32" (%"PRIu64" bytes), expected %08"PRIx32" (%"PRIu64" bytes)\n",
+                (entry == 0 || entry > n) ? kind : "D '",
+                (entry == 0 || entry > n) ? "" : name,
+                (entry == 0 || entry > n) ? "" : "'",
+                file->filename, (entry > 0 && entry <= n) ? "s" : "",
+                r->crc, r->size, crc, size);
+            problems++;
+        }
+        entry++;
     }
-    sbf_size file_diffs = 0;
-    bool deep_check = true;
-    if(n1 != n2) {
-        log(verbose_info, "Different number of datasets: %d, %d\n", n1, n2);
-        ++file_diffs;
+    if(entry != n + 2) {
+        log(error, "%s has %"PRIu64" entries, expected %"PRIu64"\n", manifest, entry, n + 2);
+        problems++;
     }
+    return problems;
+}
 
-    if(deep_check) {
-        load_datasets(file1);
-        load_datasets(file2);
+double seconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*
+ * Verify the file 'filename': check that the shapes in its headers and
+ * the chunk indexes of compressed datasets agree with its length, then
+ * compute the CRC32C of its headers, each blob and the rest of the file
+ * straight from a mapping of it, across 'n_threads' threads. These are
+ * checked against the checksums ending the file (see sbf_integrity.h)
+ * and the manifest 'filename.crc32c', or with 'update' the manifest is
+ * (re)written. Adds the bytes checksummed to 'bytes'.
+ *
+ * Returns the number of problems found.
+ */
+sbf_size verify_file(const char *filename, bool update, int n_threads, sbf_size *bytes) {
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_READONLY;
+    file.filename = filename;
+    file.headers_only = true;
+    if(sbf_open(&file) != SBF_RESULT_SUCCESS) return 1;
+    if(sbf_read_headers(&file) != SBF_RESULT_SUCCESS) {
+        log(error, "File %s has corrupt headers\n", filename);
+        sbf_close(&file);
+        return 1;
     }
 
-    // TODO process longest file first
-    for(sbf_byte i = 0; i < n1;  i++) {
-        log(debug, "Checking dataset %d in %s\n", i, file1->filename);
-        sbf_DataHeader dset1 = file1->datasets[i];
-        sbf_size dset_diffs = 0;
-        int dset_found = get_dataset(dset1.name, file2);
-        if(dset_found == -1) {
-            log(verbose_info, "No matching dataset found for '%s' in %s\n",
-                dset1.name, file2->filename);
-            file_diffs++;
-        }
-        else {
-            sbf_DataHeader dset2 = file2->datasets[dset_found];
-            void * data2 = file2->dataset_pointers[i];
-            bool dims_equal = (SBF_GET_DIMENSIONS(dset1) == SBF_GET_DIMENSIONS(dset2));
-            bool dtypes_equal = (dset1.data_type == dset2.data_type);
-            bool shapes_equal = shape_equal(dset1.shape, dset2.shape);
-
-            if(!dims_equal) {
-                log(verbose_info, "D '%s' incompatible dimensions: %d < > %d\n",
-                    dset1.name, SBF_GET_DIMENSIONS(dset1), SBF_GET_DIMENSIONS(dset2));
-                dset_diffs++;
-            }
-            if(!dtypes_equal) {
-                log(verbose_info, "D '%s' incompatible data types: %s < > %s\n",
-                    dset1.name, sbf_datatype_name(dset1.data_type), sbf_datatype_name(dset2.data_type));
-                dset_diffs++;
-            }
-            if(!shapes_equal) {
-                log(verbose_info, "D '%s' incompatible shapes: ", dset1.name);
-                for(int_fast8_t i = 0; i < SBF_GET_DIMENSIONS(dset1); i++) log(verbose_info, "[%"PRIu64"]", dset1.shape[i]);
-                log(verbose_info, " %s ", "< >");
-                for(int_fast8_t i = 0; i < SBF_GET_DIMENSIONS(dset2); i++) log(verbose_info, "[%"PRIu64"]", dset2.shape[i]);
-                log(verbose_info, "%s\n", "");
-                dset_diffs++;
-            }
-            if(deep_check && dims_equal && shapes_equal && dtypes_equal) {
-                dset_diffs = dset_diffs + diff_datablocks(dset1, file1->dataset_pointers[i],
-                                                          dset2, file2->dataset_pointers[dset_found]);
-            }
-            log(verbose_info, "%"PRIu64" differences in dataset '%s'\n", dset_diffs, dset1.name);
-            file_diffs = file_diffs + dset_diffs;
+    const double start = seconds_now();
+    sbf_size problems = 0;
+    sbf_byte *map = NULL;
+    sbf_size length = 0;
+    bool checksummed = false;
+    byte_range *ranges = malloc((file.n_datasets + 2) * sizeof(byte_range));
+    char *manifest = malloc(strlen(filename) + sizeof(MANIFEST_SUFFIX));
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if(ranges == NULL || manifest == NULL || fd < 0 || fstat(fd, &st) != 0) {
+        log(error, "Problem reading %s: %s\n", filename, strerror(errno));
+        problems++;
+        goto cleanup;
+    }
+    strcpy(manifest, filename);
+    strcat(manifest, MANIFEST_SUFFIX);
+    length = (sbf_size)st.st_size;
+    map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) {
+        map = NULL;
+        log(error, "Problem mapping %s: %s\n", filename, strerror(errno));
+        problems++;
+        goto cleanup;
+    }
+    // each thread reads through its pieces front to back
+    madvise(map, length, MADV_SEQUENTIAL);
+
+    if(!check_layout(&file, map, length, ranges)) {
+        problems++;
+        goto cleanup;
+    }
+    if(!checksum_ranges(map, ranges, file.n_datasets + 2, n_threads)) {
+        log(error, "Problem checksumming %s: %s\n", filename, "failure allocating memory");
+        problems++;
+        goto cleanup;
+    }
+    *bytes += length;
+    checksummed = true;
+
+    bool has_trailer = false, has_manifest = false;
+    problems += check_trailer(&file, map, length, ranges, &has_trailer);
+    if(update) {
+        has_manifest = write_manifest(&file, ranges, manifest);
+        if(!has_manifest) problems++;
+    }
+    else {
+        FILE *fp = fopen(manifest, "r");
+        if(fp != NULL) {
+            has_manifest = true;
+            problems += check_manifest(&file, ranges, fp, manifest);
+            fclose(fp);
         }
     }
-    if(deep_check) {
-        cleanup_datasets(file1);
-        cleanup_datasets(file2);
+    if(!has_trailer && !has_manifest)
+        log(warning, "File %s has no checksums or manifest, only its layout was checked\n", filename);
+
+cleanup:
+    if(checksummed) {
+        const double elapsed = seconds_now() - start;
+        log(info, "%s: %s, %.1f MiB in %.3f s (%.1f MiB/s)\n", filename,
+            problems ? "CORRUPT" : update ? "manifest written" : "OK", length / 1048576.0,
+            elapsed, elapsed > 0 ? length / 1048576.0 / elapsed : 0.0);
     }
-    return file_diffs;
+    else {
+        log(info, "%s: %s\n", filename, "CORRUPT");
+    }
+    if(map != NULL) munmap(map, length);
+    if(fd >= 0) close(fd);
+    free(ranges);
+    free(manifest);
+    sbf_close(&file);
+    return problems;
 }
 
 int main(int argc, char *argv[]) {
     extern char *optarg;
     extern int optind;
     bool dump_file = false, list_datasets = true, diff = false;
+    bool verify = false, update_manifest = false, metadata_only = false;
+    int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
     char * e_arg = NULL;
+    char * dataset_name = NULL;
+    char * export_format = NULL, * output_name = NULL;
     int c;
     int retcode = 0;
 
     opterr = 0;
-    while ((c = getopt (argc, argv, "e:cplhv")) != -1)
+    while ((c = getopt (argc, argv, "d:e:r:u:j:x:o:cmplhvVW")) != -1)
         switch (c)
         {
+            case 'd':
+                dataset_name = optarg;
+                break;
             case 'c':
                 diff = true;
                 break;
@@ -442,10 +1701,35 @@ int main(int argc, char *argv[]) {
                 else GLOBAL_LOG_LEVEL++;
                 break;
             case 'e':
-                eps = strtod(optarg, NULL);
+                tol.absolute = strtod(optarg, NULL);
+                break;
+            case 'r':
+                tol.relative = strtod(optarg, NULL);
+                break;
+            case 'u':
+                tol.ulps = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                metadata_only = true;
+                break;
+            case 'x':
+                export_format = optarg;
+                break;
+            case 'o':
+                output_name = optarg;
+                break;
+            case 'V':
+                verify = true;
+                break;
+            case 'W':
+                update_manifest = true;
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
                 break;
             case '?':
-                if(optopt == 'e')
+                if(optopt == 'e' || optopt == 'r' || optopt == 'u' || optopt == 'd' || optopt == 'j' ||
+                   optopt == 'x' || optopt == 'o')
                     log(error, "Option -%c requires an argument.\n", optopt);
                 else if (isprint(optopt))
                     log(error, "Unknown option -%c.\n", optopt);
@@ -455,7 +1739,62 @@ int main(int argc, char *argv[]) {
                 exit(EXIT_FAILURE);
         }
 
-    if(diff) {
+    if(verify) {
+        if(optind == argc) {
+            log(error, "Option -V requires a filename e.g.: %s\n", "file.sbf");
+            usage(argv[0]);
+        }
+        sbf_size problems = 0, bytes = 0;
+        const double start = seconds_now();
+        for(int index = optind; index < argc; index++)
+            problems += verify_file(argv[index], update_manifest, n_threads, &bytes);
+        const double elapsed = seconds_now() - start;
+        if(argc - optind > 1)
+            log(info, "%d files, %.1f MiB in %.3f s (%.1f MiB/s), %"PRIu64" problem%s\n",
+                argc - optind, bytes / 1048576.0, elapsed,
+                elapsed > 0 ? bytes / 1048576.0 / elapsed : 0.0, problems, problems == 1 ? "" : "s");
+        retcode = problems ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    else if(export_format) {
+        const bool npy = (strcmp(export_format, "npy") == 0);
+        if(!npy && strcmp(export_format, "csv") != 0) {
+            log(error, "Unknown export format '%s', expecting csv or npy\n", export_format);
+            exit(EXIT_FAILURE);
+        }
+        if(optind != (argc - 1) || dataset_name == NULL) {
+            log(error, "Option -x requires a dataset and a filename e.g.: %s\n",
+                "-x csv -d positions file.sbf");
+            usage(argv[0]);
+        }
+        sbf_File file = sbf_new_file;
+        file.mode = SBF_FILE_READONLY;
+        file.filename = argv[optind];
+        SBF_ASSERT_SUCCESSFUL(sbf_open(&file));
+        SBF_ASSERT_SUCCESSFUL(sbf_read_headers(&file));
+        int_fast32_t index = get_dataset(dataset_name, &file);
+        if(index == -1) {
+            log(error, "No dataset named '%s' in %s\n", dataset_name, file.filename);
+            exit(EXIT_FAILURE);
+        }
+        FILE *fp = output_name ? fopen(output_name, "wb") : stdout;
+        if(fp == NULL) {
+            log(error, "Problem opening %s: %s\n", output_name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        bool ok;
+        if(npy) {
+            ok = export_npy(fp, &file, index);
+        }
+        else {
+            text_output out;
+            ok = output_open(&out, fp) && export_text(&out, &file, index, true);
+            ok = output_close(&out) && ok;
+        }
+        if(output_name) ok = (fclose(fp) == 0) && ok;
+        SBF_ASSERT_SUCCESSFUL(sbf_close(&file));
+        retcode = ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if(diff) {
         if(optind != (argc - 2)) {
             log(error, "Option -c requires two filenames e.g.: %s %s\n",
                 "file1.sbf", "file2.sbf");
@@ -469,7 +1808,7 @@ int main(int argc, char *argv[]) {
         SBF_ASSERT_SUCCESSFUL(sbf_read_headers(&file1));
         SBF_ASSERT_SUCCESSFUL(sbf_read_headers(&file2));
 
-        sbf_size diffs = diff_files(&file1, &file2);
+        sbf_size diffs = diff_files(&file1, &file2, metadata_only, n_threads);
         // If we found differences in the file, print the number out
         if(diffs)
             log(info, "%"PRIu64" difference%s between %s and %s\n",
@@ -477,8 +1816,8 @@ int main(int argc, char *argv[]) {
 
         SBF_ASSERT_SUCCESSFUL(sbf_close(&file1));
         SBF_ASSERT_SUCCESSFUL(sbf_close(&file2));
-        // and return it as an exit value
-        retcode = diffs;
+        // and return it as an exit value, which can't exceed 255
+        retcode = (diffs > 255) ? 255 : (int)diffs;
     }
     else {
         if(optind == argc) {
@@ -491,6 +1830,8 @@ int main(int argc, char *argv[]) {
             sbf_File file = sbf_new_file;
             file.mode = SBF_FILE_READONLY;
             file.filename = filename;
+            // listing datasets needs nothing but their headers
+            file.headers_only = !dump_file;
             log(info, "Processing '%s'...\n", file.filename);
             sbf_result res;
             SBF_ASSERT_SUCCESSFUL(sbf_open(&file));
@@ -498,10 +1839,15 @@ int main(int argc, char *argv[]) {
                 retcode = EXIT_FAILURE;
                 continue;
             }
-            if(list_datasets || dump_file) dump_file_as_utf8(&file, dump_file);
+            if(dataset_name && get_dataset(dataset_name, &file) == -1) {
+                log(error, "No dataset named '%s' in %s\n", dataset_name, file.filename);
+                retcode = EXIT_FAILURE;
+            }
+            else if(list_datasets || dump_file) dump_file_as_utf8(&file, dump_file, dataset_name);
             SBF_ASSERT_SUCCESSFUL(sbf_close(&file));
         }
    
     }
+    sbf_arena_free(&reader_arena);
     return retcode;
 }
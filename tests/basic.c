@@ -27,8 +27,132 @@ static char *test_header() {
     return 0;
 }
 
+static char *test_codec() {
+    enum { n = 100000 };
+    static uint8_t raw[n], encoded[n], decoded[n], scratch[n];
+    // a repetitive pattern, then noise that won't compress
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < n; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        raw[i] = (i < n / 2) ? (uint8_t)(i % 7) : (uint8_t)state;
+    }
+
+    size_t stored = sbf_encode_chunk(SBF_CODEC_LZ, SBF_FILTER_SHUFFLE, 8, raw, n,
+                                     encoded, scratch);
+    assert("repetitive data did not compress", stored < n);
+    int res = sbf_decode_chunk(SBF_CODEC_LZ, SBF_FILTER_SHUFFLE, 8, encoded, stored,
+                               decoded, n, scratch);
+    assert("decoding chunk failed", res == 0);
+    assert("round trip through codec changed data", memcmp(raw, decoded, n) == 0);
+
+    stored = sbf_encode_chunk(SBF_CODEC_LZ, 0, 1, raw + n / 2, n / 2, encoded, scratch);
+    assert("incompressible data not stored raw", stored == n / 2);
+    res = sbf_decode_chunk(SBF_CODEC_LZ, 0, 1, encoded, stored, decoded, n / 2, scratch);
+    assert("round trip of raw chunk changed data",
+           res == 0 && memcmp(raw + n / 2, decoded, n / 2) == 0);
+
+    size_t compressed = sbf_lz_compress(raw, n / 2, encoded, n);
+    assert("truncated input decoded",
+           sbf_lz_decompress(encoded, compressed - 1, decoded, n / 2) != 0);
+    return 0;
+}
+
+static char *test_filters() {
+    enum { n = 8 * 1003 + 5 };
+    static uint8_t raw[n], shuffled[n], decoded[n], scratch[n];
+    for (int i = 0; i < n; i++)
+        raw[i] = (uint8_t)(i * 31 + (i >> 3));
+
+    // element sizes with and without a vectorized shuffle kernel
+    const size_t elems[] = {2, 3, 4, 8, 16};
+    for (size_t e = 0; e < sizeof(elems) / sizeof(elems[0]); e++) {
+        size_t elem = elems[e], count = n / elem;
+        sbf_shuffle(raw, shuffled, n, elem);
+        assert("shuffle misplaced a byte",
+               shuffled[(elem - 1) * count + count - 1] == raw[count * elem - 1] &&
+               shuffled[1 * count + 5] == raw[5 * elem + 1]);
+        sbf_unshuffle(shuffled, decoded, n, elem);
+        assert("unshuffle did not invert shuffle", memcmp(raw, decoded, n) == 0);
+    }
+
+    sbf_delta_encode(raw, shuffled, n, 8);
+    assert("delta did not xor with previous element", shuffled[9] == (raw[9] ^ raw[1]));
+    sbf_delta_decode(shuffled, shuffled, n, 8);
+    assert("in place delta decode did not invert encode", memcmp(raw, shuffled, n) == 0);
+
+    const uint8_t pipelines[] = {SBF_FILTER_DELTA, SBF_FILTER_DELTA | SBF_FILTER_SHUFFLE};
+    for (int p = 0; p < 2; p++) {
+        size_t stored = sbf_encode_chunk(SBF_CODEC_NONE, pipelines[p], 8, raw, n,
+                                         shuffled, scratch);
+        assert("filters alone changed the chunk size", stored == n);
+        int res = sbf_decode_chunk(SBF_CODEC_NONE, pipelines[p], 8, shuffled, stored,
+                                   decoded, n, scratch);
+        assert("round trip through filters changed data",
+               res == 0 && memcmp(raw, decoded, n) == 0);
+    }
+    return 0;
+}
+
+static char *test_byteswap() {
+    enum { n = 16 * 41 };
+    uint8_t raw[n], swapped[n];
+    for (int i = 0; i < n; i++)
+        raw[i] = (uint8_t)(i * 7 + 3);
+
+    const size_t widths[] = {2, 4, 8, 16};
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        const size_t width = widths[w];
+        memcpy(swapped, raw, n);
+        sbf_byteswap(swapped, n, width);
+        int misplaced = 0;
+        for (size_t i = 0; i < n; i++)
+            if (swapped[i] != raw[(i / width) * width + width - 1 - i % width])
+                misplaced++;
+        assert("byteswap misplaced a byte", misplaced == 0);
+        sbf_byteswap(swapped, n, width);
+        assert("swapping twice changed data", memcmp(raw, swapped, n) == 0);
+    }
+    memcpy(swapped, raw, n);
+    sbf_byteswap(swapped, n, 1);
+    assert("byteswap of single bytes changed data", memcmp(raw, swapped, n) == 0);
+    return 0;
+}
+
+static const char *test_names[] = {"alpha", "beta", "alpha", "gamma"};
+
+static const char *test_name_of(const void *context, uint32_t index) {
+    return ((const char **)context)[index];
+}
+
+static char *test_name_index() {
+    sbf_NameSlot slots[8] = {{0, 0}}, grown[16] = {{0, 0}};
+    for (uint32_t i = 0; i < 4; i++)
+        sbf_name_index_insert(slots, 8, sbf_name_hash(test_names[i], SBF_NAME_LENGTH), i);
+    assert("name index not valid", sbf_name_index_valid(slots, 8, 4));
+    assert("name not found",
+           sbf_name_index_find(slots, 8, "gamma", SBF_NAME_LENGTH, test_name_of, test_names) == 3);
+    assert("first of duplicated names not found",
+           sbf_name_index_find(slots, 8, "alpha", SBF_NAME_LENGTH, test_name_of, test_names) == 0);
+    assert("missing name found",
+           sbf_name_index_find(slots, 8, "delta", SBF_NAME_LENGTH, test_name_of, test_names) == -1);
+
+    assert("rehash failed", sbf_name_index_rehash(slots, 8, grown, 16, 4) == 0);
+    assert("first of duplicated names not found after rehash",
+           sbf_name_index_find(grown, 16, "alpha", SBF_NAME_LENGTH, test_name_of, test_names) == 0);
+    assert("name not found after rehash",
+           sbf_name_index_find(grown, 16, "beta", SBF_NAME_LENGTH, test_name_of, test_names) == 1);
+    assert("index with too few slots is valid", !sbf_name_index_valid(slots, 8, 8));
+    return 0;
+}
+
 static char *all_tests() {
     run_unit_test(test_header);
+    run_unit_test(test_codec);
+    run_unit_test(test_filters);
+    run_unit_test(test_byteswap);
+    run_unit_test(test_name_index);
     return 0;
 }
 
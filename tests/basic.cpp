@@ -13,5 +13,14 @@ TEST_CASE("Dataset basics", "[dsets]") {
 }
 
 TEST_CASE("FileHeader basics", "[files]") {
-    REQUIRE(file_header_size == 7);
+    REQUIRE(file_header_size == 22);
+    sbf::FileHeader header;
+    REQUIRE(header.size() == file_header_size);
+    REQUIRE(header.alignment == 1);
+    // before 0.3.2 there was no alignment
+    header.token_version_string[5] = '1';
+    REQUIRE(header.size() == 14);
+    // before 0.3.0 the number of datasets was a single byte
+    header.token_version_string[4] = '2';
+    REQUIRE(header.size() == 7);
 }
@@ -0,0 +1,125 @@
+#include "sbf.h"
+#include "unit_test.h"
+#include <math.h>
+#include <sys/wait.h>
+
+/*
+ * Compares files with sbftool -c, whose exit code is the number of
+ * differences found, given the path of sbftool as the first argument
+ */
+
+int tests_run = 0;
+const char *sbftool = NULL;
+const char *row_major_filename = "/tmp/sbf_test_diff_row.sbf";
+const char *column_major_filename = "/tmp/sbf_test_diff_column.sbf";
+
+enum { rows = 4, columns = 5 };
+
+/*
+ * Differences sbftool finds between the two files with 'options'
+ */
+static int sbftool_diffs(const char *options, const char *filename1, const char *filename2) {
+    char command[1024];
+    snprintf(command, sizeof(command), "\"%s\" -c -j 2 %s %s %s", sbftool, options,
+             filename1, filename2);
+    const int status = system(command);
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+static char *write_file(const char *filename, bool column_major, sbf_double *doubles,
+                        sbf_integer *ints) {
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = filename;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    sbf_size shape_doubles[SBF_MAX_DIM] = {rows, columns};
+    sbf_size shape_ints[SBF_MAX_DIM] = {3};
+    res = sbf_add_dataset(&file, "doubles", SBF_DOUBLE, shape_doubles, doubles);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    if (column_major)
+        SBF_SET_COLUMN_MAJOR_FLAG(file.datasets[0]);
+    res = sbf_add_dataset(&file, "ints", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write(&file);
+    assert("writing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    return 0;
+}
+
+static char *test_write() {
+    // the same values, stored row major in one file and column major in the other
+    sbf_double row_major[rows][columns], column_major[columns][rows];
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < columns; j++)
+            row_major[i][j] = column_major[j][i] = i * columns + j + 0.5;
+    }
+    // NaN in both files are the same
+    row_major[0][0] = column_major[0][0] = NAN;
+    // but not NaN in one of them
+    column_major[1][0] = NAN;
+    // within the default absolute tolerance, and a relative one of 1e-6
+    column_major[1][1] += 1e-6;
+    // beyond it, but within a relative tolerance of 1e-4
+    column_major[3][2] += 1e-3;
+    // 2 units in the last place
+    column_major[4][3] = nextafter(nextafter(column_major[4][3], INFINITY), INFINITY);
+
+    sbf_integer ints[3] = {1, 2, 3}, other_ints[3] = {1, 2, 4};
+    char *message = write_file(row_major_filename, false, &row_major[0][0], ints);
+    if (message)
+        return message;
+    return write_file(column_major_filename, true, &column_major[0][0], other_ints);
+}
+
+static char *test_identical() {
+    assert("differences in the same file",
+           sbftool_diffs("", row_major_filename, row_major_filename) == 0);
+    assert("differences in the same file",
+           sbftool_diffs("-e 0", column_major_filename, column_major_filename) == 0);
+    return 0;
+}
+
+static char *test_tolerances() {
+    // the NaN, the integer, and 1e-3 beyond the default absolute tolerance
+    assert("wrong number of differences with the default tolerance",
+           sbftool_diffs("", row_major_filename, column_major_filename) == 3);
+    assert("wrong number of differences comparing the other way",
+           sbftool_diffs("", column_major_filename, row_major_filename) == 3);
+    assert("wrong number of differences with no tolerance",
+           sbftool_diffs("-e 0", row_major_filename, column_major_filename) == 5);
+    assert("wrong number of differences with an absolute tolerance",
+           sbftool_diffs("-e 0.01", row_major_filename, column_major_filename) == 2);
+    assert("wrong number of differences with a relative tolerance",
+           sbftool_diffs("-e 0 -r 1e-4", row_major_filename, column_major_filename) == 2);
+    assert("wrong number of differences with a tolerance in ulps",
+           sbftool_diffs("-e 0 -u 2", row_major_filename, column_major_filename) == 4);
+    assert("wrong number of differences with a tolerance of 1 ulp",
+           sbftool_diffs("-e 0 -u 1", row_major_filename, column_major_filename) == 5);
+    return 0;
+}
+
+static char *all_tests() {
+    run_unit_test(test_write);
+    run_unit_test(test_identical);
+    run_unit_test(test_tolerances);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s path/to/sbftool\n", argv[0]);
+        return 1;
+    }
+    sbftool = argv[1];
+    char *result = all_tests();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+
+    return result != 0;
+}
@@ -1,3 +1,5 @@
+// small ranges so that parallel I/O splits datasets between threads
+#define SBF_PARALLEL_CHUNK_SIZE 1000
 #include "sbf.h"
 #include "unit_test.h"
 
@@ -65,9 +67,940 @@ static char *test_read() {
     return 0;
 }
 
+static char *test_stream() {
+    const char *stream_filename = "/tmp/sbf_test_c_stream.sbf";
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = stream_filename;
+    sbf_result res;
+
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+
+    sbf_integer ints[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    sbf_size shape_ints[SBF_MAX_DIM] = {10};
+    res = sbf_add_dataset(&file, "integer_dataset", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    // declare a single frame, the dataset will grow as it is streamed
+    sbf_size shape_frames[SBF_MAX_DIM] = {1, 3};
+    res = sbf_declare_dataset(&file, "frames", SBF_DOUBLE, shape_frames);
+    assert("declaring dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write(&file);
+    assert("writing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    sbf_DatasetStream stream;
+    res = sbf_stream_begin(&file, 1, &stream);
+    assert("beginning stream unsuccessful", res == SBF_RESULT_SUCCESS);
+    for (int chunk = 0; chunk < 5; chunk++) {
+        sbf_double frames[2][3];
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 3; j++)
+                frames[i][j] = (chunk * 2 + i) * 10 + j;
+        res = sbf_stream_write(&stream, frames, 2);
+        assert("streaming chunk unsuccessful", res == SBF_RESULT_SUCCESS);
+    }
+    res = sbf_stream_end(&stream);
+    assert("ending stream unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.mode = SBF_FILE_READONLY;
+    file.filename = stream_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("incorrect number of datasets in file", file.n_datasets == 2);
+    assert("shape not patched", file.datasets[1].shape[0] == 10);
+    assert("shape not patched", file.datasets[1].shape[1] == 3);
+
+    sbf_integer read_ints[10];
+    sbf_double read_frames[10][3];
+    // read out of order, by name and by index
+    res = sbf_read_dataset_by_name(&file, "frames", read_frames);
+    assert("reading dataset by name not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset_at(&file, 0, read_ints);
+    assert("reading dataset by index not successful", res == SBF_RESULT_SUCCESS);
+    assert("finding missing dataset succeeded", sbf_dataset_index(&file, "missing") == -1);
+    int num_differences = 0;
+    for (int i = 0; i < 10; i++) {
+        if (read_ints[i] != i)
+            num_differences++;
+        for (int j = 0; j < 3; j++)
+            if (read_frames[i][j] != i * 10 + j)
+                num_differences++;
+    }
+    assert("datasets contain different values", num_differences == 0);
+
+    // a single frame, and every third element of the last column
+    sbf_double frame[3], column[3];
+    sbf_size start[SBF_MAX_DIM] = {4, 0}, count[SBF_MAX_DIM] = {1, 3};
+    res = sbf_read_hyperslab(&file, 1, start, count, NULL, frame);
+    assert("reading hyperslab not successful", res == SBF_RESULT_SUCCESS);
+    assert("incorrect hyperslab values",
+           frame[0] == 40 && frame[1] == 41 && frame[2] == 42);
+    sbf_size start_col[SBF_MAX_DIM] = {1, 2}, count_col[SBF_MAX_DIM] = {3, 1};
+    sbf_size stride_col[SBF_MAX_DIM] = {3, 1};
+    res = sbf_read_hyperslab(&file, 1, start_col, count_col, stride_col, column);
+    assert("reading strided hyperslab not successful", res == SBF_RESULT_SUCCESS);
+    assert("incorrect strided hyperslab values",
+           column[0] == 12 && column[1] == 42 && column[2] == 72);
+    sbf_size count_oob[SBF_MAX_DIM] = {7, 3};
+    res = sbf_read_hyperslab(&file, 1, start, count_oob, NULL, frame);
+    assert("out of bounds hyperslab succeeded", res == SBF_RESULT_READ_FAILURE);
+
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    return 0;
+}
+
+static char *test_parallel() {
+    const char *parallel_filename = "/tmp/sbf_test_c_parallel.sbf";
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = parallel_filename;
+    sbf_result res;
+
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    static sbf_double doubles[10000];
+    static sbf_integer ints[3333];
+    for (int i = 0; i < 10000; i++)
+        doubles[i] = 0.5 * i;
+    for (int i = 0; i < 3333; i++)
+        ints[i] = -i;
+    sbf_size shape_doubles[SBF_MAX_DIM] = {100, 100};
+    sbf_size shape_ints[SBF_MAX_DIM] = {3333};
+    res = sbf_add_dataset(&file, "ints", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "doubles", SBF_DOUBLE, shape_doubles, doubles);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write_parallel(&file, 4);
+    assert("parallel write unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.mode = SBF_FILE_READONLY;
+    file.filename = parallel_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    static sbf_double read_doubles[10000];
+    static sbf_integer read_ints[3333];
+    void *pointers[2] = {read_ints, read_doubles};
+    res = sbf_read_parallel(&file, pointers, 3);
+    assert("parallel read unsuccessful", res == SBF_RESULT_SUCCESS);
+    int num_differences = 0;
+    for (int i = 0; i < 10000; i++)
+        if (read_doubles[i] != doubles[i])
+            num_differences++;
+    for (int i = 0; i < 3333; i++)
+        if (read_ints[i] != ints[i])
+            num_differences++;
+    assert("datasets contain different values", num_differences == 0);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    // checksums are written after the blobs
+    file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = parallel_filename;
+    file.checksums = true;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "ints", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "doubles", SBF_DOUBLE, shape_doubles, doubles);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write_parallel(&file, 4);
+    assert("parallel write unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.filename = parallel_filename;
+    file.verify = true;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("no checksums read", file.crcs != NULL);
+    for (sbf_size dset = 0; dset < 2; dset++) {
+        res = sbf_verify_dataset(&file, dset);
+        assert("verifying dataset not successful", res == SBF_RESULT_SUCCESS);
+    }
+    res = sbf_read_dataset_by_name(&file, "doubles", read_doubles);
+    assert("reading dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("data changed", memcmp(read_doubles, doubles, sizeof(doubles)) == 0);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    return 0;
+}
+
+static char *test_compression() {
+    const char *compressed_filename = "/tmp/sbf_test_c_compressed.sbf";
+    enum { n = 300000 };
+    static sbf_double smooth[n], read_smooth[n];
+    sbf_integer ints[100], read_ints[100];
+    for (int i = 0; i < n; i++)
+        smooth[i] = 0.25 * i;
+    for (int i = 0; i < 100; i++)
+        ints[i] = i * 3;
+
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = compressed_filename;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    sbf_size shape_smooth[SBF_MAX_DIM] = {n};
+    sbf_size shape_ints[SBF_MAX_DIM] = {100};
+    res = sbf_add_dataset(&file, "smooth", SBF_DOUBLE, shape_smooth, smooth);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    SBF_SET_COMPRESSED_FLAG(file.datasets[0]);
+    res = sbf_add_dataset(&file, "ints", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_set_filters(&file, 1, SBF_CODEC_LZ, SBF_FILTER_DELTA | SBF_FILTER_SHUFFLE);
+    assert("setting filters unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_set_filters(&file, 2, SBF_CODEC_LZ, SBF_FILTER_DELTA);
+    assert("setting filters of missing dataset succeeded", res != SBF_RESULT_SUCCESS);
+    res = sbf_write(&file);
+    assert("writing compressed file unsuccessful", res == SBF_RESULT_SUCCESS);
+    long file_size = ftell(file.fp);
+    assert("compressed file is not smaller", file_size < (long)(n * sizeof(sbf_double)));
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.mode = SBF_FILE_READONLY;
+    file.filename = compressed_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("compressed flag not set", SBF_CHECK_COMPRESSED_FLAG(file.datasets[0]) &&
+                                      SBF_CHECK_COMPRESSED_FLAG(file.datasets[1]));
+
+    // sequentially
+    res = sbf_read_dataset(&file, file.datasets[0], read_smooth);
+    assert("reading compressed dataset not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset(&file, file.datasets[1], read_ints);
+    assert("reading dataset after compressed dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("compressed dataset changed", memcmp(smooth, read_smooth, sizeof(smooth)) == 0);
+    assert("dataset after compressed dataset changed", memcmp(ints, read_ints, sizeof(ints)) == 0);
+
+    // at random, and in parallel
+    memset(read_smooth, 0, sizeof(read_smooth));
+    memset(read_ints, 0, sizeof(read_ints));
+    res = sbf_read_dataset_by_name(&file, "ints", read_ints);
+    assert("reading dataset by name not successful", res == SBF_RESULT_SUCCESS);
+    assert("dataset after compressed dataset changed", memcmp(ints, read_ints, sizeof(ints)) == 0);
+    void *pointers[2] = {read_smooth, NULL};
+    res = sbf_read_parallel(&file, pointers, 4);
+    assert("parallel read of compressed dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("compressed dataset changed", memcmp(smooth, read_smooth, sizeof(smooth)) == 0);
+
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    return 0;
+}
+
+static char *test_many_datasets() {
+    const char *many_filename = "/tmp/sbf_test_c_many.sbf";
+    // enough that the headers take more than one read, see SBF_HEADER_READ_SIZE
+    enum { n = 1000 };
+    static sbf_long values[n];
+    char name[SBF_NAME_LENGTH];
+    sbf_size shape[SBF_MAX_DIM] = {1};
+
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = many_filename;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    for (int i = 0; i < n; i++) {
+        values[i] = 7 * i;
+        snprintf(name, sizeof(name), "dataset_%d", i);
+        res = sbf_add_dataset(&file, name, SBF_LONG, shape, &values[i]);
+        assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    }
+    res = sbf_write(&file);
+    assert("writing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.filename = many_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("incorrect number of datasets in file", file.n_datasets == n);
+    assert("name index too small", file.n_slots >= 2 * n);
+    assert("missing dataset found", sbf_dataset_index(&file, "dataset_1000") == -1);
+    sbf_long value = 0;
+    res = sbf_read_dataset_by_name(&file, "dataset_999", &value);
+    assert("reading last dataset not successful", res == SBF_RESULT_SUCCESS && value == 7 * 999);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    // only the headers, then the data on demand
+    file = sbf_new_file;
+    file.filename = many_filename;
+    file.headers_only = true;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers only not successful", res == SBF_RESULT_SUCCESS);
+    assert("incorrect number of datasets in file", file.n_datasets == n);
+    assert("incorrect last dataset name",
+           strcmp(file.datasets[n - 1].name, "dataset_999") == 0);
+    res = sbf_read_dataset_by_name(&file, "dataset_999", &value);
+    assert("reading unlocated dataset successful", res == SBF_RESULT_READ_FAILURE);
+    res = sbf_read_dataset(&file, file.datasets[0], &value);
+    assert("reading first dataset in order not successful", res == SBF_RESULT_SUCCESS && value == 0);
+    res = sbf_locate_datasets(&file);
+    assert("locating datasets not successful", res == SBF_RESULT_SUCCESS && !file.headers_only);
+    res = sbf_read_dataset_by_name(&file, "dataset_998", &value);
+    assert("reading located dataset not successful", res == SBF_RESULT_SUCCESS && value == 7 * 998);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    // a file written before 0.3.0, with a single byte dataset count
+    const char *legacy_filename = "/tmp/sbf_test_c_legacy.sbf";
+    FILE *fp = fopen(legacy_filename, "wb");
+    assert("opening legacy file not successful", fp != NULL);
+    sbf_DataHeader header = sbf_new_data_header;
+    strncpy(header.name, "legacy", SBF_NAME_LENGTH);
+    header.data_type = SBF_LONG;
+    header.shape[0] = 1;
+    SBF_SET_DIMENSIONS(header, 1);
+    SBF_SET_BIG_ENDIAN_FLAG(header, SBF_HOST_BIG_ENDIAN);
+    sbf_data_headers_le((sbf_byte *)&header, 1);
+    const sbf_byte n_legacy = 1;
+    fwrite("SBF020", 6, 1, fp);
+    fwrite(&n_legacy, 1, 1, fp);
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(&values[42], sizeof(values[42]), 1, fp);
+    fclose(fp);
+
+    file = sbf_new_file;
+    file.filename = legacy_filename;
+    res = sbf_open(&file);
+    assert("opening legacy file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading legacy headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("incorrect number of datasets in legacy file", file.n_datasets == 1);
+    res = sbf_read_dataset_at(&file, 0, &value);
+    assert("reading legacy dataset not successful", res == SBF_RESULT_SUCCESS && value == 7 * 42);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    return 0;
+}
+
+/*
+ * The little endian integer of 'width' bytes at 'bytes', whatever the
+ * byte order of this machine
+ */
+static uint64_t little_endian(const sbf_byte *bytes, int width) {
+    uint64_t value = 0;
+    for (int i = width - 1; i >= 0; i--)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+static char *test_byte_order() {
+    const char *foreign_filename = "/tmp/sbf_test_c_byte_order.sbf";
+    enum { n = 1000 };
+    static sbf_double doubles[n], foreign_doubles[n], read_doubles[n];
+    static sbf_complex_float complex[n], foreign_complex[n], read_complex[n];
+    for (int i = 0; i < n; i++) {
+        doubles[i] = 1.5 * i;
+        complex[i].re = (sbf_float)i;
+        complex[i].im = -0.5f * i;
+    }
+    // write the data as a machine of the other byte order would, the
+    // headers of which are little endian on disk either way
+    memcpy(foreign_doubles, doubles, sizeof(doubles));
+    memcpy(foreign_complex, complex, sizeof(complex));
+    sbf_byteswap(foreign_doubles, sizeof(foreign_doubles), sizeof(sbf_double));
+    sbf_byteswap(foreign_complex, sizeof(foreign_complex), sizeof(sbf_float));
+
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = foreign_filename;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    sbf_size shape_doubles[SBF_MAX_DIM] = {40, 25};
+    sbf_size shape_complex[SBF_MAX_DIM] = {n};
+    res = sbf_add_dataset(&file, "doubles", SBF_DOUBLE, shape_doubles, foreign_doubles);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "complex", SBF_CFLOAT, shape_complex, foreign_complex);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "compressed", SBF_DOUBLE, shape_doubles, foreign_doubles);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    SBF_SET_COMPRESSED_FLAG(file.datasets[2]);
+    for (int i = 0; i < 3; i++) {
+        assert("new dataset not in native byte order", sbf_is_native_endian(file.datasets[i]));
+        file.datasets[i].flags ^= SBF_BIG_ENDIAN;
+    }
+    res = sbf_write(&file);
+    assert("writing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.filename = foreign_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("dataset in native byte order", !sbf_is_native_endian(file.datasets[0]));
+    assert("wrong shape read", file.datasets[0].shape[0] == 40 && file.datasets[0].shape[1] == 25);
+
+    // every integer of the headers, and the chunk index, is stored little endian
+    static sbf_byte stored[64 * 1024];
+    FILE *fp = fopen(foreign_filename, "rb");
+    assert("opening file not successful", fp != NULL);
+    const size_t length = fread(stored, 1, sizeof(stored), fp);
+    fclose(fp);
+    const sbf_byte *data_header = stored + SBF_FILE_HEADER_SIZE;
+    const sbf_byte *name_index = data_header + 3 * sizeof(sbf_DataHeader);
+    const sbf_byte *chunk_index = stored + sbf_data_offset(&file, 2);
+    assert("reading whole file not successful", length > 0 && length < sizeof(stored));
+    assert("dataset count not little endian", little_endian(stored + 6, 8) == 3);
+    assert("alignment not little endian", little_endian(stored + 14, 8) == 1);
+    assert("shape not little endian",
+           little_endian(data_header + offsetof(sbf_DataHeader, shape), 8) == 40 &&
+           little_endian(data_header + offsetof(sbf_DataHeader, shape) + 8, 8) == 25);
+    assert("name index size not little endian", little_endian(name_index, 8) == file.n_slots);
+    for (sbf_size slot = 0; slot < file.n_slots; slot++) {
+        const sbf_byte *stored_slot = name_index + 8 + slot * sizeof(sbf_NameSlot);
+        assert("name slot not little endian",
+               little_endian(stored_slot, 4) == file.name_index[slot].hash &&
+               little_endian(stored_slot + 4, 4) == file.name_index[slot].index);
+    }
+    assert("chunk index not little endian",
+           little_endian(chunk_index + offsetof(sbf_ChunkIndexHeader, chunk_size), 8) ==
+               SBF_COMPRESSION_CHUNK_SIZE);
+
+    res = sbf_read_dataset(&file, file.datasets[0], read_doubles);
+    assert("reading dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("doubles not swapped", memcmp(doubles, read_doubles, sizeof(doubles)) == 0);
+    res = sbf_read_dataset(&file, file.datasets[1], read_complex);
+    assert("reading dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("complex numbers not swapped", memcmp(complex, read_complex, sizeof(complex)) == 0);
+    memset(read_doubles, 0, sizeof(read_doubles));
+    res = sbf_read_dataset_by_name(&file, "compressed", read_doubles);
+    assert("reading compressed dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("compressed doubles not swapped", memcmp(doubles, read_doubles, sizeof(doubles)) == 0);
+
+    sbf_size start[SBF_MAX_DIM] = {3, 2}, count[SBF_MAX_DIM] = {4, 5};
+    res = sbf_read_hyperslab(&file, 0, start, count, NULL, read_doubles);
+    assert("reading hyperslab not successful", res == SBF_RESULT_SUCCESS);
+    assert("hyperslab not swapped", read_doubles[0] == doubles[3 * 25 + 2] &&
+                                    read_doubles[19] == doubles[6 * 25 + 6]);
+
+    memset(read_doubles, 0, sizeof(read_doubles));
+    memset(read_complex, 0, sizeof(read_complex));
+    void *pointers[3] = {read_doubles, read_complex, NULL};
+    res = sbf_read_parallel(&file, pointers, 2);
+    assert("parallel read unsuccessful", res == SBF_RESULT_SUCCESS);
+    assert("parallel read not swapped", memcmp(doubles, read_doubles, sizeof(doubles)) == 0 &&
+                                        memcmp(complex, read_complex, sizeof(complex)) == 0);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    return 0;
+}
+
+static char *test_aligned() {
+    const char *aligned_filename = "/tmp/sbf_test_c_aligned.sbf";
+    enum { n_doubles = 10000, n_ints = 3333 };
+    // one buffer as O_DIRECT wants it, one deliberately not
+    sbf_double *doubles = sbf_aligned_alloc(n_doubles * sizeof(sbf_double));
+    sbf_byte *unaligned = malloc(n_ints * sizeof(sbf_integer) + 1);
+    sbf_integer *ints = (sbf_integer *)(unaligned + 1);
+    static sbf_double read_doubles[n_doubles];
+    static sbf_integer read_ints[n_ints];
+    assert("allocating buffers unsuccessful", doubles != NULL && unaligned != NULL);
+    for (int i = 0; i < n_doubles; i++)
+        doubles[i] = 0.5 * i;
+    for (int i = 0; i < n_ints; i++)
+        ints[i] = 3 * i - 1;
+
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = aligned_filename;
+    file.direct_io = true;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    sbf_size shape_ints[SBF_MAX_DIM] = {n_ints};
+    sbf_size shape_doubles[SBF_MAX_DIM] = {100, 100};
+    res = sbf_add_dataset(&file, "ints", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "doubles", SBF_DOUBLE, shape_doubles, doubles);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_set_alignment(&file, 3000);
+    assert("setting an invalid alignment succeeded", res != SBF_RESULT_SUCCESS);
+    res = sbf_set_alignment(&file, SBF_DIRECT_ALIGNMENT);
+    assert("setting alignment unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write(&file);
+    assert("writing aligned file unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    // sequentially, at random and in parallel, with and without O_DIRECT
+    for (int direct = 0; direct < 2; direct++) {
+        file = sbf_new_file;
+        file.filename = aligned_filename;
+        file.direct_io = direct;
+        res = sbf_open(&file);
+        assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+        res = sbf_read_headers(&file);
+        assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+        assert("alignment not read", file.alignment == SBF_DIRECT_ALIGNMENT);
+        assert("dataset not aligned", sbf_data_offset(&file, 0) % SBF_DIRECT_ALIGNMENT == 0 &&
+                                      sbf_data_offset(&file, 1) % SBF_DIRECT_ALIGNMENT == 0);
+        res = sbf_read_dataset(&file, file.datasets[0], read_ints);
+        assert("reading dataset in order not successful", res == SBF_RESULT_SUCCESS);
+        res = sbf_read_dataset(&file, file.datasets[1], read_doubles);
+        assert("reading dataset in order not successful", res == SBF_RESULT_SUCCESS);
+        assert("aligned datasets changed",
+               memcmp(ints, read_ints, sizeof(read_ints)) == 0 &&
+               memcmp(doubles, read_doubles, sizeof(read_doubles)) == 0);
+        memset(read_doubles, 0, sizeof(read_doubles));
+        res = sbf_read_dataset_by_name(&file, "doubles", read_doubles);
+        assert("reading dataset by name not successful", res == SBF_RESULT_SUCCESS);
+        assert("aligned dataset changed", memcmp(doubles, read_doubles, sizeof(read_doubles)) == 0);
+        memset(read_ints, 0, sizeof(read_ints));
+        void *pointers[2] = {read_ints, NULL};
+        res = sbf_read_parallel(&file, pointers, 2);
+        assert("parallel read not successful", res == SBF_RESULT_SUCCESS);
+        assert("aligned dataset changed", memcmp(ints, read_ints, sizeof(read_ints)) == 0);
+        res = sbf_close(&file);
+        assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    }
+    sbf_aligned_free(doubles);
+    free(unaligned);
+    return 0;
+}
+
+static char *test_async() {
+    const char *async_filename = "/tmp/sbf_test_c_async.sbf";
+    enum { n = 100000, n_datasets = 8 };
+    static sbf_double values[n_datasets][n], read_values[n_datasets][n];
+    const int backends[] = {SBF_IO_THREADS, SBF_IO_AUTO};
+    char name[SBF_NAME_LENGTH];
+    sbf_size shape[SBF_MAX_DIM] = {n};
+    for (int d = 0; d < n_datasets; d++)
+        for (int i = 0; i < n; i++)
+            values[d][i] = d + 0.5 * i;
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        sbf_IOQueue queue;
+        sbf_IORequest requests[n_datasets];
+        int res = sbf_io_queue_init(&queue, backends[b], 4, 2);
+        assert("starting I/O queue unsuccessful", res == 0);
+
+        sbf_File file = sbf_new_file;
+        file.mode = SBF_FILE_WRITEONLY;
+        file.filename = async_filename;
+        sbf_result result = sbf_open(&file);
+        assert("opening file not successful", result == SBF_RESULT_SUCCESS);
+        for (int d = 0; d < n_datasets; d++) {
+            snprintf(name, sizeof(name), "dataset_%d", d);
+            result = sbf_add_dataset(&file, name, SBF_DOUBLE, shape, values[d]);
+            assert("adding dataset unsuccessful", result == SBF_RESULT_SUCCESS);
+        }
+        result = sbf_write_headers(&file);
+        assert("writing headers unsuccessful", result == SBF_RESULT_SUCCESS);
+        // more requests than the queue is deep
+        for (int d = 0; d < n_datasets; d++) {
+            result = sbf_async_write_dataset(&file, &queue, d, values[d], &requests[d]);
+            assert("submitting write unsuccessful", result == SBF_RESULT_SUCCESS);
+        }
+        for (int d = 0; d < n_datasets; d++) {
+            result = sbf_async_wait(&queue, &requests[d]);
+            assert("asynchronous write unsuccessful", result == SBF_RESULT_SUCCESS);
+            assert("finished write still pending", sbf_async_poll(&queue, &requests[d]));
+        }
+        result = sbf_close(&file);
+        assert("closing file unsuccessful", result == SBF_RESULT_SUCCESS);
+
+        file = sbf_new_file;
+        file.filename = async_filename;
+        result = sbf_open(&file);
+        assert("opening file not successful", result == SBF_RESULT_SUCCESS);
+        result = sbf_read_headers(&file);
+        assert("reading headers not successful", result == SBF_RESULT_SUCCESS);
+        memset(read_values, 0, sizeof(read_values));
+        for (int d = n_datasets - 1; d >= 0; d--) {
+            result = sbf_async_read_dataset(&file, &queue, d, read_values[d], &requests[d]);
+            assert("submitting read unsuccessful", result == SBF_RESULT_SUCCESS);
+        }
+        for (int d = 0; d < n_datasets; d++) {
+            while (!sbf_async_poll(&queue, &requests[d])) {
+            }
+            result = sbf_async_wait(&queue, &requests[d]);
+            assert("asynchronous read unsuccessful", result == SBF_RESULT_SUCCESS);
+        }
+        assert("datasets contain different values",
+               memcmp(values, read_values, sizeof(values)) == 0);
+        // past the end of the file
+        file.datasets[n_datasets - 1].shape[0] = 2 * n;
+        static sbf_double too_long[2 * n];
+        result = sbf_async_read_dataset(&file, &queue, n_datasets - 1, too_long, &requests[0]);
+        if (result == SBF_RESULT_SUCCESS)
+            result = sbf_async_wait(&queue, &requests[0]);
+        assert("reading past the end of the file succeeded", result == SBF_RESULT_READ_FAILURE);
+        result = sbf_close(&file);
+        assert("closing file unsuccessful", result == SBF_RESULT_SUCCESS);
+        sbf_io_queue_destroy(&queue);
+    }
+    return 0;
+}
+
+static char *test_checkpoint() {
+    const char *reference_filename = "/tmp/sbf_test_c_checkpoint_reference.sbf";
+    const char *checkpoint_filename = "/tmp/sbf_test_c_checkpoint.sbf";
+    const char *spare_filename = "/tmp/sbf_test_c_checkpoint.sbf.spare";
+    enum { n = 1000 };
+    static sbf_double positions[n];
+    static sbf_integer ids[n / 4 + 1];
+    static sbf_byte buffer[2][n * sizeof(sbf_double) + 4096];
+    for (int i = 0; i < n; i++)
+        positions[i] = 0.25 * i;
+    for (int i = 0; i < n / 4 + 1; i++)
+        ids[i] = i;
+
+    // the layout is written once as usual, for reference
+    sbf_File layout = sbf_new_file;
+    layout.mode = SBF_FILE_WRITEONLY;
+    layout.filename = reference_filename;
+    sbf_size shape_positions[SBF_MAX_DIM] = {n / 2, 2};
+    sbf_size shape_ids[SBF_MAX_DIM] = {n / 4 + 1};
+    sbf_result res = sbf_add_dataset(&layout, "ids", SBF_INT, shape_ids, ids);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&layout, "positions", SBF_DOUBLE, shape_positions, positions);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_set_alignment(&layout, 64);
+    assert("setting alignment unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_open(&layout);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write(&layout);
+    assert("writing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    // the checkpoint keeps what it needs of the layout
+    sbf_Checkpoint checkpoint;
+    res = sbf_checkpoint_init(&checkpoint, &layout);
+    assert("laying out checkpoint unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&layout);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_checkpoint_write(&checkpoint, checkpoint_filename);
+    assert("writing checkpoint unsuccessful", res == SBF_RESULT_SUCCESS);
+    FILE *reference = fopen(reference_filename, "rb");
+    FILE *written = fopen(checkpoint_filename, "rb");
+    size_t reference_size = fread(buffer[0], 1, sizeof(buffer[0]), reference);
+    size_t written_size = fread(buffer[1], 1, sizeof(buffer[1]), written);
+    fclose(reference);
+    fclose(written);
+    assert("checkpoint differs from sbf_write",
+           reference_size == written_size && memcmp(buffer[0], buffer[1], written_size) == 0);
+
+    // each step is swapped in, leaving the one before it in the spare
+    remove(checkpoint_filename);
+    remove(spare_filename);
+    for (int step = 1; step <= 3; step++) {
+        for (int i = 0; i < n; i++)
+            positions[i] += 1.0;
+        res = sbf_checkpoint_swap(&checkpoint, checkpoint_filename, spare_filename);
+        assert("swapping in checkpoint unsuccessful", res == SBF_RESULT_SUCCESS);
+
+        sbf_File file = sbf_new_file;
+        file.filename = checkpoint_filename;
+        res = sbf_open(&file);
+        assert("opening checkpoint not successful", res == SBF_RESULT_SUCCESS);
+        res = sbf_read_headers(&file);
+        assert("reading checkpoint headers not successful", res == SBF_RESULT_SUCCESS);
+        static sbf_double read_positions[n];
+        res = sbf_read_dataset_by_name(&file, "positions", read_positions);
+        assert("reading checkpoint not successful", res == SBF_RESULT_SUCCESS);
+        assert("checkpoint is not the latest step",
+               memcmp(positions, read_positions, sizeof(positions)) == 0);
+        sbf_close(&file);
+    }
+
+    // datasets without data are left out
+    res = sbf_checkpoint_set_data(&checkpoint, 1, NULL);
+    assert("setting checkpoint data unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_checkpoint_set_data(&checkpoint, 2, positions);
+    assert("setting data of a missing dataset succeeded", res != SBF_RESULT_SUCCESS);
+    res = sbf_checkpoint_write(&checkpoint, checkpoint_filename);
+    assert("writing checkpoint unsuccessful", res == SBF_RESULT_SUCCESS);
+    sbf_File file = sbf_new_file;
+    file.filename = checkpoint_filename;
+    res = sbf_open(&file);
+    assert("opening checkpoint not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading checkpoint headers not successful", res == SBF_RESULT_SUCCESS);
+    static sbf_integer read_ids[n / 4 + 1];
+    static sbf_double read_positions[n];
+    res = sbf_read_dataset_by_name(&file, "ids", read_ids);
+    assert("reading checkpoint not successful", res == SBF_RESULT_SUCCESS);
+    assert("checkpoint dataset changed", memcmp(ids, read_ids, sizeof(ids)) == 0);
+    res = sbf_read_dataset_by_name(&file, "positions", read_positions);
+    assert("reading hole not successful", res == SBF_RESULT_SUCCESS && read_positions[n - 1] == 0.0);
+    sbf_close(&file);
+
+    sbf_checkpoint_free(&checkpoint);
+    return 0;
+}
+
+static char *test_frames() {
+    const char *frames_filename = "/tmp/sbf_test_c_frames.sbf";
+    enum { n = 300, n_frames = 5 };
+    static sbf_double positions[n_frames][n];
+    static sbf_integer steps[n_frames];
+    for (int frame = 0; frame < n_frames; frame++) {
+        steps[frame] = 10 * frame;
+        for (int i = 0; i < n; i++)
+            positions[frame][i] = frame + 0.5 * i;
+    }
+
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = frames_filename;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    sbf_size shape_step[SBF_MAX_DIM] = {1};
+    sbf_size shape_positions[SBF_MAX_DIM] = {n / 3, 3};
+    res = sbf_declare_dataset(&file, "step", SBF_INT, shape_step);
+    assert("declaring dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_declare_dataset(&file, "positions", SBF_DOUBLE, shape_positions);
+    assert("declaring dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_set_alignment(&file, 64);
+    assert("setting alignment unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_write_headers(&file);
+    assert("writing headers unsuccessful", res == SBF_RESULT_SUCCESS);
+    for (int frame = 0; frame < n_frames; frame++) {
+        void *data[2] = {&steps[frame], positions[frame]};
+        res = sbf_append_frame(&file, data);
+        assert("appending frame unsuccessful", res == SBF_RESULT_SUCCESS);
+        // the index may be written as often as wanted, later frames overwrite it
+        if (frame == 1) {
+            res = sbf_write_frame_index(&file);
+            assert("writing frame index unsuccessful", res == SBF_RESULT_SUCCESS);
+        }
+    }
+    res = sbf_write_frame_index(&file);
+    assert("writing frame index unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.filename = frames_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("wrong number of frames", file.n_frames == n_frames);
+    static sbf_double read_positions[n];
+    sbf_integer read_step = -1;
+    for (int frame = n_frames - 1; frame >= 0; frame--) {
+        assert("frame not aligned", sbf_frame_offset(&file, frame, 1) % 64 == 0);
+        res = sbf_read_frame_dataset(&file, frame, 0, &read_step);
+        assert("reading frame not successful", res == SBF_RESULT_SUCCESS);
+        res = sbf_read_frame_dataset(&file, frame, 1, read_positions);
+        assert("reading frame not successful", res == SBF_RESULT_SUCCESS);
+        assert("frame changed", read_step == steps[frame] &&
+               memcmp(read_positions, positions[frame], sizeof(read_positions)) == 0);
+    }
+    res = sbf_read_frame_dataset(&file, n_frames, 0, &read_step);
+    assert("reading a missing frame succeeded", res != SBF_RESULT_SUCCESS);
+    // to anything unaware of frames, it is frame 0
+    res = sbf_read_dataset(&file, file.datasets[0], &read_step);
+    assert("reading dataset in order not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset(&file, file.datasets[1], read_positions);
+    assert("reading dataset in order not successful", res == SBF_RESULT_SUCCESS);
+    assert("frame 0 changed", read_step == steps[0] &&
+           memcmp(read_positions, positions[0], sizeof(read_positions)) == 0);
+    sbf_close(&file);
+    return 0;
+}
+
+static char *test_integrity() {
+    const char *integrity_filename = "/tmp/sbf_test_c_integrity.sbf";
+    enum { n = 100000 };
+    static sbf_double smooth[n], read_smooth[n];
+    sbf_integer ints[100], read_ints[100];
+    for (int i = 0; i < n; i++)
+        smooth[i] = 0.5 * i;
+    for (int i = 0; i < 100; i++)
+        ints[i] = 7 * i;
+    remove(integrity_filename);
+
+    // the file only appears, complete and with checksums, once closed
+    sbf_File file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = integrity_filename;
+    file.atomic = true;
+    file.checksums = true;
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    sbf_size shape_ints[SBF_MAX_DIM] = {100};
+    sbf_size shape_smooth[SBF_MAX_DIM] = {n};
+    res = sbf_add_dataset(&file, "ints", SBF_INT, shape_ints, ints);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    res = sbf_add_dataset(&file, "smooth", SBF_DOUBLE, shape_smooth, smooth);
+    assert("adding dataset unsuccessful", res == SBF_RESULT_SUCCESS);
+    SBF_SET_COMPRESSED_FLAG(file.datasets[1]);
+    res = sbf_write(&file);
+    assert("writing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    FILE *fp = fopen(integrity_filename, "rb");
+    assert("file visible before it was committed", fp == NULL);
+    res = sbf_close(&file);
+    assert("closing file unsuccessful", res == SBF_RESULT_SUCCESS);
+    fp = fopen(integrity_filename, "rb");
+    assert("file not committed", fp != NULL);
+    fclose(fp);
+
+    // a discarded file leaves the committed one alone
+    file = sbf_new_file;
+    file.mode = SBF_FILE_WRITEONLY;
+    file.filename = integrity_filename;
+    file.atomic = true;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    fputs("not an sbf file", file.fp);
+    res = sbf_discard(&file);
+    assert("discarding file unsuccessful", res == SBF_RESULT_SUCCESS);
+
+    file = sbf_new_file;
+    file.filename = integrity_filename;
+    file.verify = true;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("no checksums read", file.crcs != NULL);
+    res = sbf_verify_dataset(&file, 1);
+    assert("verifying dataset not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset(&file, file.datasets[0], read_ints);
+    assert("reading dataset not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset(&file, file.datasets[1], read_smooth);
+    assert("reading dataset not successful", res == SBF_RESULT_SUCCESS);
+    assert("data changed", memcmp(read_ints, ints, sizeof(ints)) == 0 &&
+           memcmp(read_smooth, smooth, sizeof(smooth)) == 0);
+    const sbf_size offsets[2] = {sbf_data_offset(&file, 0), sbf_data_offset(&file, 1)};
+    sbf_close(&file);
+
+    // flip a bit in each blob
+    fp = fopen(integrity_filename, "r+b");
+    assert("opening file not successful", fp != NULL);
+    for (int dset = 0; dset < 2; dset++) {
+        sbf_byte byte = 0;
+        long at = (long)offsets[dset] + 200;
+        fseek(fp, at, SEEK_SET);
+        assert("reading byte not successful", fread(&byte, 1, 1, fp) == 1);
+        byte ^= 0x10;
+        fseek(fp, at, SEEK_SET);
+        assert("writing byte not successful", fwrite(&byte, 1, 1, fp) == 1);
+    }
+    fclose(fp);
+
+    file = sbf_new_file;
+    file.filename = integrity_filename;
+    file.verify = true;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset_by_name(&file, "ints", read_ints);
+    assert("corrupt dataset passed", res == SBF_RESULT_CHECKSUM_FAILURE);
+    res = sbf_read_dataset_by_name(&file, "smooth", read_smooth);
+    assert("corrupt compressed dataset passed", res == SBF_RESULT_CHECKSUM_FAILURE);
+    sbf_close(&file);
+    // without 'verify' nothing is checked
+    file = sbf_new_file;
+    file.filename = integrity_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_dataset_by_name(&file, "ints", read_ints);
+    assert("reading dataset not successful", res == SBF_RESULT_SUCCESS);
+    sbf_close(&file);
+
+#ifdef SBF_POSIX
+    // a file cut short, as by a killed writer, is rejected
+    assert("truncating file not successful", truncate(integrity_filename, (off_t)offsets[1]) == 0);
+    file = sbf_new_file;
+    file.filename = integrity_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("truncated file read", res == SBF_RESULT_READ_FAILURE);
+    sbf_close(&file);
+#endif
+    return 0;
+}
+
+static char *test_arena() {
+    sbf_File file = sbf_new_file;
+    sbf_Arena arena = sbf_new_arena;
+    void *data[2] = {NULL, NULL};
+    // the file written by test_compression, then the smaller one by test_write
+    file.filename = "/tmp/sbf_test_c_compressed.sbf";
+    sbf_result res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    assert("arena size not from the headers",
+           sbf_datasets_arena_size(&file) == 300000 * sizeof(sbf_double) + 448);
+    res = sbf_read_datasets_into(&file, &arena, data);
+    assert("reading datasets into arena not successful", res == SBF_RESULT_SUCCESS);
+    sbf_close(&file);
+    assert("dataset not in arena", (uint8_t *)data[0] == arena.base);
+    assert("arena piece not aligned", (uintptr_t)data[1] % SBF_ARENA_ALIGNMENT == 0);
+    assert("compressed dataset read wrongly", ((sbf_double *)data[0])[299999] == 0.25 * 299999);
+    assert("dataset read wrongly", ((sbf_integer *)data[1])[99] == 99 * 3);
+
+    const uint8_t *base = arena.base;
+    file = sbf_new_file;
+    file.filename = test_filename;
+    res = sbf_open(&file);
+    assert("opening file not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_headers(&file);
+    assert("reading headers not successful", res == SBF_RESULT_SUCCESS);
+    res = sbf_read_datasets_into(&file, &arena, data);
+    assert("reading datasets into arena not successful", res == SBF_RESULT_SUCCESS);
+    sbf_close(&file);
+    assert("arena reallocated for a smaller file", arena.base == base && data[0] == base);
+    assert("dataset read wrongly", ((sbf_integer *)data[0])[999] == 999 * 999);
+    assert("allocating more than reserved succeeded",
+           sbf_arena_alloc(&arena, arena.capacity) == NULL);
+    sbf_arena_free(&arena);
+    assert("freed arena not empty", arena.base == NULL && arena.capacity == 0);
+    return 0;
+}
+
 static char *all_tests() {
     run_unit_test(test_write);
     run_unit_test(test_read);
+    run_unit_test(test_stream);
+    run_unit_test(test_parallel);
+    run_unit_test(test_compression);
+    run_unit_test(test_many_datasets);
+    run_unit_test(test_byte_order);
+    run_unit_test(test_aligned);
+    run_unit_test(test_async);
+    run_unit_test(test_checkpoint);
+    run_unit_test(test_frames);
+    run_unit_test(test_integrity);
+    run_unit_test(test_arena);
     return 0;
 }
 
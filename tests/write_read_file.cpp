@@ -1,6 +1,7 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "sbf.hpp"
+#include <cmath>
 std::string test_filename = "/tmp/sbf_test_cpp.sbf";
 
 TEST_CASE("Open and close files", "[io, headers]") {
@@ -68,7 +69,750 @@ TEST_CASE("Read from file", "[io, headers]") {
     for (int i = 0; i < 1000; i++) {
         REQUIRE(ints[i] == - i * i);
     }
+    sbf::sbf_integer parallel_ints[1000] = {0};
+    file.set_io_threads(4);
+    REQUIRE(file.io_threads() == 4);
+    REQUIRE(file.read_data<sbf::sbf_integer>("integer_dataset", parallel_ints) == sbf::success);
+    for (int i = 0; i < 1000; i++) {
+        REQUIRE(parallel_ints[i] == i * i);
+    }
     REQUIRE(file.close() == sbf::success);
     sbf::File file_fail("does not exist");
     REQUIRE(file_fail.status() == sbf::File::Status::FailedOpening);
 }
+
+TEST_CASE("Memory mapped view", "[io, mmap]") {
+    std::string view_filename = "/tmp/sbf_test_cpp_view.sbf";
+    {
+        // the blobs of test_filename are packed after the headers, which
+        // leaves them unaligned for sbf_integer
+        sbf::File packed(test_filename);
+        REQUIRE(packed.map() == sbf::success);
+        REQUIRE(packed.view<sbf::sbf_integer>("integer_dataset_negative").empty());
+
+        sbf::File file(view_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        REQUIRE(file.set_alignment(alignof(sbf::sbf_integer)) == sbf::success);
+        sbf::sbf_dimensions shape{{1000}};
+        sbf::Dataset dset1("integer_dataset", shape, sbf::SBF_INT);
+        sbf::Dataset dset2("integer_dataset_negative", shape, sbf::SBF_INT);
+        REQUIRE(file.add_dataset(dset1) == sbf::success);
+        REQUIRE(file.add_dataset(dset2) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        std::vector<sbf::sbf_integer> ints(1000);
+        REQUIRE(packed.read_data("integer_dataset", ints.data()) == sbf::success);
+        REQUIRE(file.write_data("integer_dataset", ints.data()) == sbf::success);
+        REQUIRE(packed.read_data("integer_dataset_negative", ints.data()) == sbf::success);
+        REQUIRE(file.write_data("integer_dataset_negative", ints.data()) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    sbf::File file(view_filename);
+    REQUIRE(file.map() == sbf::success);
+    REQUIRE(file.is_mapped());
+    auto ints = file.view<sbf::sbf_integer>("integer_dataset_negative");
+    REQUIRE(ints.size() == 1000);
+    REQUIRE(ints.dimensions() == 1);
+    for (int i = 0; i < 1000; i++) {
+        REQUIRE(ints[i] == - i * i);
+        REQUIRE(ints(i) == - i * i);
+    }
+    REQUIRE(file.view<sbf::sbf_double>("integer_dataset").empty());
+    REQUIRE(file.view<sbf::sbf_integer>("does not exist").empty());
+    REQUIRE(file.close() == sbf::success);
+    // view remains valid until the file is unmapped
+    REQUIRE(ints[10] == -100);
+    REQUIRE(file.unmap() == sbf::success);
+    REQUIRE(!file.is_mapped());
+}
+
+TEST_CASE("Stream to file in chunks", "[io, stream]") {
+    using namespace sbf;
+    std::string stream_filename = "/tmp/sbf_test_cpp_stream.sbf";
+    {
+        File file(stream_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        sbf_dimensions shape{{1, 3}};
+        Dataset frames("frames", shape, SBF_DOUBLE);
+        REQUIRE(file.add_dataset(frames) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        for (int chunk = 0; chunk < 5; chunk++) {
+            sbf_double data[6];
+            for (int i = 0; i < 6; i++) data[i] = chunk * 6 + i;
+            REQUIRE(file.write_chunk("frames", data, 2) == sbf::success);
+        }
+        REQUIRE(file.finish_dataset("frames") == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(stream_filename);
+    auto dset = file.get_dataset("frames");
+    REQUIRE(dset.get_shape()[0] == 10);
+    REQUIRE(dset.get_shape()[1] == 3);
+    sbf_double data[30];
+    REQUIRE(file.read_data("frames", data) == sbf::success);
+    for (int i = 0; i < 30; i++) {
+        REQUIRE(data[i] == i);
+    }
+}
+
+TEST_CASE("Hyperslab reads", "[io, hyperslab]") {
+    using namespace sbf;
+    std::string slab_filename = "/tmp/sbf_test_cpp_hyperslab.sbf";
+    // element (i, j) = 10 * i + j, stored in both orders
+    sbf_integer row_major[12], col_major[12];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            row_major[i * 4 + j] = 10 * i + j;
+            col_major[i + 3 * j] = 10 * i + j;
+        }
+    }
+    {
+        File file(slab_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        sbf_dimensions shape{{3, 4}};
+        Dataset rows("rows", shape, SBF_INT);
+        Dataset cols("cols", shape, SBF_INT, flags::default_flags | flags::column_major);
+        REQUIRE(file.add_dataset(rows) == sbf::success);
+        REQUIRE(file.add_dataset(cols) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        REQUIRE(file.write_data("rows", row_major) == sbf::success);
+        REQUIRE(file.write_data("cols", col_major) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(slab_filename);
+    sbf_dimensions start{{1, 1}}, count{{2, 2}};
+    sbf_integer slab[4];
+    REQUIRE(file.read_hyperslab("rows", start, count, slab) == sbf::success);
+    REQUIRE(slab[0] == 11); REQUIRE(slab[1] == 12);
+    REQUIRE(slab[2] == 21); REQUIRE(slab[3] == 22);
+    REQUIRE(file.read_hyperslab("cols", start, count, slab) == sbf::success);
+    REQUIRE(slab[0] == 11); REQUIRE(slab[1] == 21);
+    REQUIRE(slab[2] == 12); REQUIRE(slab[3] == 22);
+
+    sbf_dimensions stride{{2, 3}};
+    REQUIRE(file.read_hyperslab("rows", sbf_dimensions{{0, 0}}, count, stride, slab) == sbf::success);
+    REQUIRE(slab[0] == 0); REQUIRE(slab[1] == 3);
+    REQUIRE(slab[2] == 20); REQUIRE(slab[3] == 23);
+    REQUIRE(file.read_hyperslab("rows", start, sbf_dimensions{{3, 1}}, slab) == sbf::read_failure);
+}
+
+TEST_CASE("Compressed datasets", "[io, compression]") {
+    using namespace sbf;
+    std::string compressed_filename = "/tmp/sbf_test_cpp_compressed.sbf";
+    const std::size_t n = 300000;
+    std::vector<sbf_double> smooth(n);
+    for (std::size_t i = 0; i < n; i++) smooth[i] = std::sin(1e-4 * i);
+    sbf_integer ints[100];
+    for (int i = 0; i < 100; i++) ints[i] = i * 3;
+    {
+        File file(compressed_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        Dataset dset_smooth("smooth", sbf_dimensions{{n}}, SBF_DOUBLE,
+                            flags::default_flags | flags::compressed);
+        Dataset dset_ints("ints", sbf_dimensions{{100}}, SBF_INT);
+        REQUIRE(file.add_dataset(dset_smooth) == sbf::success);
+        REQUIRE(file.add_dataset(dset_ints) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        // the offset of 'ints' depends on how well 'smooth' compresses
+        REQUIRE(file.write_data("ints", ints) == sbf::write_failure);
+        REQUIRE(file.write_data("smooth", smooth.data()) == sbf::success);
+        REQUIRE(file.write_data("ints", ints) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(compressed_filename);
+    REQUIRE(file.get_dataset("smooth").is_compressed());
+    std::vector<sbf_double> read_smooth(n);
+    sbf_integer read_ints[100];
+    REQUIRE(file.read_data("ints", read_ints) == sbf::success);
+    REQUIRE(std::equal(ints, ints + 100, read_ints));
+    file.set_io_threads(3);
+    REQUIRE(file.read_data("smooth", read_smooth.data()) == sbf::success);
+    REQUIRE(read_smooth == smooth);
+    REQUIRE(file.map() == sbf::success);
+    REQUIRE(file.view<sbf_double>("smooth").empty());
+    REQUIRE(file.view<sbf_integer>("ints")[99] == 297);
+
+    // 'ints' is only located, by reading the chunk index of 'smooth', once read
+    File lazy(compressed_filename, sbf::reading, true, stream_io, true);
+    REQUIRE(lazy.status() == File::Open);
+    REQUIRE(lazy.headers_only());
+    REQUIRE(lazy.get_dataset("ints").get_dimensions() == 1);
+    REQUIRE(lazy.read_data("ints", read_ints) == sbf::success);
+    REQUIRE(!lazy.headers_only());
+    REQUIRE(std::equal(ints, ints + 100, read_ints));
+}
+
+TEST_CASE("Filtered datasets", "[io, compression]") {
+    using namespace sbf;
+    std::string filtered_filename = "/tmp/sbf_test_cpp_filtered.sbf";
+    const std::size_t n = 1000;
+    std::vector<sbf_double> smooth(n);
+    for (std::size_t i = 0; i < n; i++) smooth[i] = std::cos(1e-3 * i);
+    {
+        File file(filtered_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        Dataset dset("smooth", sbf_dimensions{{n}}, SBF_DOUBLE);
+        dset.set_filters(filters::delta | filters::shuffle, codecs::none);
+        REQUIRE(dset.is_compressed());
+        REQUIRE(file.add_dataset(dset) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        REQUIRE(file.write_data("smooth", smooth.data()) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(filtered_filename);
+    const Dataset &dset = file.get_dataset("smooth");
+    REQUIRE(dset.get_codec() == codecs::none);
+    REQUIRE(dset.get_filters() == (filters::delta | filters::shuffle));
+    std::vector<sbf_double> read_smooth(n);
+    REQUIRE(file.read_data("smooth", read_smooth.data()) == sbf::success);
+    REQUIRE(read_smooth == smooth);
+}
+
+TEST_CASE("More datasets than fit in the old header", "[io]") {
+    using namespace sbf;
+    std::string many_filename = "/tmp/sbf_test_cpp_many.sbf";
+    // enough that the headers take more than one read, see limits::header_read_size
+    const int n = 1000;
+    std::vector<sbf_integer> values(n);
+    {
+        File file(many_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        for (int i = 0; i < n; i++) {
+            values[i] = 5 * i;
+            Dataset dset("dataset_" + std::to_string(i), sbf_dimensions{{1}}, SBF_INT);
+            REQUIRE(file.add_dataset(dset) == sbf::success);
+        }
+        REQUIRE(file.write_headers() == sbf::success);
+        for (int i = 0; i < n; i++) {
+            REQUIRE(file.write_data("dataset_" + std::to_string(i), &values[i]) == sbf::success);
+        }
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(many_filename);
+    REQUIRE(file.n_datasets() == n);
+    REQUIRE(file.find_dataset("dataset_0") == 0);
+    REQUIRE(file.find_dataset("dataset_2") == 2);
+    REQUIRE(file.find_dataset("dataset_1000") == -1);
+    sbf_integer value = 0;
+    REQUIRE(file.read_data("dataset_999", &value) == sbf::success);
+    REQUIRE(value == 5 * 999);
+
+    File direct(many_filename, sbf::reading, true, direct_io, true);
+    REQUIRE(direct.n_datasets() == n);
+    REQUIRE(direct.read_data("dataset_998", &value) == sbf::success);
+    REQUIRE(value == 5 * 998);
+}
+
+TEST_CASE("Data in the other byte order", "[io, endianness]") {
+    using namespace sbf;
+    std::string foreign_filename = "/tmp/sbf_test_cpp_byte_order.sbf";
+    const std::size_t n = 1200;
+    std::vector<sbf_double> values(n), foreign(n);
+    for (std::size_t i = 0; i < n; i++) values[i] = 0.75 * i;
+    // as written by a machine of the other byte order
+    foreign = values;
+    sbf_byteswap(foreign.data(), n * sizeof(sbf_double), sizeof(sbf_double));
+    const sbf_byte foreign_flags = flags::default_flags ^ flags::big_endian;
+    {
+        File file(foreign_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        Dataset dset("values", sbf_dimensions{{30, 40}}, SBF_DOUBLE, foreign_flags);
+        Dataset compressed("compressed", sbf_dimensions{{n}}, SBF_DOUBLE, foreign_flags);
+        compressed.set_filters(filters::shuffle);
+        REQUIRE(!dset.is_native_endian());
+        REQUIRE(file.add_dataset(dset) == sbf::success);
+        REQUIRE(file.add_dataset(compressed) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        REQUIRE(file.write_data("values", foreign.data()) == sbf::success);
+        REQUIRE(file.write_data("compressed", foreign.data()) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(foreign_filename);
+    std::vector<sbf_double> read_values(n);
+    REQUIRE(file.read_data("values", read_values.data()) == sbf::success);
+    REQUIRE(read_values == values);
+    std::fill(read_values.begin(), read_values.end(), 0.0);
+    REQUIRE(file.read_data("compressed", read_values.data()) == sbf::success);
+    REQUIRE(read_values == values);
+
+    std::vector<sbf_double> slab(6);
+    REQUIRE(file.read_hyperslab("values", sbf_dimensions{{2, 5}}, sbf_dimensions{{2, 3}},
+                                slab.data()) == sbf::success);
+    REQUIRE(slab[0] == values[2 * 40 + 5]);
+    REQUIRE(slab[5] == values[3 * 40 + 7]);
+
+    file.set_io_threads(2);
+    std::fill(read_values.begin(), read_values.end(), 0.0);
+    REQUIRE(file.read_data("values", read_values.data()) == sbf::success);
+    REQUIRE(read_values == values);
+
+    REQUIRE(file.map() == sbf::success);
+    REQUIRE(file.view<sbf_double>("values").empty());
+}
+
+TEST_CASE("Typed reads into owned and pooled buffers", "[io, buffers]") {
+    using namespace sbf;
+    static_assert(SBFTypeTraits<sbf_float>::type == SBF_FLOAT, "float traits");
+    static_assert(SBFTypeTraits<sbf_long>::type == SBF_LONG, "long traits");
+    static_assert(SBFTypeTraits<sbf_complex_double>::type == SBF_CDOUBLE, "complex traits");
+    static_assert(SBFTypeTraits<sbf_character>::type == SBF_CHAR, "char traits");
+    static_assert(!SBFTypeTraits<short>::is_specialized, "no traits for other types");
+
+    std::string typed_filename = "/tmp/sbf_test_cpp_typed.sbf";
+    std::vector<sbf_float> floats(300);
+    std::vector<sbf_long> longs(12);
+    std::vector<sbf_complex_float> complexes(50);
+    for (std::size_t i = 0; i < floats.size(); i++) floats[i] = 0.5f * i;
+    for (std::size_t i = 0; i < longs.size(); i++) longs[i] = (sbf_long)i << 40;
+    for (std::size_t i = 0; i < complexes.size(); i++) complexes[i] = {1.0f * i, -1.0f * i};
+    const std::string text = "typed";
+    {
+        File file(typed_filename, sbf::writing);
+        REQUIRE(file.open() == sbf::success);
+        Dataset dset_floats("floats", sbf_dimensions{{300}}, SBF_FLOAT);
+        Dataset dset_longs("longs", sbf_dimensions{{3, 4}}, SBF_LONG,
+                           flags::default_flags | flags::column_major);
+        Dataset dset_complexes("complexes", sbf_dimensions{{50}}, SBF_CFLOAT);
+        Dataset dset_text("text", sbf_dimensions{{text.size()}}, SBF_CHAR);
+        REQUIRE(file.add_dataset(dset_floats) == sbf::success);
+        REQUIRE(file.add_dataset(dset_longs) == sbf::success);
+        REQUIRE(file.add_dataset(dset_complexes) == sbf::success);
+        REQUIRE(file.add_dataset(dset_text) == sbf::success);
+        std::vector<sbf_character> chars(text.begin(), text.end());
+        REQUIRE(file.write_headers() == sbf::success);
+        REQUIRE(file.write_data("floats", floats.data()) == sbf::success);
+        REQUIRE(file.write_data("longs", longs.data()) == sbf::success);
+        REQUIRE(file.write_data("complexes", complexes.data()) == sbf::success);
+        REQUIRE(file.write_data("text", chars.data()) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+    File file(typed_filename);
+    auto read_floats = file.read<sbf_float>("floats");
+    REQUIRE(read_floats.result() == sbf::success);
+    REQUIRE(std::vector<sbf_float>(read_floats.begin(), read_floats.end()) == floats);
+    auto read_longs = file.read<sbf_long>("longs");
+    REQUIRE(read_longs.size() == 12);
+    REQUIRE(read_longs.is_column_major());
+    REQUIRE(read_longs.view()(1, 2) == longs[2 * 3 + 1]);
+    auto read_text = file.read<sbf_character>("text");
+    REQUIRE(std::string(read_text.begin(), read_text.end()) == text);
+
+    auto wrong_type = file.read<sbf_double>("floats");
+    REQUIRE(wrong_type.empty());
+    REQUIRE(wrong_type.result() == sbf::read_failure);
+    REQUIRE(file.read<sbf_byte>("does not exist").empty());
+
+    BufferPool pool;
+    const sbf_complex_float *first = nullptr;
+    for (int i = 0; i < 3; i++) {
+        auto read_complexes = file.read<sbf_complex_float>("complexes", &pool);
+        REQUIRE(std::equal(read_complexes.begin(), read_complexes.end(), complexes.begin()));
+        // each read after the first reuses the buffer of the one before
+        if (first == nullptr) first = read_complexes.data();
+        REQUIRE(read_complexes.data() == first);
+    }
+    REQUIRE(pool.bytes_held() == complexes.size() * sizeof(sbf_complex_float));
+    {
+        // buffers of smaller datasets come from the pool too
+        auto pooled = file.read<sbf_long>("longs", &pool);
+        REQUIRE(pool.bytes_held() == 0);
+        DatasetBuffer<sbf_long> moved = std::move(pooled);
+        REQUIRE(pooled.empty());
+        REQUIRE(moved[11] == longs[11]);
+    }
+    REQUIRE(pool.bytes_held() == complexes.size() * sizeof(sbf_complex_float));
+    pool.clear();
+    REQUIRE(pool.bytes_held() == 0);
+}
+
+TEST_CASE("Direct I/O backend", "[io, direct]") {
+    using namespace sbf;
+    std::string direct_filename = "/tmp/sbf_test_cpp_direct.sbf";
+    const std::size_t n = 5000;
+    std::vector<sbf_double> doubles(n);
+    std::vector<sbf_integer> ints(n);
+    for (std::size_t i = 0; i < n; i++) {
+        doubles[i] = 0.125 * i;
+        ints[i] = static_cast<sbf_integer>(i) - 7;
+    }
+    {
+        File file(direct_filename, sbf::writing, false, direct_io);
+        REQUIRE(file.open() == sbf::success);
+        REQUIRE(file.is_open());
+        Dataset first("doubles", sbf_dimensions{{50, 100}}, SBF_DOUBLE);
+        Dataset second("ints", sbf_dimensions{{n}}, SBF_INT);
+        second.set_filters(filters::delta | filters::shuffle);
+        REQUIRE(file.add_dataset(first) == sbf::success);
+        REQUIRE(file.add_dataset(second) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        REQUIRE(file.write_data("doubles", doubles.data()) == sbf::success);
+        REQUIRE(file.write_data("ints", ints.data()) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+        REQUIRE(!file.is_open());
+    }
+    // headers alone, deferred until close
+    {
+        File file("/tmp/sbf_test_cpp_direct_empty.sbf", sbf::writing, false, direct_io);
+        REQUIRE(file.open() == sbf::success);
+        Dataset dset("declared", sbf_dimensions{{10}}, SBF_DOUBLE);
+        REQUIRE(file.add_dataset(dset) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+    }
+    REQUIRE(File("/tmp/sbf_test_cpp_direct_empty.sbf").n_datasets() == 1);
+
+    const IOBackend backends[] = {stream_io, direct_io};
+    for (const auto backend : backends) {
+        File file(direct_filename, sbf::reading, true, backend);
+        REQUIRE(file.status() == File::Open);
+        REQUIRE(file.backend() == backend);
+        std::vector<sbf_double> read_doubles(n);
+        std::vector<sbf_integer> read_ints(n);
+        REQUIRE(file.read_data("doubles", read_doubles.data()) == sbf::success);
+        REQUIRE(file.read_data("ints", read_ints.data()) == sbf::success);
+        REQUIRE(read_doubles == doubles);
+        REQUIRE(read_ints == ints);
+        std::vector<sbf_double> slab(4);
+        REQUIRE(file.read_hyperslab("doubles", sbf_dimensions{{1, 2}}, sbf_dimensions{{2, 2}},
+                                    slab.data()) == sbf::success);
+        REQUIRE(slab[3] == doubles[2 * 100 + 3]);
+    }
+}
+
+TEST_CASE("Aligned layout and uncached I/O", "[io, direct]") {
+    using namespace sbf;
+    std::string aligned_filename = "/tmp/sbf_test_cpp_aligned.sbf";
+    const std::size_t n = 10000;
+    std::vector<sbf_double, AlignedAllocator<sbf_double>> doubles(n);
+    std::vector<sbf_integer> ints(n / 3);
+    for (std::size_t i = 0; i < n; i++) doubles[i] = 0.25 * i;
+    for (std::size_t i = 0; i < ints.size(); i++) ints[i] = 5 - static_cast<sbf_integer>(i);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(doubles.data()) % limits::direct_alignment == 0);
+    {
+        File file(aligned_filename, sbf::writing, false, uncached_io);
+        REQUIRE(file.open() == sbf::success);
+        Dataset first("ints", sbf_dimensions{{ints.size()}}, SBF_INT);
+        Dataset second("doubles", sbf_dimensions{{100, 100}}, SBF_DOUBLE);
+        REQUIRE(file.add_dataset(first) == sbf::success);
+        REQUIRE(file.add_dataset(second) == sbf::success);
+        REQUIRE(file.set_alignment(100) == sbf::write_failure);
+        REQUIRE(file.set_alignment(limits::direct_alignment) == sbf::success);
+        REQUIRE(file.write_headers() == sbf::success);
+        REQUIRE(file.write_data("ints", ints.data()) == sbf::success);
+        REQUIRE(file.write_data("doubles", doubles.data()) == sbf::success);
+        REQUIRE(file.close() == sbf::success);
+    }
+
+    const IOBackend backends[] = {stream_io, direct_io, uncached_io};
+    for (const auto backend : backends) {
+        File file(aligned_filename, sbf::reading, true, backend);
+        REQUIRE(file.status() == File::Open);
+        REQUIRE(file.alignment() == limits::direct_alignment);
+        for (const auto &dset : file.get_datasets()) {
+            REQUIRE(dset.offset() % limits::direct_alignment == 0);
+        }
+        std::vector<sbf_double, AlignedAllocator<sbf_double>> read_doubles(n);
+        std::vector<sbf_integer> read_ints(ints.size());
+        REQUIRE(file.read_data("doubles", read_doubles.data()) == sbf::success);
+        REQUIRE(file.read_data("ints", read_ints.data()) == sbf::success);
+        REQUIRE(read_doubles == doubles);
+        REQUIRE(read_ints == ints);
+        file.set_io_threads(2);
+        std::fill(read_doubles.begin(), read_doubles.end(), 0.0);
+        REQUIRE(file.read_data("doubles", read_doubles.data()) == sbf::success);
+        REQUIRE(read_doubles == doubles);
+    }
+}
+
+TEST_CASE("Asynchronous reads and writes", "[io, async]") {
+    using namespace sbf;
+    std::string async_filename = "/tmp/sbf_test_cpp_async.sbf";
+    const std::size_t n = 100000, n_datasets = 6;
+    std::vector<std::vector<sbf_double>> values(n_datasets, std::vector<sbf_double>(n));
+    for (std::size_t d = 0; d < n_datasets; d++) {
+        for (std::size_t i = 0; i < n; i++) values[d][i] = d - 0.25 * i;
+    }
+
+    const AsyncBackend async_backends[] = {async_threads, async_auto};
+    const IOBackend backends[] = {stream_io, direct_io};
+    for (const auto async_backend : async_backends) {
+        for (const auto backend : backends) {
+            AsyncRequest pending;
+            {
+                File file(async_filename, sbf::writing, false, backend);
+                file.set_async_backend(async_backend);
+                REQUIRE(file.open() == sbf::success);
+                for (std::size_t d = 0; d < n_datasets; d++) {
+                    Dataset dset("dataset_" + std::to_string(d), sbf_dimensions{{n}}, SBF_DOUBLE);
+                    REQUIRE(file.add_dataset(dset) == sbf::success);
+                }
+                REQUIRE(file.write_headers() == sbf::success);
+                REQUIRE(!file.write_async<sbf_integer>("dataset_0", nullptr).valid());
+                std::vector<AsyncRequest> requests;
+                for (std::size_t d = 0; d < n_datasets; d++) {
+                    requests.push_back(file.write_async("dataset_" + std::to_string(d),
+                                                        values[d].data()));
+                    REQUIRE(requests.back().valid());
+                }
+                if (async_backend == async_threads) REQUIRE(file.async_backend() == async_threads);
+                for (auto &request : requests) REQUIRE(request.wait() == sbf::success);
+                // left for close() to wait on
+                pending = file.write_async("dataset_0", values[0].data());
+            }
+            REQUIRE(pending.ready());
+            REQUIRE(pending.wait() == sbf::success);
+
+            File file(async_filename, sbf::reading, true, backend);
+            file.set_async_backend(async_backend);
+            REQUIRE(file.status() == File::Open);
+            std::vector<std::vector<sbf_double>> read_values(n_datasets, std::vector<sbf_double>(n));
+            std::vector<AsyncRequest> requests;
+            for (std::size_t d = 0; d < n_datasets; d++) {
+                requests.push_back(file.read_async("dataset_" + std::to_string(d),
+                                                   read_values[d].data()));
+            }
+            while (!requests.back().ready()) {
+            }
+            for (auto &request : requests) REQUIRE(request.wait() == sbf::success);
+            REQUIRE(read_values == values);
+            REQUIRE(file.read_async("missing", read_values[0].data()).wait() == sbf::read_failure);
+        }
+    }
+}
+
+TEST_CASE("Checkpoints of the same datasets", "[io, checkpoint]") {
+    using namespace sbf;
+    std::string checkpoint_filename = "/tmp/sbf_test_cpp_checkpoint.sbf";
+    std::string spare_filename = checkpoint_filename + ".spare";
+    const std::size_t n = 5000;
+    std::vector<sbf_double> positions(n);
+    std::vector<sbf_integer> ids(n / 3);
+    for (std::size_t i = 0; i < ids.size(); i++) ids[i] = static_cast<sbf_integer>(i);
+
+    File layout(checkpoint_filename, sbf::writing);
+    Dataset dset_ids("ids", sbf_dimensions{{ids.size()}}, SBF_INT);
+    Dataset dset_positions("positions", sbf_dimensions{{n / 2, 2}}, SBF_DOUBLE);
+    Dataset dset_compressed("compressed", sbf_dimensions{{n}}, SBF_DOUBLE,
+                            flags::default_flags | flags::compressed);
+    REQUIRE(layout.add_dataset(dset_ids) == sbf::success);
+    REQUIRE(layout.add_dataset(dset_positions) == sbf::success);
+    REQUIRE(layout.set_alignment(64) == sbf::success);
+
+    Checkpoint checkpoint(layout);
+    REQUIRE(checkpoint.valid());
+    REQUIRE(checkpoint.set_data("ids", ids.data()) == sbf::success);
+    REQUIRE(checkpoint.set_data("positions", positions.data()) == sbf::success);
+    REQUIRE(checkpoint.set_data("ids", positions.data()) == sbf::write_failure);
+    REQUIRE(checkpoint.set_data("missing", positions.data()) == sbf::write_failure);
+
+    std::remove(checkpoint_filename.c_str());
+    std::remove(spare_filename.c_str());
+    for (int step = 0; step < 3; step++) {
+        for (std::size_t i = 0; i < n; i++) positions[i] = step + 0.5 * i;
+        REQUIRE(checkpoint.swap(checkpoint_filename, spare_filename) == sbf::success);
+        File file(checkpoint_filename, sbf::reading);
+        REQUIRE(file.status() == File::Open);
+        REQUIRE(file.alignment() == 64);
+        std::vector<sbf_double> read_positions(n);
+        std::vector<sbf_integer> read_ids(ids.size());
+        REQUIRE(file.read_data("positions", read_positions.data()) == sbf::success);
+        REQUIRE(file.read_data("ids", read_ids.data()) == sbf::success);
+        REQUIRE(read_positions == positions);
+        REQUIRE(read_ids == ids);
+    }
+
+    // the same file as writing it the usual way
+    REQUIRE(checkpoint.write(spare_filename) == sbf::success);
+    REQUIRE(layout.open() == sbf::success);
+    REQUIRE(layout.write_headers() == sbf::success);
+    REQUIRE(layout.write_data("ids", ids.data()) == sbf::success);
+    REQUIRE(layout.write_data("positions", positions.data()) == sbf::success);
+    REQUIRE(layout.close() == sbf::success);
+    std::ifstream written(spare_filename, std::ios::binary), expected(checkpoint_filename, std::ios::binary);
+    std::vector<char> written_bytes{std::istreambuf_iterator<char>(written), {}};
+    std::vector<char> expected_bytes{std::istreambuf_iterator<char>(expected), {}};
+    REQUIRE(written_bytes == expected_bytes);
+
+    REQUIRE(layout.add_dataset(dset_compressed) == sbf::success);
+    Checkpoint compressed(layout);
+    REQUIRE(!compressed.valid());
+    REQUIRE(compressed.write(spare_filename) == sbf::write_failure);
+}
+
+TEST_CASE("Multi-frame files", "[io, frames]") {
+    using namespace sbf;
+    std::string frames_filename = "/tmp/sbf_test_cpp_frames.sbf";
+    const std::size_t n = 1000, n_frames = 4;
+    std::vector<std::vector<sbf_double>> positions(n_frames, std::vector<sbf_double>(n));
+    std::vector<sbf_integer> ids(n / 2);
+    for (std::size_t i = 0; i < ids.size(); i++) ids[i] = static_cast<sbf_integer>(i);
+    for (std::size_t f = 0; f < n_frames; f++) {
+        for (std::size_t i = 0; i < n; i++) positions[f][i] = f - 0.125 * i;
+    }
+
+    const IOBackend backends[] = {stream_io, direct_io};
+    for (const auto backend : backends) {
+        {
+            File file(frames_filename, sbf::writing, false, backend);
+            REQUIRE(file.open() == sbf::success);
+            Dataset dset_ids("ids", sbf_dimensions{{ids.size()}}, SBF_INT);
+            Dataset dset_positions("positions", sbf_dimensions{{n}}, SBF_DOUBLE);
+            REQUIRE(file.add_dataset(dset_ids) == sbf::success);
+            REQUIRE(file.add_dataset(dset_positions) == sbf::success);
+            REQUIRE(file.set_alignment(16) == sbf::success);
+            REQUIRE(file.write_headers() == sbf::success);
+            for (std::size_t f = 0; f < n_frames; f++) {
+                REQUIRE(file.append_frame() == sbf::success);
+                REQUIRE(file.frame() == f);
+                REQUIRE(file.write_data("ids", ids.data()) == sbf::success);
+                // the last dataset can't grow into the next frame
+                REQUIRE(file.write_chunk("positions", positions[f].data(), n + 1) == sbf::write_failure);
+                REQUIRE(file.write_data("positions", positions[f].data()) == sbf::success);
+            }
+            REQUIRE(file.n_frames() == n_frames);
+        }
+
+        File file(frames_filename, sbf::reading, true, backend);
+        REQUIRE(file.status() == File::Open);
+        REQUIRE(file.n_frames() == n_frames);
+        REQUIRE(file.set_frame(n_frames) == sbf::read_failure);
+        std::vector<sbf_double> read_positions(n);
+        std::vector<sbf_integer> read_ids(ids.size());
+        for (std::size_t f = n_frames; f-- > 0;) {
+            REQUIRE(file.set_frame(f) == sbf::success);
+            REQUIRE(file.read_data("positions", read_positions.data()) == sbf::success);
+            REQUIRE(file.read_data("ids", read_ids.data()) == sbf::success);
+            REQUIRE(read_positions == positions[f]);
+            REQUIRE(read_ids == ids);
+        }
+        REQUIRE(file.map() == sbf::success);
+        REQUIRE(file.set_frame(2) == sbf::success);
+        auto view = file.view<sbf_double>("positions");
+        REQUIRE(!view.empty());
+        REQUIRE(std::equal(view.begin(), view.end(), positions[2].begin()));
+    }
+}
+
+TEST_CASE("Atomic writes and checksums", "[io, integrity]") {
+    using namespace sbf;
+    std::string integrity_filename = "/tmp/sbf_test_cpp_integrity.sbf";
+    const std::size_t n = 100000;
+    std::vector<sbf_double> smooth(n);
+    for (std::size_t i = 0; i < n; i++) smooth[i] = std::cos(1e-4 * i);
+    std::vector<sbf_integer> ints(1000);
+    for (std::size_t i = 0; i < ints.size(); i++) ints[i] = static_cast<sbf_integer>(5 * i);
+    auto exists = [&]() { return std::ifstream(integrity_filename).good(); };
+
+    const IOBackend backends[] = {stream_io, direct_io};
+    for (const auto backend : backends) {
+        std::remove(integrity_filename.c_str());
+        {
+            File file(integrity_filename, sbf::writing, false, backend);
+            file.set_atomic(true);
+            file.set_checksums(true);
+            REQUIRE(file.open() == sbf::success);
+            Dataset dset_smooth("smooth", sbf_dimensions{{n}}, SBF_DOUBLE,
+                                flags::default_flags | flags::compressed);
+            Dataset dset_ints("ints", sbf_dimensions{{ints.size()}}, SBF_INT);
+            REQUIRE(file.add_dataset(dset_smooth) == sbf::success);
+            REQUIRE(file.add_dataset(dset_ints) == sbf::success);
+            REQUIRE(file.write_headers() == sbf::success);
+            REQUIRE(file.write_data("smooth", smooth.data()) == sbf::success);
+            REQUIRE(file.write_data("ints", ints.data()) == sbf::success);
+            REQUIRE(!exists());
+            REQUIRE(file.close() == sbf::success);
+            REQUIRE(exists());
+        }
+        {
+            // not closed, so never committed
+            File file(integrity_filename, sbf::writing, false, backend);
+            file.set_atomic(true);
+            REQUIRE(file.open() == sbf::success);
+            Dataset dset_ints("ints", sbf_dimensions{{1}}, SBF_INT);
+            REQUIRE(file.add_dataset(dset_ints) == sbf::success);
+            REQUIRE(file.write_headers() == sbf::success);
+        }
+        {
+            File file(integrity_filename, sbf::reading, false, backend);
+            file.set_verify(true);
+            REQUIRE(file.open() == sbf::success);
+            REQUIRE(file.read_headers() == sbf::success);
+            REQUIRE(file.n_datasets() == 2);
+            std::vector<sbf_double> read_smooth(n);
+            std::vector<sbf_integer> read_ints(ints.size());
+            file.set_io_threads(2);
+            REQUIRE(file.read_data("smooth", read_smooth.data()) == sbf::success);
+            REQUIRE(file.read_data("ints", read_ints.data()) == sbf::success);
+            REQUIRE(read_smooth == smooth);
+            REQUIRE(read_ints == ints);
+        }
+        // the last blob is followed by the checksums
+        std::ifstream in(integrity_filename, std::ios::binary | std::ios::ate);
+        const std::size_t ints_offset = static_cast<std::size_t>(in.tellg()) -
+                                        sizeof(sbf_ChecksumTrailer) - 2 * sizeof(uint32_t) -
+                                        ints.size() * sizeof(sbf_integer);
+        in.close();
+
+        // flip a bit of the last integer
+        {
+            std::fstream stream(integrity_filename, std::ios::binary | std::ios::in | std::ios::out);
+            char byte = 0;
+            stream.seekg(ints_offset + 4 * (ints.size() - 1));
+            stream.read(&byte, 1);
+            byte ^= 0x01;
+            stream.seekp(ints_offset + 4 * (ints.size() - 1));
+            stream.write(&byte, 1);
+        }
+        std::vector<sbf_integer> read_ints(ints.size());
+        {
+            File file(integrity_filename, sbf::reading, false, backend);
+            file.set_verify(true);
+            REQUIRE(file.open() == sbf::success);
+            REQUIRE(file.read_headers() == sbf::success);
+            REQUIRE(file.read_data("ints", read_ints.data()) == sbf::checksum_failure);
+        }
+        File file(integrity_filename, sbf::reading, true, backend);
+        REQUIRE(file.status() == File::Open);
+        REQUIRE(file.read_data("ints", read_ints.data()) == sbf::success);
+        REQUIRE(read_ints.back() == (ints.back() ^ 1));
+    }
+
+#ifdef SBF_POSIX
+    // a file cut short, as by a killed writer, is rejected
+    REQUIRE(truncate(integrity_filename.c_str(), 1000) == 0);
+    File file(integrity_filename);
+    REQUIRE(file.status() == File::FailedReadingHeaders);
+#endif
+}
+
+TEST_CASE("Moving files", "[io, integrity]") {
+    using namespace sbf;
+    std::string moved_filename = "/tmp/sbf_test_cpp_moved.sbf";
+    std::vector<sbf_integer> ints(100);
+    for (std::size_t i = 0; i < ints.size(); i++) ints[i] = static_cast<sbf_integer>(3 * i);
+    auto exists = [&]() { return std::ifstream(moved_filename).good(); };
+
+    std::remove(moved_filename.c_str());
+    File file;
+    {
+        File written(moved_filename, sbf::writing, false);
+        written.set_atomic(true);
+        written.set_checksums(true);
+        REQUIRE(written.open() == sbf::success);
+        Dataset dset_ints("ints", sbf_dimensions{{ints.size()}}, SBF_INT);
+        REQUIRE(written.add_dataset(dset_ints) == sbf::success);
+        REQUIRE(written.write_headers() == sbf::success);
+        File moved(std::move(written));
+        REQUIRE(moved.write_data("ints", ints.data()) == sbf::success);
+        file = std::move(moved);
+        // destroying the Files moved from neither commits nor discards
+    }
+    REQUIRE(!exists());
+    REQUIRE(file.close() == sbf::success);
+    REQUIRE(exists());
+
+    File read(moved_filename);
+    REQUIRE(read.map() == sbf::success);
+    file = std::move(read);
+    REQUIRE(read.status() == File::Closed);
+    auto view = file.view<sbf_integer>("ints");
+    REQUIRE(std::equal(view.begin(), view.end(), ints.begin()));
+}